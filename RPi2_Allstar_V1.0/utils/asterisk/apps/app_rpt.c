@@ -428,15 +428,28 @@ enum {REM_OFF,REM_MONITOR,REM_TX};
 enum {LINKMODE_OFF,LINKMODE_ON,LINKMODE_FOLLOW,LINKMODE_DEMAND,
 	LINKMODE_GUI,LINKMODE_PHONE,LINKMODE_ECHOLINK,LINKMODE_TLB};
 
-enum{ID,PROC,TERM,COMPLETE,UNKEY,REMDISC,REMALREADY,REMNOTFOUND,REMGO,
-	CONNECTED,CONNFAIL,STATUS,TIMEOUT,ID1, STATS_TIME, PLAYBACK,
-	LOCALPLAY, STATS_VERSION, IDTALKOVER, ARB_ALPHA, TEST_TONE, REV_PATCH,
-	TAILMSG, MACRO_NOTFOUND, MACRO_BUSY, LASTNODEKEY, FULLSTATUS,
-	MEMNOTFOUND, INVFREQ, REMMODE, REMLOGIN, REMXXX, REMSHORTSTATUS,
-	REMLONGSTATUS, LOGINREQ, SCAN, SCANSTAT, TUNE, SETREMOTE, TOPKEY,
-	TIMEOUT_WARNING, ACT_TIMEOUT_WARNING, LINKUNKEY, UNAUTHTX, PARROT,
-	STATS_TIME_LOCAL, VARCMD, LOCUNKEY, METER, USEROUT, PAGE,
-	STATS_GPS,STATS_GPS_LEGACY, MDC1200, LASTUSER, REMCOMPLETE, PFXTONE};
+/* telemetry modes, in order; also gives telem_names[] */
+#define	TELEM_MODES \
+	TELEM(ID) TELEM(PROC) TELEM(TERM) TELEM(COMPLETE) TELEM(UNKEY) \
+	TELEM(REMDISC) TELEM(REMALREADY) TELEM(REMNOTFOUND) TELEM(REMGO) \
+	TELEM(CONNECTED) TELEM(CONNFAIL) TELEM(STATUS) TELEM(TIMEOUT) \
+	TELEM(ID1) TELEM(STATS_TIME) TELEM(PLAYBACK) TELEM(LOCALPLAY) \
+	TELEM(STATS_VERSION) TELEM(IDTALKOVER) TELEM(ARB_ALPHA) \
+	TELEM(TEST_TONE) TELEM(REV_PATCH) TELEM(TAILMSG) \
+	TELEM(MACRO_NOTFOUND) TELEM(MACRO_BUSY) TELEM(LASTNODEKEY) \
+	TELEM(FULLSTATUS) TELEM(MEMNOTFOUND) TELEM(INVFREQ) TELEM(REMMODE) \
+	TELEM(REMLOGIN) TELEM(REMXXX) TELEM(REMSHORTSTATUS) \
+	TELEM(REMLONGSTATUS) TELEM(LOGINREQ) TELEM(SCAN) TELEM(SCANSTAT) \
+	TELEM(TUNE) TELEM(SETREMOTE) TELEM(TOPKEY) TELEM(TIMEOUT_WARNING) \
+	TELEM(ACT_TIMEOUT_WARNING) TELEM(LINKUNKEY) TELEM(UNAUTHTX) \
+	TELEM(PARROT) TELEM(STATS_TIME_LOCAL) TELEM(VARCMD) TELEM(LOCUNKEY) \
+	TELEM(METER) TELEM(USEROUT) TELEM(PAGE) TELEM(STATS_GPS) \
+	TELEM(STATS_GPS_LEGACY) TELEM(MDC1200) TELEM(LASTUSER) \
+	TELEM(REMCOMPLETE) TELEM(PFXTONE)
+
+#define	TELEM(x) x,
+enum{TELEM_MODES};
+#undef	TELEM
 
 
 enum {REM_SIMPLEX,REM_MINUS,REM_PLUS};
@@ -451,6 +464,8 @@ enum {DLY_TELEM, DLY_ID, DLY_UNKEY, DLY_CALLTERM, DLY_COMP, DLY_LINKUNKEY, DLY_P
 
 enum {REM_MODE_FM,REM_MODE_USB,REM_MODE_LSB,REM_MODE_AM};
 
+enum {RPT_MIXER_DAHDI,RPT_MIXER_INTERNAL};
+
 enum {HF_SCAN_OFF,HF_SCAN_DOWN_SLOW,HF_SCAN_DOWN_QUICK,
       HF_SCAN_DOWN_FAST,HF_SCAN_UP_SLOW,HF_SCAN_UP_QUICK,HF_SCAN_UP_FAST};
 
@@ -509,6 +524,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/file.h>
+#include <sys/uio.h>
 #include <sys/ioctl.h>
 #include <sys/io.h>
 #include <sys/vfs.h>
@@ -516,6 +532,12 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <fnmatch.h>
+#include <fcntl.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
 
 #include "asterisk/utils.h"
 #include "asterisk/lock.h"
@@ -733,6 +755,8 @@ LOCAL_USER_DECL;
 #endif
 
 #define	MSWAIT 20
+#define	RPT_MAXCHANS 300
+#define	RPT_STATUS_INTERVAL 250	/* ms between manager status snapshot refreshes */
 #define	HANGTIME 5000
 #define SLEEPTIME 900		/* default # of seconds for of no activity before entering sleep mode */
 #define	TOTIME 180000
@@ -780,6 +804,79 @@ int	endindex;
 time_t	lastone;
 } ;
 
+/*
+* Fixed delay line of voice frames, used to hold audio back RPT_FRAMEDELAY
+* frames so that it can be muted when DTMF is detected. The frame buffers
+* live in the ring itself, so nothing is allocated on the voice path.
+*/
+
+#define	RPT_FRAMEDELAY 2
+#define	RPT_FRAMERING_LEN (RPT_FRAMEDELAY + 1)
+#define	RPT_FRAMERING_BYTES 960		/* 60 ms of 8 kHz slinear */
+
+struct rpt_framering
+{
+	int	head;			/* oldest frame held */
+	int	count;			/* number of frames held */
+	struct rpt_frameslot
+	{
+		struct ast_frame f;
+		char	buf[AST_FRIENDLY_OFFSET + RPT_FRAMERING_BYTES];
+	} slot[RPT_FRAMERING_LEN];
+} ;
+
+static void rpt_framering_flush(struct rpt_framering *r)
+{
+	r->head = r->count = 0;
+}
+
+/* zero out the audio of all frames being held */
+static void rpt_framering_mute(struct rpt_framering *r)
+{
+int	i;
+struct ast_frame *f;
+
+	for(i = 0; i < r->count; i++)
+	{
+		f = &r->slot[(r->head + i) % RPT_FRAMERING_LEN].f;
+		memset(AST_FRAME_DATAP(f),0,f->datalen);
+	}
+}
+
+/*
+* Put a copy of f into the ring, and return the frame that falls out the
+* other end, if any. The returned frame belongs to the ring, and is only
+* good until the next call.
+*/
+static struct ast_frame *rpt_framering_put(struct rpt_framering *r, struct ast_frame *f)
+{
+struct rpt_frameslot *sp;
+
+	if (!f) return(NULL);
+	if (f->datalen > RPT_FRAMERING_BYTES)
+	{
+		/* too big to hold: the held frames are discarded and this
+		   one goes straight through, undelayed */
+		if (debug) ast_log(LOG_NOTICE,"Frame of %d bytes too large to delay\n",f->datalen);
+		rpt_framering_flush(r);
+		return(f);
+	}
+	sp = &r->slot[(r->head + r->count) % RPT_FRAMERING_LEN];
+	sp->f = *f;
+	sp->f.mallocd = 0;
+	sp->f.mallocd_hdr_len = 0;
+	sp->f.offset = AST_FRIENDLY_OFFSET;
+	sp->f.src = "rpt_framering";
+	memset(&sp->f.frame_list,0,sizeof(sp->f.frame_list));
+	AST_FRAME_DATA(sp->f) = sp->buf + AST_FRIENDLY_OFFSET;
+	if (f->datalen) memcpy(AST_FRAME_DATA(sp->f),AST_FRAME_DATAP(f),f->datalen);
+	if (++r->count <= RPT_FRAMEDELAY) return(NULL);
+	sp = &r->slot[r->head];
+	r->head = (r->head + 1) % RPT_FRAMERING_LEN;
+	r->count--;
+	return(&sp->f);
+}
+
 static time_t	starttime = 0;
 
 static  pthread_t rpt_master_thread;
@@ -819,15 +916,19 @@ struct rpt_link
 	int	max_retries;
 	int	reconnects;
 	long long connecttime;
+	time_t	connectstart;		/* sys_uptime() when connecttime was last zeroed */
 	struct ast_channel *chan;	
 	struct ast_channel *pchan;	
 	char	linklist[MAXLINKLIST];
 	time_t	linklistreceived;
 	long	linklisttimer;
+	char	linklistsent[MAXLINKLIST + 2];	/* last "L" message, reused until topology changes */
+	unsigned int linklistgen;
+	unsigned int linklistlinks;
 	int	dtmfed;
 	int linkunkeytocttimer;
 	struct timeval lastlinktv;
-	struct	ast_frame *lastf1,*lastf2;
+	struct	rpt_framering lastf;	/* two frame audio delay for DTMF muting */
 	struct	rpt_chan_stat chan_stat[NRPTSTAT];
 	struct vox vox;
 	char wasvox;
@@ -866,6 +967,63 @@ struct rpt_lstat
 	struct	rpt_chan_stat chan_stat[NRPTSTAT];
 } ;
 
+/* link as seen by the manager status snapshot */
+struct rpt_status_link
+{
+	char	name[MAXNODESTR];
+	char	peer[MAXPEERSTR];
+	char	lastrx1;
+	char	outbound;
+	char	thisconnected;
+	int	reconnects;
+	time_t	lastkeytime;
+	time_t	lastunkeytime;
+	time_t	connectsince;		/* link's connectstart, so it holds still */
+} ;
+
+/* Immutable copy of what the RptStatus manager actions report. The node
+   thread rebuilds it every RPT_STATUS_INTERVAL and publishes it, with the
+   next generation number, only if something in it changed. */
+struct rpt_status
+{
+	int	refs;			/* under status_lock */
+	unsigned int gen;
+	/* everything from here to links is compared */
+	char	keyed;
+	char	txkeyed;
+	char	parrotmode;
+	char	txdisable;
+	char	totdisable;
+	char	linkfundisable;
+	char	autopatchdisable;
+	char	schedulerdisable;
+	char	userfundisable;
+	char	alternatetail;
+	char	noincomingconns;
+	char	telemdynamic;
+	char	reversepatch;		/* a '0' node is connected */
+	int	sysstate_cur;
+	int	totstate;		/* 0 timed out, 1 armed, 2 reset */
+	int	iderstate;		/* 0 queued in tail, 1 queued for cleanup, 2 clean */
+	int	callmode;
+	int	telemmode;
+	int	dailytxtime;
+	long long totaltxtime;
+	int	dailykeyups;
+	int	totalkeyups;
+	int	dailykerchunks;
+	int	totalkerchunks;
+	int	dailyexecdcommands;
+	int	totalexecdcommands;
+	int	timeouts;
+	char	exten[AST_MAX_EXTENSION];
+	char	lastdtmfcommand[MAXDTMF];
+	char	linklist[MAXLINKLIST];
+	int	nlinks;
+	struct rpt_status_link *links;	/* '0' nodes left out */
+	char	*vars;			/* rxchannel variables, "Var: " lines */
+} ;
+
 struct rpt_tele
 {
 	struct rpt_tele *next;
@@ -882,9 +1040,24 @@ struct rpt_tele
 	} submode;
 	unsigned int parrot;
 	char killed;
+	char cancelled;			/* killed before a worker got to it */
+	struct rpt_tele *pnext;		/* telemetry pool queue */
 	pthread_t threadid;
 } ;
 
+#define	RPT_TELE_WORKERS 4
+
+struct rpt_telepool
+{
+	ast_mutex_t lock;
+	ast_cond_t cond;
+	struct rpt_tele *head,**tail;	/* messages handed to workers */
+	int	navail;			/* idle workers not yet spoken for */
+	int	nthreads;
+	char	shutdown;
+	pthread_t threads[RPT_TELE_WORKERS];
+} ;
+
 struct function_table_tag
 {
 	char action[ACTIONSIZE];
@@ -1022,12 +1195,16 @@ static struct rpt
 	ast_mutex_t lock;
 	ast_mutex_t remlock;
 	ast_mutex_t statpost_lock;
+	ast_mutex_t status_lock;		/* guards status and its refs only */
+	struct rpt_status *status;
+	struct timeval statustv;
 	struct ast_config *cfg;
 	char reload;
 	char reload1;
 	char deleted;
 	char xlink;		 							// cross link state of a share repeater/remote radio
 	unsigned int statpost_seqno;
+	unsigned int statpost_drops;		// posts dropped, queue full
 
 	char *name;
 	char *rxchanname;
@@ -1036,6 +1213,9 @@ static struct rpt
 	char *remoterig;
 	struct	rpt_chan_stat chan_stat[NRPTSTAT];
 	unsigned int scram;
+	unsigned int linksgen;		/* bumped when link channels come or go */
+	unsigned int topogen;		/* bumped when link modes or node lists change */
+	char	mixer;			/* conference engine in use, RPT_MIXER_* */
 #ifdef	_MDC_DECODE_H_
 	mdc_decoder_t *mdc;
 #endif
@@ -1046,6 +1226,7 @@ static struct rpt
 		char *acctcode;
 		char *ident;
 		char *tonezone;
+		char mixer;
 		char simple;
 		char *functions;
 		char *link_functions;
@@ -1203,8 +1384,9 @@ static struct rpt
 	struct ast_channel *rxchannel,*txchannel, *monchannel, *parrotchannel;
 	struct ast_channel *pchannel,*txpchannel, *zaprxchannel, *zaptxchannel;
 	struct ast_channel *voxchannel;
-	struct ast_frame *lastf1,*lastf2;
+	struct rpt_framering lastf;
 	struct rpt_tele tele;
+	struct rpt_telepool *telepool;
 	struct timeval lasttv,curtv;
 	pthread_t rpt_call_thread,rpt_thread;
 	time_t dtmf_time,rem_dtmf_time,dtmf_time_rem;
@@ -1251,6 +1433,7 @@ static struct rpt
 	int link_longestfunc;
 	int longestfunc;
 	int longestnode;
+	int longestlocalnode;
 	int threadrestarts;		
 	int tailmessagen;
 	time_t disgorgetime;
@@ -1376,8 +1559,15 @@ static int setrtx_check(struct rpt *myrpt);
 static int channel_revert(struct rpt *myrpt);
 static int channel_steer(struct rpt *myrpt, char *data);
 static void rpt_telemetry(struct rpt *myrpt,int mode, void *data);
+static void rpt_tele_kill(struct rpt_tele *telem);
 
 AST_MUTEX_DEFINE_STATIC(nodeloglock);
+static ast_cond_t nodelog_cond;
+static struct nodelog *nodelog_pool = NULL;	/* spare entries */
+static int nodelog_npool = 0;
+static char nodelog_shutdown = 0;
+static pthread_t rpt_nodelog_writer = AST_PTHREADT_NULL;
+#define	NODELOG_POOLMAX 64
 
 AST_MUTEX_DEFINE_STATIC(nodelookuplock);
 
@@ -1835,6 +2025,9 @@ static int rpt_do_setvar(int fd, int argc, char *argv[]);
 static int rpt_do_showvars(int fd, int argc, char *argv[]);
 static int rpt_do_frog(int fd, int argc, char *argv[]);
 static int rpt_do_page(int fd, int argc, char *argv[]);
+#ifndef	OLD_ASTERISK
+static void rpt_status_update(struct rpt *myrpt);
+#endif
 
 static char debug_usage[] =
 "Usage: rpt debug level {0-7}\n"
@@ -4081,7 +4274,7 @@ static void flush_telem(struct rpt *myrpt)
 	telem = myrpt->tele.next;
 	while(telem != &myrpt->tele)
 	{
-		if (telem->mode != SETREMOTE) ast_softhangup(telem->chan,AST_SOFTHANGUP_DEV);
+		if (telem->mode != SETREMOTE) rpt_tele_kill(telem);
 		telem = telem->next;
 	}
 	rpt_mutex_unlock(&myrpt->lock);
@@ -4223,6 +4416,603 @@ int	nonlocals;
 	return(0);
 }
 
+/*
+ * Userspace conference engine, selected per node with "mixer=internal".
+ *
+ * Stands in for DAHDI pseudo channels and conferences: rpt_pseudo()
+ * hands out "RptConf" channels, and rpt_setconf()/rpt_channo() apply
+ * the same dahdi_confinfo modes to them that DAHDI_SETCONF/DAHDI_CHANNO
+ * would. One thread mixes every conference on a 20 ms tick, in slinear,
+ * and wakes each reader through its own pipe, one byte per frame.
+ *
+ * rptconf_lock covers everything here.
+ */
+
+#define	RPTCONF_FRAME 160		/* samples per tick */
+#define	RPTCONF_INMAX (RPTCONF_FRAME * 16)	/* unmixed write backlog, samples */
+#define	RPTCONF_OUTMAX 4		/* unread frames kept, like DAHDI's buffers */
+#define	RPTCONF_MAXTONES 8
+#define	RPTCONF_TONEAMP 3600
+
+struct rptconf_tonepart {
+	int	f1,f2;			/* Hz, 0 if unused */
+	int	samples;		/* 0 plays forever */
+};
+
+struct rptconf {
+	struct	rptconf *next;
+	int	confno;
+	int	nmembers;
+	int	sum[RPTCONF_FRAME];
+};
+
+struct rptconf_member {
+	struct	rptconf_member *next;	/* all members */
+	struct	rptconf *conf;		/* NULL in DAHDI_CONF_NORMAL */
+	struct	rptconf_member *monitor; /* target of the MONITOR modes */
+	int	id;			/* what DAHDI_CHANNO returns */
+	int	confmode;
+	int	alert[2];
+	struct	ast_channel *chan;
+	short	in[RPTCONF_INMAX];
+	int	inhead,inlen;
+	short	cur[RPTCONF_FRAME];	/* this tick's input */
+	short	heard[RPTCONF_FRAME];	/* this tick's output */
+	short	out[RPTCONF_OUTMAX][RPTCONF_FRAME];
+	int	outhead,outlen;
+	struct	rptconf_tonepart tone[RPTCONF_MAXTONES];
+	int	ntones,tonerepeat,tonepart,tonepos;
+	double	toneph1,toneph2;
+	struct	ast_frame fr;
+	char	frbuf[AST_FRIENDLY_OFFSET + (RPTCONF_FRAME * 2)];
+};
+
+AST_MUTEX_DEFINE_STATIC(rptconf_lock);
+static ast_cond_t rptconf_cond;
+static pthread_t rptconf_mixer = AST_PTHREADT_NULL;
+static int rptconf_shutdown;
+static struct rptconf *rptconf_confs;
+static struct rptconf_member *rptconf_members;
+static int rptconf_nextconf;
+static int rptconf_nextid;
+
+static struct ast_channel *rptconf_request(const char *type, int format, void *data, int *cause);
+static int rptconf_hangup(struct ast_channel *chan);
+static struct ast_frame *rptconf_read(struct ast_channel *chan);
+static int rptconf_write(struct ast_channel *chan, struct ast_frame *f);
+
+static const struct ast_channel_tech rptconf_tech = {
+	.type = "RptConf",
+	.description = "app_rpt conference leg",
+	.capabilities = AST_FORMAT_SLINEAR,
+	.requester = rptconf_request,
+	.hangup = rptconf_hangup,
+	.read = rptconf_read,
+	.write = rptconf_write,
+};
+
+/* dst = saturate(sum - sub), sub may be NULL */
+static void rptconf_narrow(short *dst, const int *sum, const short *sub, int n)
+{
+int	i = 0,x;
+
+#if defined(__SSE2__)
+	for(; i + 8 <= n; i += 8)
+	{
+		__m128i lo = _mm_loadu_si128((const __m128i *)(sum + i));
+		__m128i hi = _mm_loadu_si128((const __m128i *)(sum + i + 4));
+
+		if (sub)
+		{
+			__m128i s = _mm_loadu_si128((const __m128i *)(sub + i));
+
+			lo = _mm_sub_epi32(lo,_mm_srai_epi32(_mm_unpacklo_epi16(s,s),16));
+			hi = _mm_sub_epi32(hi,_mm_srai_epi32(_mm_unpackhi_epi16(s,s),16));
+		}
+		_mm_storeu_si128((__m128i *)(dst + i),_mm_packs_epi32(lo,hi));
+	}
+#elif defined(__ARM_NEON__)
+	for(; i + 8 <= n; i += 8)
+	{
+		int32x4_t lo = vld1q_s32(sum + i);
+		int32x4_t hi = vld1q_s32(sum + i + 4);
+
+		if (sub)
+		{
+			int16x8_t s = vld1q_s16(sub + i);
+
+			lo = vsubq_s32(lo,vmovl_s16(vget_low_s16(s)));
+			hi = vsubq_s32(hi,vmovl_s16(vget_high_s16(s)));
+		}
+		vst1q_s16(dst + i,vcombine_s16(vqmovn_s32(lo),vqmovn_s32(hi)));
+	}
+#endif
+	for(; i < n; i++)
+	{
+		x = sum[i];
+		if (sub) x -= sub[i];
+		if (x > 32767) x = 32767;
+		if (x < -32768) x = -32768;
+		dst[i] = x;
+	}
+}
+
+static inline int rptconf_talks(int confmode)
+{
+	switch(confmode & DAHDI_CONF_MODE_MASK)
+	{
+	    case DAHDI_CONF_CONF:
+		return((confmode & DAHDI_CONF_TALKER) != 0);
+	    case DAHDI_CONF_CONFANN:
+	    case DAHDI_CONF_CONFANNMON:
+		return(1);
+	}
+	return(0);
+}
+
+/* mix the member's call progress tone into its input */
+static void rptconf_tonegen(struct rptconf_member *m)
+{
+struct	rptconf_tonepart *tp;
+int	i,x;
+
+	for(i = 0; (i < RPTCONF_FRAME) && m->ntones; i++)
+	{
+		tp = &m->tone[m->tonepart];
+		x = m->cur[i];
+		if (tp->f1) x += RPTCONF_TONEAMP * sin(m->toneph1);
+		if (tp->f2) x += RPTCONF_TONEAMP * sin(m->toneph2);
+		if (x > 32767) x = 32767;
+		if (x < -32768) x = -32768;
+		m->cur[i] = x;
+		m->toneph1 = fmod(m->toneph1 + ((2.0 * M_PI * tp->f1) / 8000.0),2.0 * M_PI);
+		m->toneph2 = fmod(m->toneph2 + ((2.0 * M_PI * tp->f2) / 8000.0),2.0 * M_PI);
+		if ((!tp->samples) || (++m->tonepos < tp->samples)) continue;
+		m->tonepos = 0;
+		if (++m->tonepart < m->ntones) continue;
+		if (m->tonerepeat < 0) m->ntones = 0;
+		else m->tonepart = m->tonerepeat;
+	}
+}
+
+static void rptconf_tick(void)
+{
+struct	rptconf *c;
+struct	rptconf_member *m;
+int	i,n,mode;
+char	c1 = 0;
+
+	for(c = rptconf_confs; c; c = c->next)
+		memset(c->sum,0,sizeof(c->sum));
+	for(m = rptconf_members; m; m = m->next)
+	{
+		n = (m->inlen < RPTCONF_FRAME) ? m->inlen : RPTCONF_FRAME;
+		for(i = 0; i < n; i++)
+			m->cur[i] = m->in[(m->inhead + i) % RPTCONF_INMAX];
+		memset(m->cur + n,0,(RPTCONF_FRAME - n) * sizeof(short));
+		m->inhead = (m->inhead + n) % RPTCONF_INMAX;
+		m->inlen -= n;
+		if (m->ntones) rptconf_tonegen(m);
+		if ((!m->conf) || (!rptconf_talks(m->confmode))) continue;
+		for(i = 0; i < RPTCONF_FRAME; i++)
+			m->conf->sum[i] += m->cur[i];
+	}
+	for(m = rptconf_members; m; m = m->next)
+	{
+		mode = m->confmode & DAHDI_CONF_MODE_MASK;
+		switch(mode)
+		{
+		    case DAHDI_CONF_CONF:
+			if (m->conf && (m->confmode & DAHDI_CONF_LISTENER))
+			{
+				rptconf_narrow(m->heard,m->conf->sum,
+					(m->confmode & DAHDI_CONF_TALKER) ? m->cur : NULL,
+						RPTCONF_FRAME);
+				break;
+			}
+			memset(m->heard,0,sizeof(m->heard));
+			break;
+		    case DAHDI_CONF_CONFMON:
+		    case DAHDI_CONF_CONFANNMON:
+			if (m->conf)
+			{
+				rptconf_narrow(m->heard,m->conf->sum,NULL,RPTCONF_FRAME);
+				break;
+			}
+			memset(m->heard,0,sizeof(m->heard));
+			break;
+		    case DAHDI_CONF_MONITOR:
+		    case DAHDI_CONF_MONITORTX:
+		    case DAHDI_CONF_MONITORBOTH:
+			if (!m->monitor)
+			{
+				memset(m->heard,0,sizeof(m->heard));
+				break;
+			}
+			for(i = 0; i < RPTCONF_FRAME; i++)
+			{
+				n = 0;
+				if (mode != DAHDI_CONF_MONITORTX) n += m->monitor->cur[i];
+				if (mode != DAHDI_CONF_MONITOR) n += m->monitor->heard[i];
+				if (n > 32767) n = 32767;
+				if (n < -32768) n = -32768;
+				m->heard[i] = n;
+			}
+			break;
+		    default:
+			memset(m->heard,0,sizeof(m->heard));
+			break;
+		}
+		i = (m->outhead + m->outlen) % RPTCONF_OUTMAX;
+		memcpy(m->out[i],m->heard,sizeof(m->heard));
+		if (m->outlen < RPTCONF_OUTMAX)
+		{
+			m->outlen++;
+			if (write(m->alert[1],&c1,1) != 1)
+				ast_log(LOG_WARNING,"Unable to wake %s\n",m->chan->name);
+		}
+		else m->outhead = (m->outhead + 1) % RPTCONF_OUTMAX;
+	}
+}
+
+static void *rptconf_thread(void *this)
+{
+struct	timeval next;
+struct	timespec ts;
+int	ms;
+
+	ast_mutex_lock(&rptconf_lock);
+	next = ast_tvnow();
+	while(!rptconf_shutdown)
+	{
+		next = ast_tvadd(next,ast_tv(0,RPTCONF_FRAME * 125));
+		/* fell way behind, dont try to catch up */
+		if (ast_tvdiff_ms(next,ast_tvnow()) < -100) next = ast_tvnow();
+		while((!rptconf_shutdown) && ((ms = ast_tvdiff_ms(next,ast_tvnow())) > 0))
+		{
+			ts.tv_sec = next.tv_sec;
+			ts.tv_nsec = next.tv_usec * 1000;
+			ast_cond_timedwait(&rptconf_cond,&rptconf_lock,&ts);
+		}
+		if (rptconf_shutdown) break;
+		rptconf_tick();
+	}
+	ast_mutex_unlock(&rptconf_lock);
+	return(NULL);
+}
+
+static struct ast_channel *rptconf_request(const char *type, int format, void *data, int *cause)
+{
+struct	rptconf_member *m;
+struct	ast_channel *chan;
+int	flags,i;
+
+	if (!(format & AST_FORMAT_SLINEAR)) return(NULL);
+	if (!(m = ast_calloc(1,sizeof(struct rptconf_member)))) return(NULL);
+	if (pipe(m->alert) == -1)
+	{
+		ast_log(LOG_WARNING,"Unable to create conference pipe: %s\n",strerror(errno));
+		ast_free(m);
+		return(NULL);
+	}
+	for(i = 0; i < 2; i++)
+	{
+		flags = fcntl(m->alert[i],F_GETFL);
+		fcntl(m->alert[i],F_SETFL,flags | O_NONBLOCK);
+	}
+	ast_mutex_lock(&rptconf_lock);
+	m->id = ++rptconf_nextid;
+	ast_mutex_unlock(&rptconf_lock);
+	chan = ast_channel_alloc(1,AST_STATE_RESERVED,0,0,"","s","default",0,
+		"RptConf/pseudo-%d",m->id);
+	if (!chan)
+	{
+		close(m->alert[0]);
+		close(m->alert[1]);
+		ast_free(m);
+		return(NULL);
+	}
+	chan->tech = &rptconf_tech;
+	chan->nativeformats = AST_FORMAT_SLINEAR;
+	chan->readformat = chan->rawreadformat = AST_FORMAT_SLINEAR;
+	chan->writeformat = chan->rawwriteformat = AST_FORMAT_SLINEAR;
+	chan->fds[0] = m->alert[0];
+	chan->tech_pvt = m;
+	m->chan = chan;
+	ast_mutex_lock(&rptconf_lock);
+	if ((rptconf_mixer == AST_PTHREADT_NULL) &&
+	    ast_pthread_create(&rptconf_mixer,NULL,rptconf_thread,NULL))
+	{
+		ast_mutex_unlock(&rptconf_lock);
+		ast_log(LOG_WARNING,"Unable to start conference mixer\n");
+		chan->tech_pvt = NULL;
+		ast_channel_free(chan);
+		close(m->alert[0]);
+		close(m->alert[1]);
+		ast_free(m);
+		return(NULL);
+	}
+	m->next = rptconf_members;
+	rptconf_members = m;
+	ast_mutex_unlock(&rptconf_lock);
+	return(chan);
+}
+
+/* must be called locked */
+static void rptconf_leave(struct rptconf_member *m)
+{
+struct	rptconf *c,**cp;
+
+	if (!(c = m->conf)) return;
+	m->conf = NULL;
+	if (--c->nmembers) return;
+	for(cp = &rptconf_confs; *cp != c; cp = &(*cp)->next);
+	*cp = c->next;
+	ast_free(c);
+}
+
+static int rptconf_hangup(struct ast_channel *chan)
+{
+struct	rptconf_member *m = chan->tech_pvt,**mp,*m1;
+
+	if (!m) return(0);
+	ast_mutex_lock(&rptconf_lock);
+	rptconf_leave(m);
+	for(mp = &rptconf_members; *mp != m; mp = &(*mp)->next);
+	*mp = m->next;
+	for(m1 = rptconf_members; m1; m1 = m1->next)
+		if (m1->monitor == m) m1->monitor = NULL;
+	ast_mutex_unlock(&rptconf_lock);
+	close(m->alert[0]);
+	close(m->alert[1]);
+	chan->fds[0] = -1;
+	chan->tech_pvt = NULL;
+	ast_free(m);
+	return(0);
+}
+
+static struct ast_frame *rptconf_read(struct ast_channel *chan)
+{
+struct	rptconf_member *m = chan->tech_pvt;
+char	c;
+
+	ast_mutex_lock(&rptconf_lock);
+	if (!m->outlen)
+	{
+		ast_mutex_unlock(&rptconf_lock);
+		return(&ast_null_frame);
+	}
+	if (read(m->alert[0],&c,1) != 1)
+		ast_log(LOG_WARNING,"Unable to read alert for %s\n",chan->name);
+	memcpy(m->frbuf + AST_FRIENDLY_OFFSET,m->out[m->outhead],RPTCONF_FRAME * 2);
+	m->outhead = (m->outhead + 1) % RPTCONF_OUTMAX;
+	m->outlen--;
+	ast_mutex_unlock(&rptconf_lock);
+	memset(&m->fr,0,sizeof(m->fr));
+	m->fr.frametype = AST_FRAME_VOICE;
+	m->fr.subclass = AST_FORMAT_SLINEAR;
+	m->fr.datalen = RPTCONF_FRAME * 2;
+	m->fr.samples = RPTCONF_FRAME;
+	AST_FRAME_DATA(m->fr) = m->frbuf + AST_FRIENDLY_OFFSET;
+	m->fr.offset = AST_FRIENDLY_OFFSET;
+	m->fr.src = "rptconf";
+	return(&m->fr);
+}
+
+static int rptconf_write(struct ast_channel *chan, struct ast_frame *f)
+{
+struct	rptconf_member *m = chan->tech_pvt;
+short	*sp;
+int	i,n;
+
+	if ((f->frametype != AST_FRAME_VOICE) || (f->subclass != AST_FORMAT_SLINEAR))
+		return(0);
+	sp = (short *) AST_FRAME_DATAP(f);
+	n = f->datalen / 2;
+	ast_mutex_lock(&rptconf_lock);
+	/* if the mixer is not keeping up, keep the newest audio */
+	if (n > RPTCONF_INMAX)
+	{
+		sp += n - RPTCONF_INMAX;
+		n = RPTCONF_INMAX;
+	}
+	if ((m->inlen + n) > RPTCONF_INMAX)
+	{
+		i = m->inlen + n - RPTCONF_INMAX;
+		m->inhead = (m->inhead + i) % RPTCONF_INMAX;
+		m->inlen -= i;
+	}
+	for(i = 0; i < n; i++)
+		m->in[(m->inhead + m->inlen + i) % RPTCONF_INMAX] = sp[i];
+	m->inlen += n;
+	ast_mutex_unlock(&rptconf_lock);
+	return(0);
+}
+
+/* DAHDI_SETCONF for a conference leg */
+static int rptconf_setconf(struct rptconf_member *m, struct dahdi_confinfo *ci)
+{
+struct	rptconf *c;
+struct	rptconf_member *m1;
+int	mode = ci->confmode & DAHDI_CONF_MODE_MASK;
+
+	ast_mutex_lock(&rptconf_lock);
+	rptconf_leave(m);
+	m->monitor = NULL;
+	m->confmode = ci->confmode;
+	if ((mode == DAHDI_CONF_MONITOR) || (mode == DAHDI_CONF_MONITORTX) ||
+	    (mode == DAHDI_CONF_MONITORBOTH))
+	{
+		for(m1 = rptconf_members; m1; m1 = m1->next)
+			if (m1->id == ci->confno) break;
+		if (!m1)
+		{
+			m->confmode = DAHDI_CONF_NORMAL;
+			ast_mutex_unlock(&rptconf_lock);
+			errno = EINVAL;
+			return(-1);
+		}
+		m->monitor = m1;
+	}
+	else if (mode != DAHDI_CONF_NORMAL)
+	{
+		for(c = rptconf_confs; c; c = c->next)
+			if ((ci->confno > 0) && (c->confno == ci->confno)) break;
+		if (!c)
+		{
+			if (!(c = ast_calloc(1,sizeof(struct rptconf))))
+			{
+				m->confmode = DAHDI_CONF_NORMAL;
+				ast_mutex_unlock(&rptconf_lock);
+				return(-1);
+			}
+			c->confno = (ci->confno > 0) ? ci->confno : ++rptconf_nextconf;
+			if (c->confno > rptconf_nextconf) rptconf_nextconf = c->confno;
+			c->next = rptconf_confs;
+			rptconf_confs = c;
+		}
+		c->nmembers++;
+		m->conf = c;
+		ci->confno = c->confno;
+	}
+	ast_mutex_unlock(&rptconf_lock);
+	return(0);
+}
+
+/* start a tone list in indications format on a leg, or stop it */
+static int rptconf_tone(struct ast_channel *chan, const char *data)
+{
+struct	rptconf_member *m = chan->tech_pvt;
+struct	rptconf_tonepart tone[RPTCONF_MAXTONES];
+char	*str,*s,*part;
+int	n,repeat,f1,f2,ms;
+
+	n = 0;
+	repeat = -1;
+	if (data)
+	{
+		str = ast_strdupa(data);
+		while((n < RPTCONF_MAXTONES) && (part = strsep(&str,",")))
+		{
+			s = part;
+			if (*s == '!') s++;
+			else if (repeat < 0) repeat = n;
+			f1 = f2 = ms = 0;
+			if (sscanf(s,"%d+%d/%d",&f1,&f2,&ms) < 2)
+			{
+				f2 = 0;
+				if (sscanf(s,"%d*%d/%d",&f1,&f2,&ms) < 2)
+				{
+					f2 = ms = 0;
+					if (sscanf(s,"%d/%d",&f1,&ms) < 1) continue;
+				}
+			}
+			tone[n].f1 = f1;
+			tone[n].f2 = f2;
+			tone[n].samples = ms * 8;
+			n++;
+		}
+	}
+	ast_mutex_lock(&rptconf_lock);
+	memcpy(m->tone,tone,n * sizeof(struct rptconf_tonepart));
+	m->ntones = n;
+	m->tonerepeat = repeat;
+	m->tonepart = m->tonepos = 0;
+	m->toneph1 = m->toneph2 = 0.0;
+	ast_mutex_unlock(&rptconf_lock);
+	return(0);
+}
+
+static void rptconf_stop(void)
+{
+	ast_mutex_lock(&rptconf_lock);
+	if (rptconf_mixer == AST_PTHREADT_NULL)
+	{
+		ast_mutex_unlock(&rptconf_lock);
+		return;
+	}
+	rptconf_shutdown = 1;
+	ast_cond_signal(&rptconf_cond);
+	ast_mutex_unlock(&rptconf_lock);
+	pthread_join(rptconf_mixer,NULL);
+	rptconf_mixer = AST_PTHREADT_NULL;
+}
+
+/* pick the conference engine once the radio channels are up. DAHDI
+   radio channels can only be conferenced by DAHDI */
+static void rpt_mixer_select(struct rpt *myrpt)
+{
+	myrpt->mixer = myrpt->p.mixer;
+	if ((myrpt->mixer == RPT_MIXER_INTERNAL) &&
+	    (myrpt->zaprxchannel || myrpt->zaptxchannel))
+	{
+		ast_log(LOG_WARNING,"Node %s has DAHDI radio channels, using DAHDI conferencing\n",
+			myrpt->name);
+		myrpt->mixer = RPT_MIXER_DAHDI;
+	}
+}
+
+/* request a pseudo channel from whichever engine this node conferences with */
+static struct ast_channel *rpt_pseudo(struct rpt *myrpt)
+{
+	if (myrpt->mixer == RPT_MIXER_INTERNAL)
+		return(ast_request(rptconf_tech.type,AST_FORMAT_SLINEAR,"pseudo",NULL));
+	return(ast_request(DAHDI_CHANNEL_NAME,AST_FORMAT_SLINEAR,"pseudo",NULL));
+}
+
+static int rpt_setconf(struct ast_channel *chan, struct dahdi_confinfo *ci)
+{
+	if (chan->tech == &rptconf_tech) return(rptconf_setconf(chan->tech_pvt,ci));
+	return(ioctl(chan->fds[0],DAHDI_SETCONF,ci));
+}
+
+static int rpt_channo(struct ast_channel *chan, int *res)
+{
+	if (chan->tech != &rptconf_tech) return(ioctl(chan->fds[0],DAHDI_CHANNO,res));
+	*res = ((struct rptconf_member *)chan->tech_pvt)->id;
+	return(0);
+}
+
+/* DAHDI_TONE_DIALTONE, DAHDI_TONE_CONGESTION, or -1 to stop */
+static int rpt_playtone(struct rpt *myrpt, struct ast_channel *chan, int tone)
+{
+#ifdef	NEW_ASTERISK
+struct ast_tone_zone_sound *ts;
+#else
+const struct ind_tone_zone_sound *ts;
+#endif
+
+	if (chan->tech != &rptconf_tech) return(tone_zone_play_tone(chan->fds[0],tone));
+	if (tone < 0) return(rptconf_tone(chan,NULL));
+	ts = ast_get_indication_tone(ast_get_indication_zone(myrpt->p.tonezone),
+		(tone == DAHDI_TONE_CONGESTION) ? "congestion" : "dial");
+	if (!ts) return(-1);
+	return(rptconf_tone(chan,ts->data));
+}
+
+static int rpt_settonezone(struct rpt *myrpt, struct ast_channel *chan)
+{
+	if ((!myrpt->p.tonezone) || (chan->tech == &rptconf_tech)) return(0);
+	return(tone_zone_set_zone(chan->fds[0],myrpt->p.tonezone));
+}
+
+/* true once everything written to the channel has gone out */
+static int rpt_writeempty(struct ast_channel *chan)
+{
+int	flags;
+
+	if (chan->tech == &rptconf_tech)
+	{
+		ast_mutex_lock(&rptconf_lock);
+		flags = (((struct rptconf_member *)chan->tech_pvt)->inlen == 0);
+		ast_mutex_unlock(&rptconf_lock);
+		return(flags);
+	}
+	flags = DAHDI_IOMUX_WRITEEMPTY | DAHDI_IOMUX_NOWAIT;
+	ioctl(chan->fds[0],DAHDI_IOMUX,&flags);
+	return((flags & DAHDI_IOMUX_WRITEEMPTY) != 0);
+}
+
 static void rpt_qwrite(struct rpt_link *l,struct ast_frame *f)
 {
 struct	ast_frame *f1;
@@ -4378,7 +5168,7 @@ static void birdbath(struct rpt *myrpt)
 	telem = myrpt->tele.next;
 	while(telem != &myrpt->tele)
 	{
-		if (telem->mode == PARROT) ast_softhangup(telem->chan,AST_SOFTHANGUP_DEV);
+		if (telem->mode == PARROT) rpt_tele_kill(telem);
 		telem = telem->next;
 	}
 	rpt_mutex_unlock(&myrpt->lock);
@@ -4393,7 +5183,7 @@ static void cancel_pfxtone(struct rpt *myrpt)
 	telem = myrpt->tele.next;
 	while(telem != &myrpt->tele)
 	{
-		if (telem->mode == PFXTONE) ast_softhangup(telem->chan,AST_SOFTHANGUP_DEV);
+		if (telem->mode == PFXTONE) rpt_tele_kill(telem);
 		telem = telem->next;
 	}
 }
@@ -4434,7 +5224,15 @@ struct nodelog *nodep;
 char	datestr[100];
 
 	if (!myrpt->p.archivedir) return;
-	nodep = (struct nodelog *)ast_malloc(sizeof(struct nodelog));
+	ast_mutex_lock(&nodeloglock);
+	nodep = nodelog_pool;
+	if (nodep)
+	{
+		nodelog_pool = nodep->next;
+		nodelog_npool--;
+	}
+	ast_mutex_unlock(&nodeloglock);
+	if (!nodep) nodep = (struct nodelog *)ast_malloc(sizeof(struct nodelog));
 	if (nodep == NULL)
 	{
 		ast_log(LOG_ERROR,"Cannot get memory for node log");
@@ -4442,24 +5240,203 @@ char	datestr[100];
 	}
 	time(&nodep->timestamp);
 	strncpy(nodep->archivedir,myrpt->p.archivedir, sizeof(nodep->archivedir) - 1);
+	nodep->archivedir[sizeof(nodep->archivedir) - 1] = 0;
 	strftime(datestr,sizeof(datestr) - 1,"%Y%m%d%H%M%S", localtime(&nodep->timestamp));
 	snprintf(nodep->str,sizeof(nodep->str) - 1,"%s %s,%s\n", myrpt->name,datestr,str);
 	ast_mutex_lock(&nodeloglock);
 	insque((struct qelem *) nodep, (struct qelem *) nodelog.prev);
+	ast_cond_signal(&nodelog_cond);
 	ast_mutex_unlock(&nodeloglock);
 }
 
-/* must be called locked */
-static void do_dtmf_local(struct rpt *myrpt, char c)
+/*
+ * Node log writer. Takes everything queued by donodelog() in one go and
+ * appends it to the per-node daily files, which are kept open (a new
+ * date just means a new file name). Runs of entries for the same file
+ * go out in one writev().
+ */
+
+#define	NODELOG_MAXFILES 16
+#define	NODELOG_IDLE 300		/* close files unused this long */
+#define	NODELOG_MAXIOV 64
+#define	NODELOG_FNAMELEN 300
+
+struct nodelog_file {
+	char	fname[NODELOG_FNAMELEN];
+	int	fd;
+	time_t	lastused;
+} ;
+
+/* a slot is in use if its fname is set */
+static struct nodelog_file nodelog_files[NODELOG_MAXFILES];
+
+/* get a descriptor for fname, opening it (in place of the least
+   recently used one) if need be */
+static int nodelog_getfd(char *fname, time_t now)
 {
-int	i;
-char	digit;
+int	i,j;
 
-	if (c)
+	j = 0;
+	for(i = 0; i < NODELOG_MAXFILES; i++)
 	{
-		snprintf(myrpt->dtmf_local_str + strlen(myrpt->dtmf_local_str),sizeof(myrpt->dtmf_local_str) - 1,"%c",c);
-		if (!myrpt->dtmf_local_timer) 
-			 myrpt->dtmf_local_timer = DTMF_LOCAL_STARTTIME;
+		if (!nodelog_files[i].fname[0])
+		{
+			j = i;
+			continue;
+		}
+		if (!strcmp(nodelog_files[i].fname,fname))
+		{
+			nodelog_files[i].lastused = now;
+			return(nodelog_files[i].fd);
+		}
+		if (nodelog_files[j].fname[0] && 
+		    (nodelog_files[i].lastused < nodelog_files[j].lastused)) j = i;
+	}
+	if (nodelog_files[j].fname[0]) close(nodelog_files[j].fd);
+	nodelog_files[j].fname[0] = 0;
+	nodelog_files[j].fd = open(fname,O_WRONLY | O_CREAT | O_APPEND,0600);
+	if (nodelog_files[j].fd == -1)
+	{
+		ast_log(LOG_ERROR,"Cannot open node log file %s for write",fname);
+		return(-1);
+	}
+	ast_copy_string(nodelog_files[j].fname,fname,sizeof(nodelog_files[j].fname));
+	nodelog_files[j].lastused = now;
+	return(nodelog_files[j].fd);
+}
+
+/* entry's file name, and where its text starts (NULL if it can't be logged) */
+static char *nodelog_fname(struct nodelog *nodep, char *fname, int len)
+{
+char	*space,datestr[100];
+
+	space = strchr(nodep->str,' ');
+	if (!space) return(NULL);
+	strftime(datestr,sizeof(datestr) - 1,"%Y%m%d", localtime(&nodep->timestamp));
+	if (snprintf(fname,len,"%s/%.*s/%s.txt",nodep->archivedir,
+	    (int)(space - nodep->str),nodep->str,datestr) >= len)
+	{
+		ast_log(LOG_WARNING,"Node log file name too long in %s, entry dropped\n",nodep->archivedir);
+		return(NULL);
+	}
+	return(space + 1);
+}
+
+static void nodelog_put(struct nodelog *nodep)
+{
+	ast_mutex_lock(&nodeloglock);
+	if (nodelog_npool < NODELOG_POOLMAX)
+	{
+		nodep->next = nodelog_pool;
+		nodelog_pool = nodep;
+		nodelog_npool++;
+		nodep = NULL;
+	}
+	ast_mutex_unlock(&nodeloglock);
+	if (nodep) ast_free(nodep);
+}
+
+static void *rpt_nodelog_thread(void *ignore)
+{
+struct	nodelog batch,*nodep,*next;
+struct	iovec iov[NODELOG_MAXIOV];
+char	fname[NODELOG_FNAMELEN],fname1[NODELOG_FNAMELEN],*cp;
+int	i,n,fd;
+ssize_t	len;
+time_t	now;
+
+	ast_mutex_lock(&nodeloglock);
+	for(;;)
+	{
+		while((nodelog.next == &nodelog) && (!nodelog_shutdown))
+		{
+			struct timespec ts;
+
+			/* wake up now and then to close idle files */
+			ts.tv_sec = time(NULL) + NODELOG_IDLE;
+			ts.tv_nsec = 0;
+			if (ast_cond_timedwait(&nodelog_cond,&nodeloglock,&ts) == ETIMEDOUT) break;
+		}
+		if ((nodelog.next == &nodelog) && nodelog_shutdown) break;
+		/* take the whole queue */
+		if (nodelog.next != &nodelog)
+		{
+			batch.next = nodelog.next;
+			batch.prev = nodelog.prev;
+			batch.next->prev = &batch;
+			batch.prev->next = &batch;
+			nodelog.next = nodelog.prev = &nodelog;
+		}
+		else batch.next = batch.prev = &batch;
+		ast_mutex_unlock(&nodeloglock);
+		time(&now);
+		nodep = batch.next;
+		fname1[0] = 0;
+		while(nodep != &batch)
+		{
+			/* gather a run of entries going to the same file */
+			n = 0;
+			len = 0;
+			fname[0] = 0;
+			for(next = nodep; (next != &batch) && (n < NODELOG_MAXIOV); next = next->next)
+			{
+				cp = nodelog_fname(next,(n) ? fname1 : fname,sizeof(fname));
+				if (!cp) 
+				{
+					if (!n) n = -1;
+					break;
+				}
+				if (n && strcmp(fname,fname1)) break;
+				iov[n].iov_base = cp;
+				iov[n].iov_len = strlen(cp);
+				len += iov[n].iov_len;
+				n++;
+			}
+			if (n < 0) next = next->next;
+			else if ((fd = nodelog_getfd(fname,now)) != -1)
+			{
+				if (writev(fd,iov,n) != len)
+					ast_log(LOG_ERROR,"Cannot write node log file %s",fname);
+			}
+			while(nodep != next)
+			{
+				struct nodelog *nodep1 = nodep;
+
+				nodep = nodep->next;
+				nodelog_put(nodep1);
+			}
+		}
+		for(i = 0; i < NODELOG_MAXFILES; i++)
+		{
+			if (nodelog_files[i].fname[0] && 
+			    ((nodelog_files[i].lastused + NODELOG_IDLE) < now))
+			{
+				close(nodelog_files[i].fd);
+				nodelog_files[i].fname[0] = 0;
+			}
+		}
+		ast_mutex_lock(&nodeloglock);
+	}
+	ast_mutex_unlock(&nodeloglock);
+	for(i = 0; i < NODELOG_MAXFILES; i++)
+	{
+		if (nodelog_files[i].fname[0]) close(nodelog_files[i].fd);
+		nodelog_files[i].fname[0] = 0;
+	}
+	return(NULL);
+}
+
+/* must be called locked */
+static void do_dtmf_local(struct rpt *myrpt, char c)
+{
+int	i;
+char	digit;
+
+	if (c)
+	{
+		snprintf(myrpt->dtmf_local_str + strlen(myrpt->dtmf_local_str),sizeof(myrpt->dtmf_local_str) - 1,"%c",c);
+		if (!myrpt->dtmf_local_timer) 
+			 myrpt->dtmf_local_timer = DTMF_LOCAL_STARTTIME;
 	}
 	/* if at timeout */
 	if (myrpt->dtmf_local_timer == 1)
@@ -5068,10 +6045,11 @@ static void __mklinklist(struct rpt *myrpt, struct rpt_link *mylink, char *buf,i
 {
 struct rpt_link *l;
 char mode;
-int	i,spos;
+int	i,len,spos;
 
 	buf[0] = 0; /* clear output buffer */
 	if (myrpt->remote) return;
+	len = 0;
 	/* go thru all links */
 	for(l = myrpt->links.next; l != &myrpt->links; l = l->next)
 	{
@@ -5085,15 +6063,16 @@ int	i,spos;
 		mode = 'T'; /* use Tranceive by default */
 		if (!l->mode) mode = 'R'; /* indicate RX for our mode */
 		if (!l->thisconnected) 	mode = 'C'; /* indicate connecting */
-		spos = strlen(buf); /* current buf size (b4 we add our stuff) */
+		spos = len; /* current buf size (b4 we add our stuff) */
 		if (spos)
 		{
-			strcat(buf,",");
-			spos++;
+			if (spos >= (MAXLINKLIST - 1)) break;
+			buf[spos++] = ',';
+			buf[spos] = 0;
 		}
 		if (flag)
 		{
-			snprintf(buf + spos,MAXLINKLIST - spos,
+			i = snprintf(buf + spos,MAXLINKLIST - spos,
 				"%s%c%c",l->name,mode,(l->lastrx1) ? 'K' : 'U');
 		}
 		else
@@ -5101,19 +6080,21 @@ int	i,spos;
 			/* add nodes into buffer */
 			if (l->linklist[0])
 			{
-				snprintf(buf + spos,MAXLINKLIST - spos,
+				i = snprintf(buf + spos,MAXLINKLIST - spos,
 					"%c%s,%s",mode,l->name,l->linklist);
 			}
 			else /* if no nodes, add this node into buffer */
 			{
-				snprintf(buf + spos,MAXLINKLIST - spos,
+				i = snprintf(buf + spos,MAXLINKLIST - spos,
 					"%c%s",mode,l->name);
 			}	
 		}
+		len = spos + i;
+		if (len > (MAXLINKLIST - 1)) len = MAXLINKLIST - 1;
 		/* if we are in tranceive mode, let all modes stand */
 		if (mode == 'T') continue;
 		/* downgrade everyone on this node if appropriate */
-		for(i = spos; buf[i]; i++)
+		for(i = spos; i < len; i++)
 		{
 			if (buf[i] == 'T') buf[i] = mode;
 			if ((buf[i] == 'R') && (mode == 'C')) buf[i] = mode;
@@ -5127,6 +6108,7 @@ static void __kickshort(struct rpt *myrpt)
 {
 struct rpt_link *l;
 
+	myrpt->topogen++;
 	for(l = myrpt->links.next; l != &myrpt->links; l = l->next)
 	{
 		/* if is not a real link, ignore it */
@@ -5426,6 +6408,68 @@ int	n;
 	return;
 }
 
+/*
+ * AMI events. Key and link state are sent keyed, so a manager client
+ * that has fallen behind only gets the newest state of each.
+ */
+#define	TELEM(x) #x,
+static char *telem_names[] = {TELEM_MODES};
+#undef	TELEM
+
+static void rpt_manager_key(struct rpt *myrpt, int keyed)
+{
+char	key[100],*keyp;
+
+	keyp = key;
+	if (snprintf(key,sizeof(key),"RptKey/%s",myrpt->name) >= sizeof(key))
+		keyp = NULL;
+	manager_event_keyed(EVENT_FLAG_CALL,(keyed) ? "RptKeyup" : "RptUnkey",keyp,
+		"Node: %s\r\n",myrpt->name);
+	return;
+}
+
+/* reason is NULL when the link comes up */
+static void rpt_manager_link(struct rpt *myrpt, struct rpt_link *l, char *reason)
+{
+char	key[200],*keyp,*mode;
+
+	/* a cut off key could merge two links' events, so send those unkeyed */
+	keyp = key;
+	if (snprintf(key,sizeof(key),"RptLink/%s/%s",myrpt->name,l->name) >= sizeof(key))
+		keyp = NULL;
+	if (reason)
+	{
+		manager_event_keyed(EVENT_FLAG_CALL,"RptUnlink",keyp,
+			"Node: %s\r\nLink: %s\r\nReason: %s\r\n",
+				myrpt->name,l->name,reason);
+		return;
+	}
+	if (l->mode == 1) mode = "Transceive";
+	else if (l->mode > 1) mode = "LocalMonitor";
+	else mode = "Monitor";
+	manager_event_keyed(EVENT_FLAG_CALL,"RptLink",keyp,
+		"Node: %s\r\nLink: %s\r\nMode: %s\r\nDirection: %s\r\n",
+			myrpt->name,l->name,mode,(l->outbound) ? "Outbound" : "Inbound");
+	return;
+}
+
+static void rpt_manager_telem(struct rpt *myrpt, int mode, struct rpt_link *l)
+{
+char	num[20],*name;
+
+	if ((mode >= 0) && (mode < (sizeof(telem_names) / sizeof(telem_names[0]))))
+		name = telem_names[mode];
+	else
+	{
+		snprintf(num,sizeof(num),"%d",mode);
+		name = num;
+	}
+	manager_event(EVENT_FLAG_CALL,"RptTelemetry",
+		"Node: %s\r\nMode: %s\r\n%s%s%s",myrpt->name,name,
+			(l) ? "Link: " : "",(l) ? l->name : "",(l) ? "\r\n" : "");
+	return;
+}
+
 static void dodispgm(struct rpt *myrpt,char *them)
 {
 char 	*a;
@@ -5469,6 +6513,376 @@ int	i;
 }
 
 
+/*
+ * Status poster. Plain http:// status URLs are fetched in-process by one
+ * thread over a kept-alive HTTP/1.1 connection, rather than by forking
+ * Asterisk to run statpost_program for every post. Posts wait in a
+ * bounded queue; a newer post of the same kind (the first key in its
+ * pairs) from the same node replaces one still waiting, and a post that
+ * finds the queue full is dropped and counted. https:// URLs, and nodes
+ * that set their own statpost_program, still go through the program.
+ */
+
+#define	STATPOST_QUEUEMAX 32
+#define	STATPOST_TIMEOUT 5000		/* ms, for each connect/read/write */
+
+struct statpost_req {
+	struct statpost_req *next;
+	struct rpt *myrpt;
+	char	kind[32];
+	char	*url;
+} ;
+
+static struct statpost_req *statpost_head = NULL,**statpost_tail = &statpost_head;
+static int statpost_count = 0;
+static char statpost_shutdown = 0;
+static pthread_t statpost_thread = AST_PTHREADT_NULL;
+static ast_cond_t statpost_cond;
+AST_MUTEX_DEFINE_STATIC(statpost_qlock);
+
+/* the open connection */
+static int statpost_fd = -1;
+static char statpost_host[256];
+static int statpost_port;
+
+static void statpost_close(void)
+{
+	if (statpost_fd != -1) close(statpost_fd);
+	statpost_fd = -1;
+}
+
+/* wait until fd is ready for events, or time out */
+static int statpost_wait(int fd, short events)
+{
+struct pollfd pfd;
+int	res;
+
+	pfd.fd = fd;
+	pfd.events = events;
+	pfd.revents = 0;
+	do
+		res = poll(&pfd,1,STATPOST_TIMEOUT);
+	while((res == -1) && (errno == EINTR));
+	return((res > 0) ? 0 : -1);
+}
+
+static int statpost_connect(char *host, int port)
+{
+struct ast_hostent ahp;
+struct hostent *hp;
+struct sockaddr_in sin;
+int	fd,flags,err;
+socklen_t len;
+
+	if ((statpost_fd != -1) && (port == statpost_port) &&
+	    (!strcasecmp(host,statpost_host))) return(0);
+	statpost_close();
+	hp = ast_gethostbyname(host,&ahp);
+	if (!hp)
+	{
+		ast_log(LOG_WARNING,"statpost: cannot resolve %s\n",host);
+		return(-1);
+	}
+	fd = socket(AF_INET,SOCK_STREAM,0);
+	if (fd == -1) return(-1);
+	flags = fcntl(fd,F_GETFL);
+	fcntl(fd,F_SETFL,flags | O_NONBLOCK);
+	memset(&sin,0,sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	memcpy(&sin.sin_addr,hp->h_addr,sizeof(sin.sin_addr));
+	if (connect(fd,(struct sockaddr *)&sin,sizeof(sin)) == -1)
+	{
+		err = 0;
+		len = sizeof(err);
+		if ((errno != EINPROGRESS) || statpost_wait(fd,POLLOUT) ||
+		    getsockopt(fd,SOL_SOCKET,SO_ERROR,&err,&len) || err)
+		{
+			ast_log(LOG_WARNING,"statpost: cannot connect to %s:%d\n",host,port);
+			close(fd);
+			return(-1);
+		}
+	}
+	statpost_fd = fd;
+	ast_copy_string(statpost_host,host,sizeof(statpost_host));
+	statpost_port = port;
+	return(0);
+}
+
+static int statpost_write(char *buf, int len)
+{
+int	n;
+
+	while(len > 0)
+	{
+		if (statpost_wait(statpost_fd,POLLOUT)) return(-1);
+		n = write(statpost_fd,buf,len);
+		if (n == -1)
+		{
+			if ((errno == EAGAIN) || (errno == EINTR)) continue;
+			return(-1);
+		}
+		buf += n;
+		len -= n;
+	}
+	return(0);
+}
+
+/* buffered reads off the connection */
+static char statpost_rbuf[2048];
+static int statpost_rlen,statpost_rpos;
+
+static int statpost_getc(void)
+{
+	while(statpost_rpos >= statpost_rlen)
+	{
+		if (statpost_wait(statpost_fd,POLLIN)) return(-1);
+		statpost_rlen = read(statpost_fd,statpost_rbuf,sizeof(statpost_rbuf));
+		statpost_rpos = 0;
+		if (statpost_rlen == -1)
+		{
+			statpost_rlen = 0;
+			if ((errno == EAGAIN) || (errno == EINTR)) continue;
+			return(-1);
+		}
+		if (!statpost_rlen) return(-1);
+	}
+	return((unsigned char)statpost_rbuf[statpost_rpos++]);
+}
+
+static int statpost_getline(char *buf, int size)
+{
+int	c,n;
+
+	n = 0;
+	while((c = statpost_getc()) != '\n')
+	{
+		if (c == -1) return(-1);
+		if ((c != '\r') && (n < (size - 1))) buf[n++] = c;
+	}
+	buf[n] = 0;
+	return(n);
+}
+
+static int statpost_skip(long len)
+{
+	while(len-- > 0) if (statpost_getc() == -1) return(-1);
+	return(0);
+}
+
+/* read (and discard) a response. returns the status code, -1 on a
+   broken connection, and clears *keep if it has to be closed */
+static int statpost_response(int *keep)
+{
+char	line[512];
+int	status,chunked;
+long	clen;
+
+	statpost_rlen = statpost_rpos = 0;
+	if (statpost_getline(line,sizeof(line)) < 0) return(-1);
+	if (sscanf(line,"HTTP/%*d.%*d %d",&status) != 1) return(-1);
+	if (!strncmp(line,"HTTP/1.0",8)) *keep = 0;
+	clen = -1;
+	chunked = 0;
+	for(;;)
+	{
+		if (statpost_getline(line,sizeof(line)) < 0) return(-1);
+		if (!line[0]) break;
+		if (!strncasecmp(line,"Content-Length:",15)) clen = atol(line + 15);
+		else if (!strncasecmp(line,"Transfer-Encoding:",18) &&
+		    strcasestr(line + 18,"chunked")) chunked = 1;
+		else if (!strncasecmp(line,"Connection:",11))
+		{
+			if (strcasestr(line + 11,"close")) *keep = 0;
+			if (strcasestr(line + 11,"keep-alive")) *keep = 1;
+		}
+	}
+	if (chunked)
+	{
+		for(;;)
+		{
+			if (statpost_getline(line,sizeof(line)) < 0) return(-1);
+			clen = strtol(line,NULL,16);
+			if (clen <= 0) break;
+			if (statpost_skip(clen) || (statpost_getline(line,sizeof(line)) < 0)) return(-1);
+		}
+		/* trailers */
+		do
+			if (statpost_getline(line,sizeof(line)) < 0) return(-1);
+		while(line[0]);
+	}
+	else if (clen >= 0)
+	{
+		if (statpost_skip(clen)) return(-1);
+	}
+	else if ((status >= 200) && (status != 204) && (status != 304))
+	{
+		/* body runs to end of connection */
+		while(statpost_getc() != -1);
+		*keep = 0;
+	}
+	if (statpost_rpos < statpost_rlen) *keep = 0;
+	return(status);
+}
+
+/* GET url. returns -1 if it did not get an answer */
+static int statpost_http(char *url)
+{
+char	host[256],*path,*cp,*req;
+int	port,res,keep,tries;
+
+	/* http://host[:port][/path] */
+	cp = url + 7;
+	path = strchr(cp,'/');
+	if (!path) path = cp + strlen(cp);
+	if ((path - cp) >= sizeof(host)) return(-1);
+	memcpy(host,cp,path - cp);
+	host[path - cp] = 0;
+	port = 80;
+	if ((cp = strchr(host,':')))
+	{
+		*cp++ = 0;
+		port = atoi(cp);
+	}
+	req = ast_malloc(strlen(url) + strlen(host) + 100);
+	if (!req) return(-1);
+	/* Host: names the port too unless it is the default */
+	if (port != 80)
+		sprintf(req,"GET %s%s HTTP/1.1\r\nHost: %s:%d\r\nUser-Agent: app_rpt\r\n"
+			"Connection: keep-alive\r\n\r\n",(*path) ? "" : "/",path,host,port);
+	else
+		sprintf(req,"GET %s%s HTTP/1.1\r\nHost: %s\r\nUser-Agent: app_rpt\r\n"
+			"Connection: keep-alive\r\n\r\n",(*path) ? "" : "/",path,host);
+	res = -1;
+	/* a kept-alive connection may have been closed by the server */
+	for(tries = 0; tries < 2; tries++)
+	{
+		res = -1;
+		if (statpost_connect(host,port)) break;
+		keep = 1;
+		if (!statpost_write(req,strlen(req)))
+			res = statpost_response(&keep);
+		if ((res < 0) || (!keep)) statpost_close();
+		if (res >= 0) break;
+	}
+	ast_free(req);
+	return(res);
+}
+
+static void *statpost_poster(void *ignore)
+{
+struct statpost_req *req;
+int	res;
+
+	ast_mutex_lock(&statpost_qlock);
+	for(;;)
+	{
+		while((!statpost_head) && (!statpost_shutdown))
+			ast_cond_wait(&statpost_cond,&statpost_qlock);
+		if (!statpost_head) break;
+		req = statpost_head;
+		statpost_head = req->next;
+		if (!statpost_head) statpost_tail = &statpost_head;
+		statpost_count--;
+		ast_mutex_unlock(&statpost_qlock);
+		res = statpost_http(req->url);
+		if (res < 0)
+			ast_log(LOG_WARNING,"statpost: no response for node %s\n",req->myrpt->name);
+		else if (debug && ((res < 200) || (res > 299)))
+			ast_log(LOG_NOTICE,"statpost: status %d for node %s\n",res,req->myrpt->name);
+		ast_free(req);
+		ast_mutex_lock(&statpost_qlock);
+	}
+	ast_mutex_unlock(&statpost_qlock);
+	statpost_close();
+	return(NULL);
+}
+
+/* queue url to be fetched. returns -1 if it was not taken */
+static int statpost_queue(struct rpt *myrpt, char *pairs, char *url)
+{
+struct statpost_req *req,*r,**rp;
+int	n;
+
+	req = ast_calloc(1,sizeof(struct statpost_req) + strlen(url) + 1);
+	if (!req) return(-1);
+	req->myrpt = myrpt;
+	req->url = (char *)(req + 1);
+	strcpy(req->url,url);
+	if (pairs)
+	{
+		n = strcspn(pairs,"=&");
+		if (n >= sizeof(req->kind)) n = sizeof(req->kind) - 1;
+		memcpy(req->kind,pairs,n);
+	}
+	ast_mutex_lock(&statpost_qlock);
+	if (statpost_thread == AST_PTHREADT_NULL)
+	{
+		ast_cond_init(&statpost_cond,NULL);
+		statpost_shutdown = 0;
+		if (ast_pthread_create(&statpost_thread,NULL,statpost_poster,NULL))
+		{
+			statpost_thread = AST_PTHREADT_NULL;
+			ast_cond_destroy(&statpost_cond);
+			ast_mutex_unlock(&statpost_qlock);
+			ast_free(req);
+			return(-1);
+		}
+	}
+	/* a newer one replaces one of the same kind still waiting */
+	for(rp = &statpost_head; (r = *rp); rp = &r->next)
+	{
+		if ((r->myrpt != myrpt) || strcmp(r->kind,req->kind)) continue;
+		req->next = r->next;
+		*rp = req;
+		if (statpost_tail == &r->next) statpost_tail = &req->next;
+		ast_mutex_unlock(&statpost_qlock);
+		ast_free(r);
+		return(0);
+	}
+	if (statpost_count >= STATPOST_QUEUEMAX)
+	{
+		myrpt->statpost_drops++;
+		ast_mutex_unlock(&statpost_qlock);
+		if (debug) ast_log(LOG_NOTICE,"statpost: queue full, dropped post for node %s\n",myrpt->name);
+		ast_free(req);
+		return(0);
+	}
+	req->next = NULL;
+	*statpost_tail = req;
+	statpost_tail = &req->next;
+	statpost_count++;
+	ast_cond_signal(&statpost_cond);
+	ast_mutex_unlock(&statpost_qlock);
+	return(0);
+}
+
+static void statpost_stop(void)
+{
+struct statpost_req *req;
+
+	ast_mutex_lock(&statpost_qlock);
+	if (statpost_thread == AST_PTHREADT_NULL)
+	{
+		ast_mutex_unlock(&statpost_qlock);
+		return;
+	}
+	/* whatever is still waiting is not worth holding up unload for */
+	while((req = statpost_head))
+	{
+		statpost_head = req->next;
+		ast_free(req);
+	}
+	statpost_tail = &statpost_head;
+	statpost_count = 0;
+	statpost_shutdown = 1;
+	ast_cond_signal(&statpost_cond);
+	ast_mutex_unlock(&statpost_qlock);
+	pthread_join(statpost_thread,NULL);
+	statpost_thread = AST_PTHREADT_NULL;
+	ast_cond_destroy(&statpost_cond);
+}
+
 static void statpost(struct rpt *myrpt,char *pairs)
 {
 char *str,*astr;
@@ -5478,9 +6892,30 @@ time_t	now;
 unsigned int seq;
 
 	if (!myrpt->p.statpost_url) return;
-	str = ast_malloc(strlen(pairs) + strlen(myrpt->p.statpost_url) + 200);
+	str = ast_malloc(((pairs) ? strlen(pairs) : 0) + strlen(myrpt->p.statpost_url) + 200);
+	if (!str) return;
+	ast_mutex_lock(&myrpt->statpost_lock);
+	seq = ++myrpt->statpost_seqno;
+	ast_mutex_unlock(&myrpt->statpost_lock);
+	time(&now);
+	sprintf(str,"%s?node=%s&time=%u&seqno=%u",myrpt->p.statpost_url,
+		myrpt->name,(unsigned int) now,seq);
+	if (pairs) sprintf(str + strlen(str),"&%s",pairs);
+	if ((!strncasecmp(str,"http://",7)) && 
+	    (!strcmp(myrpt->p.statpost_program,STATPOST_PROGRAM)))
+	{
+		if (statpost_queue(myrpt,pairs,str) == 0)
+		{
+			ast_free(str);
+			return;
+		}
+	}
 	astr = ast_strdup(myrpt->p.statpost_program);
-	if ((!str) || (!astr)) return;
+	if (!astr)
+	{
+		ast_free(str);
+		return;
+	}
 	n = finddelim(astr,astrs,100);
 	if (n < 1)
 	{
@@ -5488,15 +6923,8 @@ unsigned int seq;
 		ast_free(astr);
 		return;
 	}
-	ast_mutex_lock(&myrpt->statpost_lock);
-	seq = ++myrpt->statpost_seqno;
-	ast_mutex_unlock(&myrpt->statpost_lock);
 	astrs[n++] = str;
 	astrs[n] = NULL;
-	time(&now);
-	sprintf(str,"%s?node=%s&time=%u&seqno=%u",myrpt->p.statpost_url,
-		myrpt->name,(unsigned int) now,seq);
-	if (pairs) sprintf(str + strlen(str),"&%s",pairs);
 	if (!(pid = fork()))
 	{
 		execv(astrs[0],astrs);
@@ -5573,27 +7001,229 @@ int	n;
 	return;
 }
 
-static int node_lookup(struct rpt *myrpt,char *digitbuf,char *str, int strmax, int wilds)
+/*
+* External node directory. Each extnodes file/stanza pair is parsed once
+* into a hash indexed table that is shared by all nodes, and rebuilt
+* (without holding nodelookuplock) only when the file changes on disk.
+* Tables are reference counted, so that a lookup that is in progress may
+* keep using the old one after a new one has been swapped in.
+*/
+
+#define	XNODE_MINBUCKETS 64
+
+struct rpt_xnode
 {
+	struct rpt_xnode *next;
+	char	*name;
+	char	*value;
+} ;
 
-char *val;
-int longestnode,i,j,found;
-struct stat mystat;
-struct ast_config *ourcfg;
-struct ast_variable *vp;
+struct rpt_xnodetab
+{
+	struct rpt_xnodetab *next;
+	char	*fname;
+	char	*stanza;
+	time_t	mtime;
+	off_t	size;
+	int	refcnt;
+	int	nnodes;
+	int	longestnode;
+	unsigned int nbuckets;
+	struct	rpt_xnode **buckets;
+	struct	rpt_xnode *nodes;
+	char	*strs;
+} ;
 
-	/* try to look it up locally first */
-	val = (char *) ast_variable_retrieve(myrpt->cfg, myrpt->p.nodes, digitbuf);
-	if (val)
-	{
-		if (str && strmax)
-			snprintf(str,strmax,val,digitbuf);
-		return(1);
-	}
-	if (wilds)
-	{
-		vp = ast_variable_browse(myrpt->cfg, myrpt->p.nodes);
-		while(vp)
+/* list of current tables, protected by nodelookuplock */
+static struct rpt_xnodetab *xnodetabs = NULL;
+
+/* case-insensitive, as ast_variable_retrieve() was */
+static unsigned int xnode_hash(const char *s)
+{
+unsigned int h = 5381;
+
+	while(*s) h = (h * 33) ^ (unsigned char) tolower(*s++);
+	return(h);
+}
+
+static void xnodetab_free(struct rpt_xnodetab *t)
+{
+	if (t->buckets) ast_free(t->buckets);
+	if (t->nodes) ast_free(t->nodes);
+	if (t->strs) ast_free(t->strs);
+	ast_free(t);
+}
+
+static void xnodetab_unref(struct rpt_xnodetab *t)
+{
+int	n;
+
+	ast_mutex_lock(&nodelookuplock);
+	n = --t->refcnt;
+	ast_mutex_unlock(&nodelookuplock);
+	if (!n) xnodetab_free(t);
+}
+
+/* parse an extnodes file into a new table. Called without any locks held */
+static struct rpt_xnodetab *xnodetab_build(char *fname, char *stanza, struct stat *st)
+{
+struct ast_config *ourcfg;
+struct ast_variable *vp;
+struct rpt_xnodetab *t;
+struct rpt_xnode *np;
+unsigned int h;
+int	i,j,n;
+size_t	len;
+char	*cp;
+
+#ifdef	NEW_ASTERISK
+	ourcfg = ast_config_load(fname,config_flags);
+#else
+	ourcfg = ast_config_load(fname);
+#endif
+	if (!ourcfg) return(NULL);
+	n = 0;
+	len = strlen(fname) + strlen(stanza) + 2;
+	for(vp = ast_variable_browse(ourcfg, stanza); vp; vp = vp->next)
+	{
+		n++;
+		len += strlen(vp->name) + strlen(vp->value) + 2;
+	}
+	t = ast_calloc(1,sizeof(struct rpt_xnodetab));
+	if (!t)
+	{
+		ast_config_destroy(ourcfg);
+		return(NULL);
+	}
+	for(t->nbuckets = XNODE_MINBUCKETS; t->nbuckets < n; t->nbuckets <<= 1);
+	t->buckets = ast_calloc(t->nbuckets,sizeof(struct rpt_xnode *));
+	t->nodes = ast_calloc(n + 1,sizeof(struct rpt_xnode));
+	t->strs = ast_malloc(len);
+	if ((!t->buckets) || (!t->nodes) || (!t->strs))
+	{
+		ast_log(LOG_ERROR,"Malloc Failed!\n");
+		xnodetab_free(t);
+		ast_config_destroy(ourcfg);
+		return(NULL);
+	}
+	cp = t->strs;
+	t->fname = strcpy(cp,fname);
+	cp += strlen(cp) + 1;
+	t->stanza = strcpy(cp,stanza);
+	cp += strlen(cp) + 1;
+	t->mtime = st->st_mtime;
+	t->size = st->st_size;
+	i = 0;
+	for(vp = ast_variable_browse(ourcfg, stanza); vp; vp = vp->next)
+	{
+		np = &t->nodes[i++];
+		np->name = strcpy(cp,vp->name);
+		cp += strlen(cp) + 1;
+		np->value = strcpy(cp,vp->value);
+		cp += strlen(cp) + 1;
+		j = strlen(np->name);
+		if (*np->name == '_') j--;
+		if (j > t->longestnode)
+			t->longestnode = j;
+	}
+	t->nnodes = i;
+	ast_config_destroy(ourcfg);
+	/* insert backwards so the first entry in the file wins, as before */
+	while(i--)
+	{
+		np = &t->nodes[i];
+		h = xnode_hash(np->name) & (t->nbuckets - 1);
+		np->next = t->buckets[h];
+		t->buckets[h] = np;
+	}
+	return(t);
+}
+
+/* get a referenced, up to date table for fname/stanza, or NULL if there is none */
+static struct rpt_xnodetab *xnodetab_get(char *fname, char *stanza)
+{
+struct stat mystat;
+struct rpt_xnodetab *t,*nt,**tp;
+
+	/* if file does not exist */
+	if (stat(fname,&mystat) == -1) return(NULL);
+	ast_mutex_lock(&nodelookuplock);
+	for(t = xnodetabs; t; t = t->next)
+	{
+		if (strcmp(t->fname,fname) || strcmp(t->stanza,stanza)) continue;
+		if ((t->mtime != mystat.st_mtime) || (t->size != mystat.st_size)) break;
+		t->refcnt++;
+		ast_mutex_unlock(&nodelookuplock);
+		return(t);
+	}
+	ast_mutex_unlock(&nodelookuplock);
+	nt = xnodetab_build(fname,stanza,&mystat);
+	/* if file not there, try next */
+	if (!nt) return(NULL);
+	nt->refcnt = 2;   /* one for the list, one for the caller */
+	t = NULL;
+	ast_mutex_lock(&nodelookuplock);
+	for(tp = &xnodetabs; *tp; tp = &(*tp)->next)
+	{
+		if (strcmp((*tp)->fname,fname) || strcmp((*tp)->stanza,stanza)) continue;
+		t = *tp;
+		*tp = t->next;
+		if (--t->refcnt) t = NULL;
+		break;
+	}
+	nt->next = xnodetabs;
+	xnodetabs = nt;
+	ast_mutex_unlock(&nodelookuplock);
+	if (t) xnodetab_free(t);
+	if (debug > 2) ast_log(LOG_NOTICE,"Loaded %d nodes from %s\n",nt->nnodes,fname);
+	return(nt);
+}
+
+static char *xnodetab_find(struct rpt_xnodetab *t, char *name)
+{
+struct rpt_xnode *np;
+
+	np = t->buckets[xnode_hash(name) & (t->nbuckets - 1)];
+	for(; np; np = np->next)
+	{
+		if (!strcasecmp(np->name,name)) return(np->value);
+	}
+	return(NULL);
+}
+
+static void xnodetab_destroy_all(void)
+{
+struct rpt_xnodetab *t;
+
+	ast_mutex_lock(&nodelookuplock);
+	while((t = xnodetabs))
+	{
+		xnodetabs = t->next;
+		if (!--t->refcnt) xnodetab_free(t);
+	}
+	ast_mutex_unlock(&nodelookuplock);
+}
+
+static int node_lookup(struct rpt *myrpt,char *digitbuf,char *str, int strmax, int wilds)
+{
+
+char *val;
+int longestnode,i,found;
+struct rpt_xnodetab *t;
+struct ast_variable *vp;
+
+	/* try to look it up locally first */
+	val = (char *) ast_variable_retrieve(myrpt->cfg, myrpt->p.nodes, digitbuf);
+	if (val)
+	{
+		if (str && strmax)
+			snprintf(str,strmax,val,digitbuf);
+		return(1);
+	}
+	if (wilds)
+	{
+		vp = ast_variable_browse(myrpt->cfg, myrpt->p.nodes);
+		while(vp)
 		{
 			if (ast_extension_match(vp->name, digitbuf))
 			{
@@ -5604,47 +7234,18 @@ struct ast_variable *vp;
 			vp = vp->next;
 		}
 	}
-	ast_mutex_lock(&nodelookuplock);
-	if (!myrpt->p.extnodefilesn) 
-	{
-		ast_mutex_unlock(&nodelookuplock);
-		return(0);
-	}
-	/* determine longest node length again */		
-	longestnode = 0;
-	vp = ast_variable_browse(myrpt->cfg, myrpt->p.nodes);
-	while(vp)
-	{
-		j = strlen(vp->name);
-		if (*vp->name == '_') j--;
-		if (j > longestnode)
-			longestnode = j;
-		vp = vp->next;
-	}
+	if (!myrpt->p.extnodefilesn) return(0);
+	longestnode = myrpt->longestlocalnode;
 	found = 0;
 	for(i = 0; i < myrpt->p.extnodefilesn; i++)
 	{
-#ifdef	NEW_ASTERISK
-		ourcfg = ast_config_load(myrpt->p.extnodefiles[i],config_flags);
-#else
-		ourcfg = ast_config_load(myrpt->p.extnodefiles[i]);
-#endif
-		/* if file does not exist */
-		if (stat(myrpt->p.extnodefiles[i],&mystat) == -1) continue;
-		/* if file not there, try next */
-		if (!ourcfg) continue;
-		vp = ast_variable_browse(ourcfg, myrpt->p.extnodes);
-		while(vp)
-		{
-			j = strlen(vp->name);
-			if (*vp->name == '_') j--;
-			if (j > longestnode)
-				longestnode = j;
-			vp = vp->next;
-		}
+		t = xnodetab_get(myrpt->p.extnodefiles[i],myrpt->p.extnodes);
+		if (!t) continue;
+		if (t->longestnode > longestnode)
+			longestnode = t->longestnode;
 		if (!found)
 		{
-			val = (char *) ast_variable_retrieve(ourcfg, myrpt->p.extnodes, digitbuf);
+			val = xnodetab_find(t,digitbuf);
 			if (val)
 			{
 				found = 1;
@@ -5652,66 +7253,39 @@ struct ast_variable *vp;
 					snprintf(str,strmax,val,digitbuf);
 			}
 		}
-		ast_config_destroy(ourcfg);
+		xnodetab_unref(t);
 	}
 	myrpt->longestnode = longestnode;
-	ast_mutex_unlock(&nodelookuplock);
 	return(found);
 }
 
-static char *forward_node_lookup(struct rpt *myrpt,char *digitbuf, struct ast_config *cfg)
+static char *forward_node_lookup(char *digitbuf, struct ast_config *cfg, char *str, int strmax)
 {
 
 char *val,*efil,*enod,*strs[100];
 int i,n;
-struct stat mystat;
-static struct ast_config *ourcfg;
+struct rpt_xnodetab *t;
 
 	val = (char *) ast_variable_retrieve(cfg, "proxy", "extnodefile");
 	if (!val) val = EXTNODEFILE;
 	enod = (char *) ast_variable_retrieve(cfg, "proxy", "extnodes");
 	if (!enod) enod = EXTNODES;
-	ast_mutex_lock(&nodelookuplock);
 	efil = ast_strdup(val);
-	if (!efil) 
-	{
-		ast_config_destroy(ourcfg);
-		if (ourcfg) ast_config_destroy(ourcfg);
-		ourcfg = NULL;
-		ast_mutex_unlock(&nodelookuplock);
-		return NULL;
-	}
+	if (!efil) return NULL;
 	n = finddelim(efil,strs,100);
-	if (n < 1)
-	{
-		ast_free(efil);
-		ast_config_destroy(ourcfg);
-		if (ourcfg) ast_config_destroy(ourcfg);
-		ourcfg = NULL;
-		ast_mutex_unlock(&nodelookuplock);
-		return NULL;
-	}
-	if (ourcfg) ast_config_destroy(ourcfg);
 	val = NULL;
-	for(i = 0; i < n; i++)
+	for(i = 0; (i < n) && (!val); i++)
 	{
-		/* if file does not exist */
-		if (stat(strs[i],&mystat) == -1) continue;
-#ifdef	NEW_ASTERISK
-		ourcfg = ast_config_load(strs[i],config_flags);
-#else
-		ourcfg = ast_config_load(strs[i]);
-#endif
-		/* if file not there, try next */
-		if (!ourcfg) continue;
-		if (!val) val = (char *) ast_variable_retrieve(ourcfg, enod, digitbuf);
+		t = xnodetab_get(strs[i],enod);
+		if (!t) continue;
+		val = xnodetab_find(t,digitbuf);
+		if (val)
+		{
+			ast_copy_string(str,val,strmax);
+			val = str;
+		}
+		xnodetab_unref(t);
 	}
-        if (!val)
-        {
-                if (ourcfg) ast_config_destroy(ourcfg);
-                ourcfg = NULL;
-        }
-	ast_mutex_unlock(&nodelookuplock);
 	ast_free(efil);
 	return(val);
 }
@@ -6000,6 +7574,9 @@ static char *cs_keywords[] = {"rptena","rptdis","apena","apdis","lnkena","lnkdis
 	rpt_vars[n].p.elke  = j * 1210;
 	val = (char *) ast_variable_retrieve(cfg,this,"tonezone");
 	if (val) rpt_vars[n].p.tonezone = val;
+	val = (char *) ast_variable_retrieve(cfg,this,"mixer");
+	if (val && (!strcasecmp(val,"internal"))) rpt_vars[n].p.mixer = RPT_MIXER_INTERNAL;
+	else rpt_vars[n].p.mixer = RPT_MIXER_DAHDI;
 	rpt_vars[n].p.tailmessages[0] = 0;
 	rpt_vars[n].p.tailmessagemax = 0;
 	val = (char *) ast_variable_retrieve(cfg,this,"tailmessagelist");
@@ -6354,6 +7931,7 @@ static char *cs_keywords[] = {"rptena","rptdis","apena","apdis","lnkena","lnkdis
 	}
 
 	longestnode = 0;
+	i = 0;
 
 	vp = ast_variable_browse(cfg, rpt_vars[n].p.nodes);
 		
@@ -6361,10 +7939,14 @@ static char *cs_keywords[] = {"rptena","rptdis","apena","apdis","lnkena","lnkdis
 		j = strlen(vp->name);
 		if (j > longestnode)
 			longestnode = j;
+		if (*vp->name == '_') j--;
+		if (j > i)
+			i = j;
 		vp = vp->next;
 	}
 
 	rpt_vars[n].longestnode = longestnode;
+	rpt_vars[n].longestlocalnode = i;
 		
 	/*
 	* For this repeater, Determine the length of the longest function 
@@ -6815,7 +8397,8 @@ static int rpt_do_stats(int fd, int argc, char *argv[])
 			(called_number && strlen(called_number)) ? called_number : not_applicable);
 			ast_cli(fd, "Reverse patch/IAXRPT connected...................: %s\n", reverse_patch_state);
 			ast_cli(fd, "User linking commands............................: %s\n", link_ena);
-			ast_cli(fd, "User functions...................................: %s\n\n", user_funs);
+			ast_cli(fd, "User functions...................................: %s\n", user_funs);
+			ast_cli(fd, "Status posts dropped.............................: %u\n\n", myrpt->statpost_drops);
 
 			for(j = 0; j < numoflinks; j++){ /* ast_free() all link names */
 				ast_free(listoflinks[j]);
@@ -7394,7 +8977,7 @@ static int rpt_do_page(int fd, int argc, char *argv[])
 				if (((telem->mode == ID) || (telem->mode == ID1) || 
 					(telem->mode == IDTALKOVER)) && (!telem->killed))
 				{
-					if (telem->chan) ast_softhangup(telem->chan, AST_SOFTHANGUP_DEV); /* Whoosh! */
+					rpt_tele_kill(telem); /* Whoosh! */
 					telem->killed = 1;
 					myrpt->deferid = 1;
 				}
@@ -8196,7 +9779,6 @@ static int send_tone_telemetry(struct ast_channel *chan, char *tonestring)
 	int amplitude;
 	int res;
 	int i;
-	int flags;
 	
 	res = 0;
 
@@ -8230,9 +9812,7 @@ static int send_tone_telemetry(struct ast_channel *chan, char *tonestring)
 	*/
 
 	for(i = 0; i < 20 ; i++){
-		flags =  DAHDI_IOMUX_WRITEEMPTY | DAHDI_IOMUX_NOWAIT; 
-		res = ioctl(chan->fds[0], DAHDI_IOMUX, &flags);
-		if(flags & DAHDI_IOMUX_WRITEEMPTY)
+		if(rpt_writeempty(chan))
 			break;
 		if( ast_safe_sleep(chan, 50)){
 			res = -1;
@@ -8330,6 +9910,201 @@ char	*val,fname[300],str[100];
 	return res;
 }
 
+/*
+ * Telemetry sound cache. Files named in the telemetry stanza (courtesy
+ * tones, IDs and the like) are decoded to slinear the first time they are
+ * played and kept in memory, so they are not read and decoded from disk
+ * every time. Flushed on reload.
+ */
+
+#define	SNDCACHE_MAXSAMPLES (8000 * 10)		/* longest file we keep */
+#define	SNDCACHE_MAXTOTAL (8000 * 600)		/* samples, all files */
+
+struct rpt_sndcache {
+	struct rpt_sndcache *next;
+	char	*name;			/* file name, then language */
+	char	*lang;
+	int	refcnt;
+	int	nsamples;		/* -1 if it can not be cached */
+	short	*samples;
+} ;
+
+static struct rpt_sndcache *sndcache = NULL;
+static int sndcache_total = 0;
+AST_MUTEX_DEFINE_STATIC(sndcachelock);
+
+static void sndcache_unref(struct rpt_sndcache *sc)
+{
+	ast_mutex_lock(&sndcachelock);
+	if (--sc->refcnt)
+	{
+		ast_mutex_unlock(&sndcachelock);
+		return;
+	}
+	ast_mutex_unlock(&sndcachelock);
+	if (sc->samples) ast_free(sc->samples);
+	ast_free(sc);
+}
+
+static void sndcache_flush(void)
+{
+	struct rpt_sndcache *sc,*next;
+
+	ast_mutex_lock(&sndcachelock);
+	sc = sndcache;
+	sndcache = NULL;
+	sndcache_total = 0;
+	ast_mutex_unlock(&sndcachelock);
+	for(; sc; sc = next)
+	{
+		next = sc->next;
+		sndcache_unref(sc);
+	}
+}
+
+/* decode fname to slinear using chan to find it, or return NULL */
+static short *sndcache_decode(struct ast_channel *chan, char *fname, int *nsamples)
+{
+	struct ast_filestream *fs;
+	struct ast_trans_pvt *trans;
+	struct ast_frame *f,*f1;
+	short *buf,*cp;
+	int n,fmt;
+
+	fs = ast_openstream(chan,fname,chan->language);
+	if (!fs) return(NULL);
+	buf = ast_malloc(SNDCACHE_MAXSAMPLES * sizeof(short));
+	trans = NULL;
+	fmt = 0;
+	n = 0;
+	while(buf && (f = ast_readframe(fs)))
+	{
+		f1 = f;
+		if (f->subclass != AST_FORMAT_SLINEAR)
+		{
+			if (trans && (fmt != f->subclass))
+			{
+				ast_translator_free_path(trans);
+				trans = NULL;
+			}
+			if (!trans) trans = ast_translator_build_path(AST_FORMAT_SLINEAR,f->subclass);
+			fmt = f->subclass;
+			f1 = (trans) ? ast_translate(trans,f,0) : NULL;
+		}
+		if ((!f1) || ((n + f1->samples) > SNDCACHE_MAXSAMPLES))
+		{
+			if (f1 && (f1 != f)) ast_frfree(f1);
+			ast_frfree(f);
+			ast_free(buf);
+			buf = NULL;
+			break;
+		}
+		memcpy(buf + n,AST_FRAME_DATAP(f1),f1->samples * sizeof(short));
+		n += f1->samples;
+		if (f1 != f) ast_frfree(f1);
+		ast_frfree(f);
+	}
+	if (trans) ast_translator_free_path(trans);
+	ast_stopstream(chan);
+	if (!buf) return(NULL);
+	if ((cp = ast_realloc(buf,(n + 1) * sizeof(short)))) buf = cp;
+	*nsamples = n;
+	return(buf);
+}
+
+/* find (or load) fname in the cache. returns it referenced */
+static struct rpt_sndcache *sndcache_get(struct ast_channel *chan, char *fname)
+{
+	struct rpt_sndcache *sc;
+	short *samples;
+	int n;
+
+	ast_mutex_lock(&sndcachelock);
+	for(sc = sndcache; sc; sc = sc->next)
+	{
+		if (strcmp(sc->name,fname) || strcmp(sc->lang,chan->language)) continue;
+		sc->refcnt++;
+		ast_mutex_unlock(&sndcachelock);
+		return(sc);
+	}
+	ast_mutex_unlock(&sndcachelock);
+	n = -1;
+	samples = sndcache_decode(chan,fname,&n);
+	if (!samples) n = -1;
+	sc = ast_calloc(1,sizeof(struct rpt_sndcache) + strlen(fname) + strlen(chan->language) + 2);
+	if (!sc)
+	{
+		if (samples) ast_free(samples);
+		return(NULL);
+	}
+	sc->name = (char *)(sc + 1);
+	strcpy(sc->name,fname);
+	sc->lang = sc->name + strlen(fname) + 1;
+	strcpy(sc->lang,chan->language);
+	sc->samples = samples;
+	sc->nsamples = n;
+	sc->refcnt = 2;
+	ast_mutex_lock(&sndcachelock);
+	if ((sndcache_total + n) > SNDCACHE_MAXTOTAL)
+	{
+		/* full, just use it this once */
+		sc->refcnt = 1;
+		ast_mutex_unlock(&sndcachelock);
+		return(sc);
+	}
+	if (n > 0) sndcache_total += n;
+	sc->next = sndcache;
+	sndcache = sc;
+	ast_mutex_unlock(&sndcachelock);
+	return(sc);
+}
+
+/* play cached slinear audio, paced by the channel's own frames */
+static int sndcache_play(struct ast_channel *chan, struct rpt_sndcache *sc)
+{
+	struct ast_frame fr,*f;
+	int i,n;
+
+	ast_stopstream(chan);
+	if (chan->generatordata) ast_deactivate_generator(chan);
+	if (ast_set_write_format(chan,AST_FORMAT_SLINEAR)) return(-1);
+	for(i = 0; i < sc->nsamples; i += n)
+	{
+		n = sc->nsamples - i;
+		if (n > 160) n = 160;
+		memset(&fr,0,sizeof(fr));
+		fr.frametype = AST_FRAME_VOICE;
+		fr.subclass = AST_FORMAT_SLINEAR;
+		fr.datalen = n * sizeof(short);
+		fr.samples = n;
+		AST_FRAME_DATA(fr) = (char *)(sc->samples + i);
+		fr.src = "rpt_sndcache";
+		if (ast_write(chan,&fr)) return(-1);
+		if (ast_waitfor(chan,100) < 0) return(-1);
+		f = ast_read(chan);
+		if (!f) return(-1);
+		ast_frfree(f);
+	}
+	return(0);
+}
+
+/* sayfile, through the cache */
+static int sayfile_cached(struct ast_channel *mychannel,char *fname)
+{
+	struct rpt_sndcache *sc;
+	int res;
+
+	sc = sndcache_get(mychannel,fname);
+	if ((!sc) || (sc->nsamples < 0))
+	{
+		if (sc) sndcache_unref(sc);
+		return(sayfile(mychannel,fname));
+	}
+	res = sndcache_play(mychannel,sc);
+	sndcache_unref(sc);
+	return(res);
+}
+
 static int telem_any(struct rpt *myrpt,struct ast_channel *chan, char *entry)
 {
 	int res;
@@ -8373,7 +10148,7 @@ static int telem_any(struct rpt *myrpt,struct ast_channel *chan, char *entry)
 		}
 	}
 	else
-		res = sayfile(chan, entry); /* File */
+		res = sayfile_cached(chan, entry); /* File */
 	return res;
 }
 
@@ -8861,15 +10636,18 @@ struct	tm localtm;
 	return;
 }
 
-static void *rpt_tele_thread(void *this)
+/*
+ * Play one telemetry message on mychannel, an answered pseudo channel that
+ * is not in a conference. Takes mytele off the queue and frees it.
+ * Returns -1 if mychannel is no longer fit for reuse.
+ */
+static int rpt_tele_play(struct rpt_tele *mytele, struct ast_channel *mychannel)
 {
 struct dahdi_confinfo ci;  /* conference info */
 int	res = 0,haslink,hastx,hasremote,imdone = 0, unkeys_queued, x;
-struct	rpt_tele *mytele = (struct rpt_tele *)this;
 struct  rpt_tele *tlist;
 struct	rpt *myrpt;
 struct	rpt_link *l,*l1,linkbase;
-struct	ast_channel *mychannel;
 int id_malloc, vmajor, vminor, m;
 char *p,*ct,*ct_copy,*ident, *nodename,*cp;
 time_t t,t1,was;
@@ -8905,7 +10683,7 @@ struct	mdcparams *mdcp;
 	    ast_log(LOG_NOTICE,"Telemetry thread aborted at line %d, mode: %d\n",__LINE__, mytele->mode); /*@@@@@@@@@@@*/
 	    rpt_mutex_unlock(&myrpt->lock);
 	    ast_free(mytele);
-	    pthread_exit(NULL);
+	    return(0);
 	}
 
 	if (myrpt->p.ident){
@@ -8920,7 +10698,7 @@ struct	mdcparams *mdcp;
                 	rpt_mutex_unlock(&myrpt->lock);
 			ast_free(nodename);
                 	ast_free(mytele);
-                	pthread_exit(NULL);
+                	return(0);
         	}
 		else{
 			id_malloc = 1;
@@ -8933,29 +10711,18 @@ struct	mdcparams *mdcp;
 	}
 	rpt_mutex_unlock(&myrpt->lock);
 		
-
-
-	/* allocate a pseudo-channel thru asterisk */
-	mychannel = ast_request(DAHDI_CHANNEL_NAME,AST_FORMAT_SLINEAR,"pseudo",NULL);
-	if (!mychannel)
+	rpt_mutex_lock(&myrpt->lock);
+	/* killed while it was waiting for a worker */
+	if (mytele->cancelled)
 	{
-		fprintf(stderr,"rpt:Sorry unable to obtain pseudo channel\n");
-		rpt_mutex_lock(&myrpt->lock);
 		remque((struct qelem *)mytele);
-		ast_log(LOG_NOTICE,"Telemetry thread aborted at line %d, mode: %d\n",__LINE__, mytele->mode); /*@@@@@@@@@@@*/
 		rpt_mutex_unlock(&myrpt->lock);
 		ast_free(nodename);
 		if(id_malloc)
 			ast_free(ident);
-		ast_free(mytele);		
-		pthread_exit(NULL);
+		ast_free(mytele);
+		return(0);
 	}
-#ifdef	AST_CDR_FLAG_POST_DISABLED
-	if (mychannel->cdr) 
-		ast_set_flag(mychannel->cdr,AST_CDR_FLAG_POST_DISABLED);
-#endif
-	ast_answer(mychannel);
-	rpt_mutex_lock(&myrpt->lock);
 	mytele->chan = mychannel;
 	while (myrpt->active_telem && 
 	    ((myrpt->active_telem->mode == PAGE) || (
@@ -8993,7 +10760,7 @@ struct	mdcparams *mdcp;
 		myrpt->conf : myrpt->txconf);
 	ci.confmode = DAHDI_CONF_CONFANN;
 	/* first put the channel on the conference in announce mode */
-	if (ioctl(mychannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+	if (rpt_setconf(mychannel,&ci) == -1)
 	{
 		ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 		rpt_mutex_lock(&myrpt->lock);
@@ -9005,8 +10772,7 @@ struct	mdcparams *mdcp;
 		if(id_malloc)
 			ast_free(ident);
 		ast_free(mytele);		
-		ast_hangup(mychannel);
-		pthread_exit(NULL);
+		return(-1);
 	}
 	ast_stopstream(mychannel);
 	res = 0;
@@ -9336,7 +11102,7 @@ treataslocal:
 			ci.confno = myrpt->conf;
 			ci.confmode = DAHDI_CONF_CONFANN;
 			/* first put the channel on the conference in announce mode */
-			if (ioctl(mychannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+			if (rpt_setconf(mychannel,&ci) == -1)
 			{
 				ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 				rpt_mutex_lock(&myrpt->lock);
@@ -9348,8 +11114,7 @@ treataslocal:
 				if(id_malloc)
 					ast_free(ident);
 				ast_free(mytele);		
-				ast_hangup(mychannel);
-				pthread_exit(NULL);
+				return(-1);
 			}
 			if((ct = (char *) ast_variable_retrieve(myrpt->cfg, nodename, "remotect"))){ /* Unlinked Courtesy Tone */
 				ast_safe_sleep(mychannel,200);
@@ -9377,7 +11142,7 @@ treataslocal:
 			ci.confno = myrpt->txconf;
 			ci.confmode = DAHDI_CONF_CONFANN;
 			/* first put the channel on the conference in announce mode */
-			if (ioctl(mychannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+			if (rpt_setconf(mychannel,&ci) == -1)
 			{
 				ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 				rpt_mutex_lock(&myrpt->lock);
@@ -9389,8 +11154,7 @@ treataslocal:
 				if(id_malloc)
 					ast_free(ident);
 				ast_free(mytele);		
-				ast_hangup(mychannel);
-				pthread_exit(NULL);
+				return(-1);
 			}
 			sprintf(mystr,"%04x",myrpt->lastunit);
 			myrpt->lastunit = 0;
@@ -10078,8 +11842,7 @@ treataslocal:
 				if(id_malloc)
 					ast_free(ident);
 				ast_free(mytele);		
-				ast_hangup(mychannel);
-				pthread_exit(NULL);
+				return(-1);
 			}
 			memcpy(l1,l,sizeof(struct rpt_link));
 			l1->next = l1->prev = NULL;
@@ -10554,6 +12317,64 @@ treataslocal:
 	if(id_malloc)
 		ast_free(ident);
 	ast_free(mytele);		
+	return(0);
+}
+
+static void send_tele_link(struct rpt *myrpt,char *cmd);
+
+
+/* get an answered pseudo channel for telemetry */
+static struct ast_channel *rpt_tele_getchan(struct rpt *myrpt)
+{
+struct ast_channel *mychannel;
+
+	mychannel = rpt_pseudo(myrpt);
+	if (!mychannel)
+	{
+		fprintf(stderr,"rpt:Sorry unable to obtain pseudo channel\n");
+		return(NULL);
+	}
+#ifdef	AST_CDR_FLAG_POST_DISABLED
+	if (mychannel->cdr) 
+		ast_set_flag(mychannel->cdr,AST_CDR_FLAG_POST_DISABLED);
+#endif
+	ast_answer(mychannel);
+	return(mychannel);
+}
+
+/* give up on a telemetry message we could not get a channel for */
+static void rpt_tele_abort(struct rpt_tele *mytele)
+{
+struct rpt *myrpt = mytele->rpt;
+
+	rpt_mutex_lock(&myrpt->lock);
+	remque((struct qelem *)mytele);
+	ast_log(LOG_NOTICE,"Telemetry thread aborted at line %d, mode: %d\n",__LINE__, mytele->mode); /*@@@@@@@@@@@*/
+	rpt_mutex_unlock(&myrpt->lock);
+	ast_free(mytele);
+}
+
+/* stop a telemetry message, whether it is playing or still queued.
+   must be called locked */
+static void rpt_tele_kill(struct rpt_tele *telem)
+{
+	if (telem->chan) ast_softhangup(telem->chan,AST_SOFTHANGUP_DEV);
+	else telem->cancelled = 1;
+}
+
+/* one-shot telemetry thread, used when no pool worker is free */
+static void *rpt_tele_thread(void *this)
+{
+struct	rpt_tele *mytele = (struct rpt_tele *)this;
+struct	ast_channel *mychannel;
+
+	mychannel = rpt_tele_getchan(mytele->rpt);
+	if (!mychannel)
+	{
+		rpt_tele_abort(mytele);
+		pthread_exit(NULL);
+	}
+	rpt_tele_play(mytele,mychannel);
 	ast_hangup(mychannel);
 #ifdef  APP_RPT_LOCK_DEBUG
 	{
@@ -10569,10 +12390,135 @@ treataslocal:
 	pthread_exit(NULL);
 }
 
-static void send_tele_link(struct rpt *myrpt,char *cmd);
-
-static void rpt_telemetry(struct rpt *myrpt,int mode, void *data)
-{
+/*
+ * Telemetry worker pool. Each node keeps RPT_TELE_WORKERS threads that
+ * hold on to their pseudo channels between messages. A message is only
+ * queued if a worker is free to take it right away (navail counts those
+ * not already spoken for), so a long playback or a test tone never holds
+ * up courtesy tones; those fall back to a one-shot thread instead.
+ *
+ * Lock order is myrpt->lock, then pool->lock.
+ */
+static void *rpt_tele_worker(void *data)
+{
+struct	rpt_telepool *pool = (struct rpt_telepool *)data;
+struct	rpt_tele *mytele;
+struct	ast_channel *mychannel = NULL;
+struct	dahdi_confinfo ci;
+int	x;
+
+	ast_mutex_lock(&pool->lock);
+	for(;;)
+	{
+		pool->navail++;
+		while((!pool->head) && (!pool->shutdown))
+			ast_cond_wait(&pool->cond,&pool->lock);
+		if (!pool->head) break;
+		mytele = pool->head;
+		pool->head = mytele->pnext;
+		if (!pool->head) pool->tail = &pool->head;
+		ast_mutex_unlock(&pool->lock);
+		if ((!mychannel) && (!(mychannel = rpt_tele_getchan(mytele->rpt))))
+		{
+			rpt_tele_abort(mytele);
+			ast_mutex_lock(&pool->lock);
+			continue;
+		}
+		x = rpt_tele_play(mytele,mychannel);
+		ast_stopstream(mychannel);
+		if (mychannel->generatordata) ast_deactivate_generator(mychannel);
+		/* take it back out of the conference */
+		ci.chan = 0;
+		ci.confno = 0;
+		ci.confmode = DAHDI_CONF_NORMAL;
+		if ((x < 0) || ast_check_hangup(mychannel) ||
+		    (rpt_setconf(mychannel,&ci) == -1))
+		{
+			ast_hangup(mychannel);
+			mychannel = NULL;
+		}
+		ast_mutex_lock(&pool->lock);
+	}
+	ast_mutex_unlock(&pool->lock);
+	if (mychannel) ast_hangup(mychannel);
+	return(NULL);
+}
+
+static void rpt_telepool_start(struct rpt *myrpt)
+{
+struct	rpt_telepool *pool;
+pthread_attr_t attr;
+int	i;
+
+	pool = ast_calloc(1,sizeof(struct rpt_telepool));
+	if (!pool) return;
+	ast_mutex_init(&pool->lock);
+	ast_cond_init(&pool->cond,NULL);
+	pool->tail = &pool->head;
+	pthread_attr_init(&attr);
+	for(i = 0; i < RPT_TELE_WORKERS; i++)
+	{
+		if (ast_pthread_create(&pool->threads[i],&attr,rpt_tele_worker,(void *) pool)) break;
+		pool->nthreads++;
+	}
+	pthread_attr_destroy(&attr);
+	if (!pool->nthreads)
+	{
+		ast_log(LOG_WARNING,"Could not start telemetry workers for node %s\n",myrpt->name);
+		ast_cond_destroy(&pool->cond);
+		ast_mutex_destroy(&pool->lock);
+		ast_free(pool);
+		return;
+	}
+	rpt_mutex_lock(&myrpt->lock);
+	myrpt->telepool = pool;
+	rpt_mutex_unlock(&myrpt->lock);
+}
+
+static void rpt_telepool_stop(struct rpt *myrpt)
+{
+struct	rpt_telepool *pool;
+int	i;
+
+	rpt_mutex_lock(&myrpt->lock);
+	pool = myrpt->telepool;
+	myrpt->telepool = NULL;
+	rpt_mutex_unlock(&myrpt->lock);
+	if (!pool) return;
+	/* workers finish anything already handed to them first */
+	ast_mutex_lock(&pool->lock);
+	pool->shutdown = 1;
+	ast_cond_broadcast(&pool->cond);
+	ast_mutex_unlock(&pool->lock);
+	for(i = 0; i < pool->nthreads; i++) pthread_join(pool->threads[i],NULL);
+	ast_cond_destroy(&pool->cond);
+	ast_mutex_destroy(&pool->lock);
+	ast_free(pool);
+}
+
+/* hand tele to an idle worker, if there is one. must be called locked */
+static int rpt_telepool_put(struct rpt *myrpt, struct rpt_tele *tele)
+{
+struct	rpt_telepool *pool = myrpt->telepool;
+
+	if (!pool) return(0);
+	ast_mutex_lock(&pool->lock);
+	if (pool->navail <= 0)
+	{
+		ast_mutex_unlock(&pool->lock);
+		return(0);
+	}
+	pool->navail--;
+	tele->pnext = NULL;
+	*pool->tail = tele;
+	pool->tail = &tele->pnext;
+	ast_cond_signal(&pool->cond);
+	ast_mutex_unlock(&pool->lock);
+	return(1);
+}
+
+static void rpt_telemetry(struct rpt *myrpt,int mode, void *data)
+{
 struct rpt_tele *tele;
 struct rpt_link *mylink = NULL;
 int res,vmajor,vminor,i,ns;
@@ -10648,6 +12594,7 @@ struct rpt_link *l;
 	    default:
 		break;
 	}
+	rpt_manager_telem(myrpt,mode,mylink);
 	if (!myrpt->remote) /* dont do if we are a remote */
 	{
 		/* send appropriate commands to everyone on link(s) */
@@ -10866,6 +12813,11 @@ struct rpt_link *l;
 	}
 	if ((mode == REMXXX) || (mode == PAGE) || (mode == MDC1200)) tele->submode.p= data;
 	insque((struct qelem *)tele, (struct qelem *)myrpt->tele.next);
+	if (rpt_telepool_put(myrpt,tele))
+	{
+		rpt_mutex_unlock(&myrpt->lock);
+		return;
+	}
 	rpt_mutex_unlock(&myrpt->lock);
         pthread_attr_init(&attr);
         pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
@@ -10892,7 +12844,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 
 	myrpt->mydtmf = 0;
 	/* allocate a pseudo-channel thru asterisk */
-	mychannel = ast_request(DAHDI_CHANNEL_NAME,AST_FORMAT_SLINEAR,"pseudo",NULL);
+	mychannel = rpt_pseudo(myrpt);
 	if (!mychannel)
 	{
 		fprintf(stderr,"rpt:Sorry unable to obtain pseudo channel\n");
@@ -10907,7 +12859,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 	ci.confno = myrpt->conf; /* use the pseudo conference */
 	ci.confmode = DAHDI_CONF_CONF | DAHDI_CONF_TALKER | DAHDI_CONF_LISTENER;
 	/* first put the channel on the conference */
-	if (ioctl(mychannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+	if (rpt_setconf(mychannel,&ci) == -1)
 	{
 		ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 		ast_hangup(mychannel);
@@ -10915,7 +12867,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 		pthread_exit(NULL);
 	}
 	/* allocate a pseudo-channel thru asterisk */
-	genchannel = ast_request(DAHDI_CHANNEL_NAME,AST_FORMAT_SLINEAR,"pseudo",NULL);
+	genchannel = rpt_pseudo(myrpt);
 	if (!genchannel)
 	{
 		fprintf(stderr,"rpt:Sorry unable to obtain pseudo channel\n");
@@ -10931,7 +12883,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 	ci.confno = myrpt->conf;
 	ci.confmode = DAHDI_CONF_CONF | DAHDI_CONF_TALKER | DAHDI_CONF_LISTENER;
 	/* first put the channel on the conference */
-	if (ioctl(genchannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+	if (rpt_setconf(genchannel,&ci) == -1)
 	{
 		ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 		ast_hangup(mychannel);
@@ -10939,7 +12891,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 		myrpt->callmode = 0;
 		pthread_exit(NULL);
 	}
-	if (myrpt->p.tonezone && (tone_zone_set_zone(mychannel->fds[0],myrpt->p.tonezone) == -1))
+	if (rpt_settonezone(myrpt,mychannel) == -1)
 	{
 		ast_log(LOG_WARNING, "Unable to set tone zone %s\n",myrpt->p.tonezone);
 		ast_hangup(mychannel);
@@ -10947,7 +12899,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 		myrpt->callmode = 0;
 		pthread_exit(NULL);
 	}
-	if (myrpt->p.tonezone && (tone_zone_set_zone(genchannel->fds[0],myrpt->p.tonezone) == -1))
+	if (rpt_settonezone(myrpt,genchannel) == -1)
 	{
 		ast_log(LOG_WARNING, "Unable to set tone zone %s\n",myrpt->p.tonezone);
 		ast_hangup(mychannel);
@@ -10957,7 +12909,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 	}
 	/* start dialtone if patchquiet is 0. Special patch modes don't send dial tone */
 	if ((!myrpt->patchquiet) && (!myrpt->patchexten[0]) 
-		&& (tone_zone_play_tone(genchannel->fds[0],DAHDI_TONE_DIALTONE) < 0))
+		&& (rpt_playtone(myrpt,genchannel,DAHDI_TONE_DIALTONE) < 0))
 	{
 		ast_log(LOG_WARNING, "Cannot start dialtone\n");
 		ast_hangup(mychannel);
@@ -10998,7 +12950,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 		{
 			stopped = 1;
 			/* stop dial tone */
-			tone_zone_play_tone(genchannel->fds[0],-1);
+			rpt_playtone(myrpt,genchannel,-1);
 		}
 		if (myrpt->callmode == 1)
 		{
@@ -11016,7 +12968,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 			if(!congstarted){
 				congstarted = 1;
 				/* start congestion tone */
-				tone_zone_play_tone(genchannel->fds[0],DAHDI_TONE_CONGESTION);
+				rpt_playtone(myrpt,genchannel,DAHDI_TONE_CONGESTION);
 			}
 		}
 		res = ast_safe_sleep(mychannel, MSWAIT);
@@ -11034,7 +12986,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 		dialtimer += MSWAIT;
 	}
 	/* stop any tone generation */
-	tone_zone_play_tone(genchannel->fds[0],-1);
+	rpt_playtone(myrpt,genchannel,-1);
 	/* end if done */
 	if (!myrpt->callmode)
 	{
@@ -11099,7 +13051,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 	if (mychannel->pbx)
 	{
 		/* first put the channel on the conference in announce mode */
-		if (ioctl(myrpt->pchannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+		if (rpt_setconf(myrpt->pchannel,&ci) == -1)
 		{
 			ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 			ast_hangup(mychannel);
@@ -11110,7 +13062,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 		}
 		/* get its channel number */
 		res = 0;
-		if (ioctl(mychannel->fds[0],DAHDI_CHANNO,&res) == -1)
+		if (rpt_channo(mychannel,&res) == -1)
 		{
 			ast_log(LOG_WARNING, "Unable to get autopatch channel number\n");
 			ast_hangup(mychannel);
@@ -11122,7 +13074,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 		ci.confno = res;
 		ci.confmode = DAHDI_CONF_MONITOR;
 		/* put vox channel monitoring on the channel  */
-		if (ioctl(myrpt->voxchannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+		if (rpt_setconf(myrpt->voxchannel,&ci) == -1)
 		{
 			ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 			ast_hangup(mychannel);
@@ -11151,7 +13103,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 				myrpt->callmode = 4;
 				rpt_mutex_unlock(&myrpt->lock);
 				/* start congestion tone */
-				tone_zone_play_tone(genchannel->fds[0],DAHDI_TONE_CONGESTION);
+				rpt_playtone(myrpt,genchannel,DAHDI_TONE_CONGESTION);
 				rpt_mutex_lock(&myrpt->lock);
 			}
 		}
@@ -11189,7 +13141,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 	if(debug)
 		ast_log(LOG_NOTICE, "exit channel loop\n");
 	rpt_mutex_unlock(&myrpt->lock);
-	tone_zone_play_tone(genchannel->fds[0],-1);
+	rpt_playtone(myrpt,genchannel,-1);
 	if (mychannel->pbx) ast_softhangup(mychannel,AST_SOFTHANGUP_DEV);
 	ast_hangup(genchannel);
 	rpt_mutex_lock(&myrpt->lock);
@@ -11203,7 +13155,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 	ci.confmode = ((myrpt->p.duplex == 2) || (myrpt->p.duplex == 4)) ? DAHDI_CONF_CONFANNMON :
 		(DAHDI_CONF_CONF | DAHDI_CONF_LISTENER | DAHDI_CONF_TALKER);
 	/* first put the channel on the conference in announce mode */
-	if (ioctl(myrpt->pchannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+	if (rpt_setconf(myrpt->pchannel,&ci) == -1)
 	{
 		ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 	}
@@ -11429,6 +13381,7 @@ static int connect_link(struct rpt *myrpt, char* node, int mode, int perma)
 			(!strncasecmp(l->chan->name,"tlb",3)))
 		{
 			l->mode = mode;
+			myrpt->topogen++;
 			strncpy(myrpt->lastlinknode,node,MAXNODESTR - 1);
 			rpt_mutex_unlock(&myrpt->lock);
 			return 0;
@@ -11465,6 +13418,7 @@ static int connect_link(struct rpt *myrpt, char* node, int mode, int perma)
 	}
 	/* zero the silly thing */
 	memset((char *)l,0,sizeof(struct rpt_link));
+	sys_uptime(&l->connectstart);
 	l->mode = mode;
 	l->outbound = 1;
 	l->thisconnected = 0;
@@ -11548,7 +13502,7 @@ static int connect_link(struct rpt *myrpt, char* node, int mode, int perma)
 		return -1;
 	}
 	/* allocate a pseudo-channel thru asterisk */
-	l->pchan = ast_request(DAHDI_CHANNEL_NAME,AST_FORMAT_SLINEAR,"pseudo",NULL);
+	l->pchan = rpt_pseudo(myrpt);
 	if (!l->pchan){
 		ast_log(LOG_WARNING,"rpt connect: Sorry unable to obtain pseudo channel\n");
 		ast_hangup(l->chan);
@@ -11567,7 +13521,7 @@ static int connect_link(struct rpt *myrpt, char* node, int mode, int perma)
 	ci.confno = ((l->mode > 1) ? myrpt->txconf : myrpt->conf);
 	ci.confmode = DAHDI_CONF_CONF | DAHDI_CONF_LISTENER | DAHDI_CONF_TALKER;
 	/* first put the channel on the conference in proper mode */
-	if (ioctl(l->pchan->fds[0], DAHDI_SETCONF, &ci) == -1)
+	if (rpt_setconf(l->pchan,&ci) == -1)
 	{
 		ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 		ast_hangup(l->chan);
@@ -11588,6 +13542,7 @@ static int connect_link(struct rpt *myrpt, char* node, int mode, int perma)
 	if (l->isremote) l->retries = l->max_retries + 1;
 	l->rxlingertimer = ((l->iaxkey) ? RX_LINGER_TIME_IAXKEY : RX_LINGER_TIME);
 	insque((struct qelem *)l,(struct qelem *)myrpt->links.next);
+	myrpt->linksgen++;
 	__kickshort(myrpt);
 	rpt_mutex_unlock(&myrpt->lock);
 	return 0;
@@ -12138,7 +14093,7 @@ static int function_status(struct rpt *myrpt, char *param, char *digitbuf, int c
 			{
 				if (((telem->mode == ID) || (telem->mode == ID1)) && (!telem->killed))
 				{
-					if (telem->chan) ast_softhangup(telem->chan, AST_SOFTHANGUP_DEV); /* Whoosh! */
+					rpt_tele_kill(telem); /* Whoosh! */
 					telem->killed = 1;
 				}
 				telem = telem->next;
@@ -12172,7 +14127,7 @@ static int function_status(struct rpt *myrpt, char *param, char *digitbuf, int c
 			{
 				if (((telem->mode == ID) || (telem->mode == ID1)) && (!telem->killed))
 				{
-					if (telem->chan) ast_softhangup(telem->chan, AST_SOFTHANGUP_DEV); /* Whoosh! */
+					rpt_tele_kill(telem); /* Whoosh! */
 					telem->killed = 1;
 				}
 				telem = telem->next;
@@ -12900,7 +14855,7 @@ static int function_cop(struct rpt *myrpt, char *param, char *digitbuf, int comm
 				if (((telem->mode == ID) || (telem->mode == ID1) || 
 					(telem->mode == IDTALKOVER)) && (!telem->killed))
 				{
-					if (telem->chan) ast_softhangup(telem->chan, AST_SOFTHANGUP_DEV); /* Whoosh! */
+					rpt_tele_kill(telem); /* Whoosh! */
 					telem->killed = 1;
 					myrpt->deferid = 1;
 				}
@@ -13073,7 +15028,11 @@ struct	ast_frame wf;
 	if (tmp[0] == 'L')
 	{
 		rpt_mutex_lock(&myrpt->lock);
-		strcpy(mylink->linklist,tmp + 2);
+		if (strcmp(mylink->linklist,tmp + 2))
+		{
+			strcpy(mylink->linklist,tmp + 2);
+			myrpt->topogen++;
+		}
 		time(&mylink->linklistreceived);
 		rpt_mutex_unlock(&myrpt->lock);
 		if (debug > 6) ast_log(LOG_NOTICE,"@@@@ node %s recieved node list %s from node %s\n",
@@ -18449,6 +20408,7 @@ static int attempt_reconnect(struct rpt *myrpt, struct rpt_link *l)
 	rpt_mutex_lock(&myrpt->lock);
 	/* remove from queue */
 	remque((struct qelem *) l);
+	myrpt->linksgen++;
 	rpt_mutex_unlock(&myrpt->lock);
 	s = tmp;
 	s1 = strsep(&s,",");
@@ -18469,6 +20429,7 @@ static int attempt_reconnect(struct rpt *myrpt, struct rpt_link *l)
 	*tele++ = 0;
 	l->elaptime = 0;
 	l->connecttime = 0;
+	sys_uptime(&l->connectstart);
 	l->thisconnected = 0;
 	l->iaxkey = 0;
 	l->newkey = 0;
@@ -18512,6 +20473,7 @@ static int attempt_reconnect(struct rpt *myrpt, struct rpt_link *l)
 	rpt_mutex_lock(&myrpt->lock);
 	/* put back in queue */
 	insque((struct qelem *)l,(struct qelem *)myrpt->links.next);
+	myrpt->linksgen++;
 	rpt_mutex_unlock(&myrpt->lock);
 	ast_log(LOG_WARNING,"Reconnect Attempt to %s in process\n",l->name);
 	return 0;
@@ -18949,11 +20911,15 @@ unsigned int u;
 FILE *fp;
 struct stat mystat;
 struct ast_channel *who;
+struct ast_channel *cs[RPT_MAXCHANS * 2];
+int ncs = 0;
+unsigned int csgen = 0;
+struct ast_waiter *waiter = NULL;
 struct dahdi_confinfo ci;  /* conference info */
 time_t	t,was;
 struct rpt_link *l,*m;
 struct rpt_tele *telem;
-char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
+char tmpstr[300],lat[100],lon[100],elev[100];
 
 
 	if (myrpt->p.archivedir) mkdir(myrpt->p.archivedir,0600);
@@ -18967,7 +20933,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 	telem = myrpt->tele.next;
 	while(telem != &myrpt->tele)
 	{
-		ast_softhangup(telem->chan,AST_SOFTHANGUP_DEV);
+		rpt_tele_kill(telem);
 		telem = telem->next;
 	}
 	rpt_mutex_unlock(&myrpt->lock);
@@ -19124,8 +21090,9 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 		ast_indicate(myrpt->txchannel,AST_CONTROL_RADIO_KEY);
 		ast_indicate(myrpt->txchannel,AST_CONTROL_RADIO_UNKEY);
 	}
+	rpt_mixer_select(myrpt);
 	/* allocate a pseudo-channel thru asterisk */
-	myrpt->pchannel = ast_request(DAHDI_CHANNEL_NAME,AST_FORMAT_SLINEAR,"pseudo",NULL);
+	myrpt->pchannel = rpt_pseudo(myrpt);
 	if (!myrpt->pchannel)
 	{
 		fprintf(stderr,"rpt:Sorry unable to obtain pseudo channel\n");
@@ -19147,7 +21114,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 	if (!myrpt->zaptxchannel)
 	{
 		/* allocate a pseudo-channel thru asterisk */
-		myrpt->zaptxchannel = ast_request(DAHDI_CHANNEL_NAME,AST_FORMAT_SLINEAR,"pseudo",NULL);
+		myrpt->zaptxchannel = rpt_pseudo(myrpt);
 		if (!myrpt->zaptxchannel)
 		{
 			fprintf(stderr,"rpt:Sorry unable to obtain pseudo channel\n");
@@ -19167,7 +21134,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 		ast_answer(myrpt->zaptxchannel);
 	}
 	/* allocate a pseudo-channel thru asterisk */
-	myrpt->monchannel = ast_request(DAHDI_CHANNEL_NAME,AST_FORMAT_SLINEAR,"pseudo",NULL);
+	myrpt->monchannel = rpt_pseudo(myrpt);
 	if (!myrpt->monchannel)
 	{
 		fprintf(stderr,"rpt:Sorry unable to obtain pseudo channel\n");
@@ -19190,7 +21157,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 	ci.confno = -1; /* make a new conf */
 	ci.confmode = DAHDI_CONF_CONF | DAHDI_CONF_LISTENER;
 	/* first put the channel on the conference in proper mode */
-	if (ioctl(myrpt->zaptxchannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+	if (rpt_setconf(myrpt->zaptxchannel,&ci) == -1)
 	{
 		ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 		rpt_mutex_unlock(&myrpt->lock);
@@ -19210,7 +21177,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 	ci.confmode = ((myrpt->p.duplex == 2) || (myrpt->p.duplex == 4)) ? DAHDI_CONF_CONFANNMON :
 		(DAHDI_CONF_CONF | DAHDI_CONF_LISTENER | DAHDI_CONF_TALKER);
 	/* first put the channel on the conference in announce mode */
-	if (ioctl(myrpt->pchannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+	if (rpt_setconf(myrpt->pchannel,&ci) == -1)
 	{
 		ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 		rpt_mutex_unlock(&myrpt->lock);
@@ -19230,7 +21197,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 		(myrpt->zaptxchannel == myrpt->txchannel))
 	{
 		/* get tx channel's port number */
-		if (ioctl(myrpt->txchannel->fds[0],DAHDI_CHANNO,&ci.confno) == -1)
+		if (rpt_channo(myrpt->txchannel,&ci.confno) == -1)
 		{
 			ast_log(LOG_WARNING, "Unable to set tx channel's chan number\n");
 			rpt_mutex_unlock(&myrpt->lock);
@@ -19251,7 +21218,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 		ci.confmode = DAHDI_CONF_CONFANNMON;
 	}
 	/* first put the channel on the conference in announce mode */
-	if (ioctl(myrpt->monchannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+	if (rpt_setconf(myrpt->monchannel,&ci) == -1)
 	{
 		ast_log(LOG_WARNING, "Unable to set conference mode for monitor\n");
 		rpt_mutex_unlock(&myrpt->lock);
@@ -19264,7 +21231,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 		pthread_exit(NULL);
 	}
 	/* allocate a pseudo-channel thru asterisk */
-	myrpt->parrotchannel = ast_request(DAHDI_CHANNEL_NAME,AST_FORMAT_SLINEAR,"pseudo",NULL);
+	myrpt->parrotchannel = rpt_pseudo(myrpt);
 	if (!myrpt->parrotchannel)
 	{
 		fprintf(stderr,"rpt:Sorry unable to obtain pseudo channel\n");
@@ -19283,7 +21250,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 #endif
 	ast_answer(myrpt->parrotchannel);
 	/* allocate a pseudo-channel thru asterisk */
-	myrpt->voxchannel = ast_request(DAHDI_CHANNEL_NAME,AST_FORMAT_SLINEAR,"pseudo",NULL);
+	myrpt->voxchannel = rpt_pseudo(myrpt);
 	if (!myrpt->voxchannel)
 	{
 		fprintf(stderr,"rpt:Sorry unable to obtain pseudo channel\n");
@@ -19302,7 +21269,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 #endif
 	ast_answer(myrpt->voxchannel);
 	/* allocate a pseudo-channel thru asterisk */
-	myrpt->txpchannel = ast_request(DAHDI_CHANNEL_NAME,AST_FORMAT_SLINEAR,"pseudo",NULL);
+	myrpt->txpchannel = rpt_pseudo(myrpt);
 	if (!myrpt->txpchannel)
 	{
 		fprintf(stderr,"rpt:Sorry unable to obtain pseudo channel\n");
@@ -19325,7 +21292,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 	ci.confno = myrpt->txconf;
 	ci.confmode = DAHDI_CONF_CONF | DAHDI_CONF_TALKER ;
  	/* first put the channel on the conference in proper mode */
-	if (ioctl(myrpt->txpchannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+	if (rpt_setconf(myrpt->txpchannel,&ci) == -1)
 	{
 		ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 		rpt_mutex_unlock(&myrpt->lock);
@@ -19420,6 +21387,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 	if (myrpt->p.archivedir) donodelog(myrpt,"STARTUP");
 	dtmfed = 0;
 	if (myrpt->remoterig && !ISRIG_RTX(myrpt->remoterig)) setrem(myrpt);
+	rpt_telepool_start(myrpt);
 	/* wait for telem to be done */
 	while((ms >= 0) && (myrpt->tele.next != &myrpt->tele))
 		if (ast_safe_sleep(myrpt->rxchannel,50) == -1) ms = -1;
@@ -19435,8 +21403,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 	myrpt->ready = 1;	
 	while (ms >= 0)
 	{
-		struct ast_frame *f,*f1,*f2;
-		struct ast_channel *cs[300],*cs1[300];
+		struct ast_frame *f,*f1;
 		int totx=0,elap=0,n,x,toexit=0;
 
 		/* DEBUG Dump */
@@ -19513,7 +21480,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 			telem = myrpt->tele.next;
 			while(telem != &myrpt->tele)
 			{
-				ast_softhangup(telem->chan,AST_SOFTHANGUP_DEV);
+				rpt_tele_kill(telem);
 				telem = telem->next;
 			}
 			myrpt->reload = 0;
@@ -19770,12 +21737,12 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 			telem = myrpt->tele.next;
 			while(telem != &myrpt->tele){
 				if(telem->mode == ID && !telem->killed){
-					if (telem->chan) ast_softhangup(telem->chan, AST_SOFTHANGUP_DEV); /* Whoosh! */
+					rpt_tele_kill(telem); /* Whoosh! */
 					telem->killed = 1;
 					hasid = 1;
 				}
 				if(telem->mode == TAILMSG && !telem->killed){
-                                        if (telem->chan) ast_softhangup(telem->chan, AST_SOFTHANGUP_DEV); /* Whoosh! */
+                                        rpt_tele_kill(telem); /* Whoosh! */
 					telem->killed = 1;
                                 }
 				if (telem->mode == IDTALKOVER) hastalkover = 1;
@@ -19924,7 +21891,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 			ci.chan = 0;
 
 			/* first put the channel on the conference in announce mode */
-			if (ioctl(myrpt->parrotchannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+			if (rpt_setconf(myrpt->parrotchannel,&ci) == -1)
 			{
 				ast_log(LOG_WARNING, "Unable to set conference mode for parrot\n");
 				ast_mutex_unlock(&myrpt->lock);
@@ -19965,6 +21932,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 			{
 				/* remove from queue */
 				remque((struct qelem *) l);
+				myrpt->linksgen++;
 				if (!strcmp(myrpt->cmdnode,l->name))
 					myrpt->cmdnode[0] = 0;
 				rpt_mutex_unlock(&myrpt->lock);
@@ -20005,25 +21973,55 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 				}
 			}
 		}
-		n = 0;
-		cs[n++] = myrpt->rxchannel;
-		cs[n++] = myrpt->pchannel;
-		cs[n++] = myrpt->monchannel;
-		if (myrpt->parrotchannel) cs[n++] = myrpt->parrotchannel;
-		if (myrpt->voxchannel) cs[n++] = myrpt->voxchannel;
-		cs[n++] = myrpt->txpchannel;
-		if (myrpt->txchannel != myrpt->rxchannel) cs[n++] = myrpt->txchannel;
-		if (myrpt->zaptxchannel != myrpt->txchannel)
-			cs[n++] = myrpt->zaptxchannel;
-		l = myrpt->links.next;
-		while(l != &myrpt->links)
-		{
-			if ((!l->killme) && (!l->disctime) && l->chan)
+		/* the channel set only changes when links come and go, so it
+		   and the waiter are rebuilt only then. It is kept twice over
+		   so the ast_waitfor_n() fallback's round-robin start is just
+		   an offset */
+		if ((!ncs) || (csgen != myrpt->linksgen))
+		{
+			csgen = myrpt->linksgen;
+			ncs = 0;
+			cs[ncs++] = myrpt->rxchannel;
+			cs[ncs++] = myrpt->pchannel;
+			cs[ncs++] = myrpt->monchannel;
+			if (myrpt->parrotchannel) cs[ncs++] = myrpt->parrotchannel;
+			if (myrpt->voxchannel) cs[ncs++] = myrpt->voxchannel;
+			cs[ncs++] = myrpt->txpchannel;
+			if (myrpt->txchannel != myrpt->rxchannel) cs[ncs++] = myrpt->txchannel;
+			if (myrpt->zaptxchannel != myrpt->txchannel)
+				cs[ncs++] = myrpt->zaptxchannel;
+			l = myrpt->links.next;
+			while(l != &myrpt->links)
 			{
-				cs[n++] = l->chan;
-				cs[n++] = l->pchan;
+				if ((!l->killme) && (!l->disctime) && l->chan)
+				{
+					if (ncs > (RPT_MAXCHANS - 2))
+					{
+						ast_log(LOG_WARNING,"Too many links on node %s, not servicing %s\n",
+							myrpt->name,l->name);
+						break;
+					}
+					cs[ncs++] = l->chan;
+					cs[ncs++] = l->pchan;
+				}
+				l = l->next;
+			}
+			memcpy(cs + ncs,cs,ncs * sizeof(cs[0]));
+			/* start the waiter over rather than work out who left: a
+			   channel that has been freed has already dropped out */
+			ast_waiter_destroy(waiter);
+			if ((waiter = ast_waiter_new()))
+			{
+				for(i = 0; i < ncs; i++)
+				{
+					if (ast_waiter_add(waiter,cs[i])) break;
+				}
+				if (i < ncs)
+				{
+					ast_waiter_destroy(waiter);
+					waiter = NULL;
+				}
 			}
-			l = l->next;
 		}
 		if ((myrpt->topkeystate == 1) && 
 		    ((t - myrpt->topkeytime) > TOPKEYWAIT))
@@ -20040,14 +22038,21 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 			rpt_telemetry(myrpt,TOPKEY,NULL);
 			myrpt->topkeystate = 3;
 		}
+#ifndef	OLD_ASTERISK
+		if (ast_tvdiff_ms(ast_tvnow(),myrpt->statustv) >= RPT_STATUS_INTERVAL)
+		{
+			myrpt->statustv = ast_tvnow();
+			rpt_status_update(myrpt);
+		}
+#endif
 		ms = MSWAIT;
-		for(x = 0; x < n; x++)
+		if (waiter)
+			who = ast_waiter_wait(waiter,NULL,NULL,&ms);
+		else
 		{
-			int s = -(-x - myrpt->scram - 1) % n;
-			cs1[x] = cs[s];
+			x = (++myrpt->scram) % ncs;
+			who = ast_waitfor_n(cs + x,ncs,&ms);
 		}
-		myrpt->scram++;
-		who = ast_waitfor_n(cs1,n,&ms);
 		if (who == NULL) ms = 0;
 		elap = MSWAIT - ms;
 		/* @@@@@@ LOCK @@@@@@@ */
@@ -20153,16 +22158,23 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 				lf.mallocd = 0;
 				lf.samples = 0;
 				l->linklisttimer = LINKLISTTIME;
-				strcpy(lstr,"L ");
-				__mklinklist(myrpt,l,lstr + 2,0);
+				/* only rebuild it if something changed since last time */
+				if ((!l->linklistsent[0]) || (l->linklistgen != myrpt->topogen) ||
+				    (l->linklistlinks != myrpt->linksgen))
+				{
+					strcpy(l->linklistsent,"L ");
+					__mklinklist(myrpt,l,l->linklistsent + 2,0);
+					l->linklistgen = myrpt->topogen;
+					l->linklistlinks = myrpt->linksgen;
+				}
 				if (l->chan)
 				{
-					lf.datalen = strlen(lstr) + 1;
-					AST_FRAME_DATA(lf) = lstr;
+					lf.datalen = strlen(l->linklistsent) + 1;
+					AST_FRAME_DATA(lf) = l->linklistsent;
 					rpt_qwrite(l,&lf);
 					if (debug > 6) ast_log(LOG_NOTICE,
 						"@@@@ node %s sent node string %s to node %s\n",
-							myrpt->name,lstr,l->name);
+							myrpt->name,l->linklistsent,l->name);
 				}
 			}
 			if (l->newkey == 1)
@@ -20203,7 +22215,10 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 			{
 				l->disctime -= elap;
 				if (l->disctime <= 0) /* Disconnect timer expired on inbound channel ? */
+				{
 					l->disctime = 0; /* Yep */
+					myrpt->linksgen++;
+				}
 			}
 
 			if (l->retrytimer)
@@ -20238,6 +22253,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 			{
 				if (l->chan) ast_hangup(l->chan);
 				l->chan = 0;
+				myrpt->linksgen++;
 				rpt_mutex_unlock(&myrpt->lock);
 				if ((l->name[0] > '0') && (l->name[0] <= '9') && (!l->isremote))
 				{
@@ -20259,6 +22275,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 			{
 				/* remove from queue */
 				remque((struct qelem *) l);
+				myrpt->linksgen++;
 				if (!strcmp(myrpt->cmdnode,l->name))
 					myrpt->cmdnode[0] = 0;
 				rpt_mutex_unlock(&myrpt->lock);
@@ -20269,6 +22286,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 					else rpt_telemetry(myrpt,REMDISC,l);
 				}
 				if (l->hasconnected) rpt_update_links(myrpt);
+				rpt_manager_link(myrpt,l,(l->hasconnected) ? "Disconnected" : "Failed");
 				if (myrpt->p.archivedir)
 				{
 					char str[100];
@@ -20292,6 +22310,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 		if(debug) ast_log(LOG_NOTICE, "LINKDISC AA\n");
                 /* remove from queue */
                 remque((struct qelem *) l);
+		myrpt->linksgen++;
 		if (myrpt->links.next==&myrpt->links) channel_revert(myrpt);
                 if (!strcmp(myrpt->cmdnode,l->name))myrpt->cmdnode[0] = 0;
                 rpt_mutex_unlock(&myrpt->lock);
@@ -20300,6 +22319,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 	            	rpt_telemetry(myrpt,REMDISC,l);
 		}
 		rpt_update_links(myrpt);
+		rpt_manager_link(myrpt,l,"Disconnected");
 		if (myrpt->p.archivedir)
 		{
 			char str[100];
@@ -20474,7 +22494,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 			ci.chan = 0;
 
 			/* first put the channel on the conference in announce mode */
-			if (ioctl(myrpt->parrotchannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+			if (rpt_setconf(myrpt->parrotchannel,&ci) == -1)
 			{
 				ast_log(LOG_WARNING, "Unable to set conference mode for parrot\n");
 				break;
@@ -20686,22 +22706,12 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 				if (ismuted)
 				{
 					memset(AST_FRAME_DATAP(f),0,f->datalen);
-					if (myrpt->lastf1)
-						memset(AST_FRAME_DATAP(myrpt->lastf1),0,myrpt->lastf1->datalen);
-					if (myrpt->lastf2)
-						memset(AST_FRAME_DATAP(myrpt->lastf2),0,myrpt->lastf2->datalen);
+					rpt_framering_mute(&myrpt->lastf);
 				} 
-				if (f) f2 = ast_frdup(f);
-				else f2 = NULL;
-				f1 = myrpt->lastf2;
-				myrpt->lastf2 = myrpt->lastf1;
-				myrpt->lastf1 = f2;
+				f1 = rpt_framering_put(&myrpt->lastf,f);
 				if (ismuted)
 				{
-					if (myrpt->lastf1)
-						memset(AST_FRAME_DATAP(myrpt->lastf1),0,myrpt->lastf1->datalen);
-					if (myrpt->lastf2)
-						memset(AST_FRAME_DATAP(myrpt->lastf2),0,myrpt->lastf2->datalen);
+					rpt_framering_mute(&myrpt->lastf);
 				}
 				if (f1)
 				{
@@ -20709,7 +22719,6 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 						ast_write(myrpt->txpchannel,f1);
 					else
 						ast_write(myrpt->pchannel,f1);
-					ast_frfree(f1);
 					if ((myrpt->p.duplex < 2) && myrpt->monstream &&
 					    (!myrpt->txkeyed) && myrpt->keyed)
 					{
@@ -20726,10 +22735,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 #ifndef	OLD_ASTERISK
 			else if (f->frametype == AST_FRAME_DTMF_BEGIN)
 			{
-				if (myrpt->lastf1)
-					memset(AST_FRAME_DATAP(myrpt->lastf1),0,myrpt->lastf1->datalen);
-				if (myrpt->lastf2)
-					memset(AST_FRAME_DATAP(myrpt->lastf2),0,myrpt->lastf2->datalen);
+				rpt_framering_mute(&myrpt->lastf);
 				dtmfed = 1;
 				myrpt->lastdtmftime = ast_tvnow();
 			}
@@ -20757,10 +22763,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 					continue;
 				}			
 #endif
-				if (myrpt->lastf1)
-					memset(AST_FRAME_DATAP(myrpt->lastf1),0,myrpt->lastf1->datalen);
-				if (myrpt->lastf2)
-					memset(AST_FRAME_DATAP(myrpt->lastf2),0,myrpt->lastf2->datalen);
+				rpt_framering_mute(&myrpt->lastf);
 				dtmfed = 1;
 				if ((!myrpt->lastkeytimer) && (!myrpt->localoverride)) 
 				{
@@ -20821,6 +22824,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 						donodelog(myrpt,"RXKEY,MAIN");
 					}
 					rpt_update_boolean(myrpt,"RPT_RXKEYED",1);
+					rpt_manager_key(myrpt,1);
 					myrpt->elketimer = 0;
 					myrpt->localoverride = 0;
 					if (f->datalen && AST_FRAME_DATAP(f))
@@ -20923,6 +22927,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 						donodelog(myrpt,"RXUNKEY,MAIN");
 					}
 					rpt_update_boolean(myrpt,"RPT_RXKEYED",0);
+					rpt_manager_key(myrpt,0);
 				}
 			}
 			else if (f->frametype == AST_FRAME_TEXT) /* if a message from a USB device */
@@ -21214,6 +23219,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 							rpt_mutex_lock(&myrpt->lock);
 							ast_hangup(l->chan);
 							l->chan = 0;
+							myrpt->linksgen++;
 							break;
 						}
 	
@@ -21221,6 +23227,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 						{
 							ast_hangup(l->chan);
 							l->chan = 0;
+							myrpt->linksgen++;
 							rpt_mutex_lock(&myrpt->lock);
 							break; 
 						}
@@ -21229,10 +23236,12 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 							rpt_mutex_lock(&myrpt->lock);
 							if (l->chan) ast_hangup(l->chan);
 							l->chan = 0;
+							myrpt->linksgen++;
 							l->hasconnected = 1;
 							l->retrytimer = RETRY_TIMER_MS;
 							l->elaptime = 0;
 							l->connecttime = 0;
+							sys_uptime(&l->connectstart);
 							l->thisconnected = 0;
 							break;
 						}
@@ -21240,6 +23249,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 					rpt_mutex_lock(&myrpt->lock);
 					/* remove from queue */
 					remque((struct qelem *) l);
+					myrpt->linksgen++;
 					if (!strcmp(myrpt->cmdnode,l->name))
 						myrpt->cmdnode[0] = 0;
 					__kickshort(myrpt);
@@ -21248,6 +23258,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 						rpt_telemetry(myrpt,CONNFAIL,l);
 					else if (l->disced != 2) rpt_telemetry(myrpt,REMDISC,l);
 					if (l->hasconnected) rpt_update_links(myrpt);
+					rpt_manager_link(myrpt,l,(l->hasconnected) ? "Disconnected" : "Failed");
 					if (myrpt->p.archivedir)
 					{
 						char str[100];
@@ -21259,10 +23270,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 						donodelog(myrpt,str);
 					}
 					dodispgm(myrpt,l->name);
-					if (l->lastf1) ast_frfree(l->lastf1);
-					l->lastf1 = NULL;
-					if (l->lastf2) ast_frfree(l->lastf2);
-					l->lastf2 = NULL;
+					rpt_framering_flush(&l->lastf);
 					/* hang-up on call to device */
 					ast_hangup(l->chan);
 					ast_hangup(l->pchan);
@@ -21398,27 +23406,16 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 						if (ismuted)
 						{
 							memset(AST_FRAME_DATAP(f),0,f->datalen);
-							if (l->lastf1)
-								memset(AST_FRAME_DATAP(l->lastf1),0,l->lastf1->datalen);
-							if (l->lastf2)
-								memset(AST_FRAME_DATAP(l->lastf2),0,l->lastf2->datalen);
+							rpt_framering_mute(&l->lastf);
 						} 
-						if (f) f2 = ast_frdup(f);
-						else f2 = NULL;
-						f1 = l->lastf2;
-						l->lastf2 = l->lastf1;
-						l->lastf1 = f2;
+						f1 = rpt_framering_put(&l->lastf,f);
 						if (ismuted)
 						{
-							if (l->lastf1)
-								memset(AST_FRAME_DATAP(l->lastf1),0,l->lastf1->datalen);
-							if (l->lastf2)
-								memset(AST_FRAME_DATAP(l->lastf2),0,l->lastf2->datalen);
+							rpt_framering_mute(&l->lastf);
 						}
 						if (f1)
 						{
 							ast_write(l->pchan,f1);
-							ast_frfree(f1);
 						}
 					}
 					else
@@ -21431,10 +23428,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 #ifndef	OLD_ASTERISK
 				else if (f->frametype == AST_FRAME_DTMF_BEGIN)
 				{
-					if (l->lastf1)
-						memset(AST_FRAME_DATAP(l->lastf1),0,l->lastf1->datalen);
-					if (l->lastf2)
-						memset(AST_FRAME_DATAP(l->lastf2),0,l->lastf2->datalen);
+					rpt_framering_mute(&l->lastf);
 					l->dtmfed = 1;
 				}
 #endif
@@ -21451,10 +23445,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 				}
 				if (f->frametype == AST_FRAME_DTMF)
 				{
-					if (l->lastf1)
-						memset(AST_FRAME_DATAP(l->lastf1),0,l->lastf1->datalen);
-					if (l->lastf2)
-						memset(AST_FRAME_DATAP(l->lastf2),0,l->lastf2->datalen);
+					rpt_framering_mute(&l->lastf);
 					l->dtmfed = 1;
 					handle_link_phone_dtmf(myrpt,l,f->subclass);
 				}
@@ -21487,6 +23478,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 									sprintf(str,"LINKMONITOR,%s",l->name);
 								donodelog(myrpt,str);
 							}
+							rpt_manager_link(myrpt,l,NULL);
 							rpt_update_links(myrpt);
 							doconpgm(myrpt,l->name);
 						}		
@@ -21554,12 +23546,14 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 								rpt_mutex_lock(&myrpt->lock);
 								ast_hangup(l->chan);
 								l->chan = 0;
+								myrpt->linksgen++;
 								break;
 							}
 							if (l->retrytimer) 
 							{
 								if (l->chan) ast_hangup(l->chan);
 								l->chan = 0;
+								myrpt->linksgen++;
 								rpt_mutex_lock(&myrpt->lock);
 								break;
 							}
@@ -21568,10 +23562,12 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 								rpt_mutex_lock(&myrpt->lock);
 								if (l->chan) ast_hangup(l->chan);
 								l->chan = 0;
+								myrpt->linksgen++;
 								l->hasconnected = 1;
 								l->elaptime = 0;
 								l->retrytimer = RETRY_TIMER_MS;
 								l->connecttime = 0;
+								sys_uptime(&l->connectstart);
 								l->thisconnected = 0;
 								break;
 							}
@@ -21579,6 +23575,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 						rpt_mutex_lock(&myrpt->lock);
 						/* remove from queue */
 						remque((struct qelem *) l);
+						myrpt->linksgen++;
 						if (!strcmp(myrpt->cmdnode,l->name))
 							myrpt->cmdnode[0] = 0;
 						__kickshort(myrpt);
@@ -21587,6 +23584,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 							rpt_telemetry(myrpt,CONNFAIL,l);
 						else if (l->disced != 2) rpt_telemetry(myrpt,REMDISC,l);
 						if (l->hasconnected) rpt_update_links(myrpt);
+						rpt_manager_link(myrpt,l,(l->hasconnected) ? "Disconnected" : "Failed");
 						if (myrpt->p.archivedir)
 						{
 							char str[100];
@@ -21598,10 +23596,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 							donodelog(myrpt,str);
 						}
 						if (l->hasconnected) dodispgm(myrpt,l->name);
-						if (l->lastf1) ast_frfree(l->lastf1);
-						l->lastf1 = NULL;
-						if (l->lastf2) ast_frfree(l->lastf2);
-						l->lastf2 = NULL;
+						rpt_framering_flush(&l->lastf);
 						/* hang-up on call to device */
 						ast_hangup(l->chan);
 						ast_hangup(l->pchan);
@@ -21841,9 +23836,11 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 		}
 	}
 	myrpt->ready = 0;
+	ast_waiter_destroy(waiter);
 	usleep(100000);
 	/* wait for telem to be done */
 	while(myrpt->tele.next != &myrpt->tele) usleep(50000);
+	rpt_telepool_stop(myrpt);
 	ast_hangup(myrpt->pchannel);
 	ast_hangup(myrpt->monchannel);
 	if (myrpt->parrotchannel) ast_hangup(myrpt->parrotchannel);
@@ -21852,10 +23849,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 	ast_hangup(myrpt->txpchannel);
 	if (myrpt->txchannel != myrpt->rxchannel) ast_hangup(myrpt->txchannel);
 	if (myrpt->zaptxchannel != myrpt->txchannel) ast_hangup(myrpt->zaptxchannel);
-	if (myrpt->lastf1) ast_frfree(myrpt->lastf1);
-	myrpt->lastf1 = NULL;
-	if (myrpt->lastf2) ast_frfree(myrpt->lastf2);
-	myrpt->lastf2 = NULL;
+	rpt_framering_flush(&myrpt->lastf);
 	ast_hangup(myrpt->rxchannel);
 	rpt_mutex_lock(&myrpt->lock);
 	l = myrpt->links.next;
@@ -21864,6 +23858,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 		struct rpt_link *ll = l;
 		/* remove from queue */
 		remque((struct qelem *) l);
+		myrpt->linksgen++;
 		/* hang-up on call to device */
 		if (l->chan) ast_hangup(l->chan);
 		ast_hangup(l->pchan);
@@ -21890,6 +23885,12 @@ char *this,*val;
 
 	/* init nodelog queue */
 	nodelog.next = nodelog.prev = &nodelog;
+	ast_cond_init(&nodelog_cond,NULL);
+	if (ast_pthread_create(&rpt_nodelog_writer,NULL,rpt_nodelog_thread,NULL))
+	{
+		ast_log(LOG_ERROR,"Cannot start node log writer\n");
+		rpt_nodelog_writer = AST_PTHREADT_NULL;
+	}
 	/* go thru all the specified repeaters */
 	this = NULL;
 	n = 0;
@@ -21948,6 +23949,7 @@ char *this,*val;
 		ast_mutex_init(&rpt_vars[n].lock);
 		ast_mutex_init(&rpt_vars[n].remlock);
 		ast_mutex_init(&rpt_vars[n].statpost_lock);
+		ast_mutex_init(&rpt_vars[n].status_lock);
 		rpt_vars[n].tele.next = &rpt_vars[n].tele;
 		rpt_vars[n].tele.prev = &rpt_vars[n].tele;
 		rpt_vars[n].rpt_thread = AST_PTHREADT_NULL;
@@ -22071,46 +24073,6 @@ char *this,*val;
 			rpt_vars[i].outstreampid = 0;
 			startoutstream(&rpt_vars[i]);
 		}			
-		for(;;)
-		{
-			struct nodelog *nodep;
-			char *space,datestr[100],fname[300];
-			int fd;
-
-			ast_mutex_lock(&nodeloglock);
-			nodep = nodelog.next;
-			if(nodep == &nodelog) /* if nothing in queue */
-			{
-				ast_mutex_unlock(&nodeloglock);
-				break;
-			}
-			remque((struct qelem *)nodep);
-			ast_mutex_unlock(&nodeloglock);
-			space = strchr(nodep->str,' ');
-			if (!space) 
-			{
-				ast_free(nodep);
-				continue;
-			}
-			*space = 0;
-			strftime(datestr,sizeof(datestr) - 1,"%Y%m%d", localtime(&nodep->timestamp));
-			sprintf(fname,"%s/%s/%s.txt",nodep->archivedir, nodep->str,datestr);
-			fd = open(fname,O_WRONLY | O_CREAT | O_APPEND,0600);
-			if (fd == -1)
-			{
-				ast_log(LOG_ERROR,"Cannot open node log file %s for write",space + 1);
-				ast_free(nodep);
-				continue;
-			}
-			if (write(fd,space + 1,strlen(space + 1)) != strlen(space + 1))
-			{
-				ast_log(LOG_ERROR,"Cannot write node log file %s for write",space + 1);
-				ast_free(nodep);
-				continue;
-			}
-			close(fd);
-			ast_free(nodep);
-		}
 		ast_mutex_unlock(&rpt_master_lock);
 		usleep(2000000);
 		ast_mutex_lock(&rpt_master_lock);
@@ -22132,7 +24094,7 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 	char *options,*stringp,*callstr,*tele,c,*altp,*memp;
 	char sx[320],*sy,myfirst,*b,*b1;
 	struct	rpt *myrpt;
-	struct ast_frame *f,*f1,*f2;
+	struct ast_frame *f,*f1;
 	struct ast_channel *who;
 	struct ast_channel *cs[20];
 	struct	rpt_link *l;
@@ -22204,7 +24166,7 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 	if (myrpt == NULL)
 	{
 		char *val,*myadr,*mypfx,sx[320],*sy,*s,*s1,*s2,*s3,dstr[100];
-		char xstr[100],hisip[100],nodeip[100],tmp1[100];
+		char xstr[100],hisip[100],nodeip[100],tmp1[100],fwdstr[MAXNODESTR];
 		struct ast_config *cfg;
 	        struct ast_hostent ahp;
 	        struct hostent *hp;
@@ -22226,7 +24188,7 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 			{
 				if (b1 && myadr) 
 				{
-					val = forward_node_lookup(myrpt,b1,cfg);
+					val = forward_node_lookup(b1,cfg,fwdstr,sizeof(fwdstr));
 					strncpy(xstr,val,sizeof(xstr) - 1);
 					s = xstr;
 					s1 = strsep(&s,",");
@@ -22246,13 +24208,13 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 					}
 					val = NULL;
 					if (!strcmp(s2,myadr))
-						val = forward_node_lookup(myrpt,tmp,cfg);
+						val = forward_node_lookup(tmp,cfg,fwdstr,sizeof(fwdstr));
 				}
 
 			}
 			else
 			{
-				val = forward_node_lookup(myrpt,tmp,cfg);
+				val = forward_node_lookup(tmp,cfg,fwdstr,sizeof(fwdstr));
 			}
 		}
 		if (b1 && val && myadr && cfg)
@@ -22283,7 +24245,7 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 					return -1;
 				}
 				/* look for his reported node string */
-				val = forward_node_lookup(myrpt,b1,cfg);
+				val = forward_node_lookup(b1,cfg,fwdstr,sizeof(fwdstr));
 				if (!val)
 				{
 					ast_log(LOG_WARNING, "Reported node %s cannot be found!!\n",b1);
@@ -22827,6 +24789,7 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 			if (l != &myrpt->links) 
 			{
 				l->killme = 1;
+				myrpt->linksgen++;
 				l->retries = l->max_retries + 1;
 				l->disced = 2;
 				reconnects = l->reconnects;
@@ -22845,6 +24808,7 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 		}
 		/* zero the silly thing */
 		memset((char *)l,0,sizeof(struct rpt_link));
+		sys_uptime(&l->connectstart);
 		l->mode = 1;
 		strncpy(l->name,b1,MAXNODESTR - 1);
 		l->isremote = 0;
@@ -22856,8 +24820,7 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 		l->phonemode = phone_mode;
 		l->phonevox = phone_vox;
 		l->phonemonitor = phone_monitor;
-		l->lastf1 = NULL;
-		l->lastf2 = NULL;
+		rpt_framering_flush(&l->lastf);
 		l->dtmfed = 0;
 		l->gott = 0;
 		l->rxlingertimer = ((l->iaxkey) ? RX_LINGER_TIME_IAXKEY : RX_LINGER_TIME);
@@ -22879,7 +24842,7 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 		ast_set_write_format(l->chan,AST_FORMAT_SLINEAR);
 		gettimeofday(&myrpt->lastlinktime,NULL);
 		/* allocate a pseudo-channel thru asterisk */
-		l->pchan = ast_request(DAHDI_CHANNEL_NAME,AST_FORMAT_SLINEAR,"pseudo",NULL);
+		l->pchan = rpt_pseudo(myrpt);
 		if (!l->pchan)
 		{
 			fprintf(stderr,"rpt:Sorry unable to obtain pseudo channel\n");
@@ -22897,7 +24860,7 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 		ci.confno = myrpt->conf;
 		ci.confmode = DAHDI_CONF_CONF | DAHDI_CONF_LISTENER | DAHDI_CONF_TALKER;
 		/* first put the channel on the conference in proper mode */
-		if (ioctl(l->pchan->fds[0],DAHDI_SETCONF,&ci) == -1)
+		if (rpt_setconf(l->pchan,&ci) == -1)
 		{
 			ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 			pthread_exit(NULL);
@@ -22907,6 +24870,7 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 		l->max_retries = MAX_RETRIES;
 		/* insert at end of queue */
 		insque((struct qelem *)l,(struct qelem *)myrpt->links.next);
+		myrpt->linksgen++;
 		__kickshort(myrpt);
 		gettimeofday(&myrpt->lastlinktime,NULL);
 		rpt_mutex_unlock(&myrpt->lock);
@@ -23154,8 +25118,9 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 	}
 	i = 3;
 	ast_channel_setoption(myrpt->rxchannel,AST_OPTION_TONE_VERIFY,&i,sizeof(char),0);
+	rpt_mixer_select(myrpt);
 	/* allocate a pseudo-channel thru asterisk */
-	myrpt->pchannel = ast_request(DAHDI_CHANNEL_NAME,AST_FORMAT_SLINEAR,"pseudo",NULL);
+	myrpt->pchannel = rpt_pseudo(myrpt);
 	if (!myrpt->pchannel)
 	{
 		fprintf(stderr,"rpt:Sorry unable to obtain pseudo channel\n");
@@ -23179,7 +25144,7 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 	ci.confno = -1; /* make a new conf */
 	ci.confmode = DAHDI_CONF_CONFANNMON ;
 	/* first put the channel on the conference in announce/monitor mode */
-	if (ioctl(myrpt->pchannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+	if (rpt_setconf(myrpt->pchannel,&ci) == -1)
 	{
 		ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 		rpt_mutex_unlock(&myrpt->lock);
@@ -23645,7 +25610,7 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 					{
 						if(telem->mode == ACT_TIMEOUT_WARNING && !telem->killed)
 						{
-							if (telem->chan) ast_softhangup(telem->chan, AST_SOFTHANGUP_DEV); /* Whoosh! */
+							rpt_tele_kill(telem); /* Whoosh! */
 							telem->killed = 1;
 						}
 						telem = telem->next;
@@ -23795,22 +25760,12 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 				if (ismuted)
 				{
 					memset(AST_FRAME_DATAP(f),0,f->datalen);
-					if (myrpt->lastf1)
-						memset(AST_FRAME_DATAP(myrpt->lastf1),0,myrpt->lastf1->datalen);
-					if (myrpt->lastf2)
-						memset(AST_FRAME_DATAP(myrpt->lastf2),0,myrpt->lastf2->datalen);
+					rpt_framering_mute(&myrpt->lastf);
 				} 
-				if (f) f2 = ast_frdup(f);
-				else f2 = NULL;
-				f1 = myrpt->lastf2;
-				myrpt->lastf2 = myrpt->lastf1;
-				myrpt->lastf1 = f2;
+				f1 = rpt_framering_put(&myrpt->lastf,f);
 				if (ismuted)
 				{
-					if (myrpt->lastf1)
-						memset(AST_FRAME_DATAP(myrpt->lastf1),0,myrpt->lastf1->datalen);
-					if (myrpt->lastf2)
-						memset(AST_FRAME_DATAP(myrpt->lastf2),0,myrpt->lastf2->datalen);
+					rpt_framering_mute(&myrpt->lastf);
 				}
 				if (f1)
 				{
@@ -23821,26 +25776,18 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 						else
 							ast_write(myrpt->txchannel,f);
 					} 
-						
-					ast_frfree(f1);
 				}
 			}
 #ifndef	OLD_ASTERISK
 			else if (f->frametype == AST_FRAME_DTMF_BEGIN)
 			{
-				if (myrpt->lastf1)
-					memset(AST_FRAME_DATAP(myrpt->lastf1),0,myrpt->lastf1->datalen);
-				if (myrpt->lastf2)
-					memset(AST_FRAME_DATAP(myrpt->lastf2),0,myrpt->lastf2->datalen);
+				rpt_framering_mute(&myrpt->lastf);
 				dtmfed = 1;
 			}
 #endif
 			if (f->frametype == AST_FRAME_DTMF)
 			{
-				if (myrpt->lastf1)
-					memset(AST_FRAME_DATAP(myrpt->lastf1),0,myrpt->lastf1->datalen);
-				if (myrpt->lastf2)
-					memset(AST_FRAME_DATAP(myrpt->lastf2),0,myrpt->lastf2->datalen);
+				rpt_framering_mute(&myrpt->lastf);
 				dtmfed = 1;
 				if (handle_remote_phone_dtmf(myrpt,f->subclass,&keyed,phone_mode) == -1)
 				{
@@ -24023,10 +25970,7 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 	myrpt->hfscanstatus = 0;
 	myrpt->remoteon = 0;
 	rpt_mutex_unlock(&myrpt->lock);
-	if (myrpt->lastf1) ast_frfree(myrpt->lastf1);
-	myrpt->lastf1 = NULL;
-	if (myrpt->lastf2) ast_frfree(myrpt->lastf2);
-	myrpt->lastf2 = NULL;
+	rpt_framering_flush(&myrpt->lastf);
 	if ((iskenwood_pci4) && (myrpt->txchannel == myrpt->zaptxchannel))
 	{
 		z.radpar = DAHDI_RADPAR_UIOMODE;
@@ -24131,10 +26075,208 @@ static void rpt_manager_success(struct mansession *s, const struct message *m)
 }
 
 
-static int rpt_manager_do_sawstat(struct mansession *ses, const struct message *m, char *str)
+/*
+ * Manager status snapshots
+ */
+
+static void rpt_status_free(struct rpt_status *st)
 {
-	int i;
+	if (st->links) ast_free(st->links);
+	if (st->vars) ast_free(st->vars);
+	ast_free(st);
+}
+
+/* copy what the manager actions report, taking myrpt->lock only briefly.
+   IAX peer names are carried over from prev for links that have stayed up */
+static struct rpt_status *rpt_status_build(struct rpt *myrpt, struct rpt_status *prev)
+{
+	struct rpt_status *st;
+	struct rpt_status_link *sl;
 	struct rpt_link *l;
+	struct ast_var_t *newvariable;
+	int i,n,len;
+
+	if (!(st = ast_calloc(1,sizeof(struct rpt_status)))) return(NULL);
+	rpt_mutex_lock(&myrpt->lock);
+	n = 0;
+	for(l = myrpt->links.next; l != &myrpt->links; l = l->next) n++;
+	if (n && (!(st->links = ast_calloc(n,sizeof(struct rpt_status_link)))))
+	{
+		rpt_mutex_unlock(&myrpt->lock);
+		ast_free(st);
+		return(NULL);
+	}
+	st->keyed = myrpt->keyed;
+	st->txkeyed = myrpt->txkeyed;
+	st->parrotmode = myrpt->p.parrotmode;
+	st->sysstate_cur = myrpt->p.sysstate_cur;
+	st->txdisable = myrpt->p.s[myrpt->p.sysstate_cur].txdisable;
+	st->totdisable = myrpt->p.s[myrpt->p.sysstate_cur].totdisable;
+	st->linkfundisable = myrpt->p.s[myrpt->p.sysstate_cur].linkfundisable;
+	st->autopatchdisable = myrpt->p.s[myrpt->p.sysstate_cur].autopatchdisable;
+	st->schedulerdisable = myrpt->p.s[myrpt->p.sysstate_cur].schedulerdisable;
+	st->userfundisable = myrpt->p.s[myrpt->p.sysstate_cur].userfundisable;
+	st->alternatetail = myrpt->p.s[myrpt->p.sysstate_cur].alternatetail;
+	st->noincomingconns = myrpt->p.s[myrpt->p.sysstate_cur].noincomingconns;
+	if (!myrpt->totimer) st->totstate = 0;
+	else if (myrpt->totimer != myrpt->p.totime) st->totstate = 1;
+	else st->totstate = 2;
+	if (myrpt->tailid) st->iderstate = 0;
+	else if (myrpt->mustid) st->iderstate = 1;
+	else st->iderstate = 2;
+	st->callmode = myrpt->callmode;
+	st->telemdynamic = myrpt->p.telemdynamic;
+	st->telemmode = myrpt->telemmode;
+	st->dailytxtime = myrpt->dailytxtime;
+	st->totaltxtime = myrpt->totaltxtime;
+	st->dailykeyups = myrpt->dailykeyups;
+	st->totalkeyups = myrpt->totalkeyups;
+	st->dailykerchunks = myrpt->dailykerchunks;
+	st->totalkerchunks = myrpt->totalkerchunks;
+	st->dailyexecdcommands = myrpt->dailyexecdcommands;
+	st->totalexecdcommands = myrpt->totalexecdcommands;
+	st->timeouts = myrpt->timeouts;
+	ast_copy_string(st->exten,myrpt->exten,sizeof(st->exten));
+	ast_copy_string(st->lastdtmfcommand,myrpt->lastdtmfcommand,sizeof(st->lastdtmfcommand));
+	for(l = myrpt->links.next; l != &myrpt->links; l = l->next)
+	{
+		if (l->name[0] == '0') /* Skip '0' nodes */
+		{
+			st->reversepatch = 1;
+			continue;
+		}
+		sl = &st->links[st->nlinks++];
+		ast_copy_string(sl->name,l->name,sizeof(sl->name));
+		sl->lastrx1 = l->lastrx1;
+		sl->outbound = l->outbound;
+		sl->thisconnected = l->thisconnected;
+		sl->reconnects = l->reconnects;
+		sl->lastkeytime = l->lastkeytime;
+		sl->lastunkeytime = l->lastunkeytime;
+		sl->connectsince = l->connectstart;
+		for(i = 0; prev && (i < prev->nlinks); i++)
+		{
+			if ((!strcmp(prev->links[i].name,sl->name)) &&
+			    prev->links[i].thisconnected && sl->thisconnected &&
+			    (prev->links[i].reconnects == sl->reconnects)) break;
+		}
+		if (prev && (i < prev->nlinks))
+			strcpy(sl->peer,prev->links[i].peer);
+		else if (l->chan)
+			pbx_substitute_variables_helper(l->chan, "${IAXPEER(CURRENTCHANNEL)}", sl->peer, MAXPEERSTR - 1);
+		else
+			strcpy(sl->peer,"(none)");
+	}
+	__mklinklist(myrpt,NULL,st->linklist,0);
+	rpt_mutex_unlock(&myrpt->lock);
+
+	if (myrpt->rxchannel)
+	{
+		ast_channel_lock(myrpt->rxchannel);
+		len = 1;
+		AST_LIST_TRAVERSE (&myrpt->rxchannel->varshead, newvariable, entries) {
+			len += strlen(ast_var_name(newvariable)) + strlen(ast_var_value(newvariable)) + 8;
+		}
+		if ((st->vars = ast_malloc(len)))
+		{
+			n = 0;
+			AST_LIST_TRAVERSE (&myrpt->rxchannel->varshead, newvariable, entries) {
+				n += snprintf(st->vars + n,len - n,"Var: %s=%s\r\n",
+					ast_var_name(newvariable), ast_var_value(newvariable));
+			}
+			st->vars[n] = 0;
+		}
+		ast_channel_unlock(myrpt->rxchannel);
+	}
+	return(st);
+}
+
+/* 0 if a and b would report the same thing */
+static int rpt_status_cmp(struct rpt_status *a, struct rpt_status *b)
+{
+	if (memcmp(&a->keyed,&b->keyed,(char *)&a->nlinks - (char *)&a->keyed)) return(1);
+	if (a->nlinks != b->nlinks) return(1);
+	if (a->nlinks && memcmp(a->links,b->links,a->nlinks * sizeof(struct rpt_status_link))) return(1);
+	return(strcmp(S_OR(a->vars,""),S_OR(b->vars,"")) != 0);
+}
+
+static void rpt_status_put(struct rpt *myrpt, struct rpt_status *st)
+{
+	int refs;
+
+	if (!st) return;
+	ast_mutex_lock(&myrpt->status_lock);
+	refs = --st->refs;
+	ast_mutex_unlock(&myrpt->status_lock);
+	if (!refs) rpt_status_free(st);
+}
+
+/* rebuild the snapshot and publish it if it changed */
+static void rpt_status_update(struct rpt *myrpt)
+{
+	struct rpt_status *st,*old,*prev;
+
+	ast_mutex_lock(&myrpt->status_lock);
+	if ((old = myrpt->status)) old->refs++;
+	ast_mutex_unlock(&myrpt->status_lock);
+	st = rpt_status_build(myrpt,old);
+	if ((!st) || (old && (!rpt_status_cmp(st,old))))
+	{
+		if (st) rpt_status_free(st);
+		rpt_status_put(myrpt,old);
+		return;
+	}
+	st->refs = 1;
+	ast_mutex_lock(&myrpt->status_lock);
+	prev = myrpt->status;
+	st->gen = (prev) ? prev->gen + 1 : 1;
+	myrpt->status = st;
+	ast_mutex_unlock(&myrpt->status_lock);
+	rpt_status_put(myrpt,prev);
+	rpt_status_put(myrpt,old);
+}
+
+/* latest snapshot, with a reference for the caller. Only built here if the
+   node thread has not got to it yet, or for a remote base, which has no
+   node thread, once it is RPT_STATUS_INTERVAL old */
+static struct rpt_status *rpt_status_get(struct rpt *myrpt)
+{
+	struct rpt_status *st;
+	int stale = 0;
+
+	ast_mutex_lock(&myrpt->status_lock);
+	if (myrpt->remote && (ast_tvdiff_ms(ast_tvnow(),myrpt->statustv) >= RPT_STATUS_INTERVAL))
+	{
+		myrpt->statustv = ast_tvnow();
+		stale = 1;
+	}
+	if ((!stale) && (st = myrpt->status)) st->refs++;
+	ast_mutex_unlock(&myrpt->status_lock);
+	if ((!stale) && st) return(st);
+	rpt_status_update(myrpt);
+	ast_mutex_lock(&myrpt->status_lock);
+	if ((st = myrpt->status)) st->refs++;
+	ast_mutex_unlock(&myrpt->status_lock);
+	return(st);
+}
+
+/* report the generation, and say so and return 1 if the client
+   asked about this one already */
+static int rpt_status_unchanged(struct mansession *ses, const struct message *m, struct rpt_status *st)
+{
+	const char *gen = astman_get_header(m, "Generation");
+
+	astman_append(ses,"Generation: %u\r\n",st->gen);
+	if (ast_strlen_zero(gen) || (strtoul(gen,NULL,10) != st->gen)) return(0);
+	astman_append(ses,"Unchanged: YES\r\n\r\n");
+	return(1);
+}
+
+static int rpt_manager_do_sawstat(struct mansession *ses, const struct message *m, char *str)
+{
+	int i,j;
+	struct rpt_status *st;
+	struct rpt_status_link *sl;
 	const char *node = astman_get_header(m, "Node");
 	time_t now;
 
@@ -24142,23 +26284,22 @@ static int rpt_manager_do_sawstat(struct mansession *ses, const struct message *
 	for(i = 0; i < nrpts; i++)
 	{
 		if ((node)&&(!strcmp(node,rpt_vars[i].name))){
+			if (!(st = rpt_status_get(&rpt_vars[i]))) return(-1);
 			rpt_manager_success(ses,m);
 			astman_append(ses,"Node: %s\r\n",node);
+			if (rpt_status_unchanged(ses,m,st))
+			{
+				rpt_status_put(&rpt_vars[i],st);
+				return(0);
+			}
 
-			rpt_mutex_lock(&rpt_vars[i].lock); /* LOCK */
-
-			l = rpt_vars[i].links.next;
-			while(l && (l != &rpt_vars[i].links)){
-				if (l->name[0] == '0'){ // Skip '0' nodes 
-					l = l->next;
-					continue;
-				}
-				astman_append(ses, "Conn: %s %d %d %d\r\n",l->name,l->lastrx1,
-					(l->lastkeytime) ? (int)(now - l->lastkeytime) : -1,
-					(l->lastunkeytime) ? (int)(now - l->lastunkeytime) : -1);
-				l = l->next;
+			for(j = 0; j < st->nlinks; j++){
+				sl = &st->links[j];
+				astman_append(ses, "Conn: %s %d %d %d\r\n",sl->name,sl->lastrx1,
+					(sl->lastkeytime) ? (int)(now - sl->lastkeytime) : -1,
+					(sl->lastunkeytime) ? (int)(now - sl->lastunkeytime) : -1);
 			}
-			rpt_mutex_unlock(&rpt_vars[i].lock); // UNLOCK 
+			rpt_status_put(&rpt_vars[i],st);
 			astman_append(ses, "\r\n");
 			return(0);
 		}
@@ -24173,94 +26314,28 @@ static int rpt_manager_do_xstat(struct mansession *ses, const struct message *m,
 	int i,j;
 	char ns;
 	char lbuf[MAXLINKLIST],*strs[MAXLINKLIST];
-	struct rpt *myrpt;
-	struct ast_var_t *newvariable;
+	struct rpt_status *st;
+	struct rpt_status_link *sl;
 	char *connstate;
-	struct rpt_link *l;
-	struct rpt_lstat *s,*t;
-	struct rpt_lstat s_head;
+	time_t now;
 	const char *node = astman_get_header(m, "Node");
 
-	s = NULL;
-	s_head.next = &s_head;
-	s_head.prev = &s_head;
-
-
-	char *parrot_ena, *sys_ena, *tot_ena, *link_ena, *patch_ena, *patch_state;
-	char *sch_ena, *user_funs, *tail_type, *iconns, *tot_state, *ider_state, *tel_mode; 
+	char *patch_state, *tel_mode;
 
+	sys_uptime(&now);
 	for(i = 0; i < nrpts; i++)
 	{
 		if ((node)&&(!strcmp(node,rpt_vars[i].name))){
+			if (!(st = rpt_status_get(&rpt_vars[i]))) return(-1);
 			rpt_manager_success(ses,m);
 			astman_append(ses,"Node: %s\r\n",node);
+			if (rpt_status_unchanged(ses,m,st))
+			{
+				rpt_status_put(&rpt_vars[i],st);
+				return(0);
+			}
 
-			/* Make a copy of all stat variables while locked */
-			myrpt = &rpt_vars[i];
-			rpt_mutex_lock(&myrpt->lock); /* LOCK */
-
-//### GET RPT STATUS STATES WHILE LOCKED ########################
-			if(myrpt->p.parrotmode)
-				parrot_ena = "1";	//"ENABLED";
-			else
-				parrot_ena = "0";	//"DISABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].txdisable)
-				sys_ena = "0";	//"DISABLED";
-			else
-				sys_ena = "1";	//"ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].totdisable)
-				tot_ena = "0";	//"DISABLED";
-			else
-				tot_ena = "1";	//"ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].linkfundisable)
-				link_ena = "0";	//"DISABLED";
-			else
-				link_ena = "1";	//"ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].autopatchdisable)
-				patch_ena = "0";	//"DISABLED";
-			else
-				patch_ena = "1";	//"ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].schedulerdisable)
-				sch_ena = "0";	//"DISABLED";
-			else
-				sch_ena = "1";	//"ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].userfundisable)
-				user_funs = "0";	//"DISABLED";
-			else
-				user_funs = "1";	//"ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].alternatetail)
-				tail_type = "1";	//"ALTERNATE";
-			else
-				tail_type = "0";	//"STANDARD";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].noincomingconns)
-				iconns = "0";	//"DISABLED";
-			else
-				iconns = "1";	//"ENABLED";
-
-			if(!myrpt->totimer)
-				tot_state = "0";	//"TIMED OUT!";
-			else if(myrpt->totimer != myrpt->p.totime)
-				tot_state = "1";	//"ARMED";
-			else
-				tot_state = "2";	//"RESET";
-
-			if(myrpt->tailid)
-				ider_state = "0";	//"QUEUED IN TAIL";
-			else if(myrpt->mustid)
-				ider_state = "1";	//"QUEUED FOR CLEANUP";
-			else
-				ider_state = "2";	//"CLEAN";
-
-
-			switch(myrpt->callmode){
+			switch(st->callmode){
 				case 1:
 					patch_state = "0";		//"DIALING";
 					break;
@@ -24279,12 +26354,11 @@ static int rpt_manager_do_xstat(struct mansession *ses, const struct message *m,
 					patch_state = "4";		//"DOWN";
 			}
 
-
-			if (myrpt->p.telemdynamic)
+			if (st->telemdynamic)
 			{
-				if(myrpt->telemmode == 0x7fffffff)
+				if(st->telemmode == 0x7fffffff)
 					tel_mode = "1";
-				else if(myrpt->telemmode == 0x00)
+				else if(st->telemmode == 0x00)
 					tel_mode = "0";
 				else
 					tel_mode = "2";
@@ -24293,71 +26367,33 @@ static int rpt_manager_do_xstat(struct mansession *ses, const struct message *m,
 				tel_mode= "3";
 			}
 
-
 //### GET CONNECTED NODE INFO ####################
-			// Traverse the list of connected nodes 
-
-			__mklinklist(myrpt,NULL,lbuf,0);
-
-			j = 0;
-			l = myrpt->links.next;
-			while(l && (l != &myrpt->links)){
-				if (l->name[0] == '0'){ // Skip '0' nodes 
-					l = l->next;
-					continue;
-				}
-				if((s = (struct rpt_lstat *) ast_malloc(sizeof(struct rpt_lstat))) == NULL){
-					ast_log(LOG_ERROR, "Malloc failed in rpt_do_lstats\r\n");
-					rpt_mutex_unlock(&myrpt->lock); // UNLOCK 
-					return -1;
-				}
-				memset(s, 0, sizeof(struct rpt_lstat));
-				strncpy(s->name, l->name, MAXREMSTR - 1);
-				if (l->chan) pbx_substitute_variables_helper(l->chan, "${IAXPEER(CURRENTCHANNEL)}", s->peer, MAXPEERSTR - 1);
-				else strcpy(s->peer,"(none)");
-				s->mode = l->mode;
-				s->outbound = l->outbound;
-				s->reconnects = l->reconnects;
-				s->connecttime = l->connecttime;
-				s->thisconnected = l->thisconnected;
-				memcpy(s->chan_stat,l->chan_stat,NRPTSTAT * sizeof(struct rpt_chan_stat));
-				insque((struct qelem *) s, (struct qelem *) s_head.next);
-				memset(l->chan_stat,0,NRPTSTAT * sizeof(struct rpt_chan_stat));
-				l = l->next;
-			}
-			rpt_mutex_unlock(&myrpt->lock); // UNLOCK 
-			for(s = s_head.next; s != &s_head; s = s->next){
+			/* newest link first, as before */
+			for(j = st->nlinks - 1; j >= 0; j--){
 				int hours, minutes, seconds;
-				long long connecttime = s->connecttime;
+				int connecttime = (int)(now - st->links[j].connectsince);
 				char conntime[21];
-				hours = (int) connecttime/3600000;
-				connecttime %= 3600000;
-				minutes = (int) connecttime/60000;
-				connecttime %= 60000;
-				seconds = (int)  connecttime/1000;
-				connecttime %= 1000;
+
+				sl = &st->links[j];
+				hours = connecttime/3600;
+				connecttime %= 3600;
+				minutes = connecttime/60;
+				seconds = connecttime % 60;
 				snprintf(conntime, 20, "%02d:%02d:%02d",
 					hours, minutes, seconds);
 				conntime[20] = 0;
-				if(s->thisconnected)
+				if(sl->thisconnected)
 					connstate  = "ESTABLISHED";
 				else
 					connstate = "CONNECTING";
 				astman_append(ses, "Conn: %-10s%-20s%-12d%-11s%-20s%-20s\r\n",
-					s->name, s->peer, s->reconnects, (s->outbound)? "OUT":"IN", conntime, connstate);
-			}	
-			// destroy our local link queue 
-			s = s_head.next;
-			while(s != &s_head){
-				t = s;
-				s = s->next;
-				remque((struct qelem *)t);
-				ast_free(t);
+					sl->name, sl->peer, sl->reconnects, (sl->outbound)? "OUT":"IN", conntime, connstate);
 			}	
 
 			astman_append(ses,"LinkedNodes: ");
 //### GET ALL LINKED NODES INFO ####################
 			/* parse em */
+			strcpy(lbuf,st->linklist);
 			ns = finddelim(lbuf,strs,MAXLINKLIST);
 			/* sort em */
 			if (ns) qsort((void *)strs,ns,sizeof(char *),mycompar);
@@ -24376,29 +26412,24 @@ static int rpt_manager_do_xstat(struct mansession *ses, const struct message *m,
 			astman_append(ses,"\r\n");
 
 //### GET VARIABLES INFO ####################
-			j = 0;
-			ast_channel_lock(rpt_vars[i].rxchannel);
-			AST_LIST_TRAVERSE (&rpt_vars[i].rxchannel->varshead, newvariable, entries) {
-				j++;
-				astman_append(ses,"Var: %s=%s\r\n", ast_var_name(newvariable), ast_var_value(newvariable));
-			}
-			ast_channel_unlock(rpt_vars[i].rxchannel);
+			if (st->vars) astman_append(ses,"%s",st->vars);
 
 //### OUTPUT RPT STATUS STATES ##############
-			astman_append(ses, "parrot_ena: %s\r\n", parrot_ena);
-			astman_append(ses, "sys_ena: %s\r\n", sys_ena);
-			astman_append(ses, "tot_ena: %s\r\n", tot_ena);
-			astman_append(ses, "link_ena: %s\r\n", link_ena);
-			astman_append(ses, "patch_ena: %s\r\n", patch_ena);
+			astman_append(ses, "parrot_ena: %s\r\n", (st->parrotmode) ? "1" : "0");
+			astman_append(ses, "sys_ena: %s\r\n", (st->txdisable) ? "0" : "1");
+			astman_append(ses, "tot_ena: %s\r\n", (st->totdisable) ? "0" : "1");
+			astman_append(ses, "link_ena: %s\r\n", (st->linkfundisable) ? "0" : "1");
+			astman_append(ses, "patch_ena: %s\r\n", (st->autopatchdisable) ? "0" : "1");
 			astman_append(ses, "patch_state: %s\r\n", patch_state);
-			astman_append(ses, "sch_ena: %s\r\n", sch_ena);
-			astman_append(ses, "user_funs: %s\r\n", user_funs);
-			astman_append(ses, "tail_type: %s\r\n", tail_type);
-			astman_append(ses, "iconns: %s\r\n", iconns);
-			astman_append(ses, "tot_state: %s\r\n", tot_state);
-			astman_append(ses, "ider_state: %s\r\n", ider_state);
+			astman_append(ses, "sch_ena: %s\r\n", (st->schedulerdisable) ? "0" : "1");
+			astman_append(ses, "user_funs: %s\r\n", (st->userfundisable) ? "0" : "1");
+			astman_append(ses, "tail_type: %s\r\n", (st->alternatetail) ? "1" : "0");
+			astman_append(ses, "iconns: %s\r\n", (st->noincomingconns) ? "0" : "1");
+			astman_append(ses, "tot_state: %d\r\n", st->totstate);
+			astman_append(ses, "ider_state: %d\r\n", st->iderstate);
 			astman_append(ses, "tel_mode: %s\r\n\r\n", tel_mode);
 
+			rpt_status_put(&rpt_vars[i],st);
 			return 0;
 		}
 	}
@@ -24414,34 +26445,21 @@ static int rpt_manager_do_xstat(struct mansession *ses, const struct message *m,
 static int rpt_manager_do_stats(struct mansession *s, const struct message *m, char *str)
 {
 	int i,j,numoflinks;
-	int dailytxtime, dailykerchunks;
-	time_t now;
-	int totalkerchunks, dailykeyups, totalkeyups, timeouts;
-	int totalexecdcommands, dailyexecdcommands, hours, minutes, seconds;
+	int dailytxtime;
+	int hours, minutes, seconds;
 	long long totaltxtime;
-	struct	rpt_link *l;
-	char *listoflinks[MAX_STAT_LINKS];	
-	char *lastdtmfcommand,*parrot_ena;
-	char *tot_state, *ider_state, *patch_state;
-	char *reverse_patch_state, *sys_ena, *tot_ena, *link_ena, *patch_ena;
-	char *sch_ena, *input_signal, *called_number, *user_funs, *tail_type;
-	char *transmitterkeyed;
+	char *patch_state;
 	const char *node = astman_get_header(m, "Node");
 	struct rpt *myrpt;
+	struct rpt_status *st;
 
 	static char *not_applicable = "N/A";
+	static char *tot_states[] = {"TIMED OUT!","ARMED","RESET"};
+	static char *ider_states[] = {"QUEUED IN TAIL","QUEUED FOR CLEANUP","CLEAN"};
 
-	tot_state = ider_state = 
-	patch_state = reverse_patch_state = 
-	input_signal = not_applicable;
-	called_number = lastdtmfcommand = transmitterkeyed = NULL;
-
-	sys_uptime(&now);
 	for(i = 0; i < nrpts; i++)
 	{
 		if ((node)&&(!strcmp(node,rpt_vars[i].name))){
-			rpt_manager_success(s,m);
-
 			myrpt = &rpt_vars[i];
 
 			if(myrpt->remote){ /* Remote base ? */
@@ -24449,6 +26467,7 @@ static int rpt_manager_do_stats(struct mansession *s, const struct message *m, c
 				char offset = 0,powerlevel = 0,rxplon = 0,txplon = 0,remoteon,remmode = 0,reportfmstuff;
 				char offsetc,powerlevelc;
 
+				rpt_manager_success(s,m);
 				loginuser = loginlevel = freq = rxpl = txpl = NULL;
 				/* Make a copy of all stat variables while locked */
 				rpt_mutex_lock(&myrpt->lock); /* LOCK */
@@ -24541,110 +26560,16 @@ static int rpt_manager_do_stats(struct mansession *s, const struct message *m, c
 				return 0; /* End of remote base status reporting */
 			}	
 
-			/* ELSE Process as a repeater node */
-			/* Make a copy of all stat variables while locked */
-			rpt_mutex_lock(&myrpt->lock); /* LOCK */
-			dailytxtime = myrpt->dailytxtime;
-			totaltxtime = myrpt->totaltxtime;
-			dailykeyups = myrpt->dailykeyups;
-			totalkeyups = myrpt->totalkeyups;
-			dailykerchunks = myrpt->dailykerchunks;
-			totalkerchunks = myrpt->totalkerchunks;
-			dailyexecdcommands = myrpt->dailyexecdcommands;
-			totalexecdcommands = myrpt->totalexecdcommands;
-			timeouts = myrpt->timeouts;
-
-
-			/* Traverse the list of connected nodes */
-			reverse_patch_state = "DOWN";
-			numoflinks = 0;
-			l = myrpt->links.next;
-			while(l && (l != &myrpt->links)){
-				if(numoflinks >= MAX_STAT_LINKS){
-					ast_log(LOG_NOTICE,
-					"maximum number of links exceeds %d in rpt_do_stats()!",MAX_STAT_LINKS);
-					break;
-				}
-				if (l->name[0] == '0'){ /* Skip '0' nodes */
-					reverse_patch_state = "UP";
-					l = l->next;
-					continue;
-				}
-				listoflinks[numoflinks] = ast_strdup(l->name);
-				if(listoflinks[numoflinks] == NULL){
-					break;
-				}
-				else{
-					numoflinks++;
-				}
-				l = l->next;
+			/* ELSE Process as a repeater node, from the snapshot */
+			if (!(st = rpt_status_get(myrpt))) return(-1);
+			rpt_manager_success(s,m);
+			if (rpt_status_unchanged(s,m,st))
+			{
+				rpt_status_put(myrpt,st);
+				return(0);
 			}
 
-			if(myrpt->keyed)
-				input_signal = "YES";
-			else
-				input_signal = "NO";
-			
-			if(myrpt->txkeyed)
-				transmitterkeyed = "YES";
-			else
-				transmitterkeyed = "NO";
-
-			if(myrpt->p.parrotmode)
-				parrot_ena = "ENABLED";
-			else
-				parrot_ena = "DISABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].txdisable)
-				sys_ena = "DISABLED";
-			else
-				sys_ena = "ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].totdisable)
-				tot_ena = "DISABLED";
-			else
-				tot_ena = "ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].linkfundisable)
-				link_ena = "DISABLED";
-			else
-				link_ena = "ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].autopatchdisable)
-				patch_ena = "DISABLED";
-			else
-				patch_ena = "ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].schedulerdisable)
-				sch_ena = "DISABLED";
-			else
-				sch_ena = "ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].userfundisable)
-				user_funs = "DISABLED";
-			else
-				user_funs = "ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].alternatetail)
-				tail_type = "ALTERNATE";
-			else
-				tail_type = "STANDARD";
-
-			if(!myrpt->totimer)
-				tot_state = "TIMED OUT!";
-			else if(myrpt->totimer != myrpt->p.totime)
-				tot_state = "ARMED";
-			else
-				tot_state = "RESET";
-
-			if(myrpt->tailid)
-				ider_state = "QUEUED IN TAIL";
-			else if(myrpt->mustid)
-				ider_state = "QUEUED FOR CLEANUP";
-			else
-				ider_state = "CLEAN";
-
-			switch(myrpt->callmode){
+			switch(st->callmode){
 				case 1:
 					patch_state = "DIALING";
 					break;
@@ -24663,35 +26588,27 @@ static int rpt_manager_do_stats(struct mansession *s, const struct message *m, c
 					patch_state = "DOWN";
 			}
 
-			if(strlen(myrpt->exten)){
-				called_number = ast_strdup(myrpt->exten);
-			}
-
-			if(strlen(myrpt->lastdtmfcommand)){
-				lastdtmfcommand = ast_strdup(myrpt->lastdtmfcommand);
-			}
-			rpt_mutex_unlock(&myrpt->lock); /* UNLOCK */
-
 			astman_append(s, "IsRemoteBase: NO\r\n");
-			astman_append(s, "NodeState: %d\r\n", myrpt->p.sysstate_cur);
-			astman_append(s, "SignalOnInput: %s\r\n", input_signal);
-			astman_append(s, "TransmitterKeyed: %s\r\n", transmitterkeyed);
-			astman_append(s, "Transmitter: %s\r\n", sys_ena);
-			astman_append(s, "Parrot: %s\r\n", parrot_ena);
-			astman_append(s, "Scheduler: %s\r\n", sch_ena);
-			astman_append(s, "TailLength: %s\r\n", tail_type);
-			astman_append(s, "TimeOutTimer: %s\r\n", tot_ena);
-			astman_append(s, "TimeOutTimerState: %s\r\n", tot_state);
-			astman_append(s, "TimeOutsSinceSystemInitialization: %d\r\n", timeouts);
-			astman_append(s, "IdentifierState: %s\r\n", ider_state);
-			astman_append(s, "KerchunksToday: %d\r\n", dailykerchunks);
-			astman_append(s, "KerchunksSinceSystemInitialization: %d\r\n", totalkerchunks);
-			astman_append(s, "KeyupsToday: %d\r\n", dailykeyups);
-			astman_append(s, "KeyupsSinceSystemInitialization: %d\r\n", totalkeyups);
-			astman_append(s, "DtmfCommandsToday: %d\r\n", dailyexecdcommands);
-			astman_append(s, "DtmfCommandsSinceSystemInitialization: %d\r\n", totalexecdcommands);
+			astman_append(s, "NodeState: %d\r\n", st->sysstate_cur);
+			astman_append(s, "SignalOnInput: %s\r\n", (st->keyed) ? "YES" : "NO");
+			astman_append(s, "TransmitterKeyed: %s\r\n", (st->txkeyed) ? "YES" : "NO");
+			astman_append(s, "Transmitter: %s\r\n", (st->txdisable) ? "DISABLED" : "ENABLED");
+			astman_append(s, "Parrot: %s\r\n", (st->parrotmode) ? "ENABLED" : "DISABLED");
+			astman_append(s, "Scheduler: %s\r\n", (st->schedulerdisable) ? "DISABLED" : "ENABLED");
+			astman_append(s, "TailLength: %s\r\n", (st->alternatetail) ? "ALTERNATE" : "STANDARD");
+			astman_append(s, "TimeOutTimer: %s\r\n", (st->totdisable) ? "DISABLED" : "ENABLED");
+			astman_append(s, "TimeOutTimerState: %s\r\n", tot_states[st->totstate]);
+			astman_append(s, "TimeOutsSinceSystemInitialization: %d\r\n", st->timeouts);
+			astman_append(s, "IdentifierState: %s\r\n", ider_states[st->iderstate]);
+			astman_append(s, "KerchunksToday: %d\r\n", st->dailykerchunks);
+			astman_append(s, "KerchunksSinceSystemInitialization: %d\r\n", st->totalkerchunks);
+			astman_append(s, "KeyupsToday: %d\r\n", st->dailykeyups);
+			astman_append(s, "KeyupsSinceSystemInitialization: %d\r\n", st->totalkeyups);
+			astman_append(s, "DtmfCommandsToday: %d\r\n", st->dailyexecdcommands);
+			astman_append(s, "DtmfCommandsSinceSystemInitialization: %d\r\n", st->totalexecdcommands);
 			astman_append(s, "LastDtmfCommandExecuted: %s\r\n", 
-			(lastdtmfcommand && strlen(lastdtmfcommand)) ? lastdtmfcommand : not_applicable);
+			(strlen(st->lastdtmfcommand)) ? st->lastdtmfcommand : not_applicable);
+			dailytxtime = st->dailytxtime;
 			hours = dailytxtime/3600000;
 			dailytxtime %= 3600000;
 			minutes = dailytxtime/60000;
@@ -24702,6 +26619,7 @@ static int rpt_manager_do_stats(struct mansession *s, const struct message *m, c
 			astman_append(s, "TxTimeToday: %02d:%02d:%02d.%d\r\n",
 				hours, minutes, seconds, dailytxtime);
 
+			totaltxtime = st->totaltxtime;
 			hours = (int) totaltxtime/3600000;
 			totaltxtime %= 3600000;
 			minutes = (int) totaltxtime/60000;
@@ -24712,36 +26630,34 @@ static int rpt_manager_do_stats(struct mansession *s, const struct message *m, c
 			astman_append(s, "TxTimeSinceSystemInitialization: %02d:%02d:%02d.%d\r\n",
 				 hours, minutes, seconds, (int) totaltxtime);
 
+			numoflinks = st->nlinks;
+			if(numoflinks > MAX_STAT_LINKS){
+				ast_log(LOG_NOTICE,
+				"maximum number of links exceeds %d in rpt_do_stats()!",MAX_STAT_LINKS);
+				numoflinks = MAX_STAT_LINKS;
+			}
   			sprintf(str, "NodesCurrentlyConnectedToUs: ");
                         if(!numoflinks){
   	                      strcat(str,"<NONE>");
                         }
 			else{
 				for(j = 0 ;j < numoflinks; j++){
-					sprintf(str+strlen(str), "%s", listoflinks[j]);
+					sprintf(str+strlen(str), "%s", st->links[j].name);
 					if(j < numoflinks - 1)
 						strcat(str,",");
 				}
 			}
 			astman_append(s,"%s\r\n", str);
 
-			astman_append(s, "Autopatch: %s\r\n", patch_ena);
+			astman_append(s, "Autopatch: %s\r\n", (st->autopatchdisable) ? "DISABLED" : "ENABLED");
 			astman_append(s, "AutopatchState: %s\r\n", patch_state);
 			astman_append(s, "AutopatchCalledNumber: %s\r\n",
-			(called_number && strlen(called_number)) ? called_number : not_applicable);
-			astman_append(s, "ReversePatchIaxrptConnected: %s\r\n", reverse_patch_state);
-			astman_append(s, "UserLinkingCommands: %s\r\n", link_ena);
-			astman_append(s, "UserFunctions: %s\r\n", user_funs);
+			(strlen(st->exten)) ? st->exten : not_applicable);
+			astman_append(s, "ReversePatchIaxrptConnected: %s\r\n", (st->reversepatch) ? "UP" : "DOWN");
+			astman_append(s, "UserLinkingCommands: %s\r\n", (st->linkfundisable) ? "DISABLED" : "ENABLED");
+			astman_append(s, "UserFunctions: %s\r\n", (st->userfundisable) ? "DISABLED" : "ENABLED");
 
-			for(j = 0; j < numoflinks; j++){ /* ast_free() all link names */
-				ast_free(listoflinks[j]);
-			}
-			if(called_number){
-				ast_free(called_number);
-			}
-			if(lastdtmfcommand){
-				ast_free(lastdtmfcommand);
-			}
+			rpt_status_put(myrpt,st);
 			astman_append(s, "\r\n"); /* We're Done! */
 		        return 0;
 		}
@@ -25089,6 +27005,29 @@ static int unload_module(void)
 #endif
 
 	daq_uninit();
+	statpost_stop();
+	rptconf_stop();
+	ast_channel_unregister(&rptconf_tech);
+	xnodetab_destroy_all();
+	sndcache_flush();
+	if (rpt_nodelog_writer != AST_PTHREADT_NULL)
+	{
+		struct nodelog *nodep;
+
+		ast_mutex_lock(&nodeloglock);
+		nodelog_shutdown = 1;
+		ast_cond_signal(&nodelog_cond);
+		ast_mutex_unlock(&nodeloglock);
+		pthread_join(rpt_nodelog_writer,NULL);
+		rpt_nodelog_writer = AST_PTHREADT_NULL;
+		while((nodep = nodelog_pool))
+		{
+			nodelog_pool = nodep->next;
+			ast_free(nodep);
+		}
+		nodelog_npool = 0;
+		ast_cond_destroy(&nodelog_cond);
+	}
 
 	for(i = 0; i < nrpts; i++) {
 		if (!strcmp(rpt_vars[i].name,rpt_vars[i].p.nodes)) continue;
@@ -25172,6 +27111,13 @@ static int load_module(void)
 		ast_log(LOG_ERROR,"Can not open /dev/null\n");
 		return -1;
 	}
+	ast_cond_init(&rptconf_cond,NULL);
+	if (ast_channel_register(&rptconf_tech))
+	{
+		ast_log(LOG_ERROR,"Unable to register channel type %s\n",rptconf_tech.type);
+		close(nullfd);
+		return -1;
+	}
 	ast_pthread_create(&rpt_master_thread,NULL,rpt_master,NULL);
 
 #ifdef	NEW_ASTERISK
@@ -25252,6 +27198,8 @@ char	*val,*this;
 		pthread_exit(NULL);
 	}
 
+	/* sound files may have changed too */
+	sndcache_flush();
 	ast_mutex_lock(&rpt_master_lock);
 	for(n = 0; n < nrpts; n++) rpt_vars[n].reload1 = 0;
 	this = NULL;
@@ -25300,6 +27248,7 @@ char	*val,*this;
 			ast_mutex_init(&rpt_vars[n].lock);
 			ast_mutex_init(&rpt_vars[n].remlock);
 			ast_mutex_init(&rpt_vars[n].statpost_lock);
+			ast_mutex_init(&rpt_vars[n].status_lock);
 			rpt_vars[n].tele.next = &rpt_vars[n].tele;
 			rpt_vars[n].tele.prev = &rpt_vars[n].tele;
 			rpt_vars[n].rpt_thread = AST_PTHREADT_NULL;
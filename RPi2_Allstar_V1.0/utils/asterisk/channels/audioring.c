@@ -0,0 +1,125 @@
+/*
+ * Block ring for audio between a producer and a consumer
+ * for the USB radio channel drivers
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ *
+ * The ring holds a power of 2 number of fixed size blocks (one 20 ms
+ * period each). One thread writes and one thread reads, without a lock:
+ * only the producer moves tail and only the consumer moves head, and
+ * both are free running counters. The producer fills the block at tail
+ * and publishes it when it is full, so the consumer only ever sees whole
+ * blocks and can work on them in place. A driver with more than one
+ * producer thread must serialize them itself.
+ *
+ * Storage is supplied by the caller, so the ring can live in a structure
+ * that gets copied by value before audioring_init() is called on it.
+ *
+ * Included directly by chan_simpleusb.c, hence the guard.
+ */
+
+#ifndef	AUDIORING_C
+#define	AUDIORING_C
+
+#include <string.h>
+
+#define	AUDIORING_BARRIER() __sync_synchronize()
+
+struct audioring {
+	volatile unsigned int head;	/* blocks consumed, consumer only */
+	volatile unsigned int tail;	/* blocks published, producer only */
+	unsigned int nblocks;		/* power of 2 */
+	unsigned int blocksize;		/* shorts per block */
+	unsigned int fill;		/* shorts in the block at tail */
+	int dropping;			/* block at tail is being discarded */
+	unsigned int hiwater;		/* most blocks ever queued */
+	unsigned int overruns;		/* blocks discarded because the ring was full */
+	unsigned int underruns;		/* blocks the consumer wanted and did not get */
+	short *buf;			/* nblocks * blocksize */
+	int *flags;			/* per block, may be NULL */
+};
+
+static void audioring_init(struct audioring *r, short *buf, int *flags, unsigned int nblocks, unsigned int blocksize)
+{
+	memset(r,0,sizeof(*r));
+	r->buf = buf;
+	r->flags = flags;
+	r->nblocks = nblocks;
+	r->blocksize = blocksize;
+}
+
+/* number of whole blocks ready for the consumer. Safe to call from a
+   thread that is neither producer nor consumer as a hint only: head and
+   tail are each read once, so the answer may be a block out of date */
+static inline unsigned int audioring_count(struct audioring *r)
+{
+	return(r->tail - r->head);
+}
+
+/* producer: append n samples. flag is recorded against the block
+   these samples complete. Returns the number of blocks published */
+static int audioring_write(struct audioring *r, const short *in, unsigned int n, int flag)
+{
+	unsigned int l,c;
+	int published = 0;
+
+	while(n)
+	{
+		if (!r->fill)
+			r->dropping = ((r->tail - r->head) >= r->nblocks);
+		l = r->blocksize - r->fill;
+		if (l > n) l = n;
+		if (!r->dropping)
+			memcpy(r->buf + ((r->tail & (r->nblocks - 1)) * r->blocksize) + r->fill,
+				in,l * sizeof(short));
+		r->fill += l;
+		in += l;
+		n -= l;
+		if (r->fill < r->blocksize) break;
+		r->fill = 0;
+		if (r->dropping)
+		{
+			r->overruns++;
+			continue;
+		}
+		if (r->flags) r->flags[r->tail & (r->nblocks - 1)] = flag;
+		AUDIORING_BARRIER();
+		r->tail++;
+		published++;
+		c = r->tail - r->head;
+		if (c > r->hiwater) r->hiwater = c;
+	}
+	return(published);
+}
+
+/* consumer: oldest whole block, or NULL if there is none */
+static inline short *audioring_peek(struct audioring *r)
+{
+	if (r->tail == r->head) return(NULL);
+	AUDIORING_BARRIER();
+	return(r->buf + ((r->head & (r->nblocks - 1)) * r->blocksize));
+}
+
+static inline int audioring_flag(struct audioring *r)
+{
+	if (!r->flags) return(0);
+	return(r->flags[r->head & (r->nblocks - 1)]);
+}
+
+/* consumer: done with the block from audioring_peek() */
+static inline void audioring_release(struct audioring *r)
+{
+	AUDIORING_BARRIER();
+	r->head++;
+}
+
+/* consumer: discard all whole blocks */
+static inline void audioring_flush(struct audioring *r)
+{
+	AUDIORING_BARRIER();
+	r->head = r->tail;
+}
+
+#endif
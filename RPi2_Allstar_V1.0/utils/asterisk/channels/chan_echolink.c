@@ -181,7 +181,6 @@ static char type[] = "echolink";
 static char snapshot_id[50] = {'0',0};
 static int el_net_get_index = 0;
 static int el_net_get_nread = 0;
-static int nodeoutfd = -1;
 
 struct sockaddr_in sin_aprs;
 
@@ -363,10 +362,42 @@ struct rtcp_t {
   } r;
 };
 
+/*
+ * The directory is an arena of entries chained into hash tables by node
+ * number, callsign and IP address. Full downloads are built into a new
+ * directory without el_db_lock held and swapped in; partial downloads are
+ * collected first and applied in one pass. Lookups hold el_db_lock and
+ * copy what they need before releasing it.
+ */
+#define	ELDB_NODENUM 0
+#define	ELDB_CALLSIGN 1
+#define	ELDB_IPADDR 2
+#define	ELDB_NKEYS 3
+
 struct eldb {
 	char nodenum[ELDB_NODENUMLEN];
 	char callsign[ELDB_CALLSIGNLEN];
 	char ipaddr[ELDB_IPADDRLEN];
+	int used;
+	int next[ELDB_NKEYS];		/* hash chains, -1 terminated */
+} ;
+
+struct eldir {
+	int nents;			/* arena slots handed out */
+	int allocents;
+	int count;			/* live entries */
+	int freelist;			/* free slots, chained through next[0] */
+	unsigned int mask;		/* hash buckets - 1 */
+	int *heads[ELDB_NKEYS];
+	struct eldb *ents;
+} ;
+
+/* a record from a partial directory download */
+struct eldelta {
+	char nodenum[ELDB_NODENUMLEN];
+	char callsign[ELDB_CALLSIGNLEN];
+	char ipaddr[ELDB_IPADDRLEN];
+	int del;
 } ;
 
 AST_MUTEX_DEFINE_STATIC(el_db_lock);
@@ -387,9 +418,7 @@ struct el_instance *count_instp;
 
 /* binary search tree in memory, root node */
 static void *el_node_list = NULL;
-static void *el_db_callsign = NULL;
-static void *el_db_nodenum = NULL;
-static void *el_db_ipaddr = NULL;
+static struct eldir *el_dir = NULL;
 
 /* Echolink registration thread */
 static  pthread_t el_register_thread = 0;
@@ -585,16 +614,6 @@ int     i,l,inquo;
 
 }
 
-static void print_nodes(const void *nodep, const VISIT which, const int depth)
-{
-   if ((which == leaf) || (which == postorder)) {
-      ast_cli(nodeoutfd,"%s|%s|%s\n",
-             (*(struct eldb **)nodep)->nodenum,
-             (*(struct eldb **)nodep)->callsign,
-             (*(struct eldb **)nodep)->ipaddr);
-   }
-}
-
 static int compare_eldb_nodenum(const void *pa, const void *pb)
 {
    return strcmp(((struct eldb *)pa)->nodenum,((struct eldb *)pb)->nodenum);
@@ -610,87 +629,205 @@ static int compare_eldb_callsign(const void *pa, const void *pb)
    return strcmp(((struct eldb *)pa)->callsign,((struct eldb *)pb)->callsign);
 }
 
-static struct eldb *el_db_find_nodenum(char *nodenum)
+static char *eldb_key(struct eldb *e, int which)
 {
-struct eldb **found_key = NULL,key;
+	if (which == ELDB_CALLSIGN) return(e->callsign);
+	if (which == ELDB_IPADDR) return(e->ipaddr);
+	return(e->nodenum);
+}
 
-	memset(&key,0,sizeof(key));
-	strncpy(key.nodenum,nodenum,sizeof(key.nodenum) - 1);
-	found_key = (struct eldb **)tfind(&key,&el_db_nodenum,compare_eldb_nodenum);
-	if (found_key) return(*found_key);
-	return NULL;
+static unsigned int eldb_hash(char *str)
+{
+unsigned int h = 2166136261U;
+
+	while(*str) h = (h ^ (unsigned char)*str++) * 16777619U;
+	return(h);
 }
 
-static struct eldb *el_db_find_callsign(char *callsign)
+/* (re)build the hash tables with nbuckets (a power of 2) buckets */
+static int eldir_rehash(struct eldir *d, unsigned int nbuckets)
 {
-struct eldb **found_key = NULL,key;
+int	*heads[ELDB_NKEYS],i,k;
+unsigned int h;
 
-	memset(&key,0,sizeof(key));
-	strncpy(key.callsign,callsign,sizeof(key.callsign) - 1);
-	found_key = (struct eldb **)tfind(&key,&el_db_callsign,compare_eldb_callsign);
-	if (found_key) return(*found_key);
-	return NULL;
+	for(k = 0; k < ELDB_NKEYS; k++)
+	{
+		heads[k] = (int *)ast_malloc(nbuckets * sizeof(int));
+		if (!heads[k])
+		{
+			while(k--) ast_free(heads[k]);
+			return(-1);
+		}
+		memset(heads[k],0xff,nbuckets * sizeof(int));
+	}
+	for(k = 0; k < ELDB_NKEYS; k++)
+	{
+		if (d->heads[k]) ast_free(d->heads[k]);
+		d->heads[k] = heads[k];
+	}
+	d->mask = nbuckets - 1;
+	for(i = 0; i < d->nents; i++)
+	{
+		if (!d->ents[i].used) continue;
+		for(k = 0; k < ELDB_NKEYS; k++)
+		{
+			h = eldb_hash(eldb_key(&d->ents[i],k)) & d->mask;
+			d->ents[i].next[k] = d->heads[k][h];
+			d->heads[k][h] = i;
+		}
+	}
+	return(0);
 }
 
-static struct eldb *el_db_find_ipaddr(char *ipaddr)
+static struct eldir *eldir_new(int hint)
 {
-struct eldb **found_key = NULL,key;
+struct eldir *d;
+unsigned int n;
 
-	memset(&key,0,sizeof(key));
-	strncpy(key.ipaddr,ipaddr,sizeof(key.ipaddr) - 1);
-	found_key = (struct eldb **)tfind(&key,&el_db_ipaddr,compare_eldb_ipaddr);
-	if (found_key) return(*found_key);
-	return NULL;
+	d = (struct eldir *)ast_calloc(1,sizeof(struct eldir));
+	if (!d) return NULL;
+	d->freelist = -1;
+	for(n = 1024; (int)n < (hint * 2); n <<= 1);
+	if (eldir_rehash(d,n))
+	{
+		ast_free(d);
+		return NULL;
+	}
+	return(d);
 }
 
-static void el_db_delete_indexes(struct eldb *node)
+static void eldir_free(struct eldir *d)
 {
-struct eldb *mynode;
+int	k;
 
-	if (!node) return;
-	mynode = el_db_find_nodenum(node->nodenum);
-	if (mynode) tdelete(mynode, &el_db_nodenum, compare_eldb_nodenum);
-	mynode = el_db_find_ipaddr(node->ipaddr);
-	if (mynode) tdelete(mynode, &el_db_ipaddr, compare_eldb_ipaddr);
-	mynode = el_db_find_callsign(node->callsign);
-	if (mynode) tdelete(mynode, &el_db_callsign, compare_eldb_callsign);
+	if (!d) return;
+	for(k = 0; k < ELDB_NKEYS; k++)
+	{
+		if (d->heads[k]) ast_free(d->heads[k]);
+	}
+	if (d->ents) ast_free(d->ents);
+	ast_free(d);
 	return;
 }
 
-static void el_db_delete(struct eldb *node)
+static int eldir_find(struct eldir *d, int which, char *key)
 {
-	if (!node) return;
-	el_db_delete_indexes(node);
-	ast_free(node);
+int	i;
+
+	if (!d) return(-1);
+	for(i = d->heads[which][eldb_hash(key) & d->mask]; i >= 0; i = d->ents[i].next[which])
+	{
+		if (!strcmp(eldb_key(&d->ents[i],which),key)) return(i);
+	}
+	return(-1);
+}
+
+static void eldir_unlink(struct eldir *d, int idx)
+{
+int	k,*pp;
+
+	for(k = 0; k < ELDB_NKEYS; k++)
+	{
+		pp = &d->heads[k][eldb_hash(eldb_key(&d->ents[idx],k)) & d->mask];
+		while((*pp >= 0) && (*pp != idx)) pp = &d->ents[*pp].next[k];
+		if (*pp == idx) *pp = d->ents[idx].next[k];
+	}
+	d->ents[idx].used = 0;
+	d->ents[idx].next[0] = d->freelist;
+	d->freelist = idx;
+	d->count--;
 	return;
 }
 
-static struct eldb *el_db_put(char *nodenum,char *ipaddr, char *callsign)
+static struct eldb *eldir_put(struct eldir *d, char *nodenum,char *ipaddr, char *callsign)
 {
-struct eldb *node,*mynode;
+struct eldb key,*e,*ents;
+int	i,k,n;
+unsigned int h;
 
-	node = (struct eldb *)ast_malloc(sizeof(struct eldb));
-	if (!node)
+	memset(&key,0,sizeof(key));
+	strncpy(key.nodenum,nodenum,ELDB_NODENUMLEN - 1);
+	strncpy(key.ipaddr,ipaddr,ELDB_IPADDRLEN - 1);
+	strncpy(key.callsign,callsign,ELDB_CALLSIGNLEN - 1);
+	/* a new entry replaces any with the same node, IP or callsign */
+	for(k = 0; k < ELDB_NKEYS; k++)
 	{
-		ast_log(LOG_NOTICE,"Caannot malloc!!\n");
-		return NULL;
+		i = eldir_find(d,k,eldb_key(&key,k));
+		if (i >= 0) eldir_unlink(d,i);
+	}
+	if (d->freelist >= 0)
+	{
+		i = d->freelist;
+		d->freelist = d->ents[i].next[0];
 	}
-	memset(node,0,sizeof(struct eldb));
-	strncpy(node->nodenum,nodenum,ELDB_NODENUMLEN - 1);
-	strncpy(node->ipaddr,ipaddr,ELDB_IPADDRLEN - 1);
-	strncpy(node->callsign,callsign,ELDB_CALLSIGNLEN - 1);
-	mynode = el_db_find_nodenum(node->nodenum);
-	if (mynode) el_db_delete(mynode);
-	mynode = el_db_find_ipaddr(node->ipaddr);
-	if (mynode) el_db_delete(mynode);
-	mynode = el_db_find_callsign(node->callsign);
-	if (mynode) el_db_delete(mynode);
-	tsearch(node,&el_db_nodenum,compare_eldb_nodenum);
-	tsearch(node,&el_db_ipaddr,compare_eldb_ipaddr);
-	tsearch(node,&el_db_callsign,compare_eldb_callsign);
+	else
+	{
+		if (d->nents >= d->allocents)
+		{
+			n = (d->allocents) ? d->allocents * 2 : 1024;
+			ents = (struct eldb *)ast_realloc(d->ents,n * sizeof(struct eldb));
+			if (!ents)
+			{
+				ast_log(LOG_NOTICE,"Cannot malloc!!\n");
+				return NULL;
+			}
+			d->ents = ents;
+			d->allocents = n;
+		}
+		i = d->nents++;
+	}
+	e = &d->ents[i];
+	*e = key;
+	e->used = 1;
+	for(k = 0; k < ELDB_NKEYS; k++)
+	{
+		h = eldb_hash(eldb_key(e,k)) & d->mask;
+		e->next[k] = d->heads[k][h];
+		d->heads[k][h] = i;
+	}
+	d->count++;
+	/* keep chains short; if this fails the old table still works */
+	if (d->count > (int)(d->mask + 1)) eldir_rehash(d,(d->mask + 1) * 2);
 	if (debug > 1)
 		ast_log(LOG_DEBUG,"eldb put: Node=%s, Call=%s, IP=%s\n",nodenum,callsign,ipaddr);
-	return(node);
+	return(e);
+}
+
+/* lookups in the published directory, el_db_lock must be held */
+static struct eldb *el_db_find_nodenum(char *nodenum)
+{
+struct eldb key;
+int	i;
+
+	memset(&key,0,sizeof(key));
+	strncpy(key.nodenum,nodenum,sizeof(key.nodenum) - 1);
+	i = eldir_find(el_dir,ELDB_NODENUM,key.nodenum);
+	if (i >= 0) return(&el_dir->ents[i]);
+	return NULL;
+}
+
+static struct eldb *el_db_find_callsign(char *callsign)
+{
+struct eldb key;
+int	i;
+
+	memset(&key,0,sizeof(key));
+	strncpy(key.callsign,callsign,sizeof(key.callsign) - 1);
+	i = eldir_find(el_dir,ELDB_CALLSIGN,key.callsign);
+	if (i >= 0) return(&el_dir->ents[i]);
+	return NULL;
+}
+
+static struct eldb *el_db_find_ipaddr(char *ipaddr)
+{
+struct eldb key;
+int	i;
+
+	memset(&key,0,sizeof(key));
+	strncpy(key.ipaddr,ipaddr,sizeof(key.ipaddr) - 1);
+	i = eldir_find(el_dir,ELDB_IPADDR,key.ipaddr);
+	if (i >= 0) return(&el_dir->ents[i]);
+	return NULL;
 }
 
 
@@ -1920,6 +2057,9 @@ static int el_do_debug(int fd, int argc, char *argv[])
 static int el_do_dbdump(int fd, int argc, char *argv[])
 {
 	char c;
+	struct eldb *list = NULL;
+	int i,n = 0;
+
         if (argc < 2)
                 return RESULT_SHOWUSAGE;
 
@@ -1928,13 +2068,25 @@ static int el_do_dbdump(int fd, int argc, char *argv[])
 	{
 		c = tolower(*argv[2]);
 	}
+	/* copy it out, sort and print without holding the lock */
 	ast_mutex_lock(&el_db_lock);
-	nodeoutfd = fd;
-	if (c == 'i') twalk(el_db_ipaddr,print_nodes);
-	else if (c == 'c') twalk(el_db_callsign,print_nodes);
-	else twalk(el_db_nodenum,print_nodes);
-	nodeoutfd = -1;
+	if (el_dir && el_dir->count)
+	{
+		list = (struct eldb *)ast_malloc(el_dir->count * sizeof(struct eldb));
+		for(i = 0; list && (i < el_dir->nents); i++)
+		{
+			if (el_dir->ents[i].used) list[n++] = el_dir->ents[i];
+		}
+	}
 	ast_mutex_unlock(&el_db_lock);
+	if (c == 'i') qsort(list,n,sizeof(struct eldb),compare_eldb_ipaddr);
+	else if (c == 'c') qsort(list,n,sizeof(struct eldb),compare_eldb_callsign);
+	else qsort(list,n,sizeof(struct eldb),compare_eldb_nodenum);
+	for(i = 0; i < n; i++)
+	{
+		ast_cli(fd,"%s|%s|%s\n",list[i].nodenum,list[i].callsign,list[i].ipaddr);
+	}
+	if (list) ast_free(list);
 	return RESULT_SUCCESS;
 }
 
@@ -1946,7 +2098,7 @@ static int el_do_dbdump(int fd, int argc, char *argv[])
 static int el_do_dbget(int fd, int argc, char *argv[])
 {
 	char c;
-	struct eldb *mynode;
+	struct eldb *mynode,node;
 
         if (argc != 4)
                 return RESULT_SHOWUSAGE;
@@ -1956,13 +2108,14 @@ static int el_do_dbget(int fd, int argc, char *argv[])
 	if (c == 'i') mynode = el_db_find_ipaddr(argv[3]);
 	else if (c == 'c') mynode = el_db_find_callsign(argv[3]);
 	else mynode = el_db_find_nodenum(argv[3]);
+	if (mynode) node = *mynode;
 	ast_mutex_unlock(&el_db_lock);
 	if (!mynode)
 	{
 		ast_cli(fd,"Error: Entry for %s not found!\n",argv[3]);
 		return RESULT_FAILURE;
 	}
-	ast_cli(fd,"%s|%s|%s\n",mynode->nodenum,mynode->callsign,mynode->ipaddr);
+	ast_cli(fd,"%s|%s|%s\n",node.nodenum,node.callsign,node.ipaddr);
 	return RESULT_SUCCESS;
 }
 
@@ -2042,6 +2195,10 @@ int	n;
 
         run_forever = 0;
         tdestroy(el_node_list, free_node);
+	ast_mutex_lock(&el_db_lock);
+	eldir_free(el_dir);
+	el_dir = NULL;
+	ast_mutex_unlock(&el_db_lock);
 	for(n = 0; n < ninstances; n++)
 	{
 		if (instances[n]->audio_sock != -1)
@@ -2195,35 +2352,48 @@ static int sendcmd(char *server, struct el_instance *instp)
 
 #define	EL_DIRECTORY_PORT 5200
 
-static void my_stupid_free(void *ptr)
+/* make room for one more partial download record */
+static struct eldelta *el_delta_add(struct eldelta **deltas, int *ndeltas, int *adeltas)
 {
-	ast_free(ptr);
-	return;
-}
+struct eldelta *d;
+int	n;
 
-static void el_zapem(void)
-{
-	ast_mutex_lock(&el_db_lock);
-        tdestroy(el_node_list, my_stupid_free);
-	ast_mutex_unlock(&el_db_lock);
+	if (*ndeltas >= *adeltas)
+	{
+		n = (*adeltas) ? *adeltas * 2 : 256;
+		d = (struct eldelta *)ast_realloc(*deltas,n * sizeof(struct eldelta));
+		if (!d) return NULL;
+		*deltas = d;
+		*adeltas = n;
+	}
+	d = &(*deltas)[(*ndeltas)++];
+	memset(d,0,sizeof(struct eldelta));
+	return(d);
 }
 
-static void el_zapcall(char *call)
+/* apply a partial download to the published directory, el_db_lock held */
+static void el_delta_apply(struct eldelta *deltas, int ndeltas)
 {
-struct eldb *mynode;
+int	i,j;
 
-	if (debug > 1)
-		ast_log(LOG_DEBUG,"zapcall eldb delete Attempt: Call=%s\n",call);
-	ast_mutex_lock(&el_db_lock);
-	mynode = el_db_find_callsign(call);
-	if (mynode)
+	if (!el_dir) el_dir = eldir_new(ndeltas);
+	if (!el_dir) return;
+	for(i = 0; i < ndeltas; i++)
 	{
-		if (debug > 1)
-			ast_log(LOG_DEBUG,"zapcall eldb delete: Node=%s, Call=%s, IP=%s\n",
-				mynode->nodenum,mynode->callsign,mynode->ipaddr);
-		el_db_delete(mynode);
+		/* every record replaces, or deletes, the station's old entry */
+		j = eldir_find(el_dir,ELDB_CALLSIGN,deltas[i].callsign);
+		if (j >= 0)
+		{
+			if (debug > 1)
+				ast_log(LOG_DEBUG,"eldb delete: Node=%s, Call=%s, IP=%s\n",
+					el_dir->ents[j].nodenum,el_dir->ents[j].callsign,
+						el_dir->ents[j].ipaddr);
+			eldir_unlink(el_dir,j);
+		}
+		if (deltas[i].del) continue;
+		eldir_put(el_dir,deltas[i].nodenum,deltas[i].ipaddr,deltas[i].callsign);
 	}
-	ast_mutex_unlock(&el_db_lock);
+	return;
 }
 
 static int el_net_read(int sock,unsigned char *buf1,int buf1len,
@@ -2297,11 +2467,14 @@ struct ast_hostent ah;
 struct hostent *host;
 struct sockaddr_in dirserver;
 char	str[200],ipaddr[50],nodenum[50];
-char	call[50],*pp,*cc;
-int	n = 0,rep_lines,delmode;
+char	call[50],*pp,*cc,newsnap[50];
+int	n = 0,rep_lines,delmode,err;
 int	dir_compressed,dir_partial;
 struct	z_stream_s z;
 int	sock;
+struct	eldir *newdir,*olddir;
+struct	eldelta *deltas,*d;
+int	ndeltas,adeltas;
 
 	sendcmd(hostname,instances[0]);
 	el_net_get_index = 0;
@@ -2405,7 +2578,7 @@ int	sock;
 	}
 	if (dir_compressed)
 	{
-		if(sscanf(str,"%d:%s",&rep_lines,snapshot_id) < 2)
+		if(sscanf(str,"%d:%s",&rep_lines,newsnap) < 2)
 		{
 			ast_log(LOG_ERROR,"Error in parsing header on %s\n",hostname);
 			close(sock);
@@ -2423,8 +2596,24 @@ int	sock;
 			return -1;
 		}	
 	}
+	/* a full download goes into a new directory, a partial one is
+	   collected; either way nobody waits on the network for el_db_lock */
 	delmode = 0;
-	if (!dir_partial) el_zapem();
+	err = 0;
+	newdir = NULL;
+	deltas = NULL;
+	ndeltas = adeltas = 0;
+	if (!dir_partial)
+	{
+		newdir = eldir_new(rep_lines);
+		if (!newdir)
+		{
+			ast_log(LOG_ERROR,"Cannot allocate directory for %s\n",hostname);
+			close(sock);
+			inflateEnd(&z);
+			return -1;
+		}
+	}
 	for(;;)
 	{
 		if (el_net_get_line(sock,str,sizeof(str) - 1,dir_compressed,&z) < 1) break;
@@ -2439,49 +2628,70 @@ int	sock;
 		if (str[strlen(str) - 1] == '\n')
 			str[strlen(str) - 1] = 0;
 		strncpy(call,str,sizeof(call) - 1);
+		d = NULL;
 		if (dir_partial)
 		{
-			el_zapcall(call);
+			d = el_delta_add(&deltas,&ndeltas,&adeltas);
+			if (!d)
+			{
+				err = 1;
+				break;
+			}
+			strncpy(d->callsign,call,ELDB_CALLSIGNLEN - 1);
+			d->del = delmode;
 			if (delmode) continue;
 		}
 		if (el_net_get_line(sock,str,sizeof(str) - 1,dir_compressed,&z) < 1)
 		{
-			ast_log(LOG_ERROR,"Error in directory download on %s\n",hostname);
-			el_zapem();
-			close(sock);
-			inflateEnd(&z);
-			return -1;
+			err = 1;
+			break;
 		}
 		if (el_net_get_line(sock,str,sizeof(str) - 1,dir_compressed,&z) < 1)
 		{
-			ast_log(LOG_ERROR,"Error in directory download on %s\n",hostname);
-			el_zapem();
-			close(sock);
-			inflateEnd(&z);
-			return -1;
+			err = 1;
+			break;
 		}
 		if (str[strlen(str) - 1] == '\n')
 			str[strlen(str) - 1] = 0;
 		strncpy(nodenum,str,sizeof(nodenum) - 1);
 		if (el_net_get_line(sock,str,sizeof(str) - 1,dir_compressed,&z) < 1)
 		{
-			ast_log(LOG_ERROR,"Error in directory download on %s\n",hostname);
-			el_zapem();
-			close(sock);
-			inflateEnd(&z);
-			return -1;
+			err = 1;
+			break;
 		}
 		if (str[strlen(str) - 1] == '\n')
 			str[strlen(str) - 1] = 0;
 		strncpy(ipaddr,str,sizeof(ipaddr) - 1);
-		if (!(n % 10)) usleep(2000); /* To get to dry land */
-		ast_mutex_lock(&el_db_lock);
-		el_db_put(nodenum,ipaddr,call);
-		ast_mutex_unlock(&el_db_lock);
+		if (d)
+		{
+			strncpy(d->nodenum,nodenum,ELDB_NODENUMLEN - 1);
+			strncpy(d->ipaddr,ipaddr,ELDB_IPADDRLEN - 1);
+		}
+		else eldir_put(newdir,nodenum,ipaddr,call);
 		n++;
 	}
 	close(sock);
 	inflateEnd(&z);
+	if (err)
+	{
+		/* keep what we have, and the snapshot it goes with */
+		ast_log(LOG_ERROR,"Error in directory download on %s\n",hostname);
+		eldir_free(newdir);
+		if (deltas) ast_free(deltas);
+		return -1;
+	}
+	olddir = NULL;
+	ast_mutex_lock(&el_db_lock);
+	if (newdir)
+	{
+		olddir = el_dir;
+		el_dir = newdir;
+	}
+	else el_delta_apply(deltas,ndeltas);
+	ast_mutex_unlock(&el_db_lock);
+	eldir_free(olddir);
+	if (deltas) ast_free(deltas);
+	if (dir_compressed) strcpy(snapshot_id,newsnap);
 	pp = (dir_partial) ? "partial" : "full";
 	cc = (dir_compressed) ? "compressed" : "un-compressed";
 	if (option_verbose > 3) ast_verbose(VERBOSE_PREFIX_3 "Directory pgm done downloading(%s,%s), %d records\n",pp,cc,n);
@@ -2589,14 +2799,16 @@ static int do_new_call(struct el_instance *instp, struct el_pvt *p, char *call,
 		strncpy(el_node_key->ip, instp->el_node_test.ip, EL_IP_SIZE);
 		strncpy(el_node_key->name,name,EL_NAME_SIZE); 
 		
+		ast_mutex_lock(&el_db_lock);
 		mynode = el_db_find_ipaddr(el_node_key->ip);
+		if (mynode) ast_copy_string(nodestr,mynode->nodenum,sizeof(nodestr));
+		ast_mutex_unlock(&el_db_lock);
 		if (!mynode)
 		{
 			ast_log(LOG_ERROR, "Cannot find DB entry for IP addr %s\n",el_node_key->ip);
 			ast_free(el_node_key); 
 			return 1;
 		}
-		strncpy(nodestr,mynode->nodenum,sizeof(nodestr) - 1);
 		el_node_key->nodenum = atoi(nodestr);
 		el_node_key->countdown = instp->rtcptimeout;
 		el_node_key->seqnum = 1;
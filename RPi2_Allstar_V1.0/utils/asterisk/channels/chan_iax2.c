@@ -58,6 +58,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include <netdb.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/poll.h>
 #include <regex.h>
 
 #if defined(HAVE_ZAPTEL) || defined (HAVE_DAHDI)
@@ -146,6 +147,10 @@ static int nochecksums = 0;
 
 #define DEFAULT_THREAD_COUNT 10
 #define DEFAULT_MAX_THREAD_COUNT 100
+#define IAX_MMSG_BATCH 32	/*!< datagrams per recvmmsg/sendmmsg */
+#define IAX_MMSG_HIST 6		/*!< batch size buckets: 1, 2-3, 4-7, 8-15, 16-31, 32 */
+#define IAX_TXSHARDS 16		/*!< transmit queue shards, by call number */
+#define IAX_MAX_SOCKS 64
 #define DEFAULT_RETRY_TIME 1000
 #define MEMORY_SIZE 100
 #define DEFAULT_DROP 3
@@ -194,6 +199,15 @@ static struct ast_netsock_list *netsock;
 static struct ast_netsock_list *outsock;		/*!< used if sourceaddress specified and bindaddr == INADDR_ANY */
 static int defaultsockfd = -1;
 
+/*! Sockets the receive thread reads, see rxsock_add() */
+AST_MUTEX_DEFINE_STATIC(rxsocklock);
+static struct {
+	int fd;
+	int out;		/*!< belongs to outsock */
+} rxsocks[IAX_MAX_SOCKS];
+static int rxsockcount;
+static unsigned int rxsockgen;
+
 int (*iax2_regfunk)(const char *username, int onoff) = NULL;
 
 /* Ethernet, etc */
@@ -219,6 +233,7 @@ int (*iax2_regfunk)(const char *username, int onoff) = NULL;
 #define DEFAULT_FREQ_NOTOK	10 * 1000	/* How often to check, if the host is down... */
 
 static	struct io_context *io;
+static	struct io_context *sockio;	/*!< netsock registrations only, never waited on */
 static	struct sched_context *sched;
 
 static int iax2_capability = IAX_CAPABILITY_FULLBANDWIDTH;
@@ -697,10 +712,85 @@ static struct ao2_container *callno_pool_trunk;
 
 static const unsigned int CALLNO_POOL_BUCKETS = 2699;
 
+/*! Frames waiting to be sent, sharded by call number so that the network
+ *  thread and the per-call lookups below only hold one shard at a time */
 static struct ast_iax2_queue {
 	AST_LIST_HEAD(, iax_frame) queue;
 	int count;
-} iaxq;
+} iaxq[IAX_TXSHARDS];
+
+static inline struct ast_iax2_queue *iaxq_shard(int callno)
+{
+	return &iaxq[callno % IAX_TXSHARDS];
+}
+
+/*! Network I/O counters, shown by "iax2 show netio" */
+static struct {
+	int rxbatches;
+	int rxframes;
+	int rxhist[IAX_MMSG_HIST];
+	int rxdropped;		/*!< read, but no helper thread was free */
+	int txbatches;
+	int txframes;
+	int txhist[IAX_MMSG_HIST];
+	int qmax;		/*!< deepest any shard has been */
+} iostats;
+
+static int iostats_bucket(int n)
+{
+	int b = 0;
+
+	while ((n >>= 1) && (b < IAX_MMSG_HIST - 1))
+		b++;
+	return b;
+}
+
+#if defined(__linux__) && defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2,14)
+#define HAVE_MMSG
+#elif __GLIBC_PREREQ(2,12)
+#define HAVE_MMSGHDR		/* recvmmsg only */
+#endif
+#endif
+
+#ifdef HAVE_MMSG
+#define iax_recvmmsg(fd, v, n) recvmmsg(fd, v, n, MSG_DONTWAIT, NULL)
+#define iax_sendmmsg(fd, v, n) sendmmsg(fd, v, n, 0)
+#else
+#ifndef HAVE_MMSGHDR
+struct mmsghdr {
+	struct msghdr msg_hdr;
+	unsigned int msg_len;
+};
+#endif
+
+/* same results as the real calls, one syscall per datagram */
+static int iax_recvmmsg(int fd, struct mmsghdr *v, int n)
+{
+	int x;
+	ssize_t res;
+
+	for (x = 0; x < n; x++) {
+		if ((res = recvmsg(fd, &v[x].msg_hdr, MSG_DONTWAIT)) < 0)
+			return x ? x : -1;
+		v[x].msg_len = res;
+	}
+	return x;
+}
+
+static int iax_sendmmsg(int fd, struct mmsghdr *v, int n)
+{
+	int x;
+	ssize_t res;
+
+	for (x = 0; x < n; x++) {
+		if ((res = sendmsg(fd, &v[x].msg_hdr, 0)) < 0)
+			return x ? x : -1;
+		v[x].msg_len = res;
+	}
+	return x;
+}
+#endif
 
 static int randomcalltokendata;
 
@@ -829,6 +919,8 @@ static int ast_cli_netstats(struct mansession *s, int fd, int limit_fmt);
 
 struct iax2_pkt_buf {
 	AST_LIST_ENTRY(iax2_pkt_buf) entry;
+	struct sockaddr_in sin;
+	int fd;
 	size_t len;
 	unsigned char buf[1];
 };
@@ -869,8 +961,20 @@ struct iax2_thread {
 	} ffinfo;
 	/*! Queued up full frames for processing.  If more full frames arrive for
 	 *  a call which this thread is already processing a full frame for, they
-	 *  are queued up here. */
+	 *  are queued up here, sorted by sequence number. */
 	AST_LIST_HEAD_NOLOCK(, iax2_pkt_buf) full_frames;
+	/*! Later mini frames for the same call from the same receive batch,
+	 *  in arrival order.  They carry no sequence number to sort by. */
+	AST_LIST_HEAD_NOLOCK(, iax2_pkt_buf) mini_frames;
+};
+
+/*! The receive thread and its recvmmsg buffers */
+struct iax2_rxthread {
+	pthread_t threadid;
+	struct mmsghdr msgs[IAX_MMSG_BATCH];
+	struct iovec iov[IAX_MMSG_BATCH];
+	struct sockaddr_in sin[IAX_MMSG_BATCH];
+	unsigned char buf[IAX_MMSG_BATCH][4096];
 };
 
 /* Thread lists */
@@ -880,6 +984,8 @@ static AST_LIST_HEAD_STATIC(dynamic_list, iax2_thread);
 
 static void *iax2_process_thread(void *data);
 
+static struct iax2_rxthread *rxthread;
+
 static void signal_condition(ast_mutex_t *lock, ast_cond_t *cond)
 {
 	ast_mutex_lock(lock);
@@ -1614,14 +1720,14 @@ static void pvt_destructor(void *obj)
 	/* Already gone */
 	ast_set_flag(pvt, IAX_ALREADYGONE);	
 
-	AST_LIST_LOCK(&iaxq.queue);
-	AST_LIST_TRAVERSE(&iaxq.queue, cur, list) {
+	AST_LIST_LOCK(&iaxq_shard(pvt->callno)->queue);
+	AST_LIST_TRAVERSE(&iaxq_shard(pvt->callno)->queue, cur, list) {
 		/* Cancel any pending transmissions */
 		if (cur->callno == pvt->callno) { 
 			cur->retries = -1;
 		}
 	}
-	AST_LIST_UNLOCK(&iaxq.queue);
+	AST_LIST_UNLOCK(&iaxq_shard(pvt->callno)->queue);
 
 	while ((s = AST_LIST_REMOVE_HEAD(&pvt->signaling_queue, next))) {
 		free_signaling_queue_entry(s);
@@ -3007,29 +3113,36 @@ static int transmit_trunk(struct iax_frame *f, struct sockaddr_in *sin, int sock
 	return res;
 }
 
-static int send_packet(struct iax_frame *f)
+/*! \brief Work out where a queued frame goes.  Returns the socket to send
+ * it on, or -1 if it should not be sent.  Called with iaxsl held. */
+static int packet_dest(struct iax_frame *f, struct sockaddr_in *sin)
 {
-	int res;
 	int callno = f->callno;
 
 	/* Don't send if there was an error, but return error instead */
 	if (!callno || !iaxs[callno] || iaxs[callno]->error)
 	    return -1;
 	
-	/* Called with iaxsl held */
 	if (option_debug > 2 && iaxdebug)
 		ast_log(LOG_DEBUG, "Sending %d on %d/%d to %s:%d\n", f->ts, callno, iaxs[callno]->peercallno, ast_inet_ntoa(iaxs[callno]->addr.sin_addr), ntohs(iaxs[callno]->addr.sin_port));
-	if (f->transfer) {
-		if (iaxdebug)
-			iax_showframe(f, NULL, 0, &iaxs[callno]->transfer, f->datalen - sizeof(struct ast_iax2_full_hdr));
-		res = sendto(iaxs[callno]->sockfd, f->data, f->datalen, 0,(struct sockaddr *)&iaxs[callno]->transfer,
-					sizeof(iaxs[callno]->transfer));
-	} else {
-		if (iaxdebug)
-			iax_showframe(f, NULL, 0, &iaxs[callno]->addr, f->datalen - sizeof(struct ast_iax2_full_hdr));
-		res = sendto(iaxs[callno]->sockfd, f->data, f->datalen, 0,(struct sockaddr *)&iaxs[callno]->addr,
-					sizeof(iaxs[callno]->addr));
-	}
+	if (f->transfer)
+		memcpy(sin, &iaxs[callno]->transfer, sizeof(*sin));
+	else
+		memcpy(sin, &iaxs[callno]->addr, sizeof(*sin));
+	if (iaxdebug)
+		iax_showframe(f, NULL, 0, sin, f->datalen - sizeof(struct ast_iax2_full_hdr));
+	return iaxs[callno]->sockfd;
+}
+
+static int send_packet(struct iax_frame *f)
+{
+	int res, sockfd;
+	struct sockaddr_in sin;
+
+	/* Called with iaxsl held */
+	if ((sockfd = packet_dest(f, &sin)) < 0)
+		return -1;
+	res = sendto(sockfd, f->data, f->datalen, 0,(struct sockaddr *)&sin, sizeof(sin));
 	if (res < 0) {
 		if (option_debug && iaxdebug)
 			ast_log(LOG_DEBUG, "Received error: %s\n", strerror(errno));
@@ -3162,10 +3275,10 @@ static void __attempt_transmit(const void *data)
 	/* Do not try again */
 	if (freeme) {
 		/* Don't attempt delivery, just remove it from the queue */
-		AST_LIST_LOCK(&iaxq.queue);
-		AST_LIST_REMOVE(&iaxq.queue, f, list);
-		iaxq.count--;
-		AST_LIST_UNLOCK(&iaxq.queue);
+		AST_LIST_LOCK(&iaxq_shard(f->callno)->queue);
+		AST_LIST_REMOVE(&iaxq_shard(f->callno)->queue, f, list);
+		iaxq_shard(f->callno)->count--;
+		AST_LIST_UNLOCK(&iaxq_shard(f->callno)->queue);
 		f->retrans = -1; /* this is safe because this is the scheduled function */
 		/* Free the IAX frame */
 		iax2_frame_free(f);
@@ -3386,20 +3499,22 @@ static char *complete_iax2_show_peer(const char *line, const char *word, int pos
 static int iax2_show_stats(int fd, int argc, char *argv[])
 {
 	struct iax_frame *cur;
-	int cnt = 0, dead=0, final=0;
+	int cnt = 0, dead=0, final=0, x;
 
 	if (argc != 3)
 		return RESULT_SHOWUSAGE;
 
-	AST_LIST_LOCK(&iaxq.queue);
-	AST_LIST_TRAVERSE(&iaxq.queue, cur, list) {
-		if (cur->retries < 0)
-			dead++;
-		if (cur->final)
-			final++;
-		cnt++;
+	for (x = 0; x < IAX_TXSHARDS; x++) {
+		AST_LIST_LOCK(&iaxq[x].queue);
+		AST_LIST_TRAVERSE(&iaxq[x].queue, cur, list) {
+			if (cur->retries < 0)
+				dead++;
+			if (cur->final)
+				final++;
+			cnt++;
+		}
+		AST_LIST_UNLOCK(&iaxq[x].queue);
 	}
-	AST_LIST_UNLOCK(&iaxq.queue);
 
 	ast_cli(fd, "    IAX Statistics\n");
 	ast_cli(fd, "---------------------\n");
@@ -3697,14 +3812,17 @@ static int schedule_delivery(struct iax_frame *fr, int updatehistory, int fromtr
 
 static int iax2_transmit(struct iax_frame *fr)
 {
+	struct ast_iax2_queue *q = iaxq_shard(fr->callno);
+
 	/* Lock the queue and place this packet at the end */
 	/* By setting this to 0, the network thread will send it for us, and
 	   queue retransmission if necessary */
 	fr->sentyet = 0;
-	AST_LIST_LOCK(&iaxq.queue);
-	AST_LIST_INSERT_TAIL(&iaxq.queue, fr, list);
-	iaxq.count++;
-	AST_LIST_UNLOCK(&iaxq.queue);
+	AST_LIST_LOCK(&q->queue);
+	AST_LIST_INSERT_TAIL(&q->queue, fr, list);
+	if (++q->count > iostats.qmax)
+		iostats.qmax = q->count;
+	AST_LIST_UNLOCK(&q->queue);
 	/* Wake up the network and scheduler thread */
 	if (netthreadid != AST_PTHREADT_NULL)
 		pthread_kill(netthreadid, SIGURG);
@@ -4227,9 +4345,10 @@ static void resend_with_token(int callno, struct iax_frame *f, const char *newto
 	pvt->calltoken_ie_len = data.ied.pos - ie_data_pos; /* new pos minus old pos tells how big token ie is */
 
 	/* ---3.--- */
-	AST_LIST_LOCK(&iaxq.queue);
-	AST_LIST_REMOVE(&iaxq.queue, f, list);
-	AST_LIST_UNLOCK(&iaxq.queue);
+	AST_LIST_LOCK(&iaxq_shard(f->callno)->queue);
+	AST_LIST_REMOVE(&iaxq_shard(f->callno)->queue, f, list);
+	iaxq_shard(f->callno)->count--;
+	AST_LIST_UNLOCK(&iaxq_shard(f->callno)->queue);
 
 	/* ---4.--- */
 	iax2_frame_free(f);
@@ -5996,6 +6115,40 @@ static int iax2_show_threads(int fd, int argc, char *argv[])
 	return RESULT_SUCCESS;
 }
 
+static int iax2_show_netio(int fd, int argc, char *argv[])
+{
+	int x, depth, total = 0;
+	char shards[IAX_TXSHARDS * 6 + 1] = "";
+
+	if (argc != 3)
+		return RESULT_SHOWUSAGE;
+
+	for (x = 0; x < IAX_TXSHARDS; x++) {
+		AST_LIST_LOCK(&iaxq[x].queue);
+		depth = iaxq[x].count;
+		AST_LIST_UNLOCK(&iaxq[x].queue);
+		total += depth;
+		snprintf(shards + strlen(shards), sizeof(shards) - strlen(shards), " %d", depth);
+	}
+	ast_cli(fd, "IAX2 Network I/O (%s)\n",
+#ifdef HAVE_MMSG
+		"recvmmsg/sendmmsg"
+#else
+		"recvmsg/sendmsg"
+#endif
+		);
+	ast_cli(fd, "1 receive thread, batches of up to %d frames\n", IAX_MMSG_BATCH);
+	ast_cli(fd, "%-4s %10s %10s %9s %9s %9s %9s %9s %9s\n", "", "Batches", "Frames", "1", "2-3", "4-7", "8-15", "16-31", "32");
+	ast_cli(fd, "%-4s %10d %10d %9d %9d %9d %9d %9d %9d\n", "RX", iostats.rxbatches, iostats.rxframes,
+		iostats.rxhist[0], iostats.rxhist[1], iostats.rxhist[2], iostats.rxhist[3], iostats.rxhist[4], iostats.rxhist[5]);
+	ast_cli(fd, "%-4s %10d %10d %9d %9d %9d %9d %9d %9d\n", "TX", iostats.txbatches, iostats.txframes,
+		iostats.txhist[0], iostats.txhist[1], iostats.txhist[2], iostats.txhist[3], iostats.txhist[4], iostats.txhist[5]);
+	ast_cli(fd, "Received frames dropped for lack of a helper thread: %d\n", iostats.rxdropped);
+	ast_cli(fd, "Transmit queue: %d frames, deepest shard %d\n", total, iostats.qmax);
+	ast_cli(fd, "Per shard:%s\n", shards);
+	return RESULT_SUCCESS;
+}
+
 static int iax2_show_peers(int fd, int argc, char *argv[])
 {
 	return __iax2_show_peers(0, fd, NULL, argc, argv);
@@ -7250,15 +7403,15 @@ static int complete_transfer(int callno, struct iax_ies *ies)
 	pvt->lastsent = 0;
 	pvt->nextpred = 0;
 	pvt->pingtime = DEFAULT_RETRY_TIME;
-	AST_LIST_LOCK(&iaxq.queue);
-	AST_LIST_TRAVERSE(&iaxq.queue, cur, list) {
+	AST_LIST_LOCK(&iaxq_shard(callno)->queue);
+	AST_LIST_TRAVERSE(&iaxq_shard(callno)->queue, cur, list) {
 		/* We must cancel any packets that would have been transmitted
 		   because now we're talking to someone new.  It's okay, they
 		   were transmitted to someone that didn't care anyway. */
 		if (callno == cur->callno) 
 			cur->retries = -1;
 	}
-	AST_LIST_UNLOCK(&iaxq.queue);
+	AST_LIST_UNLOCK(&iaxq_shard(callno)->queue);
 	return 0; 
 }
 
@@ -7848,8 +8001,8 @@ static void vnak_retransmit(int callno, int last)
 {
 	struct iax_frame *f;
 
-	AST_LIST_LOCK(&iaxq.queue);
-	AST_LIST_TRAVERSE(&iaxq.queue, f, list) {
+	AST_LIST_LOCK(&iaxq_shard(callno)->queue);
+	AST_LIST_TRAVERSE(&iaxq_shard(callno)->queue, f, list) {
 		/* Send a copy immediately */
 		if ((f->callno == callno) && iaxs[f->callno] &&
 			((unsigned char ) (f->oseqno - last) < 128) &&
@@ -7857,7 +8010,7 @@ static void vnak_retransmit(int callno, int last)
 			send_packet(f);
 		}
 	}
-	AST_LIST_UNLOCK(&iaxq.queue);
+	AST_LIST_UNLOCK(&iaxq_shard(callno)->queue);
 }
 
 static void __iax2_poke_peer_s(const void *data)
@@ -8214,7 +8367,7 @@ static void save_rr(struct iax_frame *fr, struct iax_ies *ies)
 static int socket_process(struct iax2_thread *thread);
 
 /*!
- * \brief Handle any deferred full frames for this thread
+ * \brief Handle any deferred full frames for this thread, then its mini frames
  */
 static void handle_deferred_full_frames(struct iax2_thread *thread)
 {
@@ -8222,12 +8375,15 @@ static void handle_deferred_full_frames(struct iax2_thread *thread)
 
 	ast_mutex_lock(&thread->lock);
 
-	while ((pkt_buf = AST_LIST_REMOVE_HEAD(&thread->full_frames, entry))) {
+	while ((pkt_buf = AST_LIST_REMOVE_HEAD(&thread->full_frames, entry)) ||
+	       (pkt_buf = AST_LIST_REMOVE_HEAD(&thread->mini_frames, entry))) {
 		ast_mutex_unlock(&thread->lock);
 
 		thread->buf = pkt_buf->buf;
 		thread->buf_len = pkt_buf->len;
 		thread->buf_size = pkt_buf->len + 1;
+		thread->iofd = pkt_buf->fd;
+		memcpy(&thread->iosin, &pkt_buf->sin, sizeof(thread->iosin));
 		
 		socket_process(thread);
 
@@ -8240,23 +8396,34 @@ static void handle_deferred_full_frames(struct iax2_thread *thread)
 	ast_mutex_unlock(&thread->lock);
 }
 
+static struct iax2_pkt_buf *pkt_buf_new(const unsigned char *buf, size_t len, const struct sockaddr_in *sin, int fd)
+{
+	struct iax2_pkt_buf *pkt_buf;
+
+	if (!(pkt_buf = ast_calloc(1, sizeof(*pkt_buf) + len)))
+		return NULL;
+
+	pkt_buf->len = len;
+	memcpy(pkt_buf->buf, buf, len);
+	memcpy(&pkt_buf->sin, sin, sizeof(pkt_buf->sin));
+	pkt_buf->fd = fd;
+	return pkt_buf;
+}
+
 /*!
- * \brief Queue the last read full frame for processing by a certain thread
+ * \brief Queue a received full frame for processing by a certain thread
  *
  * If there are already any full frames queued, they are sorted
  * by sequence number.
  */
-static void defer_full_frame(struct iax2_thread *from_here, struct iax2_thread *to_here)
+static void defer_full_frame(struct iax2_thread *to_here, const unsigned char *buf, size_t len, const struct sockaddr_in *sin, int fd)
 {
 	struct iax2_pkt_buf *pkt_buf, *cur_pkt_buf;
 	struct ast_iax2_full_hdr *fh, *cur_fh;
 
-	if (!(pkt_buf = ast_calloc(1, sizeof(*pkt_buf) + from_here->buf_len)))
+	if (!(pkt_buf = pkt_buf_new(buf, len, sin, fd)))
 		return;
 
-	pkt_buf->len = from_here->buf_len;
-	memcpy(pkt_buf->buf, from_here->buf, pkt_buf->len);
-
 	fh = (struct ast_iax2_full_hdr *) pkt_buf->buf;
 	ast_mutex_lock(&to_here->lock);
 	AST_LIST_TRAVERSE_SAFE_BEGIN(&to_here->full_frames, cur_pkt_buf, entry) {
@@ -8274,83 +8441,248 @@ static void defer_full_frame(struct iax2_thread *from_here, struct iax2_thread *
 	ast_mutex_unlock(&to_here->lock);
 }
 
-static int socket_read(int *id, int fd, short events, void *cbdata)
+/*!
+ * \brief Queue a received mini frame behind whatever the thread was already
+ * given, in arrival order
+ */
+static void append_mini_frame(struct iax2_thread *to_here, const unsigned char *buf, size_t len, const struct sockaddr_in *sin, int fd)
 {
+	struct iax2_pkt_buf *pkt_buf;
+
+	if (!(pkt_buf = pkt_buf_new(buf, len, sin, fd)))
+		return;
+
+	ast_mutex_lock(&to_here->lock);
+	AST_LIST_INSERT_TAIL(&to_here->mini_frames, pkt_buf, entry);
+	ast_mutex_unlock(&to_here->lock);
+}
+
+/*!
+ * \brief Sockets the receive threads poll
+ *
+ * The netsock lists own the sockets, but register them in sockio, which
+ * nobody waits on.  Each receive thread keeps its own pollfd copy of this
+ * table and rebuilds it when rxsockgen moves.
+ */
+static void rxsock_add(int fd, int out)
+{
+	int x;
+
+	ast_mutex_lock(&rxsocklock);
+	for (x = 0; x < rxsockcount; x++) {
+		if (rxsocks[x].fd == fd)
+			break;
+	}
+	if (x < rxsockcount) {
+		ast_mutex_unlock(&rxsocklock);
+		return;
+	}
+	if (rxsockcount >= IAX_MAX_SOCKS) {
+		ast_mutex_unlock(&rxsocklock);
+		ast_log(LOG_WARNING, "Too many IAX2 sockets, not reading from fd %d\n", fd);
+		return;
+	}
+	rxsocks[rxsockcount].fd = fd;
+	rxsocks[rxsockcount].out = out;
+	rxsockcount++;
+	rxsockgen++;
+	ast_mutex_unlock(&rxsocklock);
+}
+
+/*! \brief Forget the outsock sockets, before that list is released */
+static void rxsock_purge_out(void)
+{
+	int x, y;
+
+	ast_mutex_lock(&rxsocklock);
+	for (x = y = 0; x < rxsockcount; x++) {
+		if (!rxsocks[x].out)
+			rxsocks[y++] = rxsocks[x];
+	}
+	rxsockcount = y;
+	rxsockgen++;
+	ast_mutex_unlock(&rxsocklock);
+}
+
+/*!
+ * \brief Hand out one recvmmsg batch to the helper threads
+ *
+ * Frames are sharded by the sender's call number: the first frame for a
+ * call in the batch picks a thread, and the rest for that call are queued
+ * behind it, so the thread is only woken once for them.  Full frames only
+ * queue behind a thread that owns a full frame for the call, sorted by
+ * sequence number; mini frames queue in arrival order.  Nobody is
+ * signalled until the whole batch has been handed out.
+ */
+static void socket_dispatch(struct iax2_rxthread *rxt, int fd, int count)
+{
+	struct {
+		unsigned short callno;
+		int full;
+		struct sockaddr_in *sin;
+		struct iax2_thread *thread;
+	} owner[IAX_MMSG_BATCH];
 	struct iax2_thread *thread;
-	socklen_t len;
+	struct ast_iax2_full_hdr *fh;
+	unsigned short callno;
 	time_t t;
 	static time_t last_errtime = 0;
-	struct ast_iax2_full_hdr *fh;
+	int x, y, owners = 0, full;
+	size_t len;
 
-	if (!(thread = find_idle_thread())) {
-		sys_uptime(&t);
-		if (t != last_errtime && option_debug)
-			ast_log(LOG_DEBUG, "Out of idle IAX2 threads for I/O, pausing!\n");
-		last_errtime = t;
-		usleep(1);
-		return 1;
-	}
+	for (x = 0; x < count; x++) {
+		len = rxt->msgs[x].msg_len;
+		if (test_losspct && ((100.0 * ast_random() / (RAND_MAX + 1.0)) < test_losspct)) /* simulate random loss condition */
+			continue;
 
-	len = sizeof(thread->iosin);
-	thread->iofd = fd;
-	thread->buf_len = recvfrom(fd, thread->readbuf, sizeof(thread->readbuf), 0, (struct sockaddr *) &thread->iosin, &len);
-	thread->buf_size = sizeof(thread->readbuf);
-	thread->buf = thread->readbuf;
-	if (thread->buf_len < 0) {
-		if (errno != ECONNREFUSED && errno != EAGAIN)
-			ast_log(LOG_WARNING, "Error: %s\n", strerror(errno));
-		handle_error();
-		thread->iostate = IAX_IOSTATE_IDLE;
-		signal_condition(&thread->lock, &thread->cond);
-		return 1;
-	}
-	if (test_losspct && ((100.0 * ast_random() / (RAND_MAX + 1.0)) < test_losspct)) { /* simulate random loss condition */
-		thread->iostate = IAX_IOSTATE_IDLE;
-		signal_condition(&thread->lock, &thread->cond);
-		return 1;
-	}
-	
-	/* Determine if this frame is a full frame; if so, and any thread is currently
-	   processing a full frame for the same callno from this peer, then drop this
-	   frame (and the peer will retransmit it) */
-	fh = (struct ast_iax2_full_hdr *) thread->buf;
-	if (ntohs(fh->scallno) & IAX_FLAG_FULL) {
-		struct iax2_thread *cur = NULL;
-		uint16_t callno = ntohs(fh->scallno) & ~IAX_FLAG_FULL;
-		
-		AST_LIST_LOCK(&active_list);
-		AST_LIST_TRAVERSE(&active_list, cur, list) {
-			if ((cur->ffinfo.callno == callno) &&
-			    !inaddrcmp(&cur->ffinfo.sin, &thread->iosin))
+		/* scallno is in the same place in mini and full frames */
+		fh = (struct ast_iax2_full_hdr *) rxt->buf[x];
+		callno = 0;
+		full = 0;
+		if (len >= sizeof(fh->scallno)) {
+			callno = ntohs(fh->scallno) & ~IAX_FLAG_FULL;
+			full = ntohs(fh->scallno) & IAX_FLAG_FULL;
+		}
+		for (y = 0; y < owners; y++) {
+			if ((owner[y].callno == callno) && (owner[y].full || !full) &&
+			    !inaddrcmp(owner[y].sin, &rxt->sin[x]))
 				break;
 		}
-		if (cur) {
-			/* we found another thread processing a full frame for this call,
-			   so queue it up for processing later. */
-			defer_full_frame(thread, cur);
-			AST_LIST_UNLOCK(&active_list);
-			thread->iostate = IAX_IOSTATE_IDLE;
-			signal_condition(&thread->lock, &thread->cond);
-			return 1;
-		} else {
+		if (y < owners) {
+			if (full)
+				defer_full_frame(owner[y].thread, rxt->buf[x], len, &rxt->sin[x], fd);
+			else
+				append_mini_frame(owner[y].thread, rxt->buf[x], len, &rxt->sin[x], fd);
+			continue;
+		}
+
+		/* Determine if this frame is a full frame; if so, and any thread is currently
+		   processing a full frame for the same callno from this peer, then queue it
+		   up behind that one.  active_list stays locked until the thread picked
+		   below is on it, so nobody else can pick a second thread for the call. */
+		if (full) {
+			AST_LIST_LOCK(&active_list);
+			AST_LIST_TRAVERSE(&active_list, thread, list) {
+				if ((thread->ffinfo.callno == callno) &&
+				    !inaddrcmp(&thread->ffinfo.sin, &rxt->sin[x]))
+					break;
+			}
+			if (thread) {
+				defer_full_frame(thread, rxt->buf[x], len, &rxt->sin[x], fd);
+				AST_LIST_UNLOCK(&active_list);
+				continue;
+			}
+		}
+
+		if (!(thread = find_idle_thread())) {
+			if (full)
+				AST_LIST_UNLOCK(&active_list);
+			sys_uptime(&t);
+			if (t != last_errtime && option_debug)
+				ast_log(LOG_DEBUG, "Out of idle IAX2 threads for I/O, dropping frame!\n");
+			last_errtime = t;
+			ast_atomic_fetchadd_int(&iostats.rxdropped, 1);
+			continue;
+		}
+
+		thread->iofd = fd;
+		memcpy(&thread->iosin, &rxt->sin[x], sizeof(thread->iosin));
+		memcpy(thread->readbuf, rxt->buf[x], len);
+		thread->buf_len = len;
+		thread->buf_size = sizeof(thread->readbuf);
+		thread->buf = thread->readbuf;
+
+		if (full) {
 			/* this thread is going to process this frame, so mark it */
 			thread->ffinfo.callno = callno;
 			memcpy(&thread->ffinfo.sin, &thread->iosin, sizeof(thread->ffinfo.sin));
 			thread->ffinfo.type = fh->type;
 			thread->ffinfo.csub = fh->csub;
 			AST_LIST_INSERT_HEAD(&active_list, thread, list);
+			AST_LIST_UNLOCK(&active_list);
 		}
-		AST_LIST_UNLOCK(&active_list);
+
+		owner[owners].callno = callno;
+		owner[owners].full = full;
+		owner[owners].sin = &rxt->sin[x];
+		owner[owners].thread = thread;
+		owners++;
 	}
-	
-	/* Mark as ready and send on its way */
-	thread->iostate = IAX_IOSTATE_READY;
+
+	/* Mark as ready and send them on their way */
+	for (y = 0; y < owners; y++) {
+		owner[y].thread->iostate = IAX_IOSTATE_READY;
 #ifdef DEBUG_SCHED_MULTITHREAD
-	ast_copy_string(thread->curfunc, "socket_process", sizeof(thread->curfunc));
+		ast_copy_string(owner[y].thread->curfunc, "socket_process", sizeof(owner[y].thread->curfunc));
 #endif
-	signal_condition(&thread->lock, &thread->cond);
+		signal_condition(&owner[y].thread->lock, &owner[y].thread->cond);
+	}
+}
 
-	return 1;
+static void socket_read(struct iax2_rxthread *rxt, int fd)
+{
+	int x, res;
+
+	for (x = 0; x < IAX_MMSG_BATCH; x++) {
+		rxt->iov[x].iov_base = rxt->buf[x];
+		rxt->iov[x].iov_len = sizeof(rxt->buf[x]);
+		memset(&rxt->msgs[x].msg_hdr, 0, sizeof(rxt->msgs[x].msg_hdr));
+		rxt->msgs[x].msg_hdr.msg_name = &rxt->sin[x];
+		rxt->msgs[x].msg_hdr.msg_namelen = sizeof(rxt->sin[x]);
+		rxt->msgs[x].msg_hdr.msg_iov = &rxt->iov[x];
+		rxt->msgs[x].msg_hdr.msg_iovlen = 1;
+	}
+	res = iax_recvmmsg(fd, rxt->msgs, IAX_MMSG_BATCH);
+	if (res < 0) {
+		if (errno != ECONNREFUSED && errno != EAGAIN)
+			ast_log(LOG_WARNING, "Error: %s\n", strerror(errno));
+		handle_error();
+		return;
+	}
+	if (!res)
+		return;
+	ast_atomic_fetchadd_int(&iostats.rxbatches, 1);
+	ast_atomic_fetchadd_int(&iostats.rxframes, res);
+	ast_atomic_fetchadd_int(&iostats.rxhist[iostats_bucket(res)], 1);
+	socket_dispatch(rxt, fd, res);
+}
+
+static void *iax2_rx_thread(void *data)
+{
+	struct iax2_rxthread *rxt = data;
+	struct pollfd fds[IAX_MAX_SOCKS];
+	unsigned int gen = 0;
+	int nfds = 0, x, res;
+
+	for(;;) {
+		ast_mutex_lock(&rxsocklock);
+		if ((gen != rxsockgen) || !nfds) {
+			/* one reader for every socket, so all the frames for a
+			   call go through the same socket_dispatch() in order */
+			for (nfds = 0, x = 0; x < rxsockcount; x++) {
+				fds[nfds].fd = rxsocks[x].fd;
+				fds[nfds].events = POLLIN;
+				fds[nfds].revents = 0;
+				nfds++;
+			}
+			gen = rxsockgen;
+		}
+		ast_mutex_unlock(&rxsocklock);
+
+		/* Wake up now and then to notice sockets bound on reload */
+		res = poll(fds, nfds, 1000);
+		if (res < 1)
+			continue;
+
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		for (x = 0; x < nfds; x++) {
+			/* a pending ICMP error is cleared by reading */
+			if (fds[x].revents & (POLLIN | POLLERR))
+				socket_read(rxt, fds[x].fd);
+		}
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+	}
+	return NULL;
 }
 
 static int socket_process(struct iax2_thread *thread)
@@ -8806,8 +9138,8 @@ blow up, and will be removed as soon as possible */
 					if (option_debug && iaxdebug)
 						ast_log(LOG_DEBUG, "Cancelling transmission of packet %d\n", x);
 					call_to_destroy = 0;
-					AST_LIST_LOCK(&iaxq.queue);
-					AST_LIST_TRAVERSE(&iaxq.queue, cur, list) {
+					AST_LIST_LOCK(&iaxq_shard(fr->callno)->queue);
+					AST_LIST_TRAVERSE(&iaxq_shard(fr->callno)->queue, cur, list) {
 						/* If it's our call, and our timestamp, mark -1 retries */
 						if ((fr->callno == cur->callno) && (x == cur->oseqno)) {
 							cur->retries = -1;
@@ -8816,7 +9148,7 @@ blow up, and will be removed as soon as possible */
 								call_to_destroy = fr->callno;
 						}
 					}
-					AST_LIST_UNLOCK(&iaxq.queue);
+					AST_LIST_UNLOCK(&iaxq_shard(fr->callno)->queue);
 					if (call_to_destroy) {
 						if (iaxdebug && option_debug)
 							ast_log(LOG_DEBUG, "Really destroying %d, having been acked on final message\n", call_to_destroy);
@@ -8985,13 +9317,13 @@ retryowner:
 			case IAX_COMMAND_TXACC:
 				if (iaxs[fr->callno]->transferring == TRANSFER_BEGIN) {
 					/* Ack the packet with the given timestamp */
-					AST_LIST_LOCK(&iaxq.queue);
-					AST_LIST_TRAVERSE(&iaxq.queue, cur, list) {
+					AST_LIST_LOCK(&iaxq_shard(fr->callno)->queue);
+					AST_LIST_TRAVERSE(&iaxq_shard(fr->callno)->queue, cur, list) {
 						/* Cancel any outstanding txcnt's */
 						if ((fr->callno == cur->callno) && (cur->transfer))
 							cur->retries = -1;
 					}
-					AST_LIST_UNLOCK(&iaxq.queue);
+					AST_LIST_UNLOCK(&iaxq_shard(fr->callno)->queue);
 					memset(&ied1, 0, sizeof(ied1));
 					iax_ie_append_short(&ied1, IAX_IE_CALLNO, iaxs[fr->callno]->callno);
 					send_command(iaxs[fr->callno], AST_FRAME_IAX, IAX_COMMAND_TXREADY, 0, ied1.buf, ied1.pos, -1);
@@ -9827,14 +10159,14 @@ retryowner2:
 				break;	
 			case IAX_COMMAND_TXMEDIA:
 				if (iaxs[fr->callno]->transferring == TRANSFER_READY) {
-                                        AST_LIST_LOCK(&iaxq.queue);
-                                        AST_LIST_TRAVERSE(&iaxq.queue, cur, list) {
+                                        AST_LIST_LOCK(&iaxq_shard(fr->callno)->queue);
+                                        AST_LIST_TRAVERSE(&iaxq_shard(fr->callno)->queue, cur, list) {
                                                 /* Cancel any outstanding frames and start anew */
                                                 if ((fr->callno == cur->callno) && (cur->transfer)) {
                                                         cur->retries = -1;
                                                 }
                                         }
-                                        AST_LIST_UNLOCK(&iaxq.queue);
+                                        AST_LIST_UNLOCK(&iaxq_shard(fr->callno)->queue);
 					/* Start sending our media to the transfer address, but otherwise leave the call as-is */
 					iaxs[fr->callno]->transferring = TRANSFER_MEDIAPASS;
 				}
@@ -9867,8 +10199,8 @@ retryowner2:
 			case IAX_COMMAND_CALLTOKEN:
 			{
 				struct iax_frame *cur;
-				AST_LIST_LOCK(&iaxq.queue);
-				AST_LIST_TRAVERSE(&iaxq.queue, cur, list) {
+				AST_LIST_LOCK(&iaxq_shard(fr->callno)->queue);
+				AST_LIST_TRAVERSE(&iaxq_shard(fr->callno)->queue, cur, list) {
 					/* find the last sent frame in our frame queue for this callno.
 					 * There are many things to take into account before resending this frame.
 					 * All of these are taken care of in resend_with_token() */
@@ -9876,7 +10208,7 @@ retryowner2:
 						break;
 					}
 				}
-				AST_LIST_UNLOCK(&iaxq.queue);
+				AST_LIST_UNLOCK(&iaxq_shard(fr->callno)->queue);
 
 				/* find last sent frame */
 				if (cur && ies.calltoken && ies.calltokendata) {
@@ -10548,57 +10880,139 @@ static void *sched_thread(void *ignore)
 	return NULL;
 }
 
+/*! Frames gathered from one transmit queue shard for a single sendmmsg */
+struct iax2_txbatch {
+	int fd;
+	int count;
+	struct mmsghdr msgs[IAX_MMSG_BATCH];
+	struct iovec iov[IAX_MMSG_BATCH];
+	struct sockaddr_in sin[IAX_MMSG_BATCH];
+	struct iax_frame *frames[IAX_MMSG_BATCH];
+};
+
+/*! \brief Free a sent frame, or schedule its retransmission */
+static void sent_frame(struct iax_frame *f)
+{
+	if (f->retries < 0) {
+		/* This is not supposed to be retransmitted.  It has already been
+		   taken off the queue. */
+		iax_frame_free(f);
+	} else {
+		/* We need reliable delivery.  Schedule a retransmission */
+		f->retries++;
+		f->retrans = iax2_sched_add(sched, f->retrytime, attempt_transmit, f);
+	}
+}
+
+/*! \brief Send a batch.  Called with the shard locked. */
+static void flush_txbatch(struct iax2_txbatch *tb)
+{
+	int x, res;
+
+	if (!tb->count)
+		return;
+	for (x = 0; x < tb->count; ) {
+		res = iax_sendmmsg(tb->fd, tb->msgs + x, tb->count - x);
+		if (res < 1) {
+			/* skip the one that failed, as sendto would have */
+			if (option_debug && iaxdebug)
+				ast_log(LOG_DEBUG, "Received error: %s\n", strerror(errno));
+			handle_error();
+			res = 1;
+		}
+		x += res;
+	}
+	iostats.txbatches++;
+	iostats.txframes += tb->count;
+	iostats.txhist[iostats_bucket(tb->count)]++;
+	for (x = 0; x < tb->count; x++)
+		sent_frame(tb->frames[x]);
+	tb->count = 0;
+}
+
+/*! \brief Add a frame to the batch, sending the batch first if it is full
+ * or for another socket.  Called with the shard and the frame's pvt locked. */
+static void add_txbatch(struct iax2_txbatch *tb, struct iax_frame *f)
+{
+	struct sockaddr_in sin;
+	struct msghdr *m;
+	int fd;
+
+	if ((fd = packet_dest(f, &sin)) < 0) {
+		sent_frame(f);
+		return;
+	}
+	if ((tb->count == IAX_MMSG_BATCH) || (tb->count && (tb->fd != fd)))
+		flush_txbatch(tb);
+	tb->fd = fd;
+	memcpy(&tb->sin[tb->count], &sin, sizeof(sin));
+	tb->iov[tb->count].iov_base = f->data;
+	tb->iov[tb->count].iov_len = f->datalen;
+	m = &tb->msgs[tb->count].msg_hdr;
+	memset(m, 0, sizeof(*m));
+	m->msg_name = &tb->sin[tb->count];
+	m->msg_namelen = sizeof(tb->sin[tb->count]);
+	m->msg_iov = &tb->iov[tb->count];
+	m->msg_iovlen = 1;
+	tb->frames[tb->count++] = f;
+}
+
 static void *network_thread(void *ignore)
 {
-	/* Our job is simple: Send queued messages, retrying if necessary.  Read frames 
-	   from the network, and queue them for delivery to the channels */
-	int res, count, wakeup;
+	/* Our job is simple: Send queued messages, retrying if necessary.  The
+	   receive threads read frames from the network. */
+	int res, count, wakeup, x;
 	struct iax_frame *f;
+	struct ast_iax2_queue *q;
+	struct iax2_txbatch tb;
 
 	if (timingfd > -1)
 		ast_io_add(io, timingfd, timing_read, AST_IO_IN | AST_IO_PRI, NULL);
 	
+	tb.count = 0;
 	for(;;) {
 		pthread_testcancel();
 
-		/* Go through the queue, sending messages which have not yet been
-		   sent, and scheduling retransmissions if appropriate */
-		AST_LIST_LOCK(&iaxq.queue);
+		/* Go through the queues, sending messages which have not yet been
+		   sent, and scheduling retransmissions if appropriate.  Each shard
+		   goes out in as few sendmmsg calls as it can, before the next one
+		   is locked. */
 		count = 0;
 		wakeup = -1;
-		AST_LIST_TRAVERSE_SAFE_BEGIN(&iaxq.queue, f, list) {
-			if (f->sentyet)
-				continue;
-			
-			/* Try to lock the pvt, if we can't... don't fret - defer it till later */
-			if (ast_mutex_trylock(&iaxsl[f->callno])) {
-				wakeup = 1;
-				continue;
-			}
+		for (x = 0; x < IAX_TXSHARDS; x++) {
+			q = &iaxq[x];
+			AST_LIST_LOCK(&q->queue);
+			AST_LIST_TRAVERSE_SAFE_BEGIN(&q->queue, f, list) {
+				if (f->sentyet)
+					continue;
+				
+				/* Try to lock the pvt, if we can't... don't fret - defer it till later */
+				if (ast_mutex_trylock(&iaxsl[f->callno])) {
+					wakeup = 1;
+					continue;
+				}
 
-			f->sentyet++;
+				f->sentyet++;
 
-			if (iaxs[f->callno]) {
-				send_packet(f);
-				count++;
-			} 
+				/* Frames which will not be retransmitted leave the queue now,
+				   and are freed once the batch holding them is sent */
+				if (f->retries < 0) {
+					AST_LIST_REMOVE_CURRENT(&q->queue, list);
+					q->count--;
+				}
 
-			ast_mutex_unlock(&iaxsl[f->callno]);
+				if (iaxs[f->callno]) {
+					add_txbatch(&tb, f);
+					count++;
+				} else
+					sent_frame(f);
 
-			if (f->retries < 0) {
-				/* This is not supposed to be retransmitted */
-				AST_LIST_REMOVE_CURRENT(&iaxq.queue, list);
-				iaxq.count--;
-				/* Free the iax frame */
-				iax_frame_free(f);
-			} else {
-				/* We need reliable delivery.  Schedule a retransmission */
-				f->retries++;
-				f->retrans = iax2_sched_add(sched, f->retrytime, attempt_transmit, f);
+				ast_mutex_unlock(&iaxsl[f->callno]);
 			}
+			AST_LIST_TRAVERSE_SAFE_END
+			flush_txbatch(&tb);
+			AST_LIST_UNLOCK(&q->queue);
 		}
-		AST_LIST_TRAVERSE_SAFE_END
-		AST_LIST_UNLOCK(&iaxq.queue);
 
 		pthread_testcancel();
 
@@ -10639,6 +11053,13 @@ static int start_network_thread(void)
 			AST_LIST_UNLOCK(&idle_list);
 		}
 	}
+	if ((rxthread = ast_calloc(1, sizeof(*rxthread)))) {
+		if (ast_pthread_create(&rxthread->threadid, NULL, iax2_rx_thread, rxthread)) {
+			ast_log(LOG_WARNING, "Failed to create receive thread!\n");
+			free(rxthread);
+			rxthread = NULL;
+		}
+	}
 	ast_pthread_create_background(&schedthreadid, NULL, sched_thread, NULL);
 	ast_pthread_create_background(&netthreadid, NULL, network_thread, NULL);
 	if (option_verbose > 1)
@@ -10741,9 +11162,10 @@ static int peer_set_srcaddr(struct iax2_peer *peer, const char *srcaddr)
 				sin.sin_addr.s_addr = INADDR_ANY;
 				if (ast_netsock_find(netsock, &sin)) {
 					sin.sin_addr.s_addr = orig_saddr;
-					sock = ast_netsock_bind(outsock, io, srcaddr, port, tos, socket_read, NULL);
+					sock = ast_netsock_bind(outsock, sockio, srcaddr, port, tos, NULL, NULL);
 					if (sock) {
 						sockfd = ast_netsock_sockfd(sock);
+						rxsock_add(sockfd, 1);
 						ast_netsock_unref(sock);
 						nonlocal = 0;
 					} else {
@@ -11504,7 +11926,7 @@ static int set_config(const char *config_file, int reload)
 			if (reload) {
 				ast_log(LOG_NOTICE, "Ignoring bindaddr on reload\n");
 			} else {
-				if (!(ns = ast_netsock_bind(netsock, io, v->value, portno, tos, socket_read, NULL))) {
+				if (!(ns = ast_netsock_bind(netsock, sockio, v->value, portno, tos, NULL, NULL))) {
 					ast_log(LOG_WARNING, "Unable apply binding to '%s' at line %d\n", v->value, v->lineno);
 				} else {
 					if (option_verbose > 1) {
@@ -11515,6 +11937,7 @@ static int set_config(const char *config_file, int reload)
 					}
 					if (defaultsockfd < 0) 
 						defaultsockfd = ast_netsock_sockfd(ns);
+					rxsock_add(ast_netsock_sockfd(ns), 0);
 					ast_netsock_unref(ns);
 				}
 			}
@@ -11652,16 +12075,18 @@ static int set_config(const char *config_file, int reload)
 	}
 	
 	if (defaultsockfd < 0) {
-		if (!(ns = ast_netsock_bind(netsock, io, "0.0.0.0", portno, tos, socket_read, NULL))) {
+		if (!(ns = ast_netsock_bind(netsock, sockio, "0.0.0.0", portno, tos, NULL, NULL))) {
 			ast_log(LOG_ERROR, "Unable to create network socket: %s\n", strerror(errno));
 		} else {
 			if (option_verbose > 1)
 				ast_verbose(VERBOSE_PREFIX_2 "Binding IAX2 to default address 0.0.0.0:%d\n", portno);
 			defaultsockfd = ast_netsock_sockfd(ns);
+			rxsock_add(defaultsockfd, 0);
 			ast_netsock_unref(ns);
 		}
 	}
 	if (reload) {
+		rxsock_purge_out();
 		ast_netsock_release(outsock);
 		outsock = ast_netsock_list_alloc();
 		if (!outsock) {
@@ -12353,6 +12778,10 @@ static char show_threads_usage[] =
 "Usage: iax2 show threads\n"
 "       Lists status of IAX helper threads\n";
 
+static char show_netio_usage[] = 
+"Usage: iax2 show netio\n"
+"       Shows receive and transmit batch sizes and transmit queue depths\n";
+
 static char show_peers_usage[] = 
 "Usage: iax2 show peers [registered] [like <pattern>]\n"
 "       Lists all known IAX2 peers.\n"
@@ -12467,6 +12896,10 @@ static struct ast_cli_entry cli_iax2[] = {
 	iax2_show_threads, "Display IAX helper thread info",
 	show_threads_usage, NULL, },
 
+	{ { "iax2", "show", "netio", NULL },
+	iax2_show_netio, "Display IAX network I/O counters",
+	show_netio_usage, NULL, },
+
 	{ { "iax2", "show", "users", NULL },
 	iax2_show_users, "List defined IAX users",
 	show_users_usage, NULL, },
@@ -12544,14 +12977,22 @@ static int __unload_module(void)
 	/* Grab the sched lock resource to keep it away from threads about to die */
 	/* Cancel the network thread, close the net socket */
 	if (netthreadid != AST_PTHREADT_NULL) {
-		AST_LIST_LOCK(&iaxq.queue);
+		for (x = 0; x < IAX_TXSHARDS; x++)
+			AST_LIST_LOCK(&iaxq[x].queue);
 		ast_mutex_lock(&sched_lock);
 		pthread_cancel(netthreadid);
 		ast_cond_signal(&sched_cond);
 		ast_mutex_unlock(&sched_lock);	/* Release the schedule lock resource */
-		AST_LIST_UNLOCK(&iaxq.queue);
+		for (x = 0; x < IAX_TXSHARDS; x++)
+			AST_LIST_UNLOCK(&iaxq[x].queue);
 		pthread_join(netthreadid, NULL);
 	}
+	if (rxthread) {
+		pthread_cancel(rxthread->threadid);
+		pthread_join(rxthread->threadid, NULL);
+		free(rxthread);
+		rxthread = NULL;
+	}
 	if (schedthreadid != AST_PTHREADT_NULL) {
 		ast_mutex_lock(&sched_lock);	
 		pthread_cancel(schedthreadid);
@@ -12585,7 +13026,8 @@ static int __unload_module(void)
 	AST_LIST_TRAVERSE_SAFE_END
         AST_LIST_UNLOCK(&dynamic_list);
 
-	AST_LIST_HEAD_DESTROY(&iaxq.queue);
+	for (x = 0; x < IAX_TXSHARDS; x++)
+		AST_LIST_HEAD_DESTROY(&iaxq[x].queue);
 
 	/* Wait for threads to exit */
 	while(0 < iaxactivethreadcount)
@@ -12775,9 +13217,10 @@ static int load_module(void)
 	ast_cond_init(&sched_cond, NULL);
 
 	io = io_context_create();
+	sockio = io_context_create();
 	sched = sched_context_create();
 	
-	if (!io || !sched) {
+	if (!io || !sockio || !sched) {
 		ast_log(LOG_ERROR, "Out of memory\n");
 		return -1;
 	}
@@ -12798,7 +13241,8 @@ static int load_module(void)
 
 	ast_mutex_init(&waresl.lock);
 
-	AST_LIST_HEAD_INIT(&iaxq.queue);
+	for (x = 0; x < IAX_TXSHARDS; x++)
+		AST_LIST_HEAD_INIT(&iaxq[x].queue);
 	
 	ast_cli_register_multiple(cli_iax2, sizeof(cli_iax2) / sizeof(struct ast_cli_entry));
 
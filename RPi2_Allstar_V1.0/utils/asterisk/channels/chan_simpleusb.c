@@ -56,6 +56,8 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 535 $")
 #include <sys/sysinfo.h>		// KB4FXC 2014-09-27
 
 #include "pocsag.c"
+#include "polyphase.c"
+#include "audioring.c"
 
 #define DEBUG_CAPTURES	 		1
 
@@ -79,8 +81,9 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 535 $")
 #define	READERR_THRESHOLD 50
 
 #define RX_SQ_DELAY_MAX 26	// KB4FXC 2015-03-27 ...Max number of frames in FIFO
-#define SRBQ_SIZE 131072	// KB4FXC
-#define SRBQ_MASK 131071	// KB4FXC
+#define	RX_RING_BLOCKS 32	/* 20 ms periods, must be > RX_SQ_DELAY_MAX + 1 */
+#define	TX_RING_BLOCKS 512	/* 20 ms periods. Longer pages are fed in as it drains */
+#define	TX_LOWATER 3		/* periods held back while keyed */
 
 #if 0
 #define traceusb1(a) {printf a;}
@@ -444,6 +447,7 @@ struct chan_simpleusb_pvt {
 	int devtype;				/* actual type of device */
 	int pttkick[2];
 	int total_blocks;			/* total blocks in the output device */
+	int fragsize;				/* size of those blocks */
 	int sounddev;
 	enum { M_UNSET, M_FULL, M_READ, M_WRITE } duplex;
 	short cdMethod;
@@ -492,28 +496,20 @@ struct chan_simpleusb_pvt {
 	char cid_num[256];			/*XXX */
 	char mohinterpret[MAX_MUSICCLASS];
 
-	/* buffers used in simpleusb_write, 2 per int */
-    char simpleusb_write_buf[FRAME_SIZE * 2];
-
-	int simpleusb_write_dst;
-
 	// KB4FXC -- Buffers used in simpleusb_read:
 	// AST_FRIENDLY_OFFSET: space for Asterisk headers
 	// FRAME_SIZE: Size of 20msec audio frame at 8KHz sample rate.
 	// Number '4': Each audio sample is 16 bits (2 bytes) and 2 channels (LR) packed one after the other.
 	// Number '6': Sound Card Audio is sampled at 48KHz (6 times the 8KHz target rate).
 	// char simpleusb_read_buf[FRAME_SIZE * 4 * 6];
-	char simpleusb_read_buf_queue[SRBQ_SIZE];		// KB4FXC 2015-03-26 ....RX FIFO for audio delay.
+	short rxringbuf[RX_RING_BLOCKS * FRAME_SIZE * 2 * 6];	/* RX FIFO for audio delay, 48K stereo */
+	short txringbuf[TX_RING_BLOCKS * FRAME_SIZE];
+	int txringflags[TX_RING_BLOCKS];
+	struct audioring rxring;
+	struct audioring txring;		/* filled by simpleusb_write, drained by try_soundcard_write */
+	ast_mutex_t txringlock;			/* serializes the txring producers: write, echo, pages */
+	int txpaging;				/* a page is being fed into txring */
 	char simpleusb_read_frame_buf[FRAME_SIZE * 2 + AST_FRIENDLY_OFFSET];
-#ifdef 	OLD_ASTERISK
-	AST_LIST_HEAD(, ast_frame) txq;
-#else
-	AST_LIST_HEAD_NOLOCK(, ast_frame) txq;
-#endif
-	ast_mutex_t  txqlock;
-	int fifohead;				// KB4FXC 2015-03-26 ....RX FIFO head and tail.
-	int fifotail;				// KB4FXC 2015-03-26 
-	int fifocount;				// KB4FXC 2015-03-26 
 	int fifoflush;				// KB4FXC 2015-03-30 
 	int kb4fxc;				// KB4FXC 2015-03-30 
 	struct ast_frame read_f;		/* returned by simpleusb_read */
@@ -543,8 +539,8 @@ struct chan_simpleusb_pvt {
 	time_t lasthidtime;
 	struct ast_dsp *dsp;
 
-	short	flpt[NTAPS + 1];
-	short	flpr[NTAPS + 1];
+	struct polyphase flpt;		/* 8K to 48K interpolator */
+	struct polyphase flpr;		/* 48K to 8K decimator */
 
 	float	hpx[NTAPS_PL + 1];
 	float	hpy[NTAPS_PL + 1];
@@ -643,9 +639,6 @@ static struct chan_simpleusb_pvt simpleusb_default = {
 	.frags = FRAGS,
 	.ext = "s",
 	.ctx = "default",
-	.fifohead = 0,				// KB4FXC 2015-03-26 ....RX FIFO head and tail.
-	.fifotail = 0,				// KB4FXC 2015-03-26 
-	.fifocount = 0,				// KB4FXC 2015-03-26 
 	.fifoflush = 0,				// KB4FXC 2015-03-30
 	.kb4fxc = 0,				// KB4FXC 2015-03-30
 	.lastopen = { 0, 0 },
@@ -722,31 +715,14 @@ static time_t sys_uptime (time_t *t)
 
 
 
-/* FIR Low pass filter, 2900 Hz passband with 0.5 db ripple, 6300 Hz stopband at 60db */
+/* FIR Low pass filter, 2900 Hz passband with 0.5 db ripple, 6300 Hz stopband at 60db.
+   Run at 48K as a polyphase decimator (rx) and interpolator (tx). */
 
-static short lpass(short input,short *z)
-{
-    int i;
-    int accum;
-    
-    static short h[NTAPS] = {103,136,148,74,-113,-395,-694,
+static short lpass_h[NTAPS] = {103,136,148,74,-113,-395,-694,
 	-881,-801,-331,573,1836,3265,4589,5525,5864,5525,
 	4589,3265,1836,573,-331,-801,-881,-694,-395, -113,
 	74,148,136,103} ;
 
-    /* store input at the beginning of the delay line */
-    z[0] = input;
-
-    /* calc FIR and shift data */
-    accum = h[NTAPS - 1] * z[NTAPS - 1];
-    for (i = NTAPS - 2; i >= 0; i--) {
-        accum += h[i] * z[i];
-        z[i + 1] = z[i];
-    }
-
-    return(accum >> 15);
-}
-
 /* IIR 6 pole High pass filter, 300 Hz corner with 0.5 db ripple */
 
 #define GAIN1   1.745882764e+00
@@ -1742,9 +1718,8 @@ static void *hidthread(void *arg)
 				if(o->debuglevel)printf("chan_simpleusb() hidthread: update rxhidctcss = %d\n",ctcssed);
 				o->rxhidctcss = ctcssed;
 			}
-			ast_mutex_lock(&o->txqlock);
-			txreq = !(AST_LIST_EMPTY(&o->txq));
-			ast_mutex_unlock(&o->txqlock);
+			/* racy on purpose: a stale count only moves PTT one poll late */
+			txreq = (audioring_count(&o->txring) != 0);
 			txreq = txreq || o->txkeyed || o->txtestkey || o->txclikey || o->echoing;
 			if (txreq && (!o->lasttx))
 			{
@@ -1987,11 +1962,26 @@ static int used_blocks(struct chan_simpleusb_pvt *o)
 		if (0)					/* debugging */
 			ast_log(LOG_WARNING, "fragtotal %d size %d avail %d\n", info.fragstotal, info.fragsize, info.fragments);
 		o->total_blocks = info.fragments;
+		o->fragsize = info.fragsize;
 	}
 
 	return o->total_blocks - info.fragments;
 }
 
+/* Write an exactly FRAME_SIZE sized frame, caller has checked for room */
+static int soundcard_writeblock(struct chan_simpleusb_pvt *o, short *data)
+{
+	int res;
+
+	if (o->sounddev < 0)
+		return 0;
+	// KB4FXC -- log any lost bytes
+	if ((res = write(o->sounddev, ((void *) data), FRAME_SIZE * 2 * 2 * 6)) != FRAME_SIZE * 2 * 2 * 6)
+		ast_log(LOG_WARNING, "soundcard_writeframe bytes dropped: written = %d, requested = %d\n", res, FRAME_SIZE * 2 * 2 * 6);
+
+	return res;
+}
+
 /* Write an exactly FRAME_SIZE sized frame */
 static int soundcard_writeframe(struct chan_simpleusb_pvt *o, short *data)
 {
@@ -2017,11 +2007,7 @@ static int soundcard_writeframe(struct chan_simpleusb_pvt *o, short *data)
 	}
 	o->w_errors = 0;
 
-	// KB4FXC -- log any lost bytes
-	if ((res = write(o->sounddev, ((void *) data), FRAME_SIZE * 2 * 2 * 6)) != FRAME_SIZE * 2 * 2 * 6)
-		ast_log(LOG_WARNING, "soundcard_writeframe bytes dropped: written = %d, requested = %d\n", res, FRAME_SIZE * 2 * 2 * 6);
-
-	return res;
+	return soundcard_writeblock(o, data);
 }
 
 #ifndef	NEW_ASTERISK
@@ -2293,8 +2279,8 @@ static int simpleusb_text(struct ast_channel *c, const char *text)
 	int cnt,i,j,audio_samples,divcnt,divdiv,audio_ptr,baud;
 	struct pocsag_batch *batch,*b;
 	short *audio;
-	char audio1[AST_FRIENDLY_OFFSET + (FRAME_SIZE * sizeof(short))];
-	struct ast_frame wf,*f1;
+	unsigned int u,head,tail;
+	struct ast_frame wf;
 
 	if (haspp == 2) ioperm(pbase,2,1);
 
@@ -2386,10 +2372,13 @@ static int simpleusb_text(struct ast_channel *c, const char *text)
 			batch = make_pocsag_batch(i, (char *)text + j + 1, strlen(text + j + 1), ALPHA, 0);
 			break;
 		    case '?': /* Query Page Status */
-			i = 0;
-			ast_mutex_lock(&o->txqlock);
-			AST_LIST_TRAVERSE(&o->txq, f1,frame_list) if (f1->src && (!strcmp(f1->src,PAGER_SRC))) i++;
-			ast_mutex_unlock(&o->txqlock);
+			/* not the consumer: take each counter once, a
+			   block either way does not matter here */
+			head = o->txring.head;
+			tail = o->txring.tail;
+			i = o->txpaging;
+			for(u = head; u != tail; u++)
+				if (o->txringflags[u & (TX_RING_BLOCKS - 1)]) i++;
 			cmd = (i) ? "PAGES" : "NOPAGES" ;
 			memset(&wf,0,sizeof(wf));
 			wf.frametype = AST_FRAME_TEXT;
@@ -2440,24 +2429,27 @@ static int simpleusb_text(struct ast_channel *c, const char *text)
 			b = b->next;
 		}
 		free_batch(batch);
-		memset(audio1,0,sizeof(audio1));
+		/* a page can be longer than the ring, so it is fed in as the
+		   ring drains. Voice is kept out meanwhile, see simpleusb_write */
+		o->txpaging = 1;
+		cnt = 0;
 		for(i = 0; i < audio_samples; i += FRAME_SIZE)
 		{
-			memset(&wf,0,sizeof(wf));
-			wf.frametype = AST_FRAME_VOICE;
-		        wf.subclass = AST_FORMAT_SLINEAR;
-		        wf.samples = FRAME_SIZE;
-		        wf.datalen = FRAME_SIZE * 2;
-			wf.offset = AST_FRIENDLY_OFFSET;
-		        wf.data = audio1 + AST_FRIENDLY_OFFSET;
-			wf.src = PAGER_SRC;
-			memcpy(wf.data,(char *)(audio + i),FRAME_SIZE * 2);
-			f1 = ast_frdup(&wf);
-			memset(&f1->frame_list,0,sizeof(f1->frame_list));
-			ast_mutex_lock(&o->txqlock);
-			AST_LIST_INSERT_TAIL(&o->txq,f1,frame_list);
-			ast_mutex_unlock(&o->txqlock);
+			while(audioring_count(&o->txring) >= TX_RING_BLOCKS)
+			{
+				/* the sound card has stopped taking audio */
+				if (++cnt > 100) break;
+				usleep(20000);
+			}
+			if (cnt > 100) break;
+			cnt = 0;
+			ast_mutex_lock(&o->txringlock);
+			audioring_write(&o->txring,audio + i,FRAME_SIZE,1);
+			ast_mutex_unlock(&o->txringlock);
 		}
+		o->txpaging = 0;
+		if (cnt > 100)
+			ast_log(LOG_WARNING,"TX audio not draining, page truncated on %s\n",o->name);
 		free(audio);
 		return 0;
 	}
@@ -2535,7 +2527,6 @@ static int simpleusb_hangup(struct ast_channel *c)
 static int simpleusb_write(struct ast_channel *c, struct ast_frame *f)
 {
 	struct chan_simpleusb_pvt *o = c->tech_pvt;
-	struct ast_frame *f1;
 
 	traceusb2(("simpleusb_write() o->nosound= %i\n",o->nosound));
 
@@ -2576,11 +2567,13 @@ static int simpleusb_write(struct ast_channel *c, struct ast_frame *f)
 
 	if ((!o->txtestkey) && o->echoing) return 0;
 
-	f1 = ast_frdup(f);
-	memset(&f1->frame_list,0,sizeof(f1->frame_list));
-	ast_mutex_lock(&o->txqlock);
-	AST_LIST_INSERT_TAIL(&o->txq,f1,frame_list);
-	ast_mutex_unlock(&o->txqlock);
+	/* a page being fed in is not interleaved with voice */
+	if (o->txpaging) return 0;
+
+	ast_mutex_lock(&o->txringlock);
+	audioring_write(&o->txring,(short *)f->data,f->datalen / 2,
+		f->src && (!strcmp(f->src,PAGER_SRC)));
+	ast_mutex_unlock(&o->txringlock);
 
 	return 0;
 }
@@ -2592,124 +2585,88 @@ static int simpleusb_write(struct ast_channel *c, struct ast_frame *f)
 // EHL: This is transmit audio output, including filtering.
 static void try_soundcard_write(struct chan_simpleusb_pvt *o)
 {
-	int src,i,n,ispager,doleft,doright; // Yes, like Dudley!!! :-)
-	struct ast_frame *f1;
+	int i,n,used,ispager,doleft,doright; // Yes, like Dudley!!! :-)
 	struct ast_frame wf1;
 	short *sp,*sp1,outbuf[FRAME_SIZE * 2 * 6];
 
-
+	used = -1;
 	for(;;)						// KB4FXC Write samples to the soundcard???
 	{
-		n = 0;
-		ast_mutex_lock(&o->txqlock);
-		AST_LIST_TRAVERSE(&o->txq, f1,frame_list) n++;
-		ast_mutex_unlock(&o->txqlock);
-		i = used_blocks(o);
-			//if (o->kb4fxc++ % 10 == 0)
-				//printf ("..........TX list size = %d, used_blocks = %d\n", n, i);
-
-		if (n && ((n > 3) || ((!o->txkeyed) && (!o->txtestkey))) && (i <= o->queuesize))
+		n = audioring_count(&o->txring);
+		if (!n)
 		{
-
-
-			ast_mutex_lock(&o->txqlock);
-			f1 = AST_LIST_REMOVE_HEAD(&o->txq,frame_list);
-			ast_mutex_unlock(&o->txqlock);
-
-		        src = 0;                                        /* read position into f1->data */
-		        while (src < f1->datalen) {
-		                /* Compute spare room in the buffer */
-		                int l = sizeof(o->simpleusb_write_buf) - o->simpleusb_write_dst;
-
-		                if (f1->datalen - src >= l) {       /* enough to fill a frame */
-		                        memcpy(o->simpleusb_write_buf + o->simpleusb_write_dst, (char *)f1->data + src, l);
-					if (o->devtype != C108_PRODUCT_ID)
-					{
-						int v;
+			if (o->txkeyed || o->txtestkey)
+			{
+				if (used < 0) used = used_blocks(o);
+				if (used <= o->queuesize) o->txring.underruns++;
+			}
+			break;
+		}
+		if ((n <= TX_LOWATER) && (o->txkeyed || o->txtestkey)) break;
+		/* ask the device once per pass, then keep count */
+		if (used < 0) used = used_blocks(o);
+		if (used > o->queuesize) break;
+
+		sp = audioring_peek(&o->txring);
+		ispager = audioring_flag(&o->txring);
+		if (o->devtype != C108_PRODUCT_ID)
+		{
+			int v;
 			
-						sp = (short *) o->simpleusb_write_buf;
-						for(i = 0; i < FRAME_SIZE; i++)
-						{
-							v = *sp;
-							v += v >> 3;  /* add *.125 giving * 1.125 */
-							v -= *sp >> 5; /* subtract *.03125 giving * 1.09375 */
-							if (v > 32765.0) v = 32765.0;
-							if (v < -32765.0) v = -32765.0;
-							*sp++ = v;
-						}
-					}
-					sp = (short *) o->simpleusb_write_buf;
-					sp1 = outbuf;
-					doright = 1;
-					doleft = 1;
-					ispager = 0;
-					if (f1->src && (!strcmp(f1->src,PAGER_SRC))) ispager = 1;
-					if (o->pager != PAGER_NONE)
-					{
-						doleft = (o->pager == PAGER_A) ? ispager : !ispager;
-						doright = (o->pager == PAGER_B) ? ispager : !ispager;
-					}
-                    // The above decision should be made outside the loop. I think. --EHL
-					for(i = 0; i < FRAME_SIZE; i++)
-					{
-						short s,v;
-
-                                                if (o->preemphasis)
-                                                        s = preemph(sp[i],&o->prestate);
-                                                else
-                                                        s = sp[i];
-                                                v = lpass(s,o->flpt);
-                                                *sp1++ = (doleft) ? v : 0;
-                                                *sp1++ = (doright) ? v : 0;
-                                                v = lpass(s,o->flpt);
-                                                *sp1++ = (doleft) ? v : 0;
-                                                *sp1++ = (doright) ? v : 0;
-                                                v = lpass(s,o->flpt);
-                                                *sp1++ = (doleft) ? v : 0;
-                                                *sp1++ = (doright) ? v : 0;
-                                                v = lpass(s,o->flpt);
-                                                *sp1++ = (doleft) ? v : 0;
-                                                *sp1++ = (doright) ? v : 0;
-                                                v = lpass(s,o->flpt);
-                                                *sp1++ = (doleft) ? v : 0;
-                                                *sp1++ = (doright) ? v : 0;
-                                                v = lpass(s,o->flpt);
-                                                *sp1++ = (doleft) ? v : 0;
-                                                *sp1++ = (doright) ? v : 0;
-					}				
-		                        soundcard_writeframe(o, outbuf);
-		                        src += l;
-		                        o->simpleusb_write_dst = 0;
-					if (o->waspager && (!ispager))
-					{
-						memset(&wf1,0,sizeof(wf1));
-						wf1.frametype = AST_FRAME_TEXT;
-					        wf1.datalen = strlen(ENDPAGE_STR) + 1;
-					        wf1.data = ENDPAGE_STR;
-						ast_queue_frame(o->owner, &wf1);
-					}
-					o->waspager = ispager;
-		                } else {                                /* copy residue */
-		                        l = f1->datalen - src;
-		                        memcpy(o->simpleusb_write_buf + o->simpleusb_write_dst,
-						 (char *)f1->data + src, l);
-		                        src += l;                       /* but really, we are done */
-		                        o->simpleusb_write_dst += l;
-		                }
-		        }
-			ast_frfree(f1);
-			continue;
+			for(i = 0; i < FRAME_SIZE; i++)
+			{
+				v = sp[i];
+				v += v >> 3;  /* add *.125 giving * 1.125 */
+				v -= sp[i] >> 5; /* subtract *.03125 giving * 1.09375 */
+				if (v > 32765.0) v = 32765.0;
+				if (v < -32765.0) v = -32765.0;
+				sp[i] = v;
+			}
 		}
-		break;
+		sp1 = outbuf;
+		doright = 1;
+		doleft = 1;
+		if (o->pager != PAGER_NONE)
+		{
+			doleft = (o->pager == PAGER_A) ? ispager : !ispager;
+			doright = (o->pager == PAGER_B) ? ispager : !ispager;
+		}
+		for(i = 0; i < FRAME_SIZE; i++)
+		{
+			short s,v;
+			int j;
+			int64_t accum[6];
+
+			if (o->preemphasis)
+				s = preemph(sp[i],&o->prestate);
+			else
+				s = sp[i];
+			polyphase_interpolate(&o->flpt,s,accum);
+			for(j = 0; j < 6; j++)
+			{
+				v = accum[j] >> 15;
+				*sp1++ = (doleft) ? v : 0;
+				*sp1++ = (doright) ? v : 0;
+			}
+		}				
+		audioring_release(&o->txring);
+		soundcard_writeblock(o, outbuf);
+		used += (o->fragsize > 0) ? 
+			((FRAME_SIZE * 2 * 2 * 6) + o->fragsize - 1) / o->fragsize : 1;
+		if (o->waspager && (!ispager))
+		{
+			memset(&wf1,0,sizeof(wf1));
+			wf1.frametype = AST_FRAME_TEXT;
+		        wf1.datalen = strlen(ENDPAGE_STR) + 1;
+		        wf1.data = ENDPAGE_STR;
+			ast_queue_frame(o->owner, &wf1);
+		}
+		o->waspager = ispager;
 	}
 
 	if (o->waspager)
 	{
-		n = 0;
-		ast_mutex_lock(&o->txqlock);
-		AST_LIST_TRAVERSE(&o->txq, f1,frame_list) n++;
-		ast_mutex_unlock(&o->txqlock);
-		if (n < 1)
+		if (!audioring_count(&o->txring))
 		{
 			memset(&wf1,0,sizeof(wf1));
 			wf1.frametype = AST_FRAME_TEXT;
@@ -2725,50 +2682,27 @@ static void try_soundcard_write(struct chan_simpleusb_pvt *o)
 
 // KB4FXC, 2015-03-26
 // Stuff incoming audio samples into a FIFO, implementing an audio delay.
-// Returns the number of bytes in FIFO when it is filled.
+// Returns the number of 20 ms periods available past the delay.
 static int insert_into_fifo (struct chan_simpleusb_pvt *o, char read_buffer[], int res)
 {
 	int i;
 
-	if (o->fifocount + res >= SRBQ_SIZE) {		// Ouch! FIFO overflow!	For now, discard the audio data.
-		ast_log(LOG_ERROR,"FIFO overflow!\n");
-		return (o->fifocount);
-	}
-
 	if (o->fifoflush) {				// Discard all the current FIFO contents!
-		//printf("................FIFO FLUSH.................\n");
 		o->fifoflush = 0;
-		o->fifotail = o->fifohead = o->fifocount = 0;
+		audioring_flush(&o->rxring);
 	}
 
-	for (i = 0; i < res; i++) {
-		o->simpleusb_read_buf_queue[o->fifotail++ & SRBQ_MASK] = read_buffer[i];
-		o->fifocount++;
-	}
+	i = o->rxring.overruns;
+	audioring_write(&o->rxring, (short *) read_buffer, res / 2, 0);
+	if (o->rxring.overruns != i)			// Ouch! FIFO overflow!
+		ast_log(LOG_ERROR,"FIFO overflow!\n");
 
-	i = o->fifocount - ((o->rxaudiodelay + 1) * FRAME_SIZE * 4 * 6);
+	i = audioring_count(&o->rxring) - (o->rxaudiodelay + 1);
 
-	//ast_log(LOG_NOTICE,"FIFO count = %d\n", i);
 	if (i < 0)
 		return (0);
 	else
 		return (i);
-	
-
-}
-
-static short get_fifo_short(struct chan_simpleusb_pvt *o)
-{
-	short *tmp;
-
-	if (o->fifocount < 2)
-		return (0);
-
-	tmp = (short *) &(o->simpleusb_read_buf_queue[o->fifohead]);
-	o->fifohead = (o->fifohead + 2) & SRBQ_MASK;
-	o->fifocount = o->fifocount - 2;
-
-	return (*tmp);
 }
 
 static struct ast_frame *simpleusb_read(struct ast_channel *c)
@@ -2779,7 +2713,7 @@ static struct ast_frame *simpleusb_read(struct ast_channel *c)
 	struct ast_frame *f = &o->read_f,*f1;
 	struct ast_frame wf = { AST_FRAME_CONTROL };
 	time_t now;
-	short *sp1;
+	short *sp,*sp1;
 	char read_buffer[8192];				// KB4FXC 2015-03-26  temp buffer to read audio stream
 
 	traceusb2(("simpleusb_read()\n"));
@@ -2848,11 +2782,9 @@ static struct ast_frame *simpleusb_read(struct ast_channel *c)
 		        f->data = o->simpleusb_read_frame_buf + AST_FRIENDLY_OFFSET;
 			memcpy(f->data,u->data,FRAME_SIZE * 2);
 			ast_free(u);
-			f1 = ast_frdup(f);
-			memset(&f1->frame_list,0,sizeof(f1->frame_list));
-			ast_mutex_lock(&o->txqlock);
-			AST_LIST_INSERT_TAIL(&o->txq,f1,frame_list);
-			ast_mutex_unlock(&o->txqlock);
+			ast_mutex_lock(&o->txringlock);
+			audioring_write(&o->txring,(short *)f->data,FRAME_SIZE,0);
+			ast_mutex_unlock(&o->txringlock);
 			o->echoing = 1;
 		} else o->echoing = 0;
 		ast_mutex_unlock(&o->echolock);
@@ -2893,7 +2825,7 @@ static struct ast_frame *simpleusb_read(struct ast_channel *c)
 
 	try_soundcard_write(o);				// KB4FXC hack to keep the "reader" from getting ahead of the "writer"
 
-	if (i < FRAME_SIZE * 4 * 6)			// KB4FXC Not enough samples, bail out. 
+	if (i < 1)					// KB4FXC Not enough samples, bail out. 
 		return f;
 
 	if (o->mute)
@@ -2922,7 +2854,6 @@ static struct ast_frame *simpleusb_read(struct ast_channel *c)
 	if (o->lastrx && (!o->rxkeyed))
 	{
 		o->lastrx = 0;
-		//printf("AST_CONTROL_RADIO_UNKEY, fifocount = %d\n", o->fifocount);
 		wf.subclass = AST_CONTROL_RADIO_UNKEY;
 		ast_queue_frame(o->owner, &wf);
 		if (o->duplex3)
@@ -2939,31 +2870,24 @@ static struct ast_frame *simpleusb_read(struct ast_channel *c)
                         setamixer(o->devicenum,MIXER_PARAM_MIC_PLAYBACK_SW,1,0);
 	}
 
+	sp = audioring_peek(&o->rxring);
 	sp1 = (short *)(o->simpleusb_read_frame_buf + AST_FRIENDLY_OFFSET);
 	for(n = 0; n < FRAME_SIZE; n++)
 	{
-		(void)lpass(get_fifo_short(o), o->flpr);		// Down-sample from 48KHz to 8KHz. Apply to LP filter.
-		get_fifo_short(o);					// Discard audio from unused (right) channel.
-		(void)lpass(get_fifo_short(o), o->flpr);
-		get_fifo_short(o);
-		(void)lpass(get_fifo_short(o), o->flpr);
-		get_fifo_short(o);
-		(void)lpass(get_fifo_short(o), o->flpr);
-		get_fifo_short(o);
-		(void)lpass(get_fifo_short(o), o->flpr);
-		get_fifo_short(o);
+		short v;
 
+		// Down-sample from 48KHz to 8KHz, discarding the unused (right) channel.
+		v = polyphase_decimate(&o->flpr,sp + (n * 12),2) >> 15;
 		if (o->plfilter && o->deemphasis)
-			*sp1++ = hpass6(deemph(lpass(get_fifo_short(o), o->flpr), &o->destate), o->hpx,o->hpy);
+			*sp1++ = hpass6(deemph(v, &o->destate), o->hpx,o->hpy);
 		else if (o->deemphasis)
-			*sp1++ = deemph(lpass(get_fifo_short(o),o->flpr),&o->destate);
+			*sp1++ = deemph(v,&o->destate);
 		else if (o->plfilter)
-			*sp1++ = hpass(lpass(get_fifo_short(o),o->flpr),o->hpx,o->hpy);
+			*sp1++ = hpass(v,o->hpx,o->hpy);
 		else
-			*sp1++ = lpass(get_fifo_short(o),o->flpr);
-
-		get_fifo_short(o);				// Discard audio from unused (right) channel.
+			*sp1++ = v;
 	}			
+	audioring_release(&o->rxring);
 
 	if (o->echomode && o->rxkeyed && (!o->echoing))
 	{
@@ -3674,7 +3598,11 @@ static int radio_tune(int fd, int argc, char *argv[])
 		ast_cli(fd,"Tx Output B Level currently set to %d\n",o->txmixbset);
         ast_cli(fd, "PL filter: %d\n", o->plfilter);
         ast_cli(fd, "Preemphasis: %d\n", o->preemphasis);
-        ast_cli(fd, "Deemphasis: %d\n", o->deemphasis)
+        ast_cli(fd, "Deemphasis: %d\n", o->deemphasis);
+		ast_cli(fd,"RX queue: %u periods (max %u), %u overruns\n",
+			audioring_count(&o->rxring),o->rxring.hiwater,o->rxring.overruns);
+		ast_cli(fd,"TX queue: %u periods (max %u), %u overruns, %u underruns\n",
+			audioring_count(&o->txring),o->txring.hiwater,o->txring.overruns,o->txring.underruns);
 		return RESULT_SHOWUSAGE;
 	}
 
@@ -4066,6 +3994,8 @@ static struct chan_simpleusb_pvt *store_config(struct ast_config *cfg, char *ctg
 			o->index = (*indexp)++;
 			o->pttkick[0] = -1;
 			o->pttkick[1] = -1;
+			polyphase_init_interp(&o->flpt,lpass_h,NTAPS,6);
+			polyphase_init_decim(&o->flpr,lpass_h,NTAPS,6);
 			if (!simpleusb_active) 
 				simpleusb_active = o->name;
 		}
@@ -4073,7 +4003,9 @@ static struct chan_simpleusb_pvt *store_config(struct ast_config *cfg, char *ctg
 	o->echoq.q_forw = o->echoq.q_back = &o->echoq;
 	ast_mutex_init(&o->echolock);
 	ast_mutex_init(&o->eepromlock);
-	ast_mutex_init(&o->txqlock);
+	audioring_init(&o->rxring,o->rxringbuf,NULL,RX_RING_BLOCKS,FRAME_SIZE * 2 * 6);
+	audioring_init(&o->txring,o->txringbuf,o->txringflags,TX_RING_BLOCKS,FRAME_SIZE);
+	ast_mutex_init(&o->txringlock);
 	ast_mutex_init(&o->usblock);
 	o->echomax = DEFAULT_ECHO_MAX;
 	strcpy(o->mohinterpret, "default");
@@ -228,6 +228,11 @@ Obviously, it is not valid to use *ANY* of the duplex=3 modes in a voted and/or
 #include <signal.h>
 #include <fnmatch.h>
 #include <math.h>
+#if	defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif	defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "asterisk/lock.h"
 #include "asterisk/channel.h"
@@ -322,6 +327,20 @@ static int nullfd = -1;
 
 AST_MUTEX_DEFINE_STATIC(voter_lock);
 
+/* voter_lock protects the pvts and clients lists, client addressing and
+   the master timing state. Each voter_pvt's lock protects the audio and
+   RSSI buffers of the clients on that instance and its voting state, so
+   the timer can mix one instance while the reader is queueing packets for
+   another. Lock order is voter_lock, then voter_pvt lock. */
+
+#define	VOTER_HASH_SIZE 256
+#define	VOTER_HASH(x) ((((x) >> 24) ^ ((x) >> 16) ^ ((x) >> 8) ^ (x)) & (VOTER_HASH_SIZE - 1))
+#define	VOTER_ADDR_HASH(sin) VOTER_HASH((sin)->sin_addr.s_addr ^ (sin)->sin_port)
+
+static struct voter_client *client_hash[VOTER_HASH_SIZE];	/* by digest */
+static struct voter_client *dyn_hash[VOTER_HASH_SIZE];	/* bound dynamic clients, by address */
+static unsigned int pvts_generation = 0;
+
 int16_t listen_port = 667;				/* port to listen to UDP packets on */
 int udp_socket = -1;
 
@@ -424,6 +443,9 @@ struct voter_client {
 	char dynamic;
 	char txlockout;
 	struct voter_client *next;
+	struct voter_client *hnext;		/* next in digest hash chain */
+	struct voter_client *dnext;		/* next in dynamic address hash chain */
+	struct voter_client *anext;		/* scratch chain for address checks */
 	uint8_t lastrssi;
 	int txseqno;
 	int txseqno_rxkeyed;
@@ -498,8 +520,6 @@ struct voter_pvt {
 	struct ast_trans_pvt *adpcmout;
 	struct ast_trans_pvt *nuin;
 	struct ast_trans_pvt *nuout;
-	struct ast_trans_pvt *toast;
-	struct ast_trans_pvt *toast1;
 	struct ast_trans_pvt *fromast;
 	t_pmr_chan	*pmrChan;
 	char	txctcssfreq[32];
@@ -537,6 +557,8 @@ struct voter_pvt {
 #endif
 	ast_mutex_t  txqlock;
 	ast_mutex_t  pagerqlock;
+	ast_mutex_t  lock;		/* this instance's client audio buffers and voting state */
+	int mixcount;
 };
 
 #ifdef	OLD_ASTERISK
@@ -912,7 +934,7 @@ long long btime;
 	return;
 }
 		
-/* must be called with voter_lock locked */
+/* must be called with the voter_pvt locked */
  static void incr_drainindex(struct voter_pvt *p)
 {
 struct voter_client *client;
@@ -932,6 +954,167 @@ struct voter_client *client;
 	}
 }
 
+/* rebuild the digest index, must be called with voter_lock locked */
+static void voter_rehash_clients(void)
+{
+struct voter_client *client,*tail[VOTER_HASH_SIZE];
+int	h;
+
+	memset(client_hash,0,sizeof(client_hash));
+	memset(dyn_hash,0,sizeof(dyn_hash));
+	memset(tail,0,sizeof(tail));
+	/* keep the chains in list order, so the first match is the same as before */
+	for(client = clients; client; client = client->next)
+	{
+		client->hnext = NULL;
+		h = VOTER_HASH(client->digest);
+		if (tail[h]) tail[h]->hnext = client;
+		else client_hash[h] = client;
+		tail[h] = client;
+		client->dnext = NULL;
+		if (client->dynamic && (!ast_tvzero(client->lastdyntime)))
+		{
+			h = VOTER_ADDR_HASH(&client->sin);
+			client->dnext = dyn_hash[h];
+			dyn_hash[h] = client;
+		}
+	}
+}
+
+/* bind a dynamic client to an address, must be called with voter_lock locked */
+static void voter_dyn_bind(struct voter_client *client, struct sockaddr_in *sin)
+{
+int	h;
+
+	client->sin = *sin;
+	h = VOTER_ADDR_HASH(sin);
+	client->dnext = dyn_hash[h];
+	dyn_hash[h] = client;
+}
+
+/* drop a dynamic client's lease, must be called with voter_lock locked */
+static void voter_dyn_unbind(struct voter_client *client)
+{
+struct voter_client **cpp;
+
+	for(cpp = &dyn_hash[VOTER_ADDR_HASH(&client->sin)]; *cpp; cpp = &(*cpp)->dnext)
+	{
+		if (*cpp != client) continue;
+		*cpp = client->dnext;
+		break;
+	}
+	client->dnext = NULL;
+	memset(&client->lastdyntime,0,sizeof(client->lastheardtime));
+	memset(&client->sin,0,sizeof(client->sin));
+}
+
+/* find the client a packet belongs to, must be called with voter_lock locked */
+static struct voter_client *voter_find_client(uint32_t digest, struct sockaddr_in *sin, struct timeval *tv)
+{
+struct voter_client *client;
+int	h;
+
+	h = VOTER_HASH(digest);
+	/* first see if client is not a dynamic one */
+	for(client = client_hash[h]; client; client = client->hnext)
+	{
+		if (client->dynamic) continue;
+		if (client->digest == digest) return(client);
+	}
+	/* if not found as non-dynamic, try it as existing dynamic. Many dynamic
+	   clients can share one digest, so these are looked up by address */
+	for(client = dyn_hash[VOTER_ADDR_HASH(sin)]; client; client = client->dnext)
+	{
+		if (client->digest != digest) continue;
+		if (client->sin.sin_addr.s_addr != sin->sin_addr.s_addr) continue;
+		if (client->sin.sin_port != sin->sin_port) continue;
+		break;
+	}
+	if (client && (voter_tvdiff_ms(*tv,client->lastdyntime) > dyntime))
+	{
+		if (option_verbose >= 3) ast_verbose(VERBOSE_PREFIX_3 
+			"DYN client %s past lease time\n",client->name);
+		voter_dyn_unbind(client);
+		client = NULL;
+	}
+	if (client)
+	{
+		if (option_verbose > 4) ast_verbose(VERBOSE_PREFIX_3 
+			"Using existing Dynamic client %s for %s:%d\n",client->name,ast_inet_ntoa(sin->sin_addr),ntohs(sin->sin_port));
+		return(client);
+	}
+	/* if still now found, try as new dynamic */
+	for(client = client_hash[h]; client; client = client->hnext)
+	{
+		if (!client->dynamic) continue;
+		if (!ast_tvzero(client->lastdyntime)) continue;
+		if (client->digest != digest) continue;
+		/* okay, we found an empty dynamic slot with proper digest */
+		gettimeofday(&client->lastdyntime,NULL);
+		voter_dyn_bind(client,sin);
+		if (option_verbose >= 3) ast_verbose(VERBOSE_PREFIX_3 
+			"Bound new Dynamic client %s to %s:%d\n",client->name,ast_inet_ntoa(sin->sin_addr),ntohs(sin->sin_port));
+		return(client);
+	}
+	return(NULL);
+}
+
+/* disconnect clients that claim the same address and port as an earlier
+   one, must be called with voter_lock locked */
+static void voter_check_sanity(int skippriconn)
+{
+struct voter_client *client,*client1,*abuckets[VOTER_HASH_SIZE];
+struct voter_pvt *p;
+int	h;
+
+	memset(abuckets,0,sizeof(abuckets));
+	for(client = clients; client; client = client->next)
+	{
+		if (!client->respdigest) continue;
+		h = VOTER_HASH(client->sin.sin_addr.s_addr ^ client->sin.sin_port);
+		for(client1 = abuckets[h]; client1; client1 = client1->anext)
+		{
+			if ((client1->sin.sin_addr.s_addr == client->sin.sin_addr.s_addr) &&
+				(client1->sin.sin_port == client->sin.sin_port)) break;
+		}
+		if (client1)
+		{
+			client->respdigest = 0;
+			client->heardfrom = 0;
+			client1->respdigest = 0;
+			client1->heardfrom = 0;
+			continue;
+		}
+		if (skippriconn)
+		{
+			for(p = pvts; p; p = p->next)
+			{
+				if (p->nodenum == client->nodenum) break;
+			}
+			if ((!p) || p->priconn) continue;
+		}
+		client->anext = abuckets[h];
+		abuckets[h] = client;
+	}
+}
+
+/* lock the client list and every instance, for changing client buffers */
+static void voter_lock_all(void)
+{
+struct voter_pvt *p;
+
+	ast_mutex_lock(&voter_lock);
+	for(p = pvts; p; p = p->next) ast_mutex_lock(&p->lock);
+}
+
+static void voter_unlock_all(void)
+{
+struct voter_pvt *p;
+
+	for(p = pvts; p; p = p->next) ast_mutex_unlock(&p->lock);
+	ast_mutex_unlock(&voter_lock);
+}
+
 static int voter_call(struct ast_channel *ast, char *dest, int timeout)
 {
 	if ((ast->_state != AST_STATE_DOWN) && (ast->_state != AST_STATE_RESERVED)) {
@@ -956,14 +1139,6 @@ static int voter_hangup(struct ast_channel *ast)
 		ast_log(LOG_WARNING, "Asked to hangup channel not connected\n");
 		return 0;
 	}
-	if (p->dsp) ast_dsp_free(p->dsp);
-	if (p->adpcmin) ast_translator_free_path(p->adpcmin);
-	if (p->adpcmout) ast_translator_free_path(p->adpcmout);
-	if (p->toast) ast_translator_free_path(p->toast);
-	if (p->toast) ast_translator_free_path(p->toast1);
-	if (p->fromast) ast_translator_free_path(p->fromast);
-	if (p->nuin) ast_translator_free_path(p->nuin);
-	if (p->nuout) ast_translator_free_path(p->nuout);
 	ast_mutex_lock(&voter_lock);
 	for(q = pvts; q->next; q = q->next)
 	{
@@ -971,7 +1146,18 @@ static int voter_hangup(struct ast_channel *ast)
 	}
 	if (q->next) q->next = p->next;
 	if (pvts == p) pvts = p->next;
+	pvts_generation++;
 	ast_mutex_unlock(&voter_lock);
+	/* wait for the timer to finish mixing it, if it is */
+	ast_mutex_lock(&p->lock);
+	ast_mutex_unlock(&p->lock);
+	if (p->dsp) ast_dsp_free(p->dsp);
+	if (p->adpcmin) ast_translator_free_path(p->adpcmin);
+	if (p->adpcmout) ast_translator_free_path(p->adpcmout);
+	if (p->fromast) ast_translator_free_path(p->fromast);
+	if (p->nuin) ast_translator_free_path(p->nuin);
+	if (p->nuout) ast_translator_free_path(p->nuout);
+	ast_mutex_destroy(&p->lock);
 	ast_free(p);
 	ast->tech_pvt = NULL;
 	ast_setstate(ast, AST_STATE_DOWN);
@@ -1274,34 +1460,137 @@ int len;
 }
 
 
-/* must be called with voter_lock locked */
+/* sum n bytes (rssi samples) */
+static int voter_sum_bytes(const uint8_t *cp, int n)
+{
+	int i,k;
+
+	k = 0;
+	i = 0;
+#if	defined(__ARM_NEON__) || defined(__ARM_NEON)
+	if (n >= 16)
+	{
+		uint32x4_t acc = vdupq_n_u32(0);
+		uint32_t lanes[4];
+
+		for(; i + 16 <= n; i += 16)
+			acc = vpadalq_u16(acc,vpaddlq_u8(vld1q_u8(cp + i)));
+		vst1q_u32(lanes,acc);
+		k = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	}
+#elif	defined(__SSE2__)
+	if (n >= 16)
+	{
+		__m128i acc = _mm_setzero_si128();
+
+		for(; i + 16 <= n; i += 16)
+			acc = _mm_add_epi64(acc,_mm_sad_epu8(_mm_loadu_si128((const __m128i *)(cp + i)),_mm_setzero_si128()));
+		k = _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc,8));
+	}
+#endif
+	for(; i < n; i++) k += cp[i];
+	return(k);
+}
+
+/* dst[i] += src[i], clipped to +/-32767 */
+static void voter_mix_add(short *dst, const short *src, int n)
+{
+	int i,j;
+
+	i = 0;
+#if	defined(__ARM_NEON__) || defined(__ARM_NEON)
+	{
+		int16x8_t lo = vdupq_n_s16(-32767);
+
+		for(; i + 8 <= n; i += 8)
+			vst1q_s16(dst + i,vmaxq_s16(vqaddq_s16(vld1q_s16(dst + i),vld1q_s16(src + i)),lo));
+	}
+#elif	defined(__SSE2__)
+	{
+		__m128i lo = _mm_set1_epi16(-32767);
+
+		for(; i + 8 <= n; i += 8)
+			_mm_storeu_si128((__m128i *)(dst + i),_mm_max_epi16(_mm_adds_epi16(
+				_mm_loadu_si128((const __m128i *)(dst + i)),
+				_mm_loadu_si128((const __m128i *)(src + i))),lo));
+	}
+#endif
+	for(; i < n; i++)
+	{
+		j = dst[i] + src[i];
+		if (j > 32767) j = 32767;
+		if (j < -32767) j = -32767;
+		dst[i] = j;
+	}
+}
+
+static void voter_ulaw_decode(short *dst, const uint8_t *src, int n)
+{
+	int i;
+
+	for(i = 0; i < n; i++) dst[i] = AST_MULAW(src[i]);
+}
+
+/* Operations on the FRAME_SIZE window at a client's drainindex in one of
+   its circular buffers. The window is at most two contiguous pieces. */
+#define	VOTER_RING_SPLIT(client,n1,n2) do { \
+	n1 = (client)->buflen - (client)->drainindex; \
+	if (n1 > FRAME_SIZE) n1 = FRAME_SIZE; \
+	n2 = FRAME_SIZE - n1; \
+	} while(0)
+
+static int voter_ring_sum(struct voter_client *client, uint8_t *ring)
+{
+	int n1,n2;
+
+	VOTER_RING_SPLIT(client,n1,n2);
+	return(voter_sum_bytes(ring + client->drainindex,n1) + voter_sum_bytes(ring,n2));
+}
+
+static void voter_ring_fill(struct voter_client *client, uint8_t *ring, int c)
+{
+	int n1,n2;
+
+	VOTER_RING_SPLIT(client,n1,n2);
+	memset(ring + client->drainindex,c,n1);
+	if (n2) memset(ring,c,n2);
+}
+
+static void voter_ring_read(struct voter_client *client, uint8_t *ring, uint8_t *dst)
+{
+	int n1,n2;
+
+	VOTER_RING_SPLIT(client,n1,n2);
+	memcpy(dst,ring + client->drainindex,n1);
+	if (n2) memcpy(dst + n1,ring,n2);
+}
+
+/* must be called with the voter_pvt locked */
 static int voter_mix_and_send(struct voter_pvt *p, struct voter_client *maxclient, int maxrssi)
 {
 
-	int i,j,k,x,maxprio,haslastaudio;
-	struct ast_frame fr,*f1,*f2;
+	int i,x,maxprio,haslastaudio;
+	struct ast_frame fr,mixfr,*f1,*f2;
 	struct voter_client *client;
-	short  silbuf[FRAME_SIZE];
+	short  silbuf[FRAME_SIZE],mixbuf[FRAME_SIZE];
+	uint8_t ubuf[FRAME_SIZE];
 
 
 	haslastaudio = 0;
-	memset(&fr,0,sizeof(struct ast_frame));
-        fr.frametype = AST_FRAME_VOICE;
-        fr.subclass = AST_FORMAT_ULAW;
-        fr.datalen = FRAME_SIZE;
-        fr.samples = FRAME_SIZE;
-        AST_FRAME_DATA(fr) =  p->buf + AST_FRIENDLY_OFFSET;
-        fr.src = type;
-        fr.offset = AST_FRIENDLY_OFFSET;
-        fr.mallocd = 0;
-        fr.delivery.tv_sec = 0;
-        fr.delivery.tv_usec = 0;
-	f1 = ast_translate(p->toast,&fr,0);
-	if (!f1)
-	{
-		ast_log(LOG_ERROR,"Can not translate frame to send to Asterisk\n");
-		return(0);
-	}
+	/* the voted-upon audio, in slinear */
+	voter_ulaw_decode(mixbuf,(uint8_t *)p->buf + AST_FRIENDLY_OFFSET,FRAME_SIZE);
+	memset(&mixfr,0,sizeof(struct ast_frame));
+        mixfr.frametype = AST_FRAME_VOICE;
+        mixfr.subclass = AST_FORMAT_SLINEAR;
+        mixfr.datalen = FRAME_SIZE * 2;
+        mixfr.samples = FRAME_SIZE;
+        AST_FRAME_DATA(mixfr) =  mixbuf;
+        mixfr.src = type;
+        mixfr.offset = 0;
+        mixfr.mallocd = 0;
+        mixfr.delivery.tv_sec = 0;
+        mixfr.delivery.tv_usec = 0;
+	f1 = &mixfr;
 	maxprio = 0;
 	for(client = clients; client; client = client->next)
 	{
@@ -1314,10 +1603,8 @@ static int voter_mix_and_send(struct voter_pvt *p, struct voter_client *maxclien
 			i = client->prio;
 		if (i > maxprio) maxprio = i;
 	}
-	/* f1 now contains the voted-upon audio in slinear */
 	for(client = clients; client; client = client->next)
 	{
-		short *sp1,*sp2;
 		if (client->nodenum != p->nodenum) continue;
 		if (!client->mix) continue;
 		if (client->prio_override == -1) continue;
@@ -1329,89 +1616,25 @@ static int voter_mix_and_send(struct voter_pvt *p, struct voter_client *maxclien
 				i = client->prio;
 			if (i < maxprio) continue;
 		}
-		i = (int)client->buflen - ((int)client->drainindex + FRAME_SIZE);
-		if (i >= 0)
-		{
-			memcpy(p->buf + AST_FRIENDLY_OFFSET,client->audio + client->drainindex,FRAME_SIZE);
-		}
-		else
-		{
-			memcpy(p->buf + AST_FRIENDLY_OFFSET,client->audio + client->drainindex,FRAME_SIZE + i);
-			memcpy(p->buf + AST_FRIENDLY_OFFSET + (client->buflen - i),client->audio,-i);
-		}
-		if (i >= 0)
-		{
-			memset(client->audio + client->drainindex,0xff,FRAME_SIZE);
-		}
-		else
-		{
-			memset(client->audio + client->drainindex,0xff,FRAME_SIZE + i);
-			memset(client->audio,0xff,-i);
-		}
-		k = 0;
-		if (i >= 0)
-		{
-			for(j = client->drainindex; j < client->drainindex + FRAME_SIZE; j++)
-			{
-				k += client->rssi[j];
-				client->rssi[j] = 0;
-			}
-		}
-		else
-		{
-			for(j = client->drainindex; j < client->drainindex + (FRAME_SIZE + i); j++)
-			{
-				k += client->rssi[j];
-				client->rssi[j] = 0;
-			}
-			for(j = 0; j < -i; j++)
-			{
-				k += client->rssi[j];
-				client->rssi[j] = 0;
-			}
-		}			
-		client->lastrssi = k / FRAME_SIZE; 
+		voter_ring_read(client,client->audio,ubuf);
+		voter_ring_fill(client,client->audio,0xff);
+		client->lastrssi = voter_ring_sum(client,client->rssi) / FRAME_SIZE;
+		voter_ring_fill(client,client->rssi,0);
 		if (client->lastrssi > maxrssi)
 		{
 			maxrssi = client->lastrssi;
 			maxclient = client;
 		}
-		memset(&fr,0,sizeof(struct ast_frame));
-	        fr.frametype = AST_FRAME_VOICE;
-	        fr.subclass = AST_FORMAT_ULAW;
-	        fr.datalen = FRAME_SIZE;
-	        fr.samples = FRAME_SIZE;
-	        AST_FRAME_DATA(fr) =  p->buf + AST_FRIENDLY_OFFSET;
-	        fr.src = type;
-	        fr.offset = AST_FRIENDLY_OFFSET;
-	        fr.mallocd = 0;
-	        fr.delivery.tv_sec = 0;
-	        fr.delivery.tv_usec = 0;
-		f2 = ast_translate(p->toast1,&fr,0);
-		if (!f2)
-		{
-			ast_log(LOG_ERROR,"Can not translate frame to send to Asterisk\n");
-			return(0);
-		}
-		sp1 = AST_FRAME_DATAP(f1);
-		sp2 = AST_FRAME_DATAP(f2);
 		if (!haslastaudio)
 		{
-			memcpy(p->lastaudio,sp1,FRAME_SIZE * 2);
+			memcpy(p->lastaudio,mixbuf,FRAME_SIZE * 2);
 			haslastaudio = 1;
 		}
-		memcpy(client->lastaudio,sp2,FRAME_SIZE * 2);
-		for(i = 0; i < FRAME_SIZE; i++)
-		{
-			if (maxprio && client->lastrssi)
-				j = sp2[i];
-			else
-				j = sp1[i] + sp2[i];
-			if (j > 32767) j = 32767;
-			if (j < -32767) j = -32767;
-			sp1[i] = j;
-		}
-		ast_frfree(f2);
+		voter_ulaw_decode(client->lastaudio,ubuf,FRAME_SIZE);
+		if (maxprio && client->lastrssi)
+			memcpy(mixbuf,client->lastaudio,FRAME_SIZE * 2);
+		else
+			voter_mix_add(mixbuf,client->lastaudio,FRAME_SIZE);
 	}
 	if (p->priconn) maxclient = NULL;
 	if (!maxclient) /* if nothing there */
@@ -2214,6 +2437,7 @@ static struct ast_channel *voter_request(const char *type, int format, void *dat
 	ast_mutex_init(&p->txqlock);
 	ast_mutex_init(&p->pagerqlock);
 	ast_mutex_init(&p->xmit_lock);
+	ast_mutex_init(&p->lock);
 	ast_cond_init(&p->xmit_cond,NULL);
 	p->dsp = ast_dsp_new();
 	if (!p->dsp)
@@ -2246,22 +2470,6 @@ static struct ast_channel *voter_request(const char *type, int format, void *dat
 		ast_free(p);
 		return NULL;
 	}
-	p->toast = ast_translator_build_path(AST_FORMAT_SLINEAR,AST_FORMAT_ULAW);
-	if (!p->toast)
-	{
-		ast_log(LOG_ERROR,"Cannot get translator from ulaw to slinear!!\n");
-		ast_dsp_free(p->dsp);
-		ast_free(p);
-		return NULL;
-	}
-	p->toast1 = ast_translator_build_path(AST_FORMAT_SLINEAR,AST_FORMAT_ULAW);
-	if (!p->toast1)
-	{
-		ast_log(LOG_ERROR,"Cannot get translator from ulaw to slinear!!\n");
-		ast_dsp_free(p->dsp);
-		ast_free(p);
-		return NULL;
-	}
 	p->fromast = ast_translator_build_path(AST_FORMAT_ULAW,AST_FORMAT_SLINEAR);
 	if (!p->fromast)
 	{
@@ -2310,6 +2518,7 @@ static struct ast_channel *voter_request(const char *type, int format, void *dat
 	ast_mutex_lock(&voter_lock);
 	if (pvts != NULL) p->next = pvts;
 	pvts = p;
+	pvts_generation++;
 	ast_mutex_unlock(&voter_lock);
 	tmp->tech = &voter_tech;
 	tmp->rawwriteformat = AST_FORMAT_SLINEAR;
@@ -3335,8 +3544,7 @@ struct timeval tv;
 		{
 			if (option_verbose >= 3) ast_verbose(VERBOSE_PREFIX_3 
 				"DYN client %s past lease time\n",client->name);
-			memset(&client->lastdyntime,0,sizeof(client->lastheardtime));
-			memset(&client->sin,0,sizeof(client->sin));
+			voter_dyn_unbind(client);
 		}
 	}
 	return;
@@ -3350,8 +3558,9 @@ static void *voter_timer(void *data)
 	char buf[FRAME_SIZE];
 	int	i;
 	time_t	t;
+	unsigned int gen;
 	struct voter_pvt *p;
-	struct voter_client *client,*client1;
+	struct voter_client *client;
 	struct timeval tv;
 
 	while(run_forever && (!ast_shutting_down()))
@@ -3368,10 +3577,27 @@ static void *voter_timer(void *data)
 		voter_timing_count++;
 		if (!hasmaster)
 		{
-			for(p = pvts; p; p = p->next)
+			/* mix each instance holding only its own lock, so the reader
+			   can keep taking packets for the others meanwhile */
+			p = pvts;
+			while(p)
 			{
+				if (p->mixcount == voter_timing_count)
+				{
+					p = p->next;
+					continue;
+				}
+				p->mixcount = voter_timing_count;
+				ast_mutex_lock(&p->lock);
+				gen = pvts_generation;
+				ast_mutex_unlock(&voter_lock);
 				memset(p->buf + AST_FRIENDLY_OFFSET,0xff,FRAME_SIZE);
 				voter_mix_and_send(p,NULL,0);
+				ast_mutex_unlock(&p->lock);
+				ast_mutex_lock(&voter_lock);
+				/* if the list changed under us, start over */
+				if (gen != pvts_generation) p = pvts;
+				else p = p->next;
 			}
 			voter_xmit_master();
 			gettimeofday(&tv,NULL);
@@ -3385,25 +3611,7 @@ static void *voter_timer(void *data)
 					client->lastheardtime.tv_sec = client->lastheardtime.tv_usec = 0;
 				}
 			}
-			if (check_client_sanity)
-			{
-				for(client = clients; client; client = client->next)
-				{
-					if (!client->respdigest) continue;
-					for(client1 = client->next; client1; client1 = client1->next)
-					{
-						if ((client1->sin.sin_addr.s_addr == client->sin.sin_addr.s_addr) &&
-							(client1->sin.sin_port == client->sin.sin_port))
-						{
-							if (!client1->respdigest) continue;
-							client->respdigest = 0;
-							client->heardfrom = 0;
-							client1->respdigest = 0;
-							client1->heardfrom = 0;
-						}
-					}
-				}
-			}
+			if (check_client_sanity) voter_check_sanity(0);
 		}
 		ast_mutex_unlock(&voter_lock);
 	}
@@ -3416,7 +3624,7 @@ static void *voter_reader(void *data)
 	char gps1[300],gps2[300],isproxy;
 	struct sockaddr_in sin,sin_stream,psin;
 	struct voter_pvt *p;
-	int i,j,k,ms,maxrssi,master_port;
+	int i,j,ms,maxrssi,master_port;
 	struct ast_frame *f1,fr;
         socklen_t fromlen;
 	ssize_t recvlen;
@@ -3512,51 +3720,7 @@ static void *voter_reader(void *data)
 				if (vph->digest)
 				{
 					gettimeofday(&tv,NULL);
-					/* first see if client is not a dynamic one */
-					for(client = clients; client; client = client->next)
-					{
-						if (client->dynamic) continue;
-						if (client->digest == htonl(vph->digest)) break;
-					}
-					/* if not found as non-dynamic, try it as existing dynamic */					
-					if (!client)
-					{
-						for(client = clients; client; client = client->next)
-						{
-							if (!client->dynamic) continue;
-							if (ast_tvzero(client->lastdyntime)) continue;
-							if (voter_tvdiff_ms(tv,client->lastdyntime) > dyntime)
-							{
-								if (option_verbose >= 3) ast_verbose(VERBOSE_PREFIX_3 
-									"DYN client %s past lease time\n",client->name);
-								memset(&client->lastdyntime,0,sizeof(client->lastheardtime));
-								memset(&client->sin,0,sizeof(client->sin));
-								continue;
-							}
-							if (client->digest != htonl(vph->digest)) continue;
-							if (client->sin.sin_addr.s_addr != sin.sin_addr.s_addr) continue;
-							if (client->sin.sin_port != sin.sin_port) continue;
-							if (option_verbose > 4) ast_verbose(VERBOSE_PREFIX_3 
-								"Using existing Dynamic client %s for %s:%d\n",client->name,ast_inet_ntoa(sin.sin_addr),ntohs(sin.sin_port));
-							break;
-						}
-					}
-					/* if still now found, try as new dynamic */
-					if (!client)
-					{
-						for(client = clients; client; client = client->next)
-						{
-							if (!client->dynamic) continue;
-							if (!ast_tvzero(client->lastdyntime)) continue;
-							if (client->digest != htonl(vph->digest)) continue;
-							/* okay, we found an empty dynamic slot with proper digest */
-							gettimeofday(&client->lastdyntime,NULL);
-							client->sin = sin;
-							if (option_verbose >= 3) ast_verbose(VERBOSE_PREFIX_3 
-								"Bound new Dynamic client %s to %s:%d\n",client->name,ast_inet_ntoa(sin.sin_addr),ntohs(sin.sin_port));
-							break;
-						}
-					}
+					client = voter_find_client(ntohl(vph->digest),&sin,&tv);
 					if ((debug >= 3) && client && ((unsigned char)*(buf + sizeof(VOTER_PACKET_HEADER)) > 0) &&
 						ntohs(vph->payload_type) == VOTER_PAYLOAD_ULAW)
 					{
@@ -3814,6 +3978,7 @@ static void *voter_reader(void *data)
 									ast_verbose("SysTime:   %s.%03d, diff: %lld,index: %d\n",timestr,(int)timetv.tv_usec / 1000,btime - ptime,index);
 								}
 							}
+							ast_mutex_lock(&p->lock);
 							/* if in bounds */
 							if ((index > 0) && (index < (client->buflen - (FRAME_SIZE * 2))))
 							{
@@ -3922,6 +4087,7 @@ static void *voter_reader(void *data)
 								client->drain40ms = 0;
 								if (debug >= 3) ast_verbose("mix client %s outa bounds, resetting!!\n",client->name);
                                                         }
+							ast_mutex_unlock(&p->lock);
 							if (client->curmaster)
 							{
 								gettimeofday(&tv,NULL);
@@ -3935,37 +4101,14 @@ static void *voter_reader(void *data)
 									}
 									if (!client->heardfrom) client->lastheardtime.tv_sec = client->lastheardtime.tv_usec = 0;
 								}
-								if (check_client_sanity)
-								{
-									for(client = clients; client; client = client->next)
-									{
-										for(p = pvts; p; p = p->next)
-										{
-											if (p->nodenum == client->nodenum) break;
-										}
-										if ((!p) || p->priconn) continue;
-										if (!client->respdigest) continue;
-										for(client1 = client->next; client1; client1 = client1->next)
-										{
-											if (client1 == client) continue;
-											if ((client1->sin.sin_addr.s_addr == client->sin.sin_addr.s_addr) &&
-												(client1->sin.sin_port == client->sin.sin_port))
-											{
-												if (!client1->respdigest) continue;
-												client->respdigest = 0;
-												client->heardfrom = 0;
-												client1->respdigest = 0;
-												client1->heardfrom = 0;
-											}
-										}
-									}
-								}
+								if (check_client_sanity) voter_check_sanity(1);
 								hasmastered = 0;
 								voter_xmit_master();
-								for(p = pvts; p; p = p->next)
+								for(p = pvts; p; ast_mutex_unlock(&p->lock), p = p->next)
 								{
 									char startagain;
 
+									ast_mutex_lock(&p->lock);
 									startagain = 0;
 									maxrssi = 0;
 									maxclient = NULL;
@@ -3977,27 +4120,7 @@ static void *voter_reader(void *data)
 										if (client->nodenum != p->nodenum) continue;
 										if (client->mix) continue;
 										if (client->prio_override == -1) continue;
-										k = 0;
-										i = (int)client->buflen - ((int)client->drainindex + FRAME_SIZE);
-										if (i >= 0)
-										{
-											for(j = client->drainindex; j < client->drainindex + FRAME_SIZE; j++)
-											{
-												k += client->rssi[j];
-											}
-										}
-										else
-										{
-											for(j = client->drainindex; j < client->drainindex + (FRAME_SIZE + i); j++)
-											{
-												k += client->rssi[j];
-											}
-											for(j = 0; j < -i; j++)
-											{
-												k += client->rssi[j];
-											}
-										}			
-										client->lastrssi = k / FRAME_SIZE; 
+										client->lastrssi = voter_ring_sum(client,client->rssi) / FRAME_SIZE;
 										maxprio = thisprio = 0;
 										if (maxclient)
 										{
@@ -4023,25 +4146,7 @@ static void *voter_reader(void *data)
 										if (client->nodenum != p->nodenum) continue;
 										if (client->mix) continue;
 										if (client->prio_override == -1) continue;
-										i = (int)client->buflen - ((int)client->drainindex + FRAME_SIZE);
-										if (i >= 0)
-										{
-											for(j = client->drainindex; j < client->drainindex + FRAME_SIZE; j++)
-											{
-												client->rssi[j] = 0;
-											}
-										}
-										else
-										{
-											for(j = client->drainindex; j < client->drainindex + (FRAME_SIZE + i); j++)
-											{
-												client->rssi[j] = 0;
-											}
-											for(j = 0; j < -i; j++)
-											{
-												client->rssi[j] = 0;
-											}
-										}			
+										voter_ring_fill(client,client->rssi,0);
 									}
 									if (!maxclient) maxrssi = 0;
 									memset(p->buf + AST_FRIENDLY_OFFSET,0xff,FRAME_SIZE);
@@ -4581,7 +4686,7 @@ static int reload(void)
 	struct ast_variable *v;
 
 	
-	ast_mutex_lock(&voter_lock);
+	voter_lock_all();
 	for(client = clients; client; client = client->next)
 	{
 		client->reload = 0;
@@ -4594,7 +4699,8 @@ static int reload(void)
         if (!(cfg = ast_config_load(config))) {
 #endif
                 ast_log(LOG_ERROR, "Unable to load config %s\n", config);
-		ast_mutex_unlock(&voter_lock);
+		voter_rehash_clients();
+		voter_unlock_all();
 		return -1;
         }
 
@@ -4763,7 +4869,8 @@ static int reload(void)
 				ast_log(LOG_ERROR,"Cant Malloc()\n");
                                 close(udp_socket);
                                 ast_config_destroy(cfg);
-				ast_mutex_unlock(&voter_lock);
+				voter_rehash_clients();
+				voter_unlock_all();
 				return -1;
 			}
 			n = finddelim(cp,strs,40);
@@ -4795,7 +4902,8 @@ static int reload(void)
 					ast_free(cp);
 			                close(udp_socket);
 					ast_config_destroy(cfg);
-					ast_mutex_unlock(&voter_lock);
+					voter_rehash_clients();
+					voter_unlock_all();
 					return -1;
 				}
 				memset(client,0,sizeof(struct voter_client));
@@ -4865,7 +4973,8 @@ static int reload(void)
 					ast_log(LOG_ERROR,"Cant realloc()\n");
 			                close(udp_socket);
 					ast_config_destroy(cfg);
-					ast_mutex_unlock(&voter_lock);
+					voter_rehash_clients();
+					voter_unlock_all();
 					return -1;
 				}
 				memset(client->audio,0xff,client->buflen);
@@ -4878,7 +4987,8 @@ static int reload(void)
 					ast_log(LOG_ERROR,"Cant malloc()\n");
 			                close(udp_socket);
 					ast_config_destroy(cfg);
-					ast_mutex_unlock(&voter_lock);
+					voter_rehash_clients();
+					voter_unlock_all();
 					return -1;
 				}
 				memset(client->audio,0xff,client->buflen);
@@ -4891,7 +5001,8 @@ static int reload(void)
 					ast_log(LOG_ERROR,"Cant realloc()\n");
 			                close(udp_socket);
 					ast_config_destroy(cfg);
-					ast_mutex_unlock(&voter_lock);
+					voter_rehash_clients();
+					voter_unlock_all();
 					return -1;
 				}
 				memset(client->rssi,0,client->buflen);
@@ -4904,7 +5015,8 @@ static int reload(void)
 					ast_log(LOG_ERROR,"Cant malloc()\n");
 			                close(udp_socket);
 					ast_config_destroy(cfg);
-					ast_mutex_unlock(&voter_lock);
+					voter_rehash_clients();
+					voter_unlock_all();
 					return -1;
 				}
 				memset(client->rssi,0,client->buflen);
@@ -4928,7 +5040,8 @@ static int reload(void)
 		if (client->digest == 0)
 		{
 			ast_log(LOG_ERROR,"Can Not Load chan_voter -- VOTER client %s has invalid authentication digest (can not be 0)!!!\n",client->name);
-			ast_mutex_unlock(&voter_lock);
+			voter_rehash_clients();
+			voter_unlock_all();
 			return -1;
 		}
 		if (client->dynamic) continue;
@@ -4939,7 +5052,8 @@ static int reload(void)
 			if (client->digest == client1->digest)
 			{
 				ast_log(LOG_ERROR,"Can Not Load chan_voter -- VOTER clients %s and %s have same authentication digest!!!\n",client->name,client1->name);
-				ast_mutex_unlock(&voter_lock);
+				voter_rehash_clients();
+				voter_unlock_all();
 				return -1;
 			}
 		}
@@ -4960,7 +5074,8 @@ static int reload(void)
 		ast_free(client);
 		client = clients;
 	}
-	ast_mutex_unlock(&voter_lock);
+	voter_rehash_clients();
+	voter_unlock_all();
 	return(0);
 }
 
@@ -0,0 +1,174 @@
+/*
+ * Polyphase FIR rate converters for the USB radio channel drivers
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ *
+ * The decimator only computes the outputs that are kept, and the
+ * interpolator splits the prototype filter into one short bank per output
+ * phase. The interpolator assumes its input is held for factor samples
+ * (which is what feeding the same sample to a full-rate FIR factor times
+ * does), so its outputs are identical to that.
+ *
+ * The delay line is stored twice, so the newest ntaps samples are always
+ * contiguous and nothing is shifted.
+ *
+ * When the coefficients fit in 16 bits the dot products go through
+ * fir_dot16(), which uses NEON or SSE2 where the compiler offers them.
+ * Every version sums exactly in 64 bits, so they all give the same
+ * answer as the plain C loop.
+ *
+ * Included directly by chan_simpleusb.c and xpmr.c, hence the guard.
+ */
+
+#ifndef	POLYPHASE_C
+#define	POLYPHASE_C
+
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define	PP_MAXTAPS 128
+
+struct polyphase {
+	int	factor;			/* rate change */
+	int	ntaps;			/* taps per output */
+	int	pos;			/* index of newest sample in z */
+	int	narrow;			/* coef16 is usable */
+	int32_t	coef[PP_MAXTAPS];	/* filter, or factor banks of ntaps for interpolators */
+	int16_t	coef16[PP_MAXTAPS];	/* same, when every coef is within +/-32767 */
+	int16_t	z[PP_MAXTAPS * 2];	/* delay line, newest first */
+};
+
+/* sum of h[i] * x[i], exact. h must not contain -32768 */
+static inline int64_t fir_dot16(const int16_t *h, const int16_t *x, int n)
+{
+	int i = 0;
+	int64_t accum = 0;
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+	int64x2_t acc = vdupq_n_s64(0);
+
+	for(; i + 4 <= n; i += 4)
+		acc = vpadalq_s32(acc,vmull_s16(vld1_s16(h + i),vld1_s16(x + i)));
+	accum = vgetq_lane_s64(acc,0) + vgetq_lane_s64(acc,1);
+#elif defined(__SSE2__)
+	/* pairs of products can not overflow 32 bits without a -32768 in h */
+	__m128i acc = _mm_setzero_si128(),p,sign;
+	int64_t lanes[2];
+
+	for(; i + 8 <= n; i += 8)
+	{
+		p = _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(h + i)),
+			_mm_loadu_si128((const __m128i *)(x + i)));
+		sign = _mm_srai_epi32(p,31);
+		acc = _mm_add_epi64(acc,_mm_unpacklo_epi32(p,sign));
+		acc = _mm_add_epi64(acc,_mm_unpackhi_epi32(p,sign));
+	}
+	_mm_storeu_si128((__m128i *)lanes,acc);
+	accum = lanes[0] + lanes[1];
+#endif
+	for(; i < n; i++) accum += h[i] * x[i];
+	return(accum);
+}
+
+static void polyphase_narrow(struct polyphase *pp, int n)
+{
+	int i;
+
+	for(i = 0; i < n; i++)
+	{
+		if ((pp->coef[i] > 32767) || (pp->coef[i] < -32767)) return;
+		pp->coef16[i] = pp->coef[i];
+	}
+	pp->narrow = 1;
+}
+
+/* set up to decimate by factor, using FIR h */
+static int polyphase_init_decim(struct polyphase *pp, const short *h, int ntaps, int factor)
+{
+	int i;
+
+	memset(pp,0,sizeof(*pp));
+	if ((ntaps < 1) || (ntaps > PP_MAXTAPS) || (factor < 1)) return(-1);
+	pp->factor = factor;
+	pp->ntaps = ntaps;
+	for(i = 0; i < ntaps; i++) pp->coef[i] = h[i];
+	polyphase_narrow(pp,ntaps);
+	return(0);
+}
+
+/* set up to interpolate by factor, using FIR h */
+static int polyphase_init_interp(struct polyphase *pp, const short *h, int ntaps, int factor)
+{
+	int i,p,m;
+
+	memset(pp,0,sizeof(*pp));
+	if ((ntaps < 1) || (factor < 1)) return(-1);
+	m = (ntaps + factor - 2) / factor + 1;
+	if ((m * factor) > PP_MAXTAPS) return(-1);
+	pp->factor = factor;
+	pp->ntaps = m;
+	/* output phase p sees input sample n - m through taps
+	   i where ceil((i - p) / factor) == m */
+	for(p = 0; p < factor; p++)
+	{
+		for(i = 0; i < ntaps; i++)
+		{
+			if (i + factor - 1 < p) continue;
+			pp->coef[(p * m) + ((i - p + factor - 1) / factor)] += h[i];
+		}
+	}
+	polyphase_narrow(pp,m * factor);
+	return(0);
+}
+
+static inline void polyphase_push(struct polyphase *pp, int16_t x)
+{
+	pp->pos = ((pp->pos) ? pp->pos : pp->ntaps) - 1;
+	pp->z[pp->pos] = pp->z[pp->pos + pp->ntaps] = x;
+}
+
+/* output for coefficient bank b */
+static inline int64_t polyphase_dot(struct polyphase *pp, int b)
+{
+	int i;
+	int64_t accum;
+	int32_t *h;
+	int16_t *z;
+
+	z = pp->z + pp->pos;
+	if (pp->narrow) return(fir_dot16(pp->coef16 + (b * pp->ntaps),z,pp->ntaps));
+	h = pp->coef + (b * pp->ntaps);
+	accum = 0;
+	for(i = 0; i < pp->ntaps; i++) accum += h[i] * z[i];
+	return(accum);
+}
+
+/* take factor input samples, every stride shorts apart, and return one
+   unscaled output */
+static int64_t polyphase_decimate(struct polyphase *pp, const short *in, int stride)
+{
+	int i;
+
+	for(i = 0; i < pp->factor; i++) polyphase_push(pp,in[i * stride]);
+	return(polyphase_dot(pp,0));
+}
+
+/* take one input sample and return factor unscaled outputs */
+static void polyphase_interpolate(struct polyphase *pp, short in, int64_t *out)
+{
+	int p;
+
+	polyphase_push(pp,in);
+	for(p = 0; p < pp->factor; p++)
+		out[p] = polyphase_dot(pp,p);
+}
+
+#endif
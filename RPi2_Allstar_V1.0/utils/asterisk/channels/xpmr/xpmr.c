@@ -65,6 +65,7 @@
 #include "xpmr.h"
 #include "xpmr_coef.h"
 #include "sinetabx.h"
+#include "../polyphase.c"
 
 static i16 pmrChanIndex=0;	 			// count of created pmr instances
 //static i16 pmrSpsIndex=0;
@@ -479,10 +480,11 @@ i16 pmr_rx_frontend(t_pmr_sps *mySps)
 	#define DCgainBpfNoise 	65536
 
 	i16 samples,nx,iOutput, *input, *output, *noutput;
-	i16 *x, *coef;
+	i16 *x, *z, *coef;
 	i16 decimator, decimate, doNoise, fever, fev1;
     i32 i, naccum, outputGain, calcAdjust;
 	i64 y, npwr;
+	struct polyphase *pp;
 
 	TRACEJ(5,("pmr_rx_frontend()\n"));
 
@@ -515,23 +517,36 @@ i16 pmr_rx_frontend(t_pmr_sps *mySps)
 	else
 	    fev1 = nx - 1;
 
-	for(i=0;i<samples;i++)
+	// with the history fixed, keep it in a doubled delay line instead of
+	// shifting it every sample. Without fever the partial shift is kept as is.
+	if(fever && !mySps->poly)
 	{
-		i16 n;
+		mySps->poly=calloc(1,sizeof(struct polyphase));
+		if(mySps->poly&&polyphase_init_decim(mySps->poly,coef_fir_lpf_3K_1,nx,1))
+		{
+			free(mySps->poly);
+			mySps->poly=NULL;
+		}
+	}
+	pp=(fever) ? mySps->poly : NULL;
 
-		//shift the old samples
-        #if 0
-	    for(n=nx-1; n>0; n--)
-	       x[n] = x[n-1];
-        #else
-		memmove(x+1,x,fev1);
-        #endif
-	    x[0] = input[i*2];
+	for(i=0;i<samples;i++)
+	{
+		if(pp)
+		{
+			polyphase_push(pp,input[i*2]);
+			z=pp->z+pp->pos;
+		}
+		else
+		{
+			//shift the old samples
+			memmove(x+1,x,fev1);
+		    x[0] = input[i*2];
+			z=x;
+		}
 
 #if	XPMR_TRACE_FRONTEND == 1
-	    y=0;
-	    for(n=0; n<nx; n++)
-	        y += coef_fir_lpf_3K_1[n] * x[n];
+	    y=fir_dot16(coef_fir_lpf_3K_1,z,nx);
 
 	    y=((y/calcAdjust)*outputGain)/M_Q8;
 		input[i*2]=y;	 // debug output LowPass at 48KS/s 
@@ -540,17 +555,15 @@ i16 pmr_rx_frontend(t_pmr_sps *mySps)
 		if(doNoise)
 		{
 			// calculate noise filter output
-			naccum=0;
+			// i32 like the sum it replaces
 			if(mySps->parentChan->rxNoiseFilType==0)
 			{
-			    for(n=0; n<nx; n++)
-			        naccum += coef_fir_bpf_noise_1[n] * x[n];	
+			    naccum = fir_dot16(coef_fir_bpf_noise_1,z,nx);
 			    naccum /= DCgainBpfNoise;
 			}
 			else
 			{
-			    for(n=0; n<taps_fir_bpf_noise_2; n++)
-			        naccum += coef_fir_bpf_noise_2[n] * x[n];
+			    naccum = fir_dot16(coef_fir_bpf_noise_2,z,taps_fir_bpf_noise_2);
 			    naccum /= gain_fir_bpf_noise_2;
 			}
 #if	XPMR_TRACE_FRONTEND == 1
@@ -566,9 +579,7 @@ i16 pmr_rx_frontend(t_pmr_sps *mySps)
 		{
 			decimator=decimate;
 
-		    y=0;
-		    for(n=0; n<nx; n++)
-		        y += coef_fir_lpf_3K_1[n] * x[n];
+		    y=fir_dot16(coef_fir_lpf_3K_1,z,nx);
 
 		    y=((y/calcAdjust)*outputGain)/M_Q8;
 
@@ -646,6 +657,7 @@ i16 pmr_gp_fir(t_pmr_sps *mySps)
 	i16 amax, amin, apeak=0, discounteru=0, discounterl=0, discfactor;
 	i16 decimator, decimate, interpolate;
 	i16 numChanOut, selChanOut, mixOut, monoOut;
+	i64 pout[PP_MAXTAPS];
 
 	TRACEJ(5,("pmr_gp_fir() %i %i\n",mySps->index, mySps->enabled));
 
@@ -697,6 +709,28 @@ i16 pmr_gp_fir(t_pmr_sps *mySps)
 		return 0;
 	}
 
+	// code_string_parse() may have switched filters
+	if(mySps->poly&&(mySps->polycoef!=coef))
+	{
+		free(mySps->poly);
+		mySps->poly=NULL;
+	}
+
+	// upsamplers only need to compute each output phase's share of the filter,
+	// and neither needs the history shifted every sample
+	if(mySps->poly==NULL)
+	{
+		mySps->poly=calloc(1,sizeof(struct polyphase));
+		mySps->polycoef=coef;
+		if(mySps->poly&&((interpolate>1) ?
+			polyphase_init_interp(mySps->poly,coef,nx,interpolate) :
+			polyphase_init_decim(mySps->poly,coef,nx,1)))
+		{
+			free(mySps->poly);
+			mySps->poly=NULL;
+		}
+	}
+
 	ii=0;
 	for(i=0;i<nsamples;i++)
 	{
@@ -709,14 +743,31 @@ i16 pmr_gp_fir(t_pmr_sps *mySps)
 			decimator=decimate;
 		}
 
+		if(mySps->poly)
+		{
+			i16 xin=(input[i]*inputGain)/M_Q8;
+
+			if(interpolate>1)
+				polyphase_interpolate(mySps->poly,xin,pout);
+			else
+				pout[0]=polyphase_decimate(mySps->poly,&xin,1);
+		}
+
 		for(ix=0;ix<interpolate;ix++)
 		{
 			i16 n;
 			y=0;
 
-		    for(n=nx-1; n>0; n--)
-		       x[n] = x[n-1];
-		    x[0] = (input[i]*inputGain)/M_Q8;
+			if(mySps->poly)
+			{
+				y=pout[ix];
+			}
+			else
+			{
+			    for(n=nx-1; n>0; n--)
+			       x[n] = x[n-1];
+			    x[0] = (input[i]*inputGain)/M_Q8;
+			}
 
 			#if 0
 			--decimator;
@@ -729,8 +780,11 @@ i16 pmr_gp_fir(t_pmr_sps *mySps)
 				output[ii++]=y;
 			}
 		 	#else
-		    for(n=0; n<nx; n++)
-		        y += coef[n] * x[n];
+			if(!mySps->poly)
+			{
+			    for(n=0; n<nx; n++)
+			        y += coef[n] * x[n];
+			}
 
 			y=((y/calcAdjust)*outputGain)/M_Q8;
 
@@ -2614,6 +2668,7 @@ i16 destroyPmrSps(t_pmr_sps  *pSps)
 	TRACEJ(1,("destroyPmrSps(%i)\n",pSps->index));
 
 	if(pSps->x!=NULL)free(pSps->x);
+	if(pSps->poly!=NULL)free(pSps->poly);
 	free(pSps);
 	return 0;
 }
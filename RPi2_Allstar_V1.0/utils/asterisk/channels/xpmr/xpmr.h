@@ -550,6 +550,9 @@ typedef struct t_pmr_sps
  	void  *coefa;
 	void  *coefb;
 
+	void  *poly;		// polyphase filter state, replaces x
+	void  *polycoef;	// coef that poly was built from
+
 	void  *nextSps;		// next Sps function
 
 } t_pmr_sps;
@@ -0,0 +1,177 @@
+/*
+ * xpmr_replay.c - replay recorded receive audio through xpmr
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*! \file
+ *
+ * \brief Feed a recording through the xpmr receive chain and print what it
+ * detects, so two versions of xpmr.c can be checked against each other.
+ *
+ * The input is raw 16 bit native endian audio at 48 kHz, as the radio
+ * channel drivers read it from the sound card: stereo interleaved, only
+ * the left channel is used.  Mono files can be given with -m.
+ *
+ * One line is printed for every change of carrier detect or CTCSS decode,
+ * with the 48 kHz sample it happened at, and one line per second of input
+ * with a hash of the 8 kHz receive audio.  The last line has the totals
+ * and the CPU time, which is the only line that should differ between two
+ * builds that process audio identically.
+ *
+ * Built on demand from the top of the tree with
+ * "make -C channels ASTTOPDIR=`pwd` xpmr/xpmr_replay".  To compare with
+ * another revision, build this file against that revision's xpmr.c:
+ *
+ *   cc -O2 -o xpmr_replay_old -DXPMR_SRC='"/old/tree/channels/xpmr/xpmr.c"' \
+ *      channels/xpmr/xpmr_replay.c -lm
+ *   ./xpmr_replay_old rx.raw > old.txt; channels/xpmr/xpmr_replay rx.raw > new.txt
+ *   diff old.txt new.txt
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#ifndef	XPMR_SRC
+#define	XPMR_SRC "xpmr.c"
+#endif
+
+/* xpmr.c only logs from its parallel port test code */
+#define	LOG_ERROR 4
+#define	ast_log(level,...) fprintf(stderr,__VA_ARGS__)
+
+#include XPMR_SRC
+
+#define	FRAME_SIZE	160			/* 8 kHz samples per 20 ms, as in the drivers */
+#define	RX_SAMPLES	(FRAME_SIZE * 6)	/* 48 kHz samples per frame */
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: xpmr_replay [-m] [-s] [-v] [-c ctcssfreqs] [-d flat|speaker]\n"
+		"                   [-q squelch] file.raw\n"
+		"  -m  input is mono instead of stereo interleaved\n"
+		"  -s  legacy front end (fever off)\n"
+		"  -v  carrier from voice activity instead of noise\n"
+		"  -c  receive CTCSS tones, as in usbradio.conf (default 100.0)\n"
+		"  -d  receive demodulation (default flat)\n"
+		"  -q  squelch setting 0-999 (default 500)\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	t_pmr_chan tChan, *pChan;
+	char ctcss[512] = "100.0", txdefault[16] = "100.0";
+	i16 in[RX_SAMPLES * 2], rxout[FRAME_SIZE], txout[RX_SAMPLES * 2];
+	unsigned long long hash = 14695981039346656037ULL;
+	unsigned long frames = 0, events = 0, sample;
+	int mono = 0, fever = 1, squelch = 500, c, i, n;
+	i16 carrier = -1, decode = -2;
+	clock_t cpu, start;
+	FILE *fp;
+
+	memset(&tChan,0,sizeof(tChan));
+	tChan.rxDemod = RX_AUDIO_FLAT;
+	tChan.rxCdType = CD_XPMR_NOISE;
+	while ((c = getopt(argc,argv,"msvc:d:q:")) != -1)
+	{
+		switch (c)
+		{
+		case 'm':
+			mono = 1;
+			break;
+		case 's':
+			fever = 0;
+			break;
+		case 'v':
+			tChan.rxCdType = CD_XPMR_VOX;
+			break;
+		case 'c':
+			snprintf(ctcss,sizeof(ctcss),"%s",optarg);
+			break;
+		case 'd':
+			if (!strcmp(optarg,"speaker")) tChan.rxDemod = RX_AUDIO_SPEAKER;
+			else if (!strcmp(optarg,"flat")) tChan.rxDemod = RX_AUDIO_FLAT;
+			else usage();
+			break;
+		case 'q':
+			squelch = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1) usage();
+	if (!(fp = fopen(argv[optind],"r")))
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+
+	tChan.pTxCodeDefault = txdefault;
+	tChan.pRxCodeSrc = ctcss;
+	tChan.pTxCodeSrc = ctcss;
+	tChan.rxCarrierHyst = 3000;
+	tChan.rxSqVoxAdj = 1;
+	tChan.fever = fever;
+	tChan.name = "replay";
+	if (!(pChan = createPmrChannel(&tChan,FRAME_SIZE)))
+	{
+		fprintf(stderr,"createPmrChannel() failed\n");
+		return 1;
+	}
+	*(pChan->prxSquelchAdjust) = ((999 - squelch) * 32767) / 1000;
+	*(pChan->prxVoiceAdjust) = 0.5 * M_Q8;
+	*(pChan->prxCtcssAdjust) = 0.5 * M_Q8;
+
+	cpu = 0;
+	for (;;)
+	{
+		if (mono)
+		{
+			n = fread(in,sizeof(i16),RX_SAMPLES,fp);
+			for (i = n - 1; i >= 0; i--)
+			{
+				in[i * 2] = in[i];
+				in[i * 2 + 1] = 0;
+			}
+		}
+		else n = fread(in,sizeof(i16) * 2,RX_SAMPLES,fp);
+		if (n < RX_SAMPLES) break;
+
+		start = clock();
+		PmrRx(pChan,in,rxout,txout);
+		cpu += clock() - start;
+
+		sample = frames * RX_SAMPLES;
+		frames++;
+		for (i = 0; i < FRAME_SIZE; i++)
+			hash = (hash ^ (unsigned short)rxout[i]) * 1099511628211ULL;
+		if (pChan->rxCarrierDetect != carrier)
+		{
+			carrier = pChan->rxCarrierDetect;
+			printf("%lu carrier %d\n",sample,carrier);
+			events++;
+		}
+		if (pChan->b.ctcssRxEnable && (pChan->rxCtcss->decode != decode))
+		{
+			decode = pChan->rxCtcss->decode;
+			printf("%lu ctcss %d\n",sample,decode);
+			events++;
+		}
+		if (!(frames % 50))
+			printf("%lu audio %016llx\n",sample + RX_SAMPLES,hash);
+	}
+	fclose(fp);
+	printf("%lu frames, %lu events, audio %016llx, cpu %.1f ms\n",frames,events,hash,
+		cpu * 1000.0 / CLOCKS_PER_SEC);
+	destroyPmrChannel(pChan);
+	return 0;
+}
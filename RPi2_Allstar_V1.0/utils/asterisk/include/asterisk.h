@@ -65,6 +65,7 @@ int reload_logger(int);				/*!< Provided by logger.c */
 int init_framer(void);				/*!< Provided by frame.c */
 int ast_term_init(void);			/*!< Provided by term.c */
 int astdb_init(void);				/*!< Provided by db.c */
+void astdb_close(void);				/*!< Provided by db.c */
 void ast_channels_init(void);			/*!< Provided by channel.c */
 void ast_builtins_init(void);			/*!< Provided by cli.c */
 int dnsmgr_init(void);				/*!< Provided by dnsmgr.c */ 
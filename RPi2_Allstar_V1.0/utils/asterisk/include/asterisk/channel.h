@@ -461,6 +461,9 @@ struct ast_channel {
 
 	/*! \brief Data stores on the channel */
 	AST_LIST_HEAD_NOLOCK(datastores, ast_datastore) datastores;
+
+	struct ast_waiter *waiter;			/*!< Persistent waiter this channel is in, if any */
+	int waiterslot;					/*!< Its slot in that waiter */
 };
 
 /*! \brief ast_channel_tech Properties */
@@ -848,6 +851,52 @@ struct ast_channel *ast_waitfor_nandfds(struct ast_channel **chan, int n, int *f
 	\param ms time "ms" is modified in-place, if applicable */
 struct ast_channel *ast_waitfor_n(struct ast_channel **chan, int n, int *ms);
 
+/*! \brief Persistent set of channels and fds to wait on
+ *
+ * For callers that wait on the same large set of channels over and over.
+ * Channels are registered once instead of on every call, and a wait costs
+ * O(ready) rather than O(channels).  fd changes made through
+ * ast_channel_set_fd(), by masquerades, or by starting and stopping
+ * generators are picked up at once; changes a driver makes to chan->fds
+ * directly are picked up when the channel next comes up ready, or within
+ * a second.
+ *
+ * A waiter must only be used from one thread, and a channel can be in at
+ * most one waiter.  Channels are removed automatically when freed, which
+ * may happen in any thread.
+ * Unlike ast_waitfor_nandfds(), waiting does not set AST_FLAG_BLOCKING;
+ * soft hangups still wake the waiter through the channel's alert pipe.
+ */
+struct ast_waiter;
+
+/*! \brief Create an empty waiter.  \return NULL on failure */
+struct ast_waiter *ast_waiter_new(void);
+
+/*! \brief Destroy a waiter, removing any channels still in it */
+void ast_waiter_destroy(struct ast_waiter *w);
+
+/*! \brief Add a channel to a waiter.  \return 0 on success, -1 on failure */
+int ast_waiter_add(struct ast_waiter *w, struct ast_channel *chan);
+
+/*! \brief Remove a channel from a waiter.  \return 0 on success, -1 if it was not in it */
+int ast_waiter_remove(struct ast_waiter *w, struct ast_channel *chan);
+
+/*! \brief Add a plain fd to a waiter.  \return 0 on success, -1 on failure */
+int ast_waiter_add_fd(struct ast_waiter *w, int fd);
+
+/*! \brief Remove a plain fd from a waiter.  \return 0 on success, -1 if it was not in it */
+int ast_waiter_remove_fd(struct ast_waiter *w, int fd);
+
+/*! \brief Set one of a channel's fds, and tell its waiter, if any */
+void ast_channel_set_fd(struct ast_channel *chan, int which, int fd);
+
+/*! \brief Wait for activity on a waiter's channels or fds
+ * Same results as ast_waitfor_nandfds(): the channel with activity, or
+ * NULL with outfd set if an fd came first (fds have priority), or NULL on
+ * timeout or error.
+ */
+struct ast_channel *ast_waiter_wait(struct ast_waiter *w, int *exception, int *outfd, int *ms);
+
 /*! \brief Waits for input on an fd
 	This version works on fd's only.  Be careful with it. */
 int ast_waitfor_n_fd(int *fds, int n, int *ms, int *exception);
@@ -108,6 +108,17 @@ char *ast_cli_complete(const char *word, char *const choices[], int pos);
  */
 int ast_cli_command(int fd, const char *s);
 
+/*! \brief Interprets a command, collecting its output in memory
+ * Everything the handler writes with ast_cli() is returned, instead of
+ * going to a file descriptor.
+ * \note Only ast_cli() output is collected.  The handler is given a
+ * descriptor open on /dev/null, so anything it write()s to that fd itself,
+ * or hands to another process or thread to write later, is lost.  Handlers
+ * that may be run this way (manager Command, for one) must use ast_cli().
+ * \return the output, which the caller must free, or NULL on failure
+ */
+char *ast_cli_command_capture(const char *s);
+
 /*! 
  * \brief Executes multiple CLI commands
  * Interpret strings separated by '\0' and execute each one, sending output to fd
@@ -128,6 +128,13 @@ int astman_verify_session_writepermissions(uint32_t ident, int perm);
 */
 int __attribute__ ((format (printf, 3,4))) manager_event(int category, const char *event, const char *contents, ...);
 
+/*! Send a state event that may be coalesced for slow clients */
+/*!	\param key	Events with the same key replace one another in the
+			queue of a session that has fallen behind, so only the
+			newest state is sent to it
+*/
+int __attribute__ ((format (printf, 4,5))) manager_event_keyed(int category, const char *event, const char *key, const char *contents, ...);
+
 /*! Get header from mananger transaction */
 const char *astman_get_header(const struct message *m, char *var);
 
@@ -114,6 +114,8 @@ extern int option_verbose;
 extern int option_debug;		/*!< Debugging */
 extern int option_maxcalls;		/*!< Maximum number of simultaneous channels */
 extern double option_maxload;
+extern int option_dbsyncinterval;	/*!< Seconds between astdb group commits, 0 to sync every write */
+extern int option_dbsyncwrites;		/*!< astdb writes that force an early group commit */
 extern char defaultlanguage[];
 
 extern time_t ast_startuptime;
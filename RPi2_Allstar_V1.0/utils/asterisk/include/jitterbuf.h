@@ -28,7 +28,7 @@ extern "C" {
 #define JB_HISTORY_DROPPCT	3
 	/* the maximum droppct we can handle (say it was configurable). */
 #define JB_HISTORY_DROPPCT_MAX	4
-	/* the size of the buffer we use to keep the top and botton timestamps for dropping */
+	/* the most timestamps we drop from either end of the history */
 #define JB_HISTORY_MAXBUF_SZ	JB_HISTORY_SZ * JB_HISTORY_DROPPCT_MAX / 100 
 	/* amount of additional jitterbuffer adjustment  */
 #define JB_TARGET_EXTRA 40
@@ -100,9 +100,7 @@ typedef struct jitterbuf {
 	/* history */
 	long history[JB_HISTORY_SZ];   		/* history */
 	int  hist_ptr;				/* points to index in history for next entry */
-	long hist_maxbuf[JB_HISTORY_MAXBUF_SZ];	/* a sorted buffer of the max delays (highest first) */
-	long hist_minbuf[JB_HISTORY_MAXBUF_SZ];	/* a sorted buffer of the min delays (lowest first) */
-	int  hist_maxbuf_valid;			/* are the "maxbuf"/minbuf valid? */
+	long hist_sorted[JB_HISTORY_SZ];	/* the same delays, lowest first */
 	unsigned int dropem:1;                  /* flag to indicate dropping frames (overload) */
 
 	jb_frame *frames; 		/* queued frames */
@@ -160,6 +160,8 @@ int option_debug;				/*!< Debug level */
 
 double option_maxload;				/*!< Max load avg on system */
 int option_maxcalls;				/*!< Max number of active calls */
+int option_dbsyncinterval;			/*!< Seconds between astdb group commits, 0 to sync every write */
+int option_dbsyncwrites;			/*!< astdb writes that force an early group commit */
 
 /*! @} */
 
@@ -1316,6 +1318,7 @@ static void quit_handler(int num, int nice, int safeshutdown, int restart)
 		close(ast_consock);
 	if (!ast_opt_remote)
 		unlink(ast_config_AST_PID);
+	astdb_close();
 	printf(term_quit());
 	if (restart) {
 		if (option_verbose || ast_opt_console)
@@ -2567,6 +2570,14 @@ static void ast_readconfig(void)
 			if ((sscanf(v->value, "%d", &option_maxcalls) != 1) || (option_maxcalls < 0)) {
 				option_maxcalls = 0;
 			}
+		} else if (!strcasecmp(v->name, "dbsyncinterval")) {
+			if ((sscanf(v->value, "%d", &option_dbsyncinterval) != 1) || (option_dbsyncinterval < 0)) {
+				option_dbsyncinterval = 0;
+			}
+		} else if (!strcasecmp(v->name, "dbsyncwrites")) {
+			if ((sscanf(v->value, "%d", &option_dbsyncwrites) != 1) || (option_dbsyncwrites < 0)) {
+				option_dbsyncwrites = 0;
+			}
 		} else if (!strcasecmp(v->name, "maxload")) {
 			double test[1];
 
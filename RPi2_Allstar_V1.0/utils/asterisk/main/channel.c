@@ -36,6 +36,9 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 147386 $")
 #include <errno.h>
 #include <unistd.h>
 #include <math.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 
 #if defined(HAVE_ZAPTEL) || defined (HAVE_DAHDI)
 #include <sys/ioctl.h>
@@ -109,6 +112,9 @@ static AST_LIST_HEAD_NOLOCK_STATIC(backends, chanlist);
     both the channels list and the backends list.  */
 static AST_LIST_HEAD_STATIC(channels, ast_channel);
 
+static void waiter_chan_changed(struct ast_channel *chan);
+static void waiter_chan_free(struct ast_channel *chan);
+
 /*! map AST_CAUSE's to readable string representations */
 const struct ast_cause {
 	int cause;
@@ -1218,6 +1224,8 @@ void ast_channel_free(struct ast_channel *chan)
 	ast_channel_lock(chan);
 	ast_channel_unlock(chan);
 
+	waiter_chan_free(chan);
+
 	/* Get rid of each of the data stores on the channel */
 	while ((datastore = AST_LIST_REMOVE_HEAD(&chan->datastores, entry)))
 		/* Free the data store */
@@ -1576,7 +1584,7 @@ void ast_deactivate_generator(struct ast_channel *chan)
 			chan->generator->release(chan, chan->generatordata);
 		chan->generatordata = NULL;
 		chan->generator = NULL;
-		chan->fds[AST_GENERATOR_FD] = -1;
+		ast_channel_set_fd(chan, AST_GENERATOR_FD, -1);
 		ast_clear_flag(chan, AST_FLAG_WRITE_INT);
 		ast_settimeout(chan, 0, NULL, NULL);
 	}
@@ -1635,6 +1643,8 @@ int ast_activate_generator(struct ast_channel *chan, struct ast_generator *gen,
 		ast_settimeout(chan, 160, generator_force, chan);
 		chan->generator = gen;
 	}
+	/* alloc may have set the generator fd */
+	waiter_chan_changed(chan);
 
 	ast_channel_unlock(chan);
 
@@ -1803,6 +1813,425 @@ struct ast_channel *ast_waitfor_n(struct ast_channel **c, int n, int *ms)
 	return ast_waitfor_nandfds(c, n, NULL, 0, NULL, NULL, ms);
 }
 
+/*
+ * Persistent waiters.  Channels stay registered in an epoll set, so a wait
+ * costs O(ready) rather than locking every channel and rebuilding a pollfd
+ * array.  The registered fds are rechecked for a channel when it comes up
+ * ready, for every channel after a masquerade, and once a second, which also
+ * catches drivers that assign chan->fds directly and rescans whentohangup.
+ */
+
+#define WAITER_EVENTS	16
+#define WAITER_FD	(1ULL << 63)	/*!< epoll data for a caller fd, else slot << 8 | fdno */
+
+struct ast_waiter_slot {
+	struct ast_channel *chan;
+	int fds[AST_MAX_FDS];		/*!< fds registered for chan */
+};
+
+struct ast_waiter {
+	ast_mutex_t lock;		/*!< protects the slots, which ast_channel_free() may change from another thread */
+	int epfd;
+	int dirty;			/*!< bumped, atomically, when a channel's fds change */
+	time_t lastscan;		/*!< time of the last full rescan */
+	time_t whentohangup;		/*!< earliest whentohangup as of lastscan */
+	int nslots;
+	int allocslots;
+	int nchans;
+	struct ast_waiter_slot *slots;
+	int nfds;
+	int *fds;
+};
+
+/*! Protects chan->waiter, so other threads can mark a waiter dirty.  It is
+    taken before a waiter's own lock, and ast_waiter_wait() never locks a
+    channel while it holds its waiter's lock. */
+AST_MUTEX_DEFINE_STATIC(waiterlock);
+
+/*! \brief Note that a channel's fds may have changed */
+static void waiter_chan_changed(struct ast_channel *chan)
+{
+	if (!chan->waiter)
+		return;
+	ast_mutex_lock(&waiterlock);
+	if (chan->waiter)
+		ast_atomic_fetchadd_int(&chan->waiter->dirty, 1);
+	ast_mutex_unlock(&waiterlock);
+}
+
+void ast_channel_set_fd(struct ast_channel *chan, int which, int fd)
+{
+	chan->fds[which] = fd;
+	waiter_chan_changed(chan);
+}
+
+/*! \brief Bring a slot's epoll registrations in line with its channel.
+	With force, unchanged fds are reasserted as well, in case they were
+	closed and reopened under the same number. */
+static void waiter_sync_slot(struct ast_waiter *w, int slot, int force)
+{
+	struct ast_waiter_slot *ws = &w->slots[slot];
+#ifdef __linux__
+	struct epoll_event ev;
+	int y, fd;
+
+	for (y = 0; y < AST_MAX_FDS; y++) {
+		fd = ws->chan->fds[y];
+		if ((fd == ws->fds[y]) && !force)
+			continue;
+		memset(&ev, 0, sizeof(ev));
+		if ((ws->fds[y] > -1) && (fd != ws->fds[y]))
+			epoll_ctl(w->epfd, EPOLL_CTL_DEL, ws->fds[y], &ev);
+		if (fd > -1) {
+			ev.events = EPOLLIN | EPOLLPRI;
+			ev.data.u64 = ((uint64_t) slot << 8) | y;
+			if (fd == ws->fds[y]) {
+				if (epoll_ctl(w->epfd, EPOLL_CTL_MOD, fd, &ev) && (errno == ENOENT))
+					epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev);
+			} else if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev) && (errno == EEXIST))
+				epoll_ctl(w->epfd, EPOLL_CTL_MOD, fd, &ev);
+		}
+		ws->fds[y] = fd;
+	}
+#else
+	memcpy(ws->fds, ws->chan->fds, sizeof(ws->fds));
+#endif
+}
+
+struct ast_waiter *ast_waiter_new(void)
+{
+	struct ast_waiter *w;
+
+	if (!(w = ast_calloc(1, sizeof(*w))))
+		return NULL;
+#ifdef __linux__
+	if ((w->epfd = epoll_create(32)) < 0) {
+		ast_log(LOG_WARNING, "Unable to create epoll set: %s\n", strerror(errno));
+		free(w);
+		return NULL;
+	}
+#else
+	w->epfd = -1;
+#endif
+	ast_mutex_init(&w->lock);
+	return w;
+}
+
+/*! \brief Take a channel out of its waiter.  Called with waiterlock and
+	the waiter's lock held. */
+static void waiter_remove_locked(struct ast_waiter *w, struct ast_channel *chan)
+{
+	struct ast_waiter_slot *ws = &w->slots[chan->waiterslot];
+#ifdef __linux__
+	struct epoll_event ev;
+	int y;
+#endif
+
+	chan->waiter = NULL;
+#ifdef __linux__
+	for (y = 0; y < AST_MAX_FDS; y++) {
+		if (ws->fds[y] > -1)
+			epoll_ctl(w->epfd, EPOLL_CTL_DEL, ws->fds[y], &ev);
+	}
+#endif
+	ws->chan = NULL;
+	w->nchans--;
+	while (w->nslots && !w->slots[w->nslots - 1].chan)
+		w->nslots--;
+}
+
+/*! \brief Drop a channel being freed from whatever waiter it is in */
+static void waiter_chan_free(struct ast_channel *chan)
+{
+	struct ast_waiter *w;
+
+	ast_mutex_lock(&waiterlock);
+	if ((w = chan->waiter)) {
+		ast_mutex_lock(&w->lock);
+		waiter_remove_locked(w, chan);
+		ast_mutex_unlock(&w->lock);
+	}
+	ast_mutex_unlock(&waiterlock);
+}
+
+void ast_waiter_destroy(struct ast_waiter *w)
+{
+	int x;
+
+	if (!w)
+		return;
+	ast_mutex_lock(&waiterlock);
+	ast_mutex_lock(&w->lock);
+	for (x = w->nslots - 1; x >= 0; x--) {
+		if (w->slots[x].chan)
+			waiter_remove_locked(w, w->slots[x].chan);
+	}
+	ast_mutex_unlock(&w->lock);
+	ast_mutex_unlock(&waiterlock);
+	ast_mutex_destroy(&w->lock);
+	if (w->epfd > -1)
+		close(w->epfd);
+	if (w->slots)
+		free(w->slots);
+	if (w->fds)
+		free(w->fds);
+	free(w);
+}
+
+int ast_waiter_add(struct ast_waiter *w, struct ast_channel *chan)
+{
+	struct ast_waiter_slot *slots;
+	int slot, y;
+
+	ast_mutex_lock(&waiterlock);
+	if (chan->waiter) {
+		ast_mutex_unlock(&waiterlock);
+		ast_log(LOG_WARNING, "Channel '%s' is already in a waiter\n", chan->name);
+		return -1;
+	}
+	ast_mutex_lock(&w->lock);
+	for (slot = 0; slot < w->nslots; slot++) {
+		if (!w->slots[slot].chan)
+			break;
+	}
+	if (slot == w->allocslots) {
+		if (!(slots = ast_realloc(w->slots, (w->allocslots + 16) * sizeof(*slots)))) {
+			ast_mutex_unlock(&w->lock);
+			ast_mutex_unlock(&waiterlock);
+			return -1;
+		}
+		w->slots = slots;
+		w->allocslots += 16;
+	}
+	if (slot == w->nslots)
+		w->nslots++;
+	w->slots[slot].chan = chan;
+	for (y = 0; y < AST_MAX_FDS; y++)
+		w->slots[slot].fds[y] = -1;
+	chan->waiter = w;
+	chan->waiterslot = slot;
+	waiter_sync_slot(w, slot, 0);
+	w->nchans++;
+	/* pick up its whentohangup */
+	w->lastscan = 0;
+	ast_mutex_unlock(&w->lock);
+	ast_mutex_unlock(&waiterlock);
+	return 0;
+}
+
+int ast_waiter_remove(struct ast_waiter *w, struct ast_channel *chan)
+{
+	ast_mutex_lock(&waiterlock);
+	if (chan->waiter != w) {
+		ast_mutex_unlock(&waiterlock);
+		return -1;
+	}
+	ast_mutex_lock(&w->lock);
+	waiter_remove_locked(w, chan);
+	ast_mutex_unlock(&w->lock);
+	ast_mutex_unlock(&waiterlock);
+	return 0;
+}
+
+int ast_waiter_add_fd(struct ast_waiter *w, int fd)
+{
+	int *fds;
+#ifdef __linux__
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLPRI;
+	ev.data.u64 = WAITER_FD | (unsigned int) fd;
+	if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev)) {
+		ast_log(LOG_WARNING, "Unable to add fd %d to waiter: %s\n", fd, strerror(errno));
+		return -1;
+	}
+#endif
+	if (!(fds = ast_realloc(w->fds, (w->nfds + 1) * sizeof(*fds))))
+		return -1;
+	w->fds = fds;
+	w->fds[w->nfds++] = fd;
+	return 0;
+}
+
+int ast_waiter_remove_fd(struct ast_waiter *w, int fd)
+{
+	int x;
+#ifdef __linux__
+	struct epoll_event ev;
+#endif
+
+	for (x = 0; x < w->nfds; x++) {
+		if (w->fds[x] != fd)
+			continue;
+		w->fds[x] = w->fds[--w->nfds];
+#ifdef __linux__
+		epoll_ctl(w->epfd, EPOLL_CTL_DEL, fd, &ev);
+#endif
+		return 0;
+	}
+	return -1;
+}
+
+struct ast_channel *ast_waiter_wait(struct ast_waiter *w, int *exception, int *outfd, int *ms)
+{
+#ifdef __linux__
+	struct epoll_event ev[WAITER_EVENTS];
+	struct timeval start = { 0 , 0 };
+	struct ast_channel *winner, *chan;
+	time_t now;
+	long rms;
+	int res, x, slot, fdno, full, dirty;
+	unsigned int events;
+
+	if (outfd)
+		*outfd = -99999;
+	if (exception)
+		*exception = 0;
+	if (*ms > 0)
+		start = ast_tvnow();
+
+	for (;;) {
+		time(&now);
+		ast_mutex_lock(&w->lock);
+		full = (now != w->lastscan);
+		if ((dirty = w->dirty))
+			ast_atomic_fetchadd_int(&w->dirty, -dirty);
+		if (full || dirty) {
+			if (full) {
+				w->lastscan = now;
+				w->whentohangup = 0;
+			}
+			for (slot = 0; slot < w->nslots; slot++) {
+				if (!(chan = w->slots[slot].chan))
+					continue;
+				waiter_sync_slot(w, slot, full);
+				if (full && chan->whentohangup &&
+				    (!w->whentohangup || (chan->whentohangup < w->whentohangup)))
+					w->whentohangup = chan->whentohangup;
+			}
+		}
+		winner = NULL;
+		if (w->whentohangup && (now >= w->whentohangup)) {
+			for (slot = 0; slot < w->nslots; slot++) {
+				if ((chan = w->slots[slot].chan) && chan->whentohangup &&
+				    (now >= chan->whentohangup)) {
+					winner = chan;
+					break;
+				}
+			}
+			/* rescan, the caller may clear or change it, and any others
+			   that are due are returned next time */
+			w->lastscan = 0;
+		}
+		ast_mutex_unlock(&w->lock);
+		if (winner) {
+			ast_channel_lock(winner);
+			winner->_softhangup |= AST_SOFTHANGUP_TIMEOUT;
+			ast_channel_unlock(winner);
+			return winner;
+		}
+
+		rms = *ms;
+		if (*ms > 0) {
+			rms -= ast_tvdiff_ms(ast_tvnow(), start);
+			if (rms <= 0) {
+				*ms = 0;
+				return NULL;
+			}
+		}
+		if (w->whentohangup && ((rms < 0) || (rms > (w->whentohangup - now) * 1000)))
+			rms = (w->whentohangup - now) * 1000;
+		/* wake at least once a second for the rescan */
+		if ((rms < 0) || (rms > 1000))
+			rms = 1000;
+
+		res = epoll_wait(w->epfd, ev, WAITER_EVENTS, rms);
+		if (res < 0) { /* Simulate a timeout if we were interrupted */
+			if (errno != EINTR)
+				*ms = -1;
+			return NULL;
+		}
+		if (res == 0) {
+			if (!*ms)
+				return NULL;
+			continue;
+		}
+
+		/* Caller fds win over channels, as in ast_waitfor_nandfds() */
+		winner = NULL;
+		fdno = -1;
+		events = 0;
+		ast_mutex_lock(&w->lock);
+		for (x = 0; x < res; x++) {
+			if (ev[x].data.u64 & WAITER_FD) {
+				if (outfd)
+					*outfd = (int) (ev[x].data.u64 & 0xffffffff);
+				if (exception)
+					*exception = (ev[x].events & EPOLLPRI) ? -1 : 0;
+				winner = NULL;
+				break;
+			}
+			if (winner)
+				continue;
+			slot = ev[x].data.u64 >> 8;
+			/* channel removed, or the fd replaced, since registration */
+			if ((slot >= w->nslots) || !(chan = w->slots[slot].chan))
+				continue;
+			if (chan->fds[ev[x].data.u64 & 0xff] != w->slots[slot].fds[ev[x].data.u64 & 0xff]) {
+				waiter_sync_slot(w, slot, 0);
+				continue;
+			}
+			winner = chan;
+			fdno = ev[x].data.u64 & 0xff;
+			events = ev[x].events;
+		}
+		ast_mutex_unlock(&w->lock);
+		if (x < res)
+			break;
+		if (!winner)
+			continue;
+		ast_channel_lock(winner);
+		if (winner->masq) {
+			res = ast_do_masquerade(winner);
+			ast_channel_unlock(winner);
+			if (res) {
+				ast_log(LOG_WARNING, "Masquerade failed\n");
+				*ms = -1;
+				return NULL;
+			}
+			/* its fds have changed, wait again */
+			continue;
+		}
+		if (events & EPOLLPRI)
+			ast_set_flag(winner, AST_FLAG_EXCEPTION);
+		else
+			ast_clear_flag(winner, AST_FLAG_EXCEPTION);
+		winner->fdno = fdno;
+		ast_channel_unlock(winner);
+		break;
+	}
+	if (*ms > 0) {
+		*ms -= ast_tvdiff_ms(ast_tvnow(), start);
+		if (*ms < 0)
+			*ms = 0;
+	}
+	return winner;
+#else
+	struct ast_channel **chans;
+	int x, n = 0;
+
+	ast_mutex_lock(&w->lock);
+	chans = alloca(sizeof(*chans) * (w->nchans + 1));
+	for (x = 0; x < w->nslots; x++) {
+		if (w->slots[x].chan)
+			chans[n++] = w->slots[x].chan;
+	}
+	ast_mutex_unlock(&w->lock);
+	return ast_waitfor_nandfds(chans, n, w->fds, w->nfds, exception, outfd, ms);
+#endif
+}
+
 int ast_waitfor(struct ast_channel *c, int ms)
 {
 	int oldms = ms;	/* -1 if no timeout */
@@ -1833,6 +2262,7 @@ int ast_settimeout(struct ast_channel *c, int samples, int (*func)(const void *d
 		res = ioctl(c->timingfd, DAHDI_TIMERCONFIG, &samples);
 		c->timingfunc = func;
 		c->timingdata = data;
+		waiter_chan_changed(c);
 	}
 #endif	
 	return res;
@@ -3541,7 +3971,7 @@ int ast_do_masquerade(struct ast_channel *original)
 	/* Copy the FD's other than the generator fd */
 	for (x = 0; x < AST_MAX_FDS; x++) {
 		if (x != AST_GENERATOR_FD)
-			original->fds[x] = clone->fds[x];
+			ast_channel_set_fd(original, x, clone->fds[x]);
 	}
 
 	ast_app_group_update(clone, original);
@@ -3576,7 +4006,7 @@ int ast_do_masquerade(struct ast_channel *original)
 	clone->cid = tmpcid;
 	
 	/* Restore original timing file descriptor */
-	original->fds[AST_TIMING_FD] = original->timingfd;
+	ast_channel_set_fd(original, AST_TIMING_FD, original->timingfd);
 	
 	/* Our native formats are different now */
 	original->nativeformats = clone->nativeformats;
@@ -29,6 +29,8 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 147386 $")
 
 #include <unistd.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <sys/signal.h>
 #include <stdio.h>
 #include <signal.h>
@@ -56,10 +58,45 @@ AST_THREADSTORAGE(ast_cli_buf, ast_cli_buf_init);
 /*! \brief Initial buffer size for resulting strings in ast_cli() */
 #define AST_CLI_INITLEN   256
 
+/*! \brief Output collected by ast_cli_command_capture() on this thread */
+struct cli_capture {
+	int active;
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+AST_THREADSTORAGE(cli_capture_buf, cli_capture_buf_init);
+
+/*! \brief Handed to handlers by ast_cli_command_capture().  It is /dev/null,
+ * so anything not written with ast_cli() is dropped. */
+static int capture_fd = -1;
+AST_MUTEX_DEFINE_STATIC(capture_lock);
+
+static void cli_capture_append(struct cli_capture *cap, const char *s, size_t len)
+{
+	char *buf;
+	size_t size;
+
+	if (cap->len + len + 1 > cap->size) {
+		size = cap->size ? cap->size : 1024;
+		while (size < cap->len + len + 1)
+			size *= 2;
+		if (!(buf = ast_realloc(cap->buf, size)))
+			return;
+		cap->buf = buf;
+		cap->size = size;
+	}
+	memcpy(cap->buf + cap->len, s, len);
+	cap->len += len;
+	cap->buf[cap->len] = '\0';
+}
+
 void ast_cli(int fd, char *fmt, ...)
 {
 	int res;
 	struct ast_dynamic_str *buf;
+	struct cli_capture *cap;
 	va_list ap;
 
 	if (!(buf = ast_dynamic_str_thread_get(&ast_cli_buf, AST_CLI_INITLEN)))
@@ -69,7 +106,12 @@ void ast_cli(int fd, char *fmt, ...)
 	res = ast_dynamic_str_thread_set_va(&buf, 0, &ast_cli_buf, fmt, ap);
 	va_end(ap);
 
-	if (res != AST_DYNSTR_BUILD_FAILED)
+	if (res == AST_DYNSTR_BUILD_FAILED)
+		return;
+
+	if ((fd == capture_fd) && (cap = ast_threadstorage_get(&cli_capture_buf, sizeof(*cap))) && cap->active)
+		cli_capture_append(cap, buf->str, strlen(buf->str));
+	else
 		ast_carefulwrite(fd, buf->str, strlen(buf->str), 100);
 }
 
@@ -2019,6 +2061,33 @@ int ast_cli_command(int fd, const char *s)
 	return 0;
 }
 
+char *ast_cli_command_capture(const char *s)
+{
+	struct cli_capture *cap;
+	char *out;
+
+	if (!(cap = ast_threadstorage_get(&cli_capture_buf, sizeof(*cap))) || cap->active)
+		return NULL;
+
+	ast_mutex_lock(&capture_lock);
+	if (capture_fd < 0 && (capture_fd = open("/dev/null", O_WRONLY)) < 0)
+		ast_log(LOG_WARNING, "Unable to open /dev/null: %s\n", strerror(errno));
+	ast_mutex_unlock(&capture_lock);
+	if (capture_fd < 0)
+		return NULL;
+
+	cap->active = 1;
+	cap->buf = NULL;
+	cap->len = cap->size = 0;
+	ast_cli_command(capture_fd, s);
+	cap->active = 0;
+
+	if (!(out = cap->buf))
+		out = ast_strdup("");
+	cap->buf = NULL;
+	return out;
+}
+
 int ast_cli_command_multiple(int fd, size_t size, const char *s)
 {
 	char cmd[512];
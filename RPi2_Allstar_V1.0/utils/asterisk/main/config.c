@@ -34,6 +34,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 147386 $")
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <errno.h>
 #include <time.h>
 #include <sys/stat.h>
@@ -175,6 +176,10 @@ struct ast_category {
 	struct ast_variable *root;
 	struct ast_variable *last;
 	struct ast_category *next;
+	struct ast_config *owner;		/*!< config this category was appended to */
+	unsigned int nvars;			/*!< number of variables in root */
+	struct ast_variable **varindex;		/*!< hash of the first variable of each name, or NULL */
+	unsigned int varmask;			/*!< size of varindex - 1 */
 };
 
 struct ast_config {
@@ -184,8 +189,153 @@ struct ast_config {
 	struct ast_category *last_browse;		/*!< used to cache the last category supplied via category_browse */
 	int include_level;
 	int max_include_level;
+	unsigned int ncats;			/*!< number of categories in root */
+	struct ast_category **catindex;		/*!< hash of the visible categories, or NULL */
+	unsigned int catmask;			/*!< size of catindex - 1 */
 };
 
+/*!
+ * \brief Categories and variables are found through a hash once a list
+ * reaches this length; shorter lists are just walked.
+ *
+ * The indexes are kept up to date by the functions that change the lists,
+ * never by the lookups, so a loaded config can still be read from several
+ * threads at once.
+ */
+#define CONFIG_INDEX_MIN 16
+
+/*! \brief Case-insensitive hash of a category or variable name */
+static unsigned int config_hash(const char *s)
+{
+	unsigned int h = 2166136261U;
+
+	for (; *s; s++)
+		h = (h ^ (unsigned char) tolower(*s)) * 16777619U;
+	return h;
+}
+
+/*! \brief Table size for n entries, kept at most half full */
+static unsigned int config_index_size(unsigned int n)
+{
+	unsigned int size = 32;
+
+	while (size < n * 2)
+		size <<= 1;
+	return size;
+}
+
+/*! \brief Add a variable to the index unless an earlier one has its name */
+static void var_index_add(struct ast_category *cat, struct ast_variable *v)
+{
+	unsigned int i;
+
+	for (i = config_hash(v->name) & cat->varmask; cat->varindex[i]; i = (i + 1) & cat->varmask) {
+		if (!strcasecmp(cat->varindex[i]->name, v->name))
+			return;
+	}
+	cat->varindex[i] = v;
+}
+
+/*! \brief (Re)build the variable index of a category, or drop it if the category is short */
+static void var_index_build(struct ast_category *cat)
+{
+	struct ast_variable *v;
+	unsigned int size;
+
+	free(cat->varindex);
+	cat->varindex = NULL;
+	if (cat->nvars < CONFIG_INDEX_MIN)
+		return;
+	size = config_index_size(cat->nvars);
+	if (!(cat->varindex = ast_calloc(size, sizeof(*cat->varindex))))
+		return;
+	cat->varmask = size - 1;
+	for (v = cat->root; v; v = v->next)
+		var_index_add(cat, v);
+}
+
+/*! \brief Update the variable index for the list starting at v, just appended */
+static void var_index_appended(struct ast_category *cat, struct ast_variable *v)
+{
+	if (!cat->varindex || cat->nvars * 2 > cat->varmask + 1) {
+		var_index_build(cat);
+		return;
+	}
+	for (; v; v = v->next)
+		var_index_add(cat, v);
+}
+
+/*! \brief First variable of a category with the given name */
+static struct ast_variable *variable_find(const struct ast_category *cat, const char *name)
+{
+	struct ast_variable *v;
+	unsigned int i;
+
+	if (cat->varindex) {
+		for (i = config_hash(name) & cat->varmask; (v = cat->varindex[i]); i = (i + 1) & cat->varmask) {
+			if (!strcasecmp(v->name, name))
+				return v;
+		}
+		return NULL;
+	}
+
+	for (v = cat->root; v; v = v->next) {
+		if (!strcasecmp(name, v->name))
+			return v;
+	}
+	return NULL;
+}
+
+/*!
+ * \brief Add a category to the index
+ *
+ * Every visible category goes in, duplicates included. Entries of the same
+ * name share a probe sequence in list order, so the first one found is the
+ * first one in the list.
+ */
+static void cat_index_add(struct ast_config *config, struct ast_category *cat)
+{
+	unsigned int i;
+
+	if (cat->ignored)
+		return;
+	for (i = config_hash(cat->name) & config->catmask; config->catindex[i]; i = (i + 1) & config->catmask);
+	config->catindex[i] = cat;
+}
+
+/*! \brief (Re)build the category index of a config, or drop it if the config is short */
+static void cat_index_build(struct ast_config *config)
+{
+	struct ast_category *cat;
+	unsigned int size;
+
+	free(config->catindex);
+	config->catindex = NULL;
+	if (config->ncats < CONFIG_INDEX_MIN)
+		return;
+	size = config_index_size(config->ncats);
+	if (!(config->catindex = ast_calloc(size, sizeof(*config->catindex))))
+		return;
+	config->catmask = size - 1;
+	for (cat = config->root; cat; cat = cat->next)
+		cat_index_add(config, cat);
+}
+
+/*! \brief Visible category for category_get(): the one whose name is category_name itself, else the first of that name */
+static struct ast_category *cat_index_find(const struct ast_config *config, const char *category_name)
+{
+	struct ast_category *cat, *first = NULL;
+	unsigned int i;
+
+	for (i = config_hash(category_name) & config->catmask; (cat = config->catindex[i]); i = (i + 1) & config->catmask) {
+		if (cat->name == category_name)
+			return cat;
+		if (!first && !strcasecmp(cat->name, category_name))
+			first = cat;
+	}
+	return first;
+}
+
 struct ast_variable *ast_variable_new(const char *name, const char *value) 
 {
 	struct ast_variable *variable;
@@ -210,8 +360,12 @@ void ast_variable_append(struct ast_category *category, struct ast_variable *var
 	else
 		category->root = variable;
 	category->last = variable;
-	while (category->last->next)
+	category->nvars++;
+	while (category->last->next) {
 		category->last = category->last->next;
+		category->nvars++;
+	}
+	var_index_appended(category, variable);
 }
 
 void ast_variables_destroy(struct ast_variable *v)
@@ -249,20 +403,20 @@ const char *ast_config_option(struct ast_config *cfg, const char *cat, const cha
 
 const char *ast_variable_retrieve(const struct ast_config *config, const char *category, const char *variable)
 {
+	struct ast_category *cat;
 	struct ast_variable *v;
 
 	if (category) {
-		for (v = ast_variable_browse(config, category); v; v = v->next) {
-			if (!strcasecmp(variable, v->name))
-				return v->value;
-		}
+		if (config->last_browse && (config->last_browse->name == category))
+			cat = config->last_browse;
+		else
+			cat = ast_category_get(config, category);
+		if (cat && (v = variable_find(cat, variable)))
+			return v->value;
 	} else {
-		struct ast_category *cat;
-
 		for (cat = config->root; cat; cat = cat->next)
-			for (v = cat->root; v; v = v->next)
-				if (!strcasecmp(variable, v->name))
-					return v->value;
+			if ((v = variable_find(cat, variable)))
+				return v->value;
 	}
 
 	return NULL;
@@ -286,6 +440,9 @@ static void move_variables(struct ast_category *old, struct ast_category *new)
 {
 	struct ast_variable *var = old->root;
 	old->root = NULL;
+	old->last = NULL;
+	old->nvars = 0;
+	var_index_build(old);
 #if 1
 	/* we can just move the entire list in a single op */
 	ast_variable_append(new, var);
@@ -312,6 +469,9 @@ static struct ast_category *category_get(const struct ast_config *config, const
 {
 	struct ast_category *cat;
 
+	if (!ignored && config->catindex)
+		return cat_index_find(config, category_name);
+
 	/* try exact match first, then case-insensitive match */
 	for (cat = config->root; cat; cat = cat->next) {
 		if (cat->name == category_name && (ignored || !cat->ignored))
@@ -343,8 +503,14 @@ void ast_category_append(struct ast_config *config, struct ast_category *categor
 	else
 		config->root = category;
 	category->include_level = config->include_level;
+	category->owner = config;
 	config->last = category;
 	config->current = category;
+	config->ncats++;
+	if (!config->catindex || config->ncats * 2 > config->catmask + 1)
+		cat_index_build(config);
+	else
+		cat_index_add(config, category);
 }
 
 static void ast_destroy_comments(struct ast_category *cat)
@@ -377,6 +543,7 @@ void ast_category_destroy(struct ast_category *cat)
 	ast_variables_destroy(cat->root);
 	ast_destroy_comments(cat);
 	ast_destroy_template_list(cat);
+	free(cat->varindex);
 	free(cat);
 }
 
@@ -434,6 +601,8 @@ struct ast_variable *ast_category_detach_variables(struct ast_category *cat)
 	v = cat->root;
 	cat->root = NULL;
 	cat->last = NULL;
+	cat->nvars = 0;
+	var_index_build(cat);
 
 	return v;
 }
@@ -441,6 +610,8 @@ struct ast_variable *ast_category_detach_variables(struct ast_category *cat)
 void ast_category_rename(struct ast_category *cat, const char *name)
 {
 	ast_copy_string(cat->name, name, sizeof(cat->name));
+	if (cat->owner)
+		cat_index_build(cat->owner);
 }
 
 static void inherit_category(struct ast_category *new, const struct ast_category *base)
@@ -481,6 +652,8 @@ int ast_variable_delete(struct ast_category *category, char *variable, char *mat
 			}
 			cur->next = NULL;
 			ast_variables_destroy(cur);
+			category->nvars--;
+			var_index_build(category);
 			return 0;
 		}
 		prev = cur;
@@ -503,12 +676,15 @@ int ast_variable_delete(struct ast_category *category, char *variable, char *mat
 			}
 			cur->next = NULL;
 			ast_variables_destroy(cur);
+			category->nvars--;
 			res = 0;
 		} else
 			prev = cur;
 
 		cur = curn;
 	}
+	if (!res)
+		var_index_build(category);
 	return res;
 }
 
@@ -538,6 +714,7 @@ int ast_variable_update(struct ast_category *category, const char *variable,
 
 		cur->next = NULL;
 		ast_variables_destroy(cur);
+		var_index_build(category);
 
 		return 0;
 	}
@@ -546,6 +723,9 @@ int ast_variable_update(struct ast_category *category, const char *variable,
 		prev->next = newer;
 	else
 		category->root = newer;
+	category->last = newer;
+	category->nvars++;
+	var_index_appended(category, newer);
 
 	return 0;
 }
@@ -566,6 +746,8 @@ int ast_category_delete(struct ast_config *cfg, char *category)
 					cfg->last = NULL;
 			}
 			ast_category_destroy(cat);
+			cfg->ncats--;
+			cat_index_build(cfg);
 			return 0;
 		}
 		prev = cat;
@@ -586,6 +768,8 @@ int ast_category_delete(struct ast_config *cfg, char *category)
 					cfg->last = NULL;
 			}
 			ast_category_destroy(cat);
+			cfg->ncats--;
+			cat_index_build(cfg);
 			return 0;
 		}
 		prev = cat;
@@ -607,6 +791,7 @@ void ast_config_destroy(struct ast_config *cfg)
 		cat = cat->next;
 		ast_category_destroy(catn);
 	}
+	free(cfg->catindex);
 	free(cfg);
 }
 
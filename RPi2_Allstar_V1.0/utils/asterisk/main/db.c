@@ -25,6 +25,14 @@
  * \note DB3 is licensed under Sleepycat Public License and is thus incompatible
  * with GPL.  To avoid having to make another exception (and complicate 
  * licensing even further) we elect to use DB1 which is BSD licensed 
+ *
+ * \note By default every change is synced to disk before the call returns.
+ * With dbsyncinterval set in asterisk.conf, the database is kept in memory
+ * instead. Changes are appended to a journal next to the database file,
+ * which a background thread flushes every dbsyncinterval seconds, or sooner
+ * once dbsyncwrites changes are waiting. When the journal gets big, a new
+ * snapshot of the whole database is renamed over the file. A crash loses at
+ * most the changes since the last flush.
  */
 
 #include "asterisk.h"
@@ -39,6 +47,9 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 85574 $")
 #include <errno.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "asterisk/channel.h"
 #include "asterisk/file.h"
@@ -60,6 +71,28 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 85574 $")
 static DB *astdb;
 AST_MUTEX_DEFINE_STATIC(dblock);
 
+static int writeback;				/*!< astdb is in memory, changes are journalled */
+static int dirty;				/*!< changes not yet flushed from the journal */
+static int journalfd = -1;
+static off_t journalsize;			/*!< bytes in the journal */
+static char *journalpath;			/*!< astdb.journal, set up by astdb_init() */
+static char *journaltmppath;
+static char *snaptmppath;
+static int checkpointdue;			/*!< the journal could not be written */
+static int syncstop;
+static ast_cond_t synccond;
+static pthread_t syncthread = AST_PTHREADT_NULL;
+
+/*! Write a new snapshot once the journal is this big */
+#define DB_JOURNAL_MAX	(256 * 1024)
+
+/*! \brief Journal record header, followed by the key and the data */
+struct journal_rec {
+	char op;				/*!< 'P' put or 'D' del */
+	unsigned int keylen;
+	unsigned int datalen;
+};
+
 static int dbinit(void) 
 {
 	if (!astdb && !(astdb = dbopen((char *)ast_config_AST_DB, O_CREAT | O_RDWR, 0664, DB_BTREE, NULL))) {
@@ -70,6 +103,361 @@ static int dbinit(void)
 }
 
 
+/*! \brief Build the name of a file next to the database, NULL on failure */
+static char *db_path(const char *suffix)
+{
+	size_t len = strlen(ast_config_AST_DB) + strlen(suffix) + 1;
+	char *buf;
+
+	if (!(buf = ast_malloc(len)))
+		return NULL;
+	if (snprintf(buf, len, "%s%s", ast_config_AST_DB, suffix) != len - 1) {
+		free(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+/*! \brief Make renames in the database's directory stick */
+static void db_fsync_dir(void)
+{
+	char dir[PATH_MAX], *slash;
+	int fd;
+
+	ast_copy_string(dir, ast_config_AST_DB, sizeof(dir));
+	if (!(slash = strrchr(dir, '/')))
+		return;
+	*slash = '\0';
+	if ((fd = open(S_OR(dir, "/"), O_RDONLY)) < 0)
+		return;
+	fsync(fd);
+	close(fd);
+}
+
+/*! \brief Append a record to a buffer in journal format */
+static int rec_append(char **buf, size_t *len, size_t *size, char op, const DBT *key, const DBT *data)
+{
+	struct journal_rec rec;
+	size_t need;
+	char *tmp;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.op = op;
+	rec.keylen = key->size;
+	rec.datalen = data ? data->size : 0;
+	need = sizeof(rec) + rec.keylen + rec.datalen;
+	if (*len + need > *size) {
+		if (!(tmp = ast_realloc(*buf, (*len + need) * 2)))
+			return -1;
+		*buf = tmp;
+		*size = (*len + need) * 2;
+	}
+	memcpy(*buf + *len, &rec, sizeof(rec));
+	memcpy(*buf + *len + sizeof(rec), key->data, rec.keylen);
+	if (rec.datalen)
+		memcpy(*buf + *len + sizeof(rec) + rec.keylen, data->data, rec.datalen);
+	*len += need;
+	return 0;
+}
+
+/*! \brief Apply journal format records to a database.  \return the number applied */
+static int journal_apply(DB *db, char *buf, size_t len)
+{
+	struct journal_rec rec;
+	DBT key, data;
+	char *pos, *end = buf + len;
+	int changes;
+
+	for (pos = buf, changes = 0; end - pos >= sizeof(rec); changes++) {
+		memcpy(&rec, pos, sizeof(rec));
+		/* the last record may be torn if we died writing it */
+		if (rec.keylen > end - pos - sizeof(rec) || rec.datalen > end - pos - sizeof(rec) - rec.keylen)
+			break;
+		memset(&key, 0, sizeof(key));
+		memset(&data, 0, sizeof(data));
+		key.data = pos + sizeof(rec);
+		key.size = rec.keylen;
+		data.data = pos + sizeof(rec) + rec.keylen;
+		data.size = rec.datalen;
+		if (rec.op == 'P')
+			db->put(db, &key, &data, 0);
+		else if (rec.op == 'D')
+			db->del(db, &key, 0);
+		pos += sizeof(rec) + rec.keylen + rec.datalen;
+	}
+	return changes;
+}
+
+/*! \brief Apply a journal file to a database.  \return the number of changes, -1 if there is no journal */
+static int journal_load(DB *db, const char *path)
+{
+	struct stat st;
+	char *buf;
+	int fd, changes;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -1;
+	if (fstat(fd, &st) || !st.st_size || !(buf = ast_malloc(st.st_size))) {
+		close(fd);
+		return 0;
+	}
+	if (read(fd, buf, st.st_size) != st.st_size) {
+		ast_log(LOG_WARNING, "Unable to read astdb journal '%s': %s\n", path, strerror(errno));
+		free(buf);
+		close(fd);
+		return 0;
+	}
+	close(fd);
+	changes = journal_apply(db, buf, st.st_size);
+	free(buf);
+	if (changes)
+		ast_log(LOG_NOTICE, "Replayed %d astdb changes from '%s'\n", changes, path);
+	return changes;
+}
+
+/*! \brief Record a change in the journal. Called with dblock held. */
+static void journal_add(char op, const DBT *key, const DBT *data)
+{
+	struct journal_rec rec;
+	struct iovec iov[3];
+	ssize_t len;
+
+	if (!writeback)
+		return;
+	memset(&rec, 0, sizeof(rec));
+	rec.op = op;
+	rec.keylen = key->size;
+	rec.datalen = data ? data->size : 0;
+	iov[0].iov_base = &rec;
+	iov[0].iov_len = sizeof(rec);
+	iov[1].iov_base = key->data;
+	iov[1].iov_len = rec.keylen;
+	iov[2].iov_base = data ? data->data : NULL;
+	iov[2].iov_len = rec.datalen;
+	len = writev(journalfd, iov, 3);
+	if (len == sizeof(rec) + rec.keylen + rec.datalen) {
+		journalsize += len;
+		return;
+	}
+	/* A torn record would hide every later one at replay, so cut it
+	   off.  The change itself is in memory and goes out with the next
+	   snapshot, which is brought forward. */
+	ast_log(LOG_WARNING, "Unable to write astdb journal, writing a snapshot instead: %s\n", strerror(errno));
+	if (len > 0 && ftruncate(journalfd, journalsize))
+		ast_log(LOG_ERROR, "Unable to truncate astdb journal: %s\n", strerror(errno));
+	checkpointdue = 1;
+	ast_cond_signal(&synccond);
+}
+
+/*! \brief Finish a call that made changes. Called with dblock held. */
+static void db_commit(int changes)
+{
+	if (!writeback) {
+		astdb->sync(astdb, 0);
+		return;
+	}
+	if (!changes)
+		return;
+	/* no sync thread while shutting down, so flush now */
+	if (syncthread == AST_PTHREADT_NULL) {
+		if (fdatasync(journalfd))
+			ast_log(LOG_WARNING, "Unable to flush astdb journal: %s\n", strerror(errno));
+		return;
+	}
+	dirty += changes;
+	if (dirty >= option_dbsyncwrites)
+		ast_cond_signal(&synccond);
+}
+
+/*! \brief Drop the journal records before cut, which the snapshot now holds.
+	Called with dblock held. */
+static int journal_trim(off_t cut)
+{
+	size_t n = journalsize - cut;
+	char *buf;
+	int fd;
+
+	if (!n) {
+		if (ftruncate(journalfd, 0)) {
+			ast_log(LOG_WARNING, "Unable to truncate astdb journal: %s\n", strerror(errno));
+			return -1;
+		}
+		journalsize = 0;
+		return 0;
+	}
+	/* changes that came in while the snapshot was written go to a new journal */
+	if (!(buf = ast_malloc(n)))
+		return -1;
+	if (pread(journalfd, buf, n, cut) != n) {
+		ast_log(LOG_WARNING, "Unable to read astdb journal: %s\n", strerror(errno));
+		free(buf);
+		return -1;
+	}
+	if ((fd = open(journaltmppath, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0664)) < 0) {
+		ast_log(LOG_WARNING, "Unable to create '%s': %s\n", journaltmppath, strerror(errno));
+		free(buf);
+		return -1;
+	}
+	if (write(fd, buf, n) != n || fdatasync(fd) || rename(journaltmppath, journalpath)) {
+		ast_log(LOG_WARNING, "Unable to replace astdb journal: %s\n", strerror(errno));
+		close(fd);
+		unlink(journaltmppath);
+		free(buf);
+		return -1;
+	}
+	free(buf);
+	db_fsync_dir();
+	close(journalfd);
+	journalfd = fd;
+	journalsize = n;
+	return 0;
+}
+
+/*!
+ * \brief Write the whole database out as a new snapshot, then drop the
+ * journal records it covers.
+ *
+ * The in-memory database is copied under dblock, but the snapshot is
+ * written and renamed into place without it.  The file on disk is only
+ * ever replaced whole, so a crash leaves the old or the new snapshot, plus
+ * a journal that brings either one up to date: replaying records that the
+ * snapshot already holds ends in the same state.
+ *
+ * Called without dblock, by one thread at a time.
+ */
+static int db_checkpoint(void)
+{
+	char *buf = NULL;
+	size_t len = 0, size = 0;
+	off_t cut;
+	DBT key, data;
+	DB *snap;
+	int fd, res;
+
+	ast_mutex_lock(&dblock);
+	memset(&key, 0, sizeof(key));
+	memset(&data, 0, sizeof(data));
+	for (res = astdb->seq(astdb, &key, &data, R_FIRST); !res; res = astdb->seq(astdb, &key, &data, R_NEXT)) {
+		if (rec_append(&buf, &len, &size, 'P', &key, &data))
+			break;
+	}
+	cut = journalsize;
+	checkpointdue = 0;
+	ast_mutex_unlock(&dblock);
+	if (res != 1) {
+		ast_log(LOG_WARNING, "Unable to copy astdb for a snapshot\n");
+		if (buf)
+			free(buf);
+		return -1;
+	}
+
+	if (!(snap = dbopen(snaptmppath, O_CREAT | O_TRUNC | O_RDWR, 0664, DB_BTREE, NULL))) {
+		ast_log(LOG_WARNING, "Unable to create astdb snapshot '%s': %s\n", snaptmppath, strerror(errno));
+		if (buf)
+			free(buf);
+		return -1;
+	}
+	journal_apply(snap, buf, len);
+	if (buf)
+		free(buf);
+	res = snap->close(snap);
+	if (!res && (fd = open(snaptmppath, O_RDONLY)) > -1) {
+		res = fsync(fd);
+		close(fd);
+	}
+	if (res || rename(snaptmppath, ast_config_AST_DB)) {
+		ast_log(LOG_WARNING, "Unable to write astdb snapshot: %s\n", strerror(errno));
+		unlink(snaptmppath);
+		return -1;
+	}
+	db_fsync_dir();
+
+	ast_mutex_lock(&dblock);
+	res = journal_trim(cut);
+	ast_mutex_unlock(&dblock);
+	return res;
+}
+
+/*!
+ * \brief Group commit: flush the journal every dbsyncinterval seconds, or
+ * once dbsyncwrites changes are waiting, and write a snapshot when the
+ * journal grows past DB_JOURNAL_MAX.  dblock is not held for either.
+ */
+static void *db_sync_thread(void *data)
+{
+	struct timeval tv;
+	struct timespec ts;
+	int checkpoint;
+
+	ast_mutex_lock(&dblock);
+	while (!syncstop) {
+		if (dirty < option_dbsyncwrites && !checkpointdue) {
+			tv = ast_tvadd(ast_tvnow(), ast_tv(option_dbsyncinterval, 0));
+			ts.tv_sec = tv.tv_sec;
+			ts.tv_nsec = tv.tv_usec * 1000;
+			ast_cond_timedwait(&synccond, &dblock, &ts);
+		}
+		if (syncstop || (!dirty && !checkpointdue))
+			continue;
+		dirty = 0;
+		checkpoint = checkpointdue || (journalsize >= DB_JOURNAL_MAX);
+		ast_mutex_unlock(&dblock);
+		/* only this thread replaces journalfd, so it can be used unlocked */
+		if (fdatasync(journalfd))
+			ast_log(LOG_WARNING, "Unable to flush astdb journal: %s\n", strerror(errno));
+		if (checkpoint)
+			db_checkpoint();
+		ast_mutex_lock(&dblock);
+	}
+	ast_mutex_unlock(&dblock);
+	return NULL;
+}
+
+/*! \brief Load the database into memory and start journalling changes to it */
+static int writeback_start(void)
+{
+	DBT key, data;
+	DB *disk;
+	int res, changes;
+
+	if (option_dbsyncwrites < 1)
+		option_dbsyncwrites = 100;
+	if (!(disk = dbopen((char *)ast_config_AST_DB, O_CREAT | O_RDWR, 0664, DB_BTREE, NULL))) {
+		ast_log(LOG_WARNING, "Unable to open Asterisk database '%s': %s\n", ast_config_AST_DB, strerror(errno));
+		return -1;
+	}
+	if (!(astdb = dbopen(NULL, O_CREAT | O_RDWR, 0664, DB_BTREE, NULL))) {
+		ast_log(LOG_WARNING, "Unable to create in-memory astdb: %s\n", strerror(errno));
+		disk->close(disk);
+		return -1;
+	}
+	memset(&key, 0, sizeof(key));
+	memset(&data, 0, sizeof(data));
+	for (res = disk->seq(disk, &key, &data, R_FIRST); !res; res = disk->seq(disk, &key, &data, R_NEXT))
+		astdb->put(astdb, &key, &data, 0);
+	disk->close(disk);
+
+	changes = journal_load(astdb, journalpath);
+	if ((journalfd = open(journalpath, O_RDWR | O_CREAT | O_APPEND, 0664)) < 0) {
+		ast_log(LOG_WARNING, "Unable to open astdb journal '%s': %s\n", journalpath, strerror(errno));
+		astdb->close(astdb);
+		astdb = NULL;
+		return -1;
+	}
+	journalsize = lseek(journalfd, 0, SEEK_END);
+	writeback = 1;
+	/* fold a crashed run's journal into the snapshot */
+	if (changes > 0)
+		db_checkpoint();
+	ast_cond_init(&synccond, NULL);
+	if (ast_pthread_create_background(&syncthread, NULL, db_sync_thread, NULL)) {
+		ast_log(LOG_WARNING, "Unable to start astdb sync thread\n");
+		syncthread = AST_PTHREADT_NULL;
+		astdb_close();
+	}
+	return 0;
+}
+
 static inline int keymatch(const char *key, const char *prefix)
 {
 	int preflen = strlen(prefix);
@@ -104,6 +492,7 @@ int ast_db_deltree(const char *family, const char *keytree)
 	char *keys;
 	int res;
 	int pass;
+	int changes = 0;
 	
 	if (family) {
 		if (keytree) {
@@ -134,10 +523,12 @@ int ast_db_deltree(const char *family, const char *keytree)
 			keys = "<bad key>";
 		}
 		if (keymatch(keys, prefix)) {
+			journal_add('D', &key, NULL);
 			astdb->del(astdb, &key, 0);
+			changes++;
 		}
 	}
-	astdb->sync(astdb, 0);
+	db_commit(changes);
 	ast_mutex_unlock(&dblock);
 	return 0;
 }
@@ -162,7 +553,9 @@ int ast_db_put(const char *family, const char *keys, char *value)
 	data.data = value;
 	data.size = strlen(value) + 1;
 	res = astdb->put(astdb, &key, &data, 0);
-	astdb->sync(astdb, 0);
+	if (!res)
+		journal_add('P', &key, &data);
+	db_commit(!res);
 	ast_mutex_unlock(&dblock);
 	if (res)
 		ast_log(LOG_WARNING, "Unable to put value '%s' for key '%s' in family '%s'\n", value, keys, family);
@@ -229,7 +622,9 @@ int ast_db_del(const char *family, const char *keys)
 	key.size = fullkeylen + 1;
 	
 	res = astdb->del(astdb, &key, 0);
-	astdb->sync(astdb, 0);
+	if (!res)
+		journal_add('D', &key, NULL);
+	db_commit(!res);
 	
 	ast_mutex_unlock(&dblock);
 
@@ -584,9 +979,66 @@ static int manager_dbget(struct mansession *s, const struct message *m)
 
 int astdb_init(void)
 {
-	dbinit();
+	journalpath = db_path(".journal");
+	journaltmppath = db_path(".journal.tmp");
+	snaptmppath = db_path(".tmp");
+	if (!journalpath || !journaltmppath || !snaptmppath) {
+		ast_log(LOG_WARNING, "Unable to build astdb journal file names, write-back disabled\n");
+		dbinit();
+	} else {
+		if (option_dbsyncinterval > 0)
+			writeback_start();
+		if (!writeback && !dbinit()) {
+			/* left by a write-back run that did not shut down cleanly */
+			if (journal_load(astdb, journalpath) > -1) {
+				astdb->sync(astdb, 0);
+				unlink(journalpath);
+			}
+		}
+	}
 	ast_cli_register_multiple(cli_database, sizeof(cli_database) / sizeof(struct ast_cli_entry));
 	ast_manager_register("DBGet", EVENT_FLAG_SYSTEM, manager_dbget, "Get DB Entry");
 	ast_manager_register("DBPut", EVENT_FLAG_SYSTEM, manager_dbput, "Put DB Entry");
 	return 0;
 }
+
+/*! \brief Write out a final snapshot and go back to syncing every write */
+void astdb_close(void)
+{
+	pthread_t thread;
+
+	ast_mutex_lock(&dblock);
+	if (!writeback) {
+		ast_mutex_unlock(&dblock);
+		return;
+	}
+	thread = syncthread;
+	syncstop = 1;
+	ast_cond_signal(&synccond);
+	ast_mutex_unlock(&dblock);
+	if (thread != AST_PTHREADT_NULL)
+		pthread_join(thread, NULL);
+
+	/* from here on db_commit() flushes the journal itself */
+	ast_mutex_lock(&dblock);
+	syncthread = AST_PTHREADT_NULL;
+	ast_mutex_unlock(&dblock);
+	if (db_checkpoint()) {
+		ast_log(LOG_WARNING, "Keeping the astdb journal, it will be replayed at startup\n");
+		return;
+	}
+
+	/* the snapshot is now the database, plus whatever came in since */
+	ast_mutex_lock(&dblock);
+	astdb->close(astdb);
+	astdb = NULL;
+	writeback = 0;
+	close(journalfd);
+	journalfd = -1;
+	if (!dbinit()) {
+		journal_load(astdb, journalpath);
+		astdb->sync(astdb, 0);
+		unlink(journalpath);
+	}
+	ast_mutex_unlock(&dblock);
+}
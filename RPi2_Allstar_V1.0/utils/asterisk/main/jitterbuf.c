@@ -123,15 +123,33 @@ static int longcmp(const void *a, const void *b)
 }
 #endif
 
+/*! \brief index of the first entry in the sorted history (of n) that is greater than val */
+static int history_sorted_find(jitterbuf *jb, int n, long val)
+{
+	int lo = 0, hi = n, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (jb->hist_sorted[mid] <= val)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
 /*!	\brief simple history manipulation 
  	\note maybe later we can make the history buckets variable size, or something? */
 /* drop parameter determines whether we will drop outliers to minimize
  * delay */
+/* hist_sorted is kept in step with history, so history_get() just reads
+ * the percentiles out of it instead of re-sorting the whole window */
 static int history_put(jitterbuf *jb, long ts, long now, long ms) 
 {
 	long delay = now - (ts - jb->info.resync_offset);
 	long threshold = 2 * jb->info.jitter + jb->info.conf.resync_threshold;
 	long kicked;
+	int count, i;
 
 	/* don't add special/negative times to history */
 	if (ts <= 0) 
@@ -145,7 +163,6 @@ static int history_put(jitterbuf *jb, long ts, long now, long ms)
 				/* resync the jitterbuffer */
 				jb->info.cnt_delay_discont = 0;
 				jb->hist_ptr = 0;
-				jb->hist_maxbuf_valid = 0;
 
 				jb_warn("Resyncing the jb. last_delay %ld, this delay %ld, threshold %ld, new offset %ld\n", jb->info.last_delay, delay, threshold, ts - now);
 				jb->info.resync_offset = ts - now;
@@ -159,124 +176,23 @@ static int history_put(jitterbuf *jb, long ts, long now, long ms)
 		}
 	}
 
-	kicked = jb->history[jb->hist_ptr % JB_HISTORY_SZ];
-
-	jb->history[(jb->hist_ptr++) % JB_HISTORY_SZ] = delay;
-
-	/* optimization; the max/min buffers don't need to be recalculated, if this packet's
-	 * entry doesn't change them.  This happens if this packet is not involved, _and_ any packet
-	 * that got kicked out of the history is also not involved 
-	 * We do a number of comparisons, but it's probably still worthwhile, because it will usually
-	 * succeed, and should be a lot faster than going through all 500 packets in history */
-	if (!jb->hist_maxbuf_valid)
-		return 0;
-
-	/* don't do this until we've filled history 
-	 * (reduces some edge cases below) */
-	if (jb->hist_ptr < JB_HISTORY_SZ)
-		goto invalidate;
-
-	/* if the new delay would go into min */
-	if (delay < jb->hist_minbuf[JB_HISTORY_MAXBUF_SZ-1])
-		goto invalidate;
-    
-	/* or max.. */
-	if (delay > jb->hist_maxbuf[JB_HISTORY_MAXBUF_SZ-1])
-		goto invalidate;
-
-	/* or the kicked delay would be in min */
-	if (kicked <= jb->hist_minbuf[JB_HISTORY_MAXBUF_SZ-1]) 
-		goto invalidate;
-
-	if (kicked >= jb->hist_maxbuf[JB_HISTORY_MAXBUF_SZ-1]) 
-		goto invalidate;
-
-	/* if we got here, we don't need to invalidate, 'cause this delay didn't 
-	 * affect things */
-	return 0;
-	/* end optimization */
-
-
-invalidate:
-	jb->hist_maxbuf_valid = 0;
-	return 0;
-}
-
-static void history_calc_maxbuf(jitterbuf *jb) 
-{
-	int i,j;
-
-	if (jb->hist_ptr == 0) 
-		return;
-
+	count = (jb->hist_ptr < JB_HISTORY_SZ) ? jb->hist_ptr : JB_HISTORY_SZ;
 
-	/* initialize maxbuf/minbuf to the latest value */
-	for (i=0;i<JB_HISTORY_MAXBUF_SZ;i++) {
-/*
- * jb->hist_maxbuf[i] = jb->history[(jb->hist_ptr-1) % JB_HISTORY_SZ];
- * jb->hist_minbuf[i] = jb->history[(jb->hist_ptr-1) % JB_HISTORY_SZ];
- */
-		jb->hist_maxbuf[i] = JB_LONGMIN;
-		jb->hist_minbuf[i] = JB_LONGMAX;
+	/* take the delay that is about to be overwritten out of the sorted copy */
+	if (count == JB_HISTORY_SZ) {
+		kicked = jb->history[jb->hist_ptr % JB_HISTORY_SZ];
+		i = history_sorted_find(jb, count, kicked) - 1;
+		count--;
+		memmove(jb->hist_sorted + i, jb->hist_sorted + i + 1, (count - i) * sizeof(jb->hist_sorted[0]));
 	}
 
-	/* use insertion sort to populate maxbuf */
-	/* we want it to be the top "n" values, in order */
-
-	/* start at the beginning, or JB_HISTORY_SZ frames ago */
-	i = (jb->hist_ptr > JB_HISTORY_SZ) ? (jb->hist_ptr - JB_HISTORY_SZ) : 0; 
-
-	for (;i<jb->hist_ptr;i++) {
-		long toins = jb->history[i % JB_HISTORY_SZ];
-
-		/* if the maxbuf should get this */
-		if (toins > jb->hist_maxbuf[JB_HISTORY_MAXBUF_SZ-1])  {
-
-			/* insertion-sort it into the maxbuf */
-			for (j=0;j<JB_HISTORY_MAXBUF_SZ;j++) {
-				/* found where it fits */
-				if (toins > jb->hist_maxbuf[j]) {
-					/* move over */
-					memmove(jb->hist_maxbuf + j + 1, jb->hist_maxbuf + j, (JB_HISTORY_MAXBUF_SZ - (j + 1)) * sizeof(jb->hist_maxbuf[0]));
-					/* insert */
-					jb->hist_maxbuf[j] = toins;
-
-					break;
-				}
-			}
-		}
-
-		/* if the minbuf should get this */
-		if (toins < jb->hist_minbuf[JB_HISTORY_MAXBUF_SZ-1])  {
-
-			/* insertion-sort it into the maxbuf */
-			for (j=0;j<JB_HISTORY_MAXBUF_SZ;j++) {
-				/* found where it fits */
-				if (toins < jb->hist_minbuf[j]) {
-					/* move over */
-					memmove(jb->hist_minbuf + j + 1, jb->hist_minbuf + j, (JB_HISTORY_MAXBUF_SZ - (j + 1)) * sizeof(jb->hist_minbuf[0]));
-					/* insert */
-					jb->hist_minbuf[j] = toins;
-
-					break;
-				}
-			}
-		}
+	jb->history[(jb->hist_ptr++) % JB_HISTORY_SZ] = delay;
 
-		if (0) { 
-			int k;
-			fprintf(stderr, "toins = %ld\n", toins);
-			fprintf(stderr, "maxbuf =");
-			for (k=0;k<JB_HISTORY_MAXBUF_SZ;k++) 
-				fprintf(stderr, "%ld ", jb->hist_maxbuf[k]);
-			fprintf(stderr, "\nminbuf =");
-			for (k=0;k<JB_HISTORY_MAXBUF_SZ;k++) 
-				fprintf(stderr, "%ld ", jb->hist_minbuf[k]);
-			fprintf(stderr, "\n");
-		}
-	}
+	i = history_sorted_find(jb, count, delay);
+	memmove(jb->hist_sorted + i + 1, jb->hist_sorted + i, (count - i) * sizeof(jb->hist_sorted[0]));
+	jb->hist_sorted[i] = delay;
 
-	jb->hist_maxbuf_valid = 1;
+	return 0;
 }
 
 static void history_get(jitterbuf *jb) 
@@ -285,9 +201,6 @@ static void history_get(jitterbuf *jb)
 	int index;
 	int count;
 
-	if (!jb->hist_maxbuf_valid) 
-		history_calc_maxbuf(jb);
-
 	/* count is how many items in history we're examining */
 	count = (jb->hist_ptr < JB_HISTORY_SZ) ? jb->hist_ptr : JB_HISTORY_SZ;
 
@@ -299,14 +212,14 @@ static void history_get(jitterbuf *jb)
 		index = JB_HISTORY_MAXBUF_SZ - 1;
 
 
-	if (index < 0) {
+	if (index < 0 || !count) {
 		jb->info.min = 0;
 		jb->info.jitter = 0;
 		return;
 	}
 
-	max = jb->hist_maxbuf[index];
-	min = jb->hist_minbuf[index];
+	max = jb->hist_sorted[count - 1 - index];
+	min = jb->hist_sorted[index];
 
 	jitter = max - min;
 
@@ -314,7 +227,7 @@ static void history_get(jitterbuf *jb)
 	 * values we get by throwing away the outliers */
 	/*
 	fprintf(stderr, "[%d] min=%d, max=%d, jitter=%d\n", index, min, max, jitter);
-	fprintf(stderr, "[%d] min=%d, max=%d, jitter=%d\n", 0, jb->hist_minbuf[0], jb->hist_maxbuf[0], jb->hist_maxbuf[0]-jb->hist_minbuf[0]);
+	fprintf(stderr, "[%d] min=%d, max=%d, jitter=%d\n", 0, jb->hist_sorted[0], jb->hist_sorted[count - 1], jb->hist_sorted[count - 1]-jb->hist_sorted[0]);
 	*/
 
 	jb->info.min = min;
@@ -111,6 +111,31 @@ struct logchannel {
 
 static AST_LIST_HEAD_STATIC(logchannels, logchannel);
 
+/*! \brief A message formatted by ast_log() and waiting for logger_thread */
+struct logmsg {
+	int level;
+	int line;
+	long lwp;
+	time_t t;
+	char *file;
+	char *function;
+	AST_LIST_ENTRY(logmsg) list;
+	char str[0];			/* the message, then file and function */
+};
+
+/*! \brief Messages waiting to be written, oldest first */
+static AST_LIST_HEAD_STATIC(logmsgs, logmsg);
+static ast_cond_t logcond;
+static pthread_t logthread = AST_PTHREADT_NULL;
+static int close_logger_thread;
+static unsigned int logmsgs_queued;
+static unsigned int logmsgs_dropped;		/* since logger_thread last reported */
+static unsigned int logmsgs_dropped_total;
+
+/*! \brief Past this many waiting messages new ones are dropped rather than
+ * letting a stalled disk hold up the threads that log */
+#define LOGMSG_MAX_QUEUED	1000
+
 static FILE *eventlog;
 static FILE *qlog;
 
@@ -541,7 +566,7 @@ static int handle_logger_show_channels(int fd, int argc, char *argv[])
 		ast_cli(fd, "\n");
 	}
 	AST_LIST_UNLOCK(&logchannels);
-	ast_cli(fd, "\n");
+	ast_cli(fd, "\nMessages dropped: %u\n", logmsgs_dropped_total);
  		
 	return RESULT_SUCCESS;
 }
@@ -586,6 +611,167 @@ static int handle_SIGXFSZ(int sig)
 	return 0;
 }
 
+static void logger_check_rotate(void)
+{
+	if (filesize_reload_needed) {
+		reload_logger(1);
+		ast_log(LOG_EVENT,"Rotated Logs Per SIGXFSZ (Exceeded file size limit)\n");
+		if (option_verbose)
+			ast_verbose("Rotated Logs Per SIGXFSZ (Exceeded file size limit)\n");
+	}
+}
+
+static void logger_print_syslog(struct logmsg *msg) 
+{
+	char buf[BUFSIZ];
+	char *s;
+	int level = msg->level;
+
+	if (level >= SYSLOG_NLEVELS) {
+		/* we are locked here, so cannot ast_log() */
+		fprintf(stderr, "logger_print_syslog called with bogus level: %d\n", level);
+		return;
+	}
+	if (level == __LOG_VERBOSE) {
+		snprintf(buf, sizeof(buf), "VERBOSE[%ld]: ", msg->lwp);
+		level = __LOG_DEBUG;
+	} else if (level == __LOG_DTMF) {
+		snprintf(buf, sizeof(buf), "DTMF[%ld]: ", msg->lwp);
+		level = __LOG_DEBUG;
+	} else {
+		snprintf(buf, sizeof(buf), "%s[%ld]: %s:%d in %s: ",
+			 levels[level], msg->lwp, msg->file, msg->line, msg->function);
+	}
+	s = buf + strlen(buf);
+	ast_copy_string(s, msg->str, sizeof(buf) - strlen(buf));
+	term_strip(s, s, strlen(s) + 1);
+	syslog(syslog_level_map[level], "%s", buf);
+}
+
+/*!
+ * \brief Write one message to the event log or to the log channels that want it
+ * \note Called with logchannels locked. Files are flushed by logger_flush().
+ */
+static void logger_print(struct logmsg *msg)
+{
+	struct logchannel *chan;
+	struct tm tm;
+	char date[256];
+	char buf[BUFSIZ];
+	int level = msg->level;
+
+	ast_localtime(&msg->t, &tm, NULL);
+	strftime(date, sizeof(date), dateformat, &tm);
+
+	if (logfiles.event_log && level == __LOG_EVENT) {
+		if (eventlog)
+			fprintf(eventlog, "%s asterisk[%ld]: %s", date, (long)getpid(), msg->str);
+		return;
+	}
+
+	AST_LIST_TRAVERSE(&logchannels, chan, list) {
+		if (chan->disabled)
+			break;
+		/* Check syslog channels */
+		if (chan->type == LOGTYPE_SYSLOG && (chan->logmask & (1 << level))) {
+			logger_print_syslog(msg);
+		/* Console channels */
+		} else if ((chan->logmask & (1 << level)) && (chan->type == LOGTYPE_CONSOLE)) {
+			char linestr[128];
+			char tmp1[80], tmp2[80], tmp3[80], tmp4[80];
+
+			if (level != __LOG_VERBOSE) {
+				sprintf(linestr, "%d", msg->line);
+				snprintf(buf, sizeof(buf),
+					"[%s] %s[%ld]: %s:%s %s: ",
+					date,
+					term_color(tmp1, levels[level], colors[level], 0, sizeof(tmp1)),
+					msg->lwp,
+					term_color(tmp2, msg->file, COLOR_BRWHITE, 0, sizeof(tmp2)),
+					term_color(tmp3, linestr, COLOR_BRWHITE, 0, sizeof(tmp3)),
+					term_color(tmp4, msg->function, COLOR_BRWHITE, 0, sizeof(tmp4)));
+				/*filter to the console!*/
+				term_filter_escapes(buf);
+				ast_console_puts_mutable(buf);
+				ast_console_puts_mutable(msg->str);
+			}
+		/* File channels */
+		} else if ((chan->logmask & (1 << level)) && (chan->fileptr)) {
+			int res;
+			res = fprintf(chan->fileptr, "[%s] %s[%ld] %s: ",
+				date, levels[level], msg->lwp, msg->file);
+			if (res <= 0) {	/* Error, no characters printed */
+				fprintf(stderr,"**** Asterisk Logging Error: ***********\n");
+				if (errno == ENOMEM || errno == ENOSPC) {
+					fprintf(stderr, "Asterisk logging error: Out of disk space, can't log to log file %s\n", chan->filename);
+				} else
+					fprintf(stderr, "Logger Warning: Unable to write to log file '%s': %s (disabled)\n", chan->filename, strerror(errno));
+				manager_event(EVENT_FLAG_SYSTEM, "LogChannel", "Channel: %s\r\nEnabled: No\r\nReason: %d - %s\r\n", chan->filename, errno, strerror(errno));
+				chan->disabled = 1;	
+			} else {
+				/* No error message, continue printing */
+				term_strip(buf, msg->str, sizeof(buf));
+				fputs(buf, chan->fileptr);
+			}
+		}
+	}
+}
+
+/*! \brief Flush the log files. Called with logchannels locked. */
+static void logger_flush(void)
+{
+	struct logchannel *chan;
+
+	if (eventlog)
+		fflush(eventlog);
+	AST_LIST_TRAVERSE(&logchannels, chan, list) {
+		if (chan->fileptr)
+			fflush(chan->fileptr);
+	}
+}
+
+/*!
+ * \brief Write out queued messages
+ *
+ * Takes everything that is waiting in one go, writes it under a single
+ * hold of the logchannels lock and flushes the files once per batch.
+ */
+static void *logger_thread(void *data)
+{
+	struct logmsg *msg, *next;
+	unsigned int dropped;
+
+	for (;;) {
+		AST_LIST_LOCK(&logmsgs);
+		while (AST_LIST_EMPTY(&logmsgs) && !close_logger_thread)
+			ast_cond_wait(&logcond, &logmsgs.lock);
+		msg = logmsgs.first;
+		AST_LIST_HEAD_INIT_NOLOCK(&logmsgs);
+		logmsgs_queued = 0;
+		dropped = logmsgs_dropped;
+		logmsgs_dropped = 0;
+		AST_LIST_UNLOCK(&logmsgs);
+
+		if (!msg)
+			break;
+
+		AST_LIST_LOCK(&logchannels);
+		for (; msg; msg = next) {
+			next = AST_LIST_NEXT(msg, list);
+			logger_print(msg);
+			free(msg);
+		}
+		logger_flush();
+		AST_LIST_UNLOCK(&logchannels);
+
+		if (dropped)
+			ast_log(LOG_WARNING, "Logger could not keep up, %u messages dropped\n", dropped);
+		logger_check_rotate();
+	}
+
+	return NULL;
+}
+
 int init_logger(void)
 {
 	char tmp[256];
@@ -602,6 +788,13 @@ int init_logger(void)
 	/* create log channels */
 	init_logger_chain();
 
+	/* start the writer; until then, and if it fails, ast_log() writes directly */
+	ast_cond_init(&logcond, NULL);
+	if (ast_pthread_create(&logthread, NULL, logger_thread, NULL)) {
+		logthread = AST_PTHREADT_NULL;
+		ast_log(LOG_ERROR, "Unable to start logger thread, logging synchronously\n");
+	}
+
 	/* create the eventlog */
 	if (logfiles.event_log) {
 		mkdir((char *)ast_config_AST_LOG_DIR, 0755);
@@ -628,6 +821,16 @@ int init_logger(void)
 void close_logger(void)
 {
 	struct logchannel *f;
+	pthread_t thread;
+
+	/* let the writer drain the queue; from here on ast_log() writes directly */
+	AST_LIST_LOCK(&logmsgs);
+	close_logger_thread = 1;
+	thread = logthread;
+	ast_cond_signal(&logcond);
+	AST_LIST_UNLOCK(&logmsgs);
+	if (thread != AST_PTHREADT_NULL && thread != pthread_self())
+		pthread_join(thread, NULL);
 
 	AST_LIST_LOCK(&logchannels);
 
@@ -655,48 +858,21 @@ void close_logger(void)
 	return;
 }
 
-static void ast_log_vsyslog(int level, const char *file, int line, const char *function, const char *fmt, va_list args) 
-{
-	char buf[BUFSIZ];
-	char *s;
-
-	if (level >= SYSLOG_NLEVELS) {
-		/* we are locked here, so cannot ast_log() */
-		fprintf(stderr, "ast_log_vsyslog called with bogus level: %d\n", level);
-		return;
-	}
-	if (level == __LOG_VERBOSE) {
-		snprintf(buf, sizeof(buf), "VERBOSE[%ld]: ", (long)GETTID());
-		level = __LOG_DEBUG;
-	} else if (level == __LOG_DTMF) {
-		snprintf(buf, sizeof(buf), "DTMF[%ld]: ", (long)GETTID());
-		level = __LOG_DEBUG;
-	} else {
-		snprintf(buf, sizeof(buf), "%s[%ld]: %s:%d in %s: ",
-			 levels[level], (long)GETTID(), file, line, function);
-	}
-	s = buf + strlen(buf);
-	vsnprintf(s, sizeof(buf) - strlen(buf), fmt, args);
-	term_strip(s, s, strlen(s) + 1);
-	syslog(syslog_level_map[level], "%s", buf);
-}
-
 /*!
  * \brief send log messages to syslog and/or the console
+ *
+ * The message is formatted here and handed to logger_thread, so the caller
+ * never waits for a disk, syslog or the console.
  */
 void ast_log(int level, const char *file, int line, const char *function, const char *fmt, ...)
 {
-	struct logchannel *chan;
+	struct logmsg *msg;
 	struct ast_dynamic_str *buf;
-	time_t t;
-	struct tm tm;
-	char date[256];
+	size_t len, filelen, funclen;
+	int res;
 
 	va_list ap;
 
-	if (!(buf = ast_dynamic_str_thread_get(&log_buf, LOG_BUF_INIT_SIZE)))
-		return;
-
 	if (AST_LIST_EMPTY(&logchannels))
 	{
 		/*
@@ -704,7 +880,8 @@ void ast_log(int level, const char *file, int line, const char *function, const
 		 * so just log to stdout
 		*/
 		if (level != __LOG_VERBOSE) {
-			int res;
+			if (!(buf = ast_dynamic_str_thread_get(&log_buf, LOG_BUF_INIT_SIZE)))
+				return;
 			va_start(ap, fmt);
 			res = ast_dynamic_str_thread_set_va(&buf, BUFSIZ, &log_buf, fmt, ap);
 			va_end(ap);
@@ -733,96 +910,57 @@ void ast_log(int level, const char *file, int line, const char *function, const
 	if ((level == __LOG_DEBUG) && !ast_strlen_zero(debug_filename) && strcasecmp(debug_filename, file))
 		return;
 
-	time(&t);
-	ast_localtime(&t, &tm, NULL);
-	strftime(date, sizeof(date), dateformat, &tm);
-
-	AST_LIST_LOCK(&logchannels);
-
-	if (logfiles.event_log && level == __LOG_EVENT) {
-		va_start(ap, fmt);
-
-		fprintf(eventlog, "%s asterisk[%ld]: ", date, (long)getpid());
-		vfprintf(eventlog, fmt, ap);
-		fflush(eventlog);
-
-		va_end(ap);
-		AST_LIST_UNLOCK(&logchannels);
+	if (!(buf = ast_dynamic_str_thread_get(&log_buf, LOG_BUF_INIT_SIZE)))
+		return;
+	va_start(ap, fmt);
+	res = ast_dynamic_str_thread_set_va(&buf, BUFSIZ, &log_buf, fmt, ap);
+	va_end(ap);
+	if (res == AST_DYNSTR_BUILD_FAILED)
 		return;
-	}
-
-	AST_LIST_TRAVERSE(&logchannels, chan, list) {
-		if (chan->disabled)
-			break;
-		/* Check syslog channels */
-		if (chan->type == LOGTYPE_SYSLOG && (chan->logmask & (1 << level))) {
-			va_start(ap, fmt);
-			ast_log_vsyslog(level, file, line, function, fmt, ap);
-			va_end(ap);
-		/* Console channels */
-		} else if ((chan->logmask & (1 << level)) && (chan->type == LOGTYPE_CONSOLE)) {
-			char linestr[128];
-			char tmp1[80], tmp2[80], tmp3[80], tmp4[80];
 
-			if (level != __LOG_VERBOSE) {
-				int res;
-				sprintf(linestr, "%d", line);
-				ast_dynamic_str_thread_set(&buf, BUFSIZ, &log_buf,
-					"[%s] %s[%ld]: %s:%s %s: ",
-					date,
-					term_color(tmp1, levels[level], colors[level], 0, sizeof(tmp1)),
-					(long)GETTID(),
-					term_color(tmp2, file, COLOR_BRWHITE, 0, sizeof(tmp2)),
-					term_color(tmp3, linestr, COLOR_BRWHITE, 0, sizeof(tmp3)),
-					term_color(tmp4, function, COLOR_BRWHITE, 0, sizeof(tmp4)));
-				/*filter to the console!*/
-				term_filter_escapes(buf->str);
-				ast_console_puts_mutable(buf->str);
-				
-				va_start(ap, fmt);
-				res = ast_dynamic_str_thread_set_va(&buf, BUFSIZ, &log_buf, fmt, ap);
-				va_end(ap);
-				if (res != AST_DYNSTR_BUILD_FAILED)
-					ast_console_puts_mutable(buf->str);
-			}
-		/* File channels */
-		} else if ((chan->logmask & (1 << level)) && (chan->fileptr)) {
-			int res;
-			ast_dynamic_str_thread_set(&buf, BUFSIZ, &log_buf, 
-				"[%s] %s[%ld] %s: ",
-				date, levels[level], (long)GETTID(), file);
-			res = fprintf(chan->fileptr, "%s", buf->str);
-			if (res <= 0 && !ast_strlen_zero(buf->str)) {	/* Error, no characters printed */
-				fprintf(stderr,"**** Asterisk Logging Error: ***********\n");
-				if (errno == ENOMEM || errno == ENOSPC) {
-					fprintf(stderr, "Asterisk logging error: Out of disk space, can't log to log file %s\n", chan->filename);
-				} else
-					fprintf(stderr, "Logger Warning: Unable to write to log file '%s': %s (disabled)\n", chan->filename, strerror(errno));
-				manager_event(EVENT_FLAG_SYSTEM, "LogChannel", "Channel: %s\r\nEnabled: No\r\nReason: %d - %s\r\n", chan->filename, errno, strerror(errno));
-				chan->disabled = 1;	
-			} else {
-				int res;
-				/* No error message, continue printing */
-				va_start(ap, fmt);
-				res = ast_dynamic_str_thread_set_va(&buf, BUFSIZ, &log_buf, fmt, ap);
-				va_end(ap);
-				if (res != AST_DYNSTR_BUILD_FAILED) {
-					term_strip(buf->str, buf->str, buf->len);
-					fputs(buf->str, chan->fileptr);
-					fflush(chan->fileptr);
-				}
-			}
+	/* file and function are copied, the module they live in may be gone
+	   by the time the message is written. Not ast_malloc(), which logs. */
+	len = strlen(buf->str) + 1;
+	filelen = strlen(file) + 1;
+	funclen = strlen(function) + 1;
+	if (!(msg = malloc(sizeof(*msg) + len + filelen + funclen)))
+		return;
+	AST_LIST_NEXT(msg, list) = NULL;
+	msg->level = level;
+	msg->line = line;
+	msg->lwp = (long)GETTID();
+	time(&msg->t);
+	memcpy(msg->str, buf->str, len);
+	msg->file = msg->str + len;
+	memcpy(msg->file, file, filelen);
+	msg->function = msg->file + filelen;
+	memcpy(msg->function, function, funclen);
+
+	AST_LIST_LOCK(&logmsgs);
+	if (logthread != AST_PTHREADT_NULL && !close_logger_thread) {
+		if (logmsgs_queued >= LOGMSG_MAX_QUEUED) {
+			logmsgs_dropped++;
+			logmsgs_dropped_total++;
+			AST_LIST_UNLOCK(&logmsgs);
+			free(msg);
+			return;
 		}
+		AST_LIST_INSERT_TAIL(&logmsgs, msg, list);
+		logmsgs_queued++;
+		ast_cond_signal(&logcond);
+		AST_LIST_UNLOCK(&logmsgs);
+		return;
 	}
+	AST_LIST_UNLOCK(&logmsgs);
 
+	/* no writer thread (yet, or any more), so write it here */
+	AST_LIST_LOCK(&logchannels);
+	logger_print(msg);
+	logger_flush();
 	AST_LIST_UNLOCK(&logchannels);
+	free(msg);
 
-	if (filesize_reload_needed) {
-		reload_logger(1);
-		ast_log(LOG_EVENT,"Rotated Logs Per SIGXFSZ (Exceeded file size limit)\n");
-		if (option_verbose)
-			ast_verbose("Rotated Logs Per SIGXFSZ (Exceeded file size limit)\n");
-	}
+	logger_check_rotate();
 }
 
 void ast_backtrace(void)
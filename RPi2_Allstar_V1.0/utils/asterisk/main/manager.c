@@ -91,6 +91,13 @@ struct fast_originate_helper {
 struct eventqent {
 	int usecount;
 	int category;
+	unsigned int seq;	/*!< Position in the master queue */
+	int superseded;		/*!< A newer event with the same key is queued */
+	int len;		/*!< strlen(eventdata) */
+	unsigned int keyhash;
+	const char *event;	/*!< Event name */
+	const char *node;	/*!< Node: header value, or NULL */
+	const char *key;	/*!< Coalescing key, or NULL */
 	struct eventqent *next;
 	char eventdata[1];
 };
@@ -108,6 +115,15 @@ static int num_sessions;
 
 /* Protected by the sessions list lock */
 struct eventqent *master_eventq = NULL;
+static struct eventqent *master_eventq_tail = NULL;
+static unsigned int master_eventseq;
+
+/* Newest queued event per coalescing key bucket, also under the sessions lock */
+#define EVENT_KEY_BUCKETS	256
+static struct eventqent *event_keys[EVENT_KEY_BUCKETS];
+
+/* Sessions this many events behind skip keyed events that have been superseded */
+#define EVENT_COALESCE_BACKLOG	64
 
 AST_THREADSTORAGE(manager_event_buf, manager_event_buf_init);
 #define MANAGER_EVENT_BUF_INITSIZE   256
@@ -180,6 +196,9 @@ struct mansession {
 	/* Timeout for ast_carefulwrite() */
 	int writetimeout;
 	int pending_event;         /*!< Pending events indicator in case when waiting_thread is NULL */
+	char *eventfilter;		/*!< Event names to send, NULL for all */
+	char *nodefilter;		/*!< Node: values to send, NULL for all */
+	int coalesced;			/*!< Superseded events skipped while behind */
 	AST_LIST_ENTRY(mansession) list;
 };
 
@@ -741,6 +760,10 @@ static void free_session(struct mansession *s)
 		close(s->fd);
 	if (s->outputstr)
 		free(s->outputstr);
+	if (s->eventfilter)
+		free(s->eventfilter);
+	if (s->nodefilter)
+		free(s->nodefilter);
 	ast_mutex_destroy(&s->__lock);
 	while (s->eventq) {
 		eqe = s->eventq;
@@ -949,6 +972,59 @@ static int set_eventmask(struct mansession *s, const char *eventmask)
 	return maskint;
 }
 
+/*! \brief Whether item is one of the comma separated entries in list */
+static int filter_match(const char *list, const char *item)
+{
+	size_t len = strlen(item);
+	const char *p;
+
+	for (p = list; *p; p++) {
+		p = ast_skip_blanks(p);
+		if (!strncasecmp(p, item, len) && (!p[len] || p[len] == ',' || p[len] == ' '))
+			return 1;
+		if (!(p = strchr(p, ',')))
+			break;
+	}
+	return 0;
+}
+
+/*! \brief Set the event name and node subscription filters, empty for none */
+static void set_eventfilter(struct mansession *s, const char *events, const char *nodes)
+{
+	char *e = NULL, *n = NULL;
+
+	if (!ast_strlen_zero(events))
+		e = ast_strdup(events);
+	if (!ast_strlen_zero(nodes))
+		n = ast_strdup(nodes);
+	ast_mutex_lock(&s->__lock);
+	if (s->eventfilter)
+		free(s->eventfilter);
+	if (s->nodefilter)
+		free(s->nodefilter);
+	s->eventfilter = e;
+	s->nodefilter = n;
+	ast_mutex_unlock(&s->__lock);
+}
+
+/*! \brief Whether a queued event should be sent to this session */
+static int event_wanted(struct mansession *s, struct eventqent *eqe)
+{
+	if (((s->readperm & eqe->category) != eqe->category) ||
+	    ((s->send_events & eqe->category) != eqe->category))
+		return 0;
+	if (s->eventfilter && !filter_match(s->eventfilter, eqe->event))
+		return 0;
+	if (s->nodefilter && eqe->node && !filter_match(s->nodefilter, eqe->node))
+		return 0;
+	/* A client this far behind only needs the newest state per key */
+	if (eqe->superseded && ((master_eventseq - eqe->seq) > EVENT_COALESCE_BACKLOG)) {
+		s->coalesced++;
+		return 0;
+	}
+	return 1;
+}
+
 static int authenticate(struct mansession *s, const struct message *m)
 {
 	struct ast_config *cfg;
@@ -958,6 +1034,8 @@ static int authenticate(struct mansession *s, const struct message *m)
 	const char *authtype = astman_get_header(m, "AuthType");
 	const char *key = astman_get_header(m, "Key");
 	const char *events = astman_get_header(m, "Events");
+	const char *eventfilter = astman_get_header(m, "EventFilter");
+	const char *nodefilter = astman_get_header(m, "NodeFilter");
 	
 	cfg = ast_config_load("manager.conf");
 	if (!cfg)
@@ -1046,6 +1124,7 @@ static int authenticate(struct mansession *s, const struct message *m)
 		ast_config_destroy(cfg);
 		if (events)
 			set_eventmask(s, events);
+		set_eventfilter(s, eventfilter, nodefilter);
 		return 0;
 	}
 	ast_config_destroy(cfg);
@@ -1087,6 +1166,7 @@ static int authenticate(struct mansession *s, const struct message *m)
 		ast_config_destroy(cfg);
 		if (events)
 			set_eventmask(s, events);
+		set_eventfilter(s, eventfilter, nodefilter);
 		return 0;
 	}
 	ast_log(LOG_NOTICE, "%s tried to authenticate with nonexistent user '%s'\n", ast_inet_ntoa(s->sin.sin_addr), user);
@@ -1331,10 +1411,8 @@ static int action_waitevent(struct mansession *s, const struct message *m)
 		/* Only show events if we're the most recent waiter */
 		while(s->eventq->next) {
 			eqe = s->eventq->next;
-			if (((s->readperm & eqe->category) == eqe->category) &&
-			    ((s->send_events & eqe->category) == eqe->category)) {
+			if (event_wanted(s, eqe))
 				astman_append(s, "%s", eqe->eventdata);
-			}
 			unuse_eventqent(s->eventq);
 			s->eventq = eqe;
 		}
@@ -1381,13 +1459,22 @@ static char mandescr_events[] =
 "Variables:\n"
 "	EventMask: 'on' if all events should be sent,\n"
 "		'off' if no events should be sent,\n"
-"		'system,call,log' to select which flags events should have to be sent.\n";
+"		'system,call,log' to select which flags events should have to be sent.\n"
+"	EventFilter: Optional ',' list of event names to send, e.g. 'RptKeyup,RptUnkey'.\n"
+"	NodeFilter: Optional ',' list of nodes; events with a Node: header\n"
+"		are only sent for these.\n"
+"  Each Events action replaces both filters. The same headers are accepted on Login.\n";
 
 static int action_events(struct mansession *s, const struct message *m)
 {
 	const char *mask = astman_get_header(m, "EventMask");
 	int res;
 
+	set_eventfilter(s, astman_get_header(m, "EventFilter"), astman_get_header(m, "NodeFilter"));
+	if (ast_strlen_zero(mask)) {
+		astman_send_response(s, m, s->send_events ? "Events On" : "Events Off", NULL);
+		return 0;
+	}
 	res = set_eventmask(s, mask);
 	if (res > 0)
 		astman_send_response(s, m, "Events On", NULL);
@@ -1731,10 +1818,7 @@ static int action_command(struct mansession *s, const struct message *m)
 {
 	const char *cmd = astman_get_header(m, "Command");
 	const char *id = astman_get_header(m, "ActionID");
-	char *buf, *final_buf;
-	char template[] = "/tmp/ast-ami-XXXXXX";	/* template for temporary file */
-	int fd = mkstemp(template);
-	off_t l;
+	char *buf;
 
 	if (ast_strlen_zero(cmd)) {
 		astman_send_error(s, m, "No command provided");
@@ -1750,28 +1834,13 @@ static int action_command(struct mansession *s, const struct message *m)
 	if (!ast_strlen_zero(id))
 		astman_append(s, "ActionID: %s\r\n", id);
 	/* FIXME: Wedge a ActionID response in here, waiting for later changes */
-	ast_cli_command(fd, cmd);	/* XXX need to change this to use a FILE * */
-	l = lseek(fd, 0, SEEK_END);	/* how many chars available */
-
-	/* This has a potential to overflow the stack.  Hence, use the heap. */
-	buf = ast_calloc(1, l + 1);
-	final_buf = ast_calloc(1, l + 1);
-	if (buf) {
-		lseek(fd, 0, SEEK_SET);
-		read(fd, buf, l);
-		buf[l] = '\0';
-		if (final_buf) {
-			term_strip(final_buf, buf, l);
-			final_buf[l] = '\0';
-		}
-		astman_append(s, "%s", S_OR(final_buf, buf));
+	if ((buf = ast_cli_command_capture(cmd))) {
+		/* stripping only ever shortens, so it can be done in place */
+		term_strip(buf, buf, strlen(buf));
+		astman_append(s, "%s", buf);
 		ast_free(buf);
 	}
-	close(fd);
-	unlink(template);
 	astman_append(s, "--END COMMAND--\r\n\r\n");
-	if (final_buf)
-		ast_free(final_buf);
 	return 0;
 }
 
@@ -2103,11 +2172,14 @@ static int process_events(struct mansession *s)
 		s->eventq = master_eventq;
 	while(s->eventq->next) {
 		eqe = s->eventq->next;
-		if ((s->authenticated && (s->readperm & eqe->category) == eqe->category) &&
-				   ((s->send_events & eqe->category) == eqe->category)) {
+		if (s->authenticated && event_wanted(s, eqe)) {
 			if (s->fd > -1) {
-				if (!ret && ast_carefulwrite(s->fd, eqe->eventdata, strlen(eqe->eventdata), s->writetimeout) < 0)
+				/* Only this thread moves a socket session's eventq, so don't
+				   make manager_event() wait on the lock behind a slow client */
+				ast_mutex_unlock(&s->__lock);
+				if (!ret && ast_carefulwrite(s->fd, eqe->eventdata, eqe->len, s->writetimeout) < 0)
 					ret = -1;
+				ast_mutex_lock(&s->__lock);
 			} else if (!s->outputstr && !(s->outputstr = ast_calloc(1, sizeof(*s->outputstr)))) 
 				ret = -1;
 			else 
@@ -2396,6 +2468,8 @@ static void *accept_thread(void *ignore)
 		while (master_eventq->next && !master_eventq->usecount) {
 			eqe = master_eventq;
 			master_eventq = master_eventq->next;
+			if (eqe->key && (event_keys[eqe->keyhash] == eqe))
+				event_keys[eqe->keyhash] = NULL;
 			free(eqe);
 		}
 		AST_LIST_UNLOCK(&sessions);
@@ -2439,11 +2513,8 @@ static void *accept_thread(void *ignore)
 		AST_LIST_LOCK(&sessions);
 		AST_LIST_INSERT_HEAD(&sessions, s, list);
 		num_sessions++;
-		/* Find the last place in the master event queue and hook ourselves
-		   in there */
-		s->eventq = master_eventq;
-		while(s->eventq->next)
-			s->eventq = s->eventq->next;
+		/* Hook ourselves in at the end of the master event queue */
+		s->eventq = master_eventq_tail;
 		ast_atomic_fetchadd_int(&s->eventq->usecount, 1);
 		AST_LIST_UNLOCK(&sessions);
 		if (ast_pthread_create_background(&s->t, &attr, session_do, s))
@@ -2453,47 +2524,80 @@ static void *accept_thread(void *ignore)
 	return NULL;
 }
 
-static int append_event(const char *str, int category)
+/*! \brief Queue a formatted event. Called with the sessions list locked */
+static int append_event(const char *str, int category, const char *event, const char *key)
 {
-	struct eventqent *tmp, *prev = NULL;
-	tmp = ast_malloc(sizeof(*tmp) + strlen(str));
+	struct eventqent *tmp, *prev;
+	const char *node;
+	char *p;
+	size_t len, elen, nlen = 0, klen = 0;
+	unsigned int h = 0;
+
+	len = strlen(str);
+	elen = strlen(event);
+	/* Remember the Node: header once, rather than per subscriber */
+	if ((node = strstr(str, "\r\nNode: "))) {
+		node += 8;
+		nlen = strcspn(node, "\r\n") + 1;
+	}
+	if (key)
+		klen = strlen(key) + 1;
+	tmp = ast_malloc(sizeof(*tmp) + len + elen + 1 + nlen + klen);
 
 	if (!tmp)
 		return -1;
 
 	tmp->next = NULL;
 	tmp->category = category;
+	tmp->superseded = 0;
+	tmp->len = len;
 	strcpy(tmp->eventdata, str);
+	p = tmp->eventdata + len + 1;
+	strcpy(p, event);
+	tmp->event = p;
+	p += elen + 1;
+	tmp->node = NULL;
+	if (node) {
+		ast_copy_string(p, node, nlen);
+		tmp->node = p;
+		p += nlen;
+	}
+	tmp->key = NULL;
+	tmp->keyhash = 0;
+	if (key) {
+		strcpy(p, key);
+		tmp->key = p;
+		for (; *key; key++)
+			h = (h * 31) + (unsigned char) *key;
+		tmp->keyhash = h % EVENT_KEY_BUCKETS;
+		/* Mark the previous event with this key as superseded */
+		prev = event_keys[tmp->keyhash];
+		if (prev && !strcmp(prev->key, tmp->key))
+			prev->superseded = 1;
+		event_keys[tmp->keyhash] = tmp;
+	}
 	
-	if (master_eventq) {
-		prev = master_eventq;
-		while (prev->next) 
-			prev = prev->next;
-		prev->next = tmp;
-	} else {
+	tmp->seq = ++master_eventseq;
+	if (master_eventq_tail)
+		master_eventq_tail->next = tmp;
+	else
 		master_eventq = tmp;
-	}
+	master_eventq_tail = tmp;
 	
 	tmp->usecount = num_sessions;
 	
 	return 0;
 }
 
-/*! \brief  manager_event: Send AMI event to client */
-int manager_event(int category, const char *event, const char *fmt, ...)
+/*! \brief Start an event in the thread's event buffer */
+static struct ast_dynamic_str *manager_event_start(int category, const char *event)
 {
-	struct mansession *s;
 	char auth[80];
-	va_list ap;
 	struct timeval now;
 	struct ast_dynamic_str *buf;
 
-	/* Abort if there aren't any manager sessions */
-	if (!num_sessions)
-		return 0;
-
 	if (!(buf = ast_dynamic_str_thread_get(&manager_event_buf, MANAGER_EVENT_BUF_INITSIZE)))
-		return -1;
+		return NULL;
 
 	ast_dynamic_str_thread_set(&buf, 0, &manager_event_buf,
 			"Event: %s\r\nPrivilege: %s\r\n",
@@ -2505,16 +2609,19 @@ int manager_event(int category, const char *event, const char *fmt, ...)
 				"Timestamp: %ld.%06lu\r\n",
 				 now.tv_sec, (unsigned long) now.tv_usec);
 	}
+	return buf;
+}
+
+/*! \brief Terminate a built event, queue it and wake the sessions */
+static int manager_event_queue(struct ast_dynamic_str *buf, int category, const char *event, const char *key)
+{
+	struct mansession *s;
 
-	va_start(ap, fmt);
-	ast_dynamic_str_thread_append_va(&buf, 0, &manager_event_buf, fmt, ap);
-	va_end(ap);
-	
 	ast_dynamic_str_thread_append(&buf, 0, &manager_event_buf, "\r\n");	
 	
 	/* Append event to master list and wake up any sleeping sessions */
 	AST_LIST_LOCK(&sessions);
-	append_event(buf->str, category);
+	append_event(buf->str, category, event, key);
 	AST_LIST_TRAVERSE(&sessions, s, list) {
 		ast_mutex_lock(&s->__lock);
 		if (s->waiting_thread != AST_PTHREADT_NULL)
@@ -2533,6 +2640,44 @@ int manager_event(int category, const char *event, const char *fmt, ...)
 	return 0;
 }
 
+/*! \brief  manager_event: Send AMI event to client */
+int manager_event(int category, const char *event, const char *fmt, ...)
+{
+	va_list ap;
+	struct ast_dynamic_str *buf;
+
+	/* Abort if there aren't any manager sessions */
+	if (!num_sessions)
+		return 0;
+
+	if (!(buf = manager_event_start(category, event)))
+		return -1;
+
+	va_start(ap, fmt);
+	ast_dynamic_str_thread_append_va(&buf, 0, &manager_event_buf, fmt, ap);
+	va_end(ap);
+
+	return manager_event_queue(buf, category, event, NULL);
+}
+
+int manager_event_keyed(int category, const char *event, const char *key, const char *fmt, ...)
+{
+	va_list ap;
+	struct ast_dynamic_str *buf;
+
+	if (!num_sessions)
+		return 0;
+
+	if (!(buf = manager_event_start(category, event)))
+		return -1;
+
+	va_start(ap, fmt);
+	ast_dynamic_str_thread_append_va(&buf, 0, &manager_event_buf, fmt, ap);
+	va_end(ap);
+
+	return manager_event_queue(buf, category, event, key);
+}
+
 int ast_manager_unregister(char *action) 
 {
 	struct manager_action *cur, *prev;
@@ -2732,9 +2877,7 @@ static char *generic_http_callback(int format, struct sockaddr_in *requestor, co
 		AST_LIST_LOCK(&sessions);
 		AST_LIST_INSERT_HEAD(&sessions, s, list);
 		/* Hook into the last spot in the event queue */
-		s->eventq = master_eventq;
-		while (s->eventq->next)
-			s->eventq = s->eventq->next;
+		s->eventq = master_eventq_tail;
 		ast_atomic_fetchadd_int(&s->eventq->usecount, 1);
 		ast_atomic_fetchadd_int(&num_sessions, 1);
 		AST_LIST_UNLOCK(&sessions);
@@ -2923,7 +3066,7 @@ int init_manager(void)
 		ast_extension_state_add(NULL, NULL, manager_state_cb, NULL);
 		registered = 1;
 		/* Append placeholder event so master_eventq never runs dry */
-		append_event("Event: Placeholder\r\n\r\n", 0);
+		append_event("Event: Placeholder\r\n\r\n", 0, "Placeholder", NULL);
 	}
 	portno = DEFAULT_MANAGER_PORT;
 	displayconnects = 1;
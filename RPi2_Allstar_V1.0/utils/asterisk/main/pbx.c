@@ -168,6 +168,7 @@ struct ast_context {
 	const char *registrar;			/*!< Registrar */
 	AST_LIST_HEAD_NOLOCK(, ast_sw) alts;	/*!< Alternative switches */
 	ast_mutex_t macrolock;			/*!< A lock to implement "exclusive" macros - held whilst a call is executing in the macro */
+	struct ext_trie *trie;			/*!< Match index over root, NULL until the next lookup */
 	char name[0];				/*!< Name of the context */
 };
 
@@ -908,6 +909,368 @@ struct ast_context *ast_context_find(const char *name)
 	return tmp;
 }
 
+/*!
+ * \brief Per-context index for pbx_find_extension().
+ *
+ * Each extension is compiled into a path of character sets (one per
+ * digit, 'X'/'N'/'Z' or [...] in patterns, case folded for plain
+ * extensions) and the paths share a trie. Walking the trie with the
+ * dialed string gives every extension that could possibly match, which
+ * are then checked with extension_match_core() in the order of the
+ * context's list, so the precedence from ext_cmp() is unchanged. The
+ * trie is thrown away whenever the context's extensions change and
+ * rebuilt on the next lookup.
+ */
+#define EXT_TRIE_MAXDEPTH	AST_MAX_EXTENSION
+
+enum ext_trie_tok {
+	T_SET,		/* a character set */
+	T_END,		/* end of the extension */
+	T_WILD,		/* '.' */
+	T_BANG,		/* '!' */
+	T_BAD,		/* unterminated [, nothing past here can match */
+	T_ODD,		/* can't be indexed, always try it */
+};
+
+struct ext_trie_list {
+	int *idx;
+	int len;
+	int alloc;
+};
+
+struct ext_trie_node {
+	uint32_t set[8];		/*!< characters leading here from the parent */
+	struct ext_trie_node *child;
+	struct ext_trie_node *sibling;
+	struct ext_trie_list all;	/*!< extensions whose path passes or ends here */
+	struct ext_trie_list term;	/*!< extensions that may be complete here */
+	struct ext_trie_list wild;	/*!< extensions that end in '.' or '!' here */
+};
+
+struct ext_trie {
+	struct ext_trie_node root;
+	struct ast_exten **ext;		/*!< by position in the context's list */
+	int next;
+	struct ext_trie_list odd;	/*!< extensions that are always tried */
+	int width;			/*!< most nodes at one depth */
+};
+
+static int ext_trie_list_add(struct ext_trie_list *l, int i)
+{
+	if (l->len == l->alloc) {
+		int *n = ast_realloc(l->idx, (l->alloc ? l->alloc * 2 : 4) * sizeof(*n));
+		if (!n)
+			return -1;
+		l->idx = n;
+		l->alloc = l->alloc ? l->alloc * 2 : 4;
+	}
+	l->idx[l->len++] = i;
+	return 0;
+}
+
+static void ext_trie_free_node(struct ext_trie_node *n)
+{
+	struct ext_trie_node *c;
+
+	while ((c = n->child)) {
+		n->child = c->sibling;
+		ext_trie_free_node(c);
+		free(c);
+	}
+	free(n->all.idx);
+	free(n->term.idx);
+	free(n->wild.idx);
+}
+
+static void ext_trie_free(struct ext_trie *t)
+{
+	if (!t)
+		return;
+	ext_trie_free_node(&t->root);
+	free(t->odd.idx);
+	free(t->ext);
+	free(t);
+}
+
+static void ext_trie_setrange(uint32_t *set, unsigned char c1, unsigned char c2)
+{
+	for (; c1 <= c2; c1++) {
+		set[c1 / 32] |= 1 << (c1 % 32);
+		if (c1 == 0xff)
+			break;
+	}
+}
+
+/*!
+ * \brief next token of an extension, following _extension_match_core()
+ * for patterns, or the case insensitive compare for plain extensions.
+ * Separators the matcher skips are skipped here too.
+ */
+static enum ext_trie_tok ext_trie_token(const char **p, int pattern, uint32_t *set)
+{
+	const char *end;
+	int c;
+
+	memset(set, 0, 8 * sizeof(*set));
+	if (!pattern) {
+		while (**p == '-')
+			(*p)++;
+		if (!(c = (unsigned char)*(*p)++))
+			return T_END;
+		ext_trie_setrange(set, tolower(c), tolower(c));
+		ext_trie_setrange(set, toupper(c), toupper(c));
+		return T_SET;
+	}
+	while (**p == ' ' || **p == '-')
+		(*p)++;
+	c = (unsigned char)*(*p)++;
+	if (!c || c == '/')
+		return T_END;
+	switch (toupper(c)) {
+	case '[':
+		if (!(end = strchr(*p, ']')))
+			return T_BAD;
+		for (; *p < end; (*p)++) {
+			unsigned char c1 = (*p)[0], c2 = c1;
+			if (*p + 2 < end && (*p)[1] == '-') {
+				c2 = (*p)[2];
+				*p += 2;
+			}
+			/* the matcher compares plain chars, so high ones may sort differently */
+			if (c1 > 0x7f || c2 > 0x7f)
+				return T_ODD;
+			ext_trie_setrange(set, c1, c2);
+		}
+		(*p)++;
+		return T_SET;
+	case 'N':
+		ext_trie_setrange(set, '2', '9');
+		return T_SET;
+	case 'X':
+		ext_trie_setrange(set, '0', '9');
+		return T_SET;
+	case 'Z':
+		ext_trie_setrange(set, '1', '9');
+		return T_SET;
+	case '.':
+		return T_WILD;
+	case '!':
+		return T_BANG;
+	}
+	ext_trie_setrange(set, c, c);
+	return T_SET;
+}
+
+static struct ext_trie_node *ext_trie_child(struct ext_trie_node *n, uint32_t *set, int *created)
+{
+	struct ext_trie_node *c;
+
+	*created = 0;
+	for (c = n->child; c; c = c->sibling) {
+		if (!memcmp(c->set, set, sizeof(c->set)))
+			return c;
+	}
+	if (!(c = ast_calloc(1, sizeof(*c))))
+		return NULL;
+	memcpy(c->set, set, sizeof(c->set));
+	c->sibling = n->child;
+	n->child = c;
+	*created = 1;
+	return c;
+}
+
+static int ext_trie_insert(struct ext_trie *t, int i, int *level)
+{
+	uint32_t sets[EXT_TRIE_MAXDEPTH][8];
+	const char *p = t->ext[i]->exten;
+	struct ext_trie_node *n = &t->root;
+	enum ext_trie_tok tok;
+	int pattern = (*p == '_'), depth = 0, x, created;
+
+	if (pattern)
+		p++;
+	/* tokenize first, so an odd extension never gets into the trie */
+	for (;;) {
+		if (depth == EXT_TRIE_MAXDEPTH)
+			return ext_trie_list_add(&t->odd, i);
+		if ((tok = ext_trie_token(&p, pattern, sets[depth])) != T_SET)
+			break;
+		depth++;
+	}
+	if (tok == T_ODD)
+		return ext_trie_list_add(&t->odd, i);
+
+	if (ext_trie_list_add(&n->all, i))
+		return -1;
+	for (x = 0; x < depth; x++) {
+		if (!(n = ext_trie_child(n, sets[x], &created)))
+			return -1;
+		if (created && ++level[x] > t->width)
+			t->width = level[x];
+		if (ext_trie_list_add(&n->all, i))
+			return -1;
+	}
+	switch (tok) {
+	case T_END:
+		return ext_trie_list_add(&n->term, i);
+	case T_WILD:
+		return ext_trie_list_add(&n->wild, i);
+	case T_BANG:
+		if (ext_trie_list_add(&n->term, i))
+			return -1;
+		return ext_trie_list_add(&n->wild, i);
+	default:
+		return 0;
+	}
+}
+
+/*! \brief Call with con->lock held */
+static struct ext_trie *ext_trie_build(struct ast_context *con)
+{
+	struct ext_trie *t;
+	struct ast_exten *e;
+	int level[EXT_TRIE_MAXDEPTH] = { 0, };
+	int i;
+
+	if (!(t = ast_calloc(1, sizeof(*t))))
+		return NULL;
+	for (e = con->root; e; e = e->next)
+		t->next++;
+	if (t->next && !(t->ext = ast_calloc(t->next, sizeof(*t->ext)))) {
+		free(t);
+		return NULL;
+	}
+	for (i = 0, e = con->root; e; e = e->next)
+		t->ext[i++] = e;
+	t->width = 1;
+	for (i = 0; i < t->next; i++) {
+		if (ext_trie_insert(t, i, level)) {
+			ext_trie_free(t);
+			return NULL;
+		}
+	}
+	return t;
+}
+
+static int ext_trie_cmp(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+static void ext_trie_collect(int *out, int *n, struct ext_trie_list *l)
+{
+	if (out)
+		memcpy(out + *n, l->idx, l->len * sizeof(*out));
+	*n += l->len;
+}
+
+/*!
+ * \brief Walk t with exten, adding the candidates to out (if not NULL).
+ * cur and nxt each have room for t->width nodes.
+ * \return the number of candidates
+ */
+static int ext_trie_walk(struct ext_trie *t, const char *exten, enum ext_match_t action,
+	struct ext_trie_node **cur, struct ext_trie_node **nxt, int *out)
+{
+	struct ext_trie_node **tmp, *c;
+	int ncur, nnxt, n = 0, x;
+	unsigned char ch;
+
+	ext_trie_collect(out, &n, &t->odd);
+	cur[0] = &t->root;
+	ncur = 1;
+	for (; *exten && ncur; exten++) {
+		if (*exten == '-')
+			continue;
+		ch = *exten;
+		nnxt = 0;
+		for (x = 0; x < ncur; x++) {
+			ext_trie_collect(out, &n, &cur[x]->wild);
+			for (c = cur[x]->child; c; c = c->sibling) {
+				if (c->set[ch / 32] & (1 << (ch % 32)))
+					nxt[nnxt++] = c;
+			}
+		}
+		tmp = cur;
+		cur = nxt;
+		nxt = tmp;
+		ncur = nnxt;
+	}
+	for (x = 0; x < ncur; x++) {
+		if ((action & E_MATCH_MASK) == E_MATCH)
+			ext_trie_collect(out, &n, &cur[x]->term);
+		else
+			ext_trie_collect(out, &n, &cur[x]->all);
+	}
+	return n;
+}
+
+/*!
+ * \brief Fill cand with the extensions of con that may match exten, in
+ * list order. cand is buf if it is big enough, otherwise allocated.
+ * \return the number found, or -1 if the whole list has to be scanned.
+ */
+static int ext_trie_candidates(struct ast_context *con, const char *exten,
+	enum ext_match_t action, struct ast_exten **buf, int nbuf, struct ast_exten ***cand)
+{
+	struct ext_trie *t;
+	struct ext_trie_node *wbuf[64], **walk;
+	int ibuf[64], *idx;
+	int half, n, x, y;
+
+	*cand = buf;
+	/* _extension_match_core() matches a pattern against its own text */
+	if (exten[0] == '_')
+		return -1;
+
+	ast_mutex_lock(&con->lock);
+	if (!con->trie)
+		con->trie = ext_trie_build(con);
+	if (!(t = con->trie)) {
+		ast_mutex_unlock(&con->lock);
+		return -1;
+	}
+	/* count first, so the buffers only need to be as big as the answer */
+	walk = wbuf;
+	half = ARRAY_LEN(wbuf) / 2;
+	if (t->width > half) {
+		half = t->width;
+		walk = ast_malloc(2 * half * sizeof(*walk));
+	}
+	idx = ibuf;
+	n = 0;
+	if (walk) {
+		n = ext_trie_walk(t, exten, action, walk, walk + half, NULL);
+		if (n > (int) ARRAY_LEN(ibuf))
+			idx = ast_malloc(n * sizeof(*idx));
+		if (n > nbuf)
+			*cand = ast_malloc(n * sizeof(**cand));
+	}
+	if (!walk || !idx || !*cand) {
+		ast_mutex_unlock(&con->lock);
+		if (walk != wbuf)
+			free(walk);
+		if (idx != ibuf)
+			free(idx);
+		*cand = buf;
+		return -1;
+	}
+	ext_trie_walk(t, exten, action, walk, walk + half, idx);
+
+	qsort(idx, n, sizeof(*idx), ext_trie_cmp);
+	for (x = y = 0; x < n; x++) {
+		if (!y || (*cand)[y - 1] != t->ext[idx[x]])
+			(*cand)[y++] = t->ext[idx[x]];
+	}
+	ast_mutex_unlock(&con->lock);
+
+	if (walk != wbuf)
+		free(walk);
+	if (idx != ibuf)
+		free(idx);
+	return y;
+}
+
 #define STATUS_NO_CONTEXT	1
 #define STATUS_NO_EXTENSION	2
 #define STATUS_NO_PRIORITY	3
@@ -935,6 +1298,7 @@ struct pbx_find_info {
 
 	char *incstack[AST_PBX_MAX_STACK];      /* filled during the search */
 	int stacklen;                   /* modified during the search */
+	int notrie;                     /* scan whole lists, for 'dialplan benchmark' */
 	int status;                     /* set on return */
 	struct ast_switch *swo;         /* set on return */
 	const char *data;               /* set on return */
@@ -946,9 +1310,10 @@ static struct ast_exten *pbx_find_extension(struct ast_channel *chan,
 	const char *context, const char *exten, int priority,
 	const char *label, const char *callerid, enum ext_match_t action)
 {
-	int x, res;
+	int x, res, ncand, done = 0;
 	struct ast_context *tmp;
-	struct ast_exten *e, *eroot;
+	struct ast_exten *e = NULL, *eroot;
+	struct ast_exten *candbuf[32], **cand;
 	struct ast_include *i;
 	struct ast_sw *sw;
 	char *tmpdata = NULL;
@@ -984,10 +1349,24 @@ static struct ast_exten *pbx_find_extension(struct ast_channel *chan,
 	if (q->status < STATUS_NO_EXTENSION)
 		q->status = STATUS_NO_EXTENSION;
 
-	/* scan the list trying to match extension and CID */
+	/* scan the list trying to match extension and CID,
+	 * or just the part of it the trie says can match */
+	if (q->notrie) {
+		ncand = -1;
+		cand = candbuf;
+	} else
+		ncand = ext_trie_candidates(tmp, exten, action, candbuf, ARRAY_LEN(candbuf), &cand);
 	eroot = NULL;
-	while ( (eroot = ast_walk_context_extensions(tmp, eroot)) ) {
-		int match = extension_match_core(eroot->exten, exten, action);
+	for (x = 0; ; x++) {
+		int match;
+
+		if (ncand < 0)
+			eroot = ast_walk_context_extensions(tmp, eroot);
+		else
+			eroot = (x < ncand) ? cand[x] : NULL;
+		if (!eroot)
+			break;
+		match = extension_match_core(eroot->exten, exten, action);
 		/* 0 on fail, 1 on match, 2 on earlymatch */
 
 		if (!match || (eroot->matchcid && !matchcid(eroot->cidmatch, callerid)))
@@ -996,7 +1375,9 @@ static struct ast_exten *pbx_find_extension(struct ast_channel *chan,
 			/* We match an extension ending in '!'.
 			 * The decision in this case is final and is NULL (no match).
 			 */
-			return NULL;
+			e = NULL;
+			done = 1;
+			break;
 		}
 		/* found entry, now look for the right priority */
 		if (q->status < STATUS_NO_PRIORITY)
@@ -1016,9 +1397,14 @@ static struct ast_exten *pbx_find_extension(struct ast_channel *chan,
 		if (e) {	/* found a valid match */
 			q->status = STATUS_SUCCESS;
 			q->foundcontext = context;
-			return e;
+			done = 1;
+			break;
 		}
 	}
+	if (cand != candbuf)
+		free(cand);
+	if (done)
+		return e;
 	/* Check alternative switches */
 	AST_LIST_TRAVERSE(&tmp->alts, sw, list) {
 		struct ast_switch *asw = pbx_findswitch(sw->name);
@@ -2897,6 +3283,8 @@ int ast_context_remove_extension_callerid2(struct ast_context *con, const char *
 
 			/* now, free whole priority extension */
 			destroy_exten(peer);
+			ext_trie_free(con->trie);
+			con->trie = NULL;
 		} else {
 			previous_peer = peer;
 		}
@@ -3075,6 +3463,13 @@ static char show_dialplan_help[] =
 "Usage: dialplan show [exten@][context]\n"
 "       Show dialplan\n";
 
+static char dialplan_benchmark_help[] =
+"Usage: dialplan benchmark [<extensions> [<lookups>]]\n"
+"       Build a context of <extensions> node numbers (default 10000) and a\n"
+"       few patterns, and time <lookups> (default 1000) lookups in it with\n"
+"       and without the match trie.  Scanning big contexts without the trie\n"
+"       takes long enough that 'asterisk -rx' may give up waiting.\n";
+
 static char set_global_help[] =
 "Usage: core set global <name> <value>\n"
 "       Set global dialplan variable <name> to <value>\n";
@@ -3715,6 +4110,145 @@ static int handle_show_dialplan(int fd, int argc, char *argv[])
 	return RESULT_SUCCESS;
 }
 
+#define BENCH_CONTEXT	"__dialplan_benchmark"
+#define BENCH_REGISTRAR	"dialplan benchmark"
+
+/*! \brief Lookups timed by 'dialplan benchmark' */
+static const struct {
+	const char *name;
+	enum ext_match_t action;
+	int digits;	/* how much of a node number is dialed, 0 for none */
+} bench_modes[] = {
+	{ "node number", E_MATCH, 6 },
+	{ "other number", E_MATCH, 0 },
+	{ "partly dialed", E_MATCHMORE, 4 },
+};
+
+static long bench_usec(struct timeval start)
+{
+	struct timeval tv = ast_tvsub(ast_tvnow(), start);
+
+	return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/*! \brief Time one kind of lookup, through the trie or across the whole list */
+static long bench_lookups(struct ast_context *con, char **dialed, int lookups,
+	enum ext_match_t action, int notrie, struct ast_exten **found)
+{
+	struct timeval start = ast_tvnow();
+	int x;
+
+	for (x = 0; x < lookups; x++) {
+		struct pbx_find_info q = { .stacklen = 0 };
+
+		q.notrie = notrie;
+		found[x] = pbx_find_extension(NULL, con, &q, con->name, dialed[x], 1, NULL, NULL, action);
+	}
+	return bench_usec(start);
+}
+
+/*! \brief CLI support for timing extension lookups in a generated context */
+static int handle_dialplan_benchmark(int fd, int argc, char *argv[])
+{
+	/* the kind of patterns an AllStar node or a small PBX has */
+	static const char *patterns[] = {
+		"_1XXX", "_2XXXX", "_3XXXXX", "_4XXXXX.", "_NXXNXXXXXX", "_1NXXNXXXXXX",
+		"_011.", "_9.", "_*X.", "_*[2-5]XX!", "_#X.", "_[6-8]XXXXXX",
+	};
+	struct ast_context *con;
+	struct ast_exten **found[2] = { NULL, NULL };
+	char **dialed = NULL;
+	int extensions = 10000, lookups = 1000, res = RESULT_SUCCESS;
+	int x, y, mismatch;
+	long usec[2];
+	struct timeval start;
+
+	if (argc > 4)
+		return RESULT_SHOWUSAGE;
+	if (argc > 2 && (sscanf(argv[2], "%d", &extensions) != 1 || extensions < 1 || extensions > 900000))
+		return RESULT_SHOWUSAGE;
+	if (argc > 3 && (sscanf(argv[3], "%d", &lookups) != 1 || lookups < 1))
+		return RESULT_SHOWUSAGE;
+
+	if (!(con = ast_context_create(NULL, BENCH_CONTEXT, BENCH_REGISTRAR))) {
+		ast_cli(fd, "Unable to create context '%s'\n", BENCH_CONTEXT);
+		return RESULT_FAILURE;
+	}
+	start = ast_tvnow();
+	for (x = 0; x < ARRAY_LEN(patterns); x++)
+		ast_add_extension2(con, 0, patterns[x], 1, NULL, NULL, "NoOp", NULL, NULL, BENCH_REGISTRAR);
+	/* six digit node numbers, 100000 + 1, 4, 7 ..., added from the top
+	   down so each one goes to the head of the list */
+	for (x = extensions - 1; x >= 0; x--) {
+		char exten[16];
+
+		snprintf(exten, sizeof(exten), "%d", 100000 + 3 * x + 1);
+		if (ast_add_extension2(con, 0, exten, 1, NULL, NULL, "NoOp", NULL, NULL, BENCH_REGISTRAR)) {
+			ast_cli(fd, "Unable to add extension '%s'\n", exten);
+			res = RESULT_FAILURE;
+			goto done;
+		}
+	}
+	ast_cli(fd, "%d extensions and %d patterns added in %ld ms\n",
+		extensions, (int) ARRAY_LEN(patterns), bench_usec(start) / 1000);
+
+	if (!(dialed = ast_calloc(lookups, sizeof(*dialed))) ||
+	    !(found[0] = ast_calloc(lookups, sizeof(*found[0]))) ||
+	    !(found[1] = ast_calloc(lookups, sizeof(*found[1])))) {
+		res = RESULT_FAILURE;
+		goto done;
+	}
+	for (x = 0; x < lookups; x++) {
+		if (!(dialed[x] = ast_calloc(1, 16))) {
+			res = RESULT_FAILURE;
+			goto done;
+		}
+	}
+	start = ast_tvnow();
+
+	/* the first lookup builds the trie */
+	bench_lookups(con, dialed, 1, E_MATCH, 0, found[0]);
+	ast_cli(fd, "Trie built in %ld us\n", bench_usec(start));
+
+	ast_cli(fd, "%-14s %12s %12s %8s\n", "Lookup", "Trie us", "List us", "Matched");
+	for (y = 0; y < ARRAY_LEN(bench_modes); y++) {
+		int matched = 0;
+
+		for (x = 0; x < lookups; x++) {
+			if (bench_modes[y].digits) {
+				snprintf(dialed[x], 16, "%ld", 100000 + 3 * (ast_random() % extensions) + 1);
+				dialed[x][bench_modes[y].digits] = '\0';
+			} else	/* ten digits, so only a pattern can take it */
+				snprintf(dialed[x], 16, "%ld%09ld", 2 + ast_random() % 8, ast_random() % 1000000000);
+		}
+		usec[0] = bench_lookups(con, dialed, lookups, bench_modes[y].action, 0, found[0]);
+		usec[1] = bench_lookups(con, dialed, lookups, bench_modes[y].action, 1, found[1]);
+		for (x = mismatch = 0; x < lookups; x++) {
+			if (found[0][x] != found[1][x])
+				mismatch++;
+			if (found[0][x])
+				matched++;
+		}
+		ast_cli(fd, "%-14s %12.2f %12.2f %8d\n", bench_modes[y].name,
+			(double) usec[0] / lookups, (double) usec[1] / lookups, matched);
+		if (mismatch) {
+			ast_cli(fd, "%d lookups found a different extension through the trie\n", mismatch);
+			res = RESULT_FAILURE;
+		}
+	}
+
+done:
+	if (dialed) {
+		for (x = 0; x < lookups; x++)
+			free(dialed[x]);
+		free(dialed);
+	}
+	free(found[0]);
+	free(found[1]);
+	ast_context_destroy(con, BENCH_REGISTRAR);
+	return res;
+}
+
 /*! \brief CLI support for listing global variables in a parseable way */
 static int handle_show_globals(int fd, int argc, char *argv[])
 {
@@ -3842,6 +4376,10 @@ static struct ast_cli_entry pbx_cli[] = {
 	{ { "dialplan", "show", NULL },
 	handle_show_dialplan, "Show dialplan",
 	show_dialplan_help, complete_show_dialplan_context, &cli_show_dialplan_deprecated },
+
+	{ { "dialplan", "benchmark", NULL },
+	handle_dialplan_benchmark, "Time extension lookups in a generated context",
+	dialplan_benchmark_help },
 };
 
 int ast_unregister_application(const char *app)
@@ -4833,6 +5371,9 @@ int ast_add_extension2(struct ast_context *con,
 	tmp->registrar = registrar;
 
 	ast_mutex_lock(&con->lock);
+	/* the list is about to change, index it again on the next lookup */
+	ext_trie_free(con->trie);
+	con->trie = NULL;
 	res = 0; /* some compilers will think it is uninitialized otherwise */
 	for (e = con->root; e; el = e, e = e->next) {   /* scan the extension list */
 		res = ext_cmp(e->exten, extension);
@@ -5340,6 +5881,7 @@ void __ast_context_destroy(struct ast_context *con, const char *registrar)
 			e = e->next;
 			destroy_exten(el);
 		}
+		ext_trie_free(tmp->trie);
 		ast_mutex_destroy(&tmp->lock);
 		free(tmp);
 		/* if we have a specific match, we are done, otherwise continue */
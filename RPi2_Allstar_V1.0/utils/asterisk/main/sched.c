@@ -50,8 +50,14 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 147386 $")
 #include "asterisk/linkedlists.h"
 #include "asterisk/options.h"
 
+/*! Initial number of id hash buckets; grows by doubling */
+#define SCHED_HASH_MIN 64
+
 struct sched {
-	AST_LIST_ENTRY(sched) list;
+	AST_LIST_ENTRY(sched) list;   /*!< Entry in the cache of unused structures */
+	struct sched *hnext;          /*!< Next entry in the same id hash bucket */
+	unsigned int slot;            /*!< Index of this entry in the heap */
+	unsigned int seq;             /*!< Keeps entries due at the same time in order */
 	int id;                       /*!< ID number of event */
 	struct timeval when;          /*!< Absolute time event should take place */
 	int resched;                  /*!< When to reschedule */
@@ -64,7 +70,11 @@ struct sched_context {
 	ast_mutex_t lock;
 	unsigned int eventcnt;                  /*!< Number of events processed */
 	unsigned int schedcnt;                  /*!< Number of outstanding schedule events */
-	AST_LIST_HEAD_NOLOCK(, sched) schedq;   /*!< Schedule entry and main queue */
+	unsigned int seq;                       /*!< Insertion counter for tie breaking */
+	struct sched **heap;                    /*!< Binary min-heap of events, soonest first */
+	unsigned int heapsize;                  /*!< Allocated slots in the heap */
+	struct sched **hash;                    /*!< Events by id */
+	unsigned int hashsize;                  /*!< Number of hash buckets, a power of two */
 
 #ifdef SCHED_MAX_CACHE
 	AST_LIST_HEAD_NOLOCK(, sched) schedc;   /*!< Cache of unused schedule structures and how many */
@@ -81,6 +91,12 @@ struct sched_context *sched_context_create(void)
 
 	ast_mutex_init(&tmp->lock);
 	tmp->eventcnt = 1;
+	tmp->hashsize = SCHED_HASH_MIN;
+	if (!(tmp->hash = ast_calloc(tmp->hashsize, sizeof(*tmp->hash)))) {
+		ast_mutex_destroy(&tmp->lock);
+		free(tmp);
+		return NULL;
+	}
 	
 	return tmp;
 }
@@ -98,8 +114,10 @@ void sched_context_destroy(struct sched_context *con)
 #endif
 
 	/* And the queue */
-	while ((s = AST_LIST_REMOVE_HEAD(&con->schedq, list)))
-		free(s);
+	while (con->schedcnt)
+		free(con->heap[--con->schedcnt]);
+	free(con->heap);
+	free(con->hash);
 	
 	/* And the context */
 	ast_mutex_unlock(&con->lock);
@@ -152,10 +170,10 @@ int ast_sched_wait(struct sched_context *con)
 	DEBUG(ast_log(LOG_DEBUG, "ast_sched_wait()\n"));
 
 	ast_mutex_lock(&con->lock);
-	if (AST_LIST_EMPTY(&con->schedq)) {
+	if (!con->schedcnt) {
 		ms = -1;
 	} else {
-		ms = ast_tvdiff_ms(AST_LIST_FIRST(&con->schedq)->when, ast_tvnow());
+		ms = ast_tvdiff_ms(con->heap[0]->when, ast_tvnow());
 		if (ms < 0)
 			ms = 0;
 	}
@@ -165,27 +183,143 @@ int ast_sched_wait(struct sched_context *con)
 }
 
 
+/*! \brief True if a is due before b; equal times keep insertion order */
+static inline int sched_before(const struct sched *a, const struct sched *b)
+{
+	int res = ast_tvcmp(a->when, b->when);
+
+	if (res)
+		return res < 0;
+	return (int) (a->seq - b->seq) < 0;
+}
+
+static inline void heap_set(struct sched_context *con, unsigned int slot, struct sched *s)
+{
+	con->heap[slot] = s;
+	s->slot = slot;
+}
+
+static void heap_up(struct sched_context *con, unsigned int slot)
+{
+	struct sched *s = con->heap[slot];
+
+	while (slot) {
+		unsigned int parent = (slot - 1) / 2;
+
+		if (!sched_before(s, con->heap[parent]))
+			break;
+		heap_set(con, slot, con->heap[parent]);
+		slot = parent;
+	}
+	heap_set(con, slot, s);
+}
+
+static void heap_down(struct sched_context *con, unsigned int slot)
+{
+	struct sched *s = con->heap[slot];
+	unsigned int child;
+
+	while ((child = slot * 2 + 1) < con->schedcnt) {
+		if ((child + 1 < con->schedcnt) && sched_before(con->heap[child + 1], con->heap[child]))
+			child++;
+		if (!sched_before(con->heap[child], s))
+			break;
+		heap_set(con, slot, con->heap[child]);
+		slot = child;
+	}
+	heap_set(con, slot, s);
+}
+
+static inline struct sched **hash_bucket(struct sched_context *con, int id)
+{
+	return &con->hash[(unsigned int) id & (con->hashsize - 1)];
+}
+
+/*! \brief Double the id hash once it averages more than one entry per bucket */
+static void hash_grow(struct sched_context *con)
+{
+	struct sched **old = con->hash, *s;
+	unsigned int i, oldsize = con->hashsize;
+	struct sched **new;
+
+	if (!(new = ast_calloc(oldsize * 2, sizeof(*new))))
+		return;
+	con->hash = new;
+	con->hashsize = oldsize * 2;
+	for (i = 0; i < oldsize; i++) {
+		while ((s = old[i])) {
+			struct sched **b = hash_bucket(con, s->id);
+
+			old[i] = s->hnext;
+			s->hnext = *b;
+			*b = s;
+		}
+	}
+	free(old);
+}
+
+static struct sched *hash_find(struct sched_context *con, int id)
+{
+	struct sched *s;
+
+	for (s = *hash_bucket(con, id); s; s = s->hnext) {
+		if (s->id == id)
+			break;
+	}
+	return s;
+}
+
+/*! \brief
+ * Take an event out of the queue, wherever it is.
+ */
+static void unschedule(struct sched_context *con, struct sched *s)
+{
+	struct sched **b;
+	unsigned int slot = s->slot;
+
+	for (b = hash_bucket(con, s->id); *b != s; b = &(*b)->hnext)
+		;
+	*b = s->hnext;
+
+	if (slot != --con->schedcnt) {
+		heap_set(con, slot, con->heap[con->schedcnt]);
+		if (slot && sched_before(con->heap[slot], con->heap[(slot - 1) / 2]))
+			heap_up(con, slot);
+		else
+			heap_down(con, slot);
+	}
+}
+
 /*! \brief
  * Take a sched structure and put it in the
  * queue, such that the soonest event is
- * first in the list. 
+ * at the top of the heap. 
  */
-static void schedule(struct sched_context *con, struct sched *s)
+static int schedule(struct sched_context *con, struct sched *s)
 {
-	 
-	struct sched *cur = NULL;
-	
-	AST_LIST_TRAVERSE_SAFE_BEGIN(&con->schedq, cur, list) {
-		if (ast_tvcmp(s->when, cur->when) == -1) {
-			AST_LIST_INSERT_BEFORE_CURRENT(&con->schedq, s, list);
-			break;
-		}
+	struct sched **b;
+
+	if (con->schedcnt == con->heapsize) {
+		unsigned int size = con->heapsize ? con->heapsize * 2 : SCHED_HASH_MIN;
+		struct sched **heap;
+
+		if (!(heap = ast_realloc(con->heap, size * sizeof(*heap))))
+			return -1;
+		con->heap = heap;
+		con->heapsize = size;
 	}
-	AST_LIST_TRAVERSE_SAFE_END
-	if (!cur)
-		AST_LIST_INSERT_TAIL(&con->schedq, s, list);
-	
-	con->schedcnt++;
+	if (con->schedcnt >= con->hashsize)
+		hash_grow(con);
+
+	b = hash_bucket(con, s->id);
+	s->hnext = *b;
+	*b = s;
+
+	s->seq = con->seq++;
+	heap_set(con, con->schedcnt, s);
+	heap_up(con, con->schedcnt++);
+
+	return 0;
 }
 
 /*! \brief
@@ -225,10 +359,9 @@ int ast_sched_add_variable(struct sched_context *con, int when, ast_sched_cb cal
 		tmp->resched = when;
 		tmp->variable = variable;
 		tmp->when = ast_tv(0, 0);
-		if (sched_settime(&tmp->when, when)) {
+		if (sched_settime(&tmp->when, when) || schedule(con, tmp)) {
 			sched_release(con, tmp);
 		} else {
-			schedule(con, tmp);
 			res = tmp->id;
 		}
 	}
@@ -264,15 +397,10 @@ int _ast_sched_del(struct sched_context *con, int id, const char *file, int line
 	DEBUG(ast_log(LOG_DEBUG, "ast_sched_del()\n"));
 	
 	ast_mutex_lock(&con->lock);
-	AST_LIST_TRAVERSE_SAFE_BEGIN(&con->schedq, s, list) {
-		if (s->id == id) {
-			AST_LIST_REMOVE_CURRENT(&con->schedq, list);
-			con->schedcnt--;
-			sched_release(con, s);
-			break;
-		}
+	if ((s = hash_find(con, id))) {
+		unschedule(con, s);
+		sched_release(con, s);
 	}
-	AST_LIST_TRAVERSE_SAFE_END
 
 #ifdef DUMP_SCHEDULER
 	/* Dump contents of the context while we have the lock so nothing gets screwed up by accident. */
@@ -295,11 +423,12 @@ int _ast_sched_del(struct sched_context *con, int id, const char *file, int line
 	return 0;
 }
 
-/*! \brief Dump the contents of the scheduler to LOG_DEBUG */
+/*! \brief Dump the contents of the scheduler to LOG_DEBUG, in heap order */
 void ast_sched_dump(const struct sched_context *con)
 {
 	struct sched *q;
 	struct timeval tv = ast_tvnow();
+	unsigned int i;
 #ifdef SCHED_MAX_CACHE
 	ast_log(LOG_DEBUG, "Asterisk Schedule Dump (%d in Q, %d Total, %d Cache)\n", con->schedcnt, con->eventcnt - 1, con->schedccnt);
 #else
@@ -309,8 +438,11 @@ void ast_sched_dump(const struct sched_context *con)
 	ast_log(LOG_DEBUG, "=============================================================\n");
 	ast_log(LOG_DEBUG, "|ID    Callback          Data              Time  (sec:ms)   |\n");
 	ast_log(LOG_DEBUG, "+-----+-----------------+-----------------+-----------------+\n");
-	AST_LIST_TRAVERSE(&con->schedq, q, list) {
-		struct timeval delta = ast_tvsub(q->when, tv);
+	for (i = 0; i < con->schedcnt; i++) {
+		struct timeval delta;
+
+		q = con->heap[i];
+		delta = ast_tvsub(q->when, tv);
 
 		ast_log(LOG_DEBUG, "|%.4d | %-15p | %-15p | %.6ld : %.6ld |\n", 
 			q->id,
@@ -337,18 +469,18 @@ int ast_sched_runq(struct sched_context *con)
 		
 	ast_mutex_lock(&con->lock);
 
-	for (numevents = 0; !AST_LIST_EMPTY(&con->schedq); numevents++) {
+	for (numevents = 0; con->schedcnt; numevents++) {
 		/* schedule all events which are going to expire within 1ms.
 		 * We only care about millisecond accuracy anyway, so this will
 		 * help us get more than one event at one time if they are very
 		 * close together.
 		 */
 		tv = ast_tvadd(ast_tvnow(), ast_tv(0, 1000));
-		if (ast_tvcmp(AST_LIST_FIRST(&con->schedq)->when, tv) != -1)
+		if (ast_tvcmp(con->heap[0]->when, tv) != -1)
 			break;
 		
-		current = AST_LIST_REMOVE_HEAD(&con->schedq, list);
-		con->schedcnt--;
+		current = con->heap[0];
+		unschedule(con, current);
 
 		/*
 		 * At this point, the schedule queue is still intact.  We
@@ -368,10 +500,10 @@ int ast_sched_runq(struct sched_context *con)
 			 * If they return non-zero, we should schedule them to be
 			 * run again.
 			 */
-			if (sched_settime(&current->when, current->variable? res : current->resched)) {
+			if (sched_settime(&current->when, current->variable? res : current->resched) ||
+			    schedule(con, current)) {
 				sched_release(con, current);
-			} else
-				schedule(con, current);
+			}
 		} else {
 			/* No longer needed, so release it */
 		 	sched_release(con, current);
@@ -390,11 +522,7 @@ long ast_sched_when(struct sched_context *con,int id)
 	DEBUG(ast_log(LOG_DEBUG, "ast_sched_when()\n"));
 
 	ast_mutex_lock(&con->lock);
-	AST_LIST_TRAVERSE(&con->schedq, s, list) {
-		if (s->id == id)
-			break;
-	}
-	if (s) {
+	if ((s = hash_find(con, id))) {
 		struct timeval now = ast_tvnow();
 		secs = s->when.tv_sec - now.tv_sec;
 	}
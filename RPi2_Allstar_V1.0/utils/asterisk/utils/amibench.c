@@ -0,0 +1,206 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Time manager "Action: Command" requests against a running Asterisk
+ *
+ * Logs in with events off, sends the same CLI command the given number of
+ * times, one request at a time, and reports the round trip time from
+ * sending a request to reading the end of its output.  It only talks the
+ * manager protocol, so the same binary can be pointed at two builds of
+ * Asterisk, for example app_rpt's "rpt stats" on a node.
+ *
+ * Built on demand with "make -C utils ASTTOPDIR=`pwd` amibench".
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <sys/time.h>
+
+static int sock;
+static char rbuf[65536];
+static int rlen;
+
+/*! \brief Read one CRLF terminated line into line, without the line end */
+static int get_line(char *line, int size)
+{
+	char *eol;
+	int res, len;
+
+	while (!(eol = memchr(rbuf, '\n', rlen))) {
+		if (rlen == sizeof(rbuf))
+			rlen = 0;	/* a line this long is output, keep reading */
+		if ((res = read(sock, rbuf + rlen, sizeof(rbuf) - rlen)) <= 0)
+			return -1;
+		rlen += res;
+	}
+	len = eol - rbuf;
+	if (len && rbuf[len - 1] == '\r')
+		len--;
+	if (len >= size)
+		len = size - 1;
+	memcpy(line, rbuf, len);
+	line[len] = '\0';
+	rlen -= eol + 1 - rbuf;
+	memmove(rbuf, eol + 1, rlen);
+	return 0;
+}
+
+/*! \brief Read a response, following Command output to its end marker
+ * \return the number of lines read, or -1 if the response was not a success */
+static int get_response(void)
+{
+	char line[1024];
+	int lines = 0, follows = 0, ok = 0;
+
+	for (;;) {
+		if (get_line(line, sizeof(line)))
+			return -1;
+		if (!strcasecmp(line, "Response: Success"))
+			ok = 1;
+		else if (!strcasecmp(line, "Response: Follows"))
+			ok = follows = 1;
+		else if (follows && strstr(line, "--END COMMAND--"))
+			follows = 0;	/* output without a final newline runs into it */
+		else if (!line[0] && !follows)
+			break;
+		lines++;
+	}
+	return ok ? lines : -1;
+}
+
+static int send_all(const char *buf)
+{
+	int len = strlen(buf), res;
+
+	while (len > 0) {
+		if ((res = write(sock, buf, len)) <= 0)
+			return -1;
+		buf += res;
+		len -= res;
+	}
+	return 0;
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+	long x = *(const long *) a, y = *(const long *) b;
+
+	return (x < y) ? -1 : (x > y);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: amibench [-h host] [-p port] [-n count] -u user -s secret <command>\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_in sin;
+	struct hostent *hp;
+	struct timeval start, end;
+	const char *host = "127.0.0.1", *user = NULL, *secret = NULL;
+	char req[1024], command[512] = "";
+	int port = 5038, count = 1000, lines = 0, res, x;
+	long *usec, total = 0;
+
+	while ((res = getopt(argc, argv, "h:p:n:u:s:")) != -1) {
+		switch (res) {
+		case 'h':
+			host = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'u':
+			user = optarg;
+			break;
+		case 's':
+			secret = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!user || !secret || optind >= argc || count < 1)
+		usage();
+	for (x = optind; x < argc; x++) {
+		if (x > optind)
+			strncat(command, " ", sizeof(command) - strlen(command) - 1);
+		strncat(command, argv[x], sizeof(command) - strlen(command) - 1);
+	}
+	if (!(usec = calloc(count, sizeof(*usec)))) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	if (!(hp = gethostbyname(host))) {
+		fprintf(stderr, "Unable to lookup IP for host '%s'\n", host);
+		exit(1);
+	}
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	memcpy(&sin.sin_addr, hp->h_addr, sizeof(sin.sin_addr));
+	if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+	    connect(sock, (struct sockaddr *) &sin, sizeof(sin))) {
+		perror("Unable to connect");
+		exit(1);
+	}
+
+	/* the greeting is a single line */
+	if (get_line(req, sizeof(req))) {
+		fprintf(stderr, "No manager greeting\n");
+		exit(1);
+	}
+	snprintf(req, sizeof(req), "Action: Login\r\nUsername: %s\r\nSecret: %s\r\nEvents: off\r\n\r\n",
+		user, secret);
+	if (send_all(req) || get_response() < 0) {
+		fprintf(stderr, "Login failed\n");
+		exit(1);
+	}
+
+	snprintf(req, sizeof(req), "Action: Command\r\nCommand: %s\r\n\r\n", command);
+	for (x = 0; x < count; x++) {
+		gettimeofday(&start, NULL);
+		if (send_all(req) || (res = get_response()) < 0) {
+			fprintf(stderr, "Command '%s' failed\n", command);
+			exit(1);
+		}
+		gettimeofday(&end, NULL);
+		usec[x] = (end.tv_sec - start.tv_sec) * 1000000 + end.tv_usec - start.tv_usec;
+		total += usec[x];
+		lines = res;
+	}
+	send_all("Action: Logoff\r\n\r\n");
+	close(sock);
+
+	qsort(usec, count, sizeof(*usec), cmp_long);
+	printf("%d requests, %d lines each, us per request: avg %ld, p50 %ld, p90 %ld, p99 %ld, max %ld\n",
+		count, lines, total / count, usec[count / 2], usec[count * 9 / 10],
+		usec[count * 99 / 100], usec[count - 1]);
+	free(usec);
+	return 0;
+}
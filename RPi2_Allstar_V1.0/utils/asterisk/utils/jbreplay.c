@@ -0,0 +1,206 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Replay a packet timing trace through the adaptive jitterbuffer
+ *
+ * A trace has one line per received voice frame: the arrival time and the
+ * sender's timestamp in ms, and optionally the frame length (default 20).
+ * Lines starting with '#' are skipped.  "jbreplay -g seed frames" writes
+ * a generated trace with jitter, loss, reordering and clock jumps.
+ *
+ * The trace is fed to jb_put() as the frames arrive, and jb_get() is
+ * called whenever jb_next() says a frame is due, at least a millisecond
+ * after the last call, as chan_iax2 schedules it.  Every
+ * get that does not return JB_NOFRAME is printed with the jb_info that
+ * followed it, then a summary with the CPU time spent in the jitterbuffer.
+ * Only the CPU time should differ between two builds that make the same
+ * decisions.
+ *
+ * "make -C utils ASTTOPDIR=`pwd` jbreplay" builds it against
+ * main/jitterbuf.c.  To compare with another revision, put that revision's
+ * jitterbuf.c and jitterbuf.h in one directory and build against them:
+ *
+ *   cc -O2 -Iinclude -DJITTERBUF_SRC='"/tmp/old/jitterbuf.c"' \
+ *      -o jbreplay.old utils/jbreplay.c
+ */
+
+#include "asterisk.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef	JITTERBUF_SRC
+#define	JITTERBUF_SRC "../main/jitterbuf.c"
+#endif
+
+#include JITTERBUF_SRC
+
+void ast_log(int level, const char *file, int line, const char *function, const char *fmt, ...) __attribute__ ((format (printf,5,6)));
+
+void ast_log(int level, const char *file, int line, const char *function, const char *fmt, ...)
+{
+}
+
+void ast_register_file_version(const char *file, const char *version)
+{
+}
+
+void ast_unregister_file_version(const char *file)
+{
+}
+
+struct pkt {
+	long arrival;
+	long ts;
+	long ms;
+};
+
+static int pkt_cmp(const void *a, const void *b)
+{
+	const struct pkt *x = a, *y = b;
+
+	if (x->arrival != y->arrival)
+		return (x->arrival < y->arrival) ? -1 : 1;
+	return (x->ts < y->ts) ? -1 : (x->ts > y->ts);
+}
+
+/*! \brief A repeatable trace, so runs can be compared without a capture */
+static void generate(unsigned int seed, int frames)
+{
+	long offset = 0, jitter = 5 + seed % 40, arrival;
+	int i;
+
+	srandom(seed);
+	printf("# jbreplay -g %u %d\n", seed, frames);
+	for (i = 0; i < frames; i++) {
+		/* clock jumps, jitter changes, late bursts and loss */
+		if (random() % 500 == 0)
+			offset += ((random() & 1) ? -1 : 1) * (200 + random() % 2000);
+		if (random() % 100 == 0)
+			jitter = 2 + random() % 80;
+		arrival = (i + 1) * 20 + 100 + offset + random() % (jitter + 1);
+		if (random() % 100 == 0)
+			arrival += random() % 400;
+		if (random() % 20 == 0)
+			continue;
+		printf("%ld %d\n", arrival, (i + 1) * 20);
+	}
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: jbreplay [-q] trace | -g seed frames\n"
+		"  -q  print the summary only\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct pkt *pkts = NULL;
+	int npkts = 0, size = 0, quiet = 0, i, ret;
+	char line[256];
+	long now = 0, next;
+	jitterbuf *jb;
+	jb_conf conf;
+	jb_frame frame;
+	jb_info info;
+	clock_t cpu = 0, start;
+	long gets = 0, interp = 0, drops = 0;
+	FILE *fp;
+
+	if (argc == 4 && !strcmp(argv[1], "-g")) {
+		generate(atoi(argv[2]), atoi(argv[3]));
+		return 0;
+	}
+	if (argc == 3 && !strcmp(argv[1], "-q"))
+		quiet = 1;
+	else if (argc != 2)
+		usage();
+	if (!(fp = fopen(argv[argc - 1], "r"))) {
+		perror(argv[argc - 1]);
+		return 1;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		if (line[0] == '#')
+			continue;
+		if (npkts == size) {
+			size = size ? size * 2 : 1024;
+			if (!(pkts = realloc(pkts, size * sizeof(*pkts)))) {
+				fprintf(stderr, "out of memory\n");
+				return 1;
+			}
+		}
+		pkts[npkts].ms = 20;
+		if (sscanf(line, "%ld %ld %ld", &pkts[npkts].arrival, &pkts[npkts].ts, &pkts[npkts].ms) < 2)
+			continue;
+		npkts++;
+	}
+	fclose(fp);
+	if (!npkts)
+		usage();
+	qsort(pkts, npkts, sizeof(*pkts), pkt_cmp);
+
+	/* same settings chan_iax2 uses by default */
+	memset(&conf, 0, sizeof(conf));
+	conf.max_jitterbuf = 1000;
+	conf.resync_threshold = 1000;
+	conf.max_contig_interp = 10;
+	jb = jb_new();
+	jb_setconf(jb, &conf);
+
+	i = 0;
+	while (i < npkts || jb->frames) {
+		next = jb_next(jb);
+		if (next <= now)
+			next = now + 1;
+		if (i < npkts && (!jb->frames || pkts[i].arrival <= next)) {
+			if (pkts[i].arrival > now)
+				now = pkts[i].arrival;
+			start = clock();
+			ret = jb_put(jb, pkts + i, JB_TYPE_VOICE, pkts[i].ms, pkts[i].ts, now);
+			cpu += clock() - start;
+			if (ret == JB_DROP)
+				drops++;
+			i++;
+			continue;
+		}
+		now = next;
+		start = clock();
+		ret = jb_get(jb, &frame, now, 20);
+		jb_getinfo(jb, &info);
+		cpu += clock() - start;
+		if (ret == JB_NOFRAME)
+			continue;
+		gets++;
+		if (ret == JB_INTERP)
+			interp++;
+		if (!quiet)
+			printf("%ld %d %ld jitter %ld min %ld current %ld target %ld lost %ld dropped %ld\n",
+				now, ret, (ret == JB_OK || ret == JB_DROP) ? frame.ts : -1L,
+				info.jitter, info.min, info.current, info.target,
+				info.frames_lost, info.frames_dropped);
+	}
+	jb_getinfo(jb, &info);
+	printf("%d frames in, %ld out, %ld interpolated, %ld put drops, %ld late, %ld lost, "
+		"%ld dropped, cpu %.1f ms\n", npkts, gets, interp, drops, info.frames_late,
+		info.frames_lost, info.frames_dropped, cpu * 1000.0 / CLOCKS_PER_SEC);
+	jb_destroy(jb);
+	free(pkts);
+	return 0;
+}
@@ -0,0 +1,178 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Microbenchmark for the scheduler in main/sched.c
+ *
+ * Models the chan_iax2 load: a context holding a fixed number of pending
+ * events (retransmits, pings, lag checks), where every step cancels one
+ * of them and schedules a replacement.  For each size it reports the cost
+ * of an ast_sched_del() plus ast_sched_add() pair, of ast_sched_when(),
+ * and of running due events through ast_sched_runq().
+ *
+ * The arguments are the number of steps (default 100000) and the sizes to
+ * run (default 100, 1000 and 10000).
+ *
+ * "make -C utils ASTTOPDIR=`pwd` schedbench" builds it against
+ * main/sched.c.  To time another revision, build it against that
+ * revision's copy:
+ *
+ *   cc -O2 -Iinclude -DSCHED_SRC='"/tmp/old/sched.c"' -o schedbench.old \
+ *      utils/schedbench.c -lpthread
+ */
+
+#include "asterisk.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef	SCHED_SRC
+#define	SCHED_SRC "../main/sched.c"
+#endif
+
+#include SCHED_SRC
+
+int option_debug;
+int option_verbose;
+
+void ast_log(int level, const char *file, int line, const char *function, const char *fmt, ...) __attribute__ ((format (printf,5,6)));
+
+void ast_log(int level, const char *file, int line, const char *function, const char *fmt, ...)
+{
+	va_list vars;
+
+	if (level == __LOG_DEBUG)
+		return;
+	va_start(vars, fmt);
+	vfprintf(stderr, fmt, vars);
+	va_end(vars);
+}
+
+void ast_verbose(const char *fmt, ...)
+{
+}
+
+void ast_register_file_version(const char *file, const char *version)
+{
+}
+
+void ast_unregister_file_version(const char *file)
+{
+}
+
+/* from main/utils.c, without the range checks */
+struct timeval ast_tvadd(struct timeval a, struct timeval b)
+{
+	a.tv_sec += b.tv_sec;
+	a.tv_usec += b.tv_usec;
+	if (a.tv_usec >= 1000000) {
+		a.tv_sec++;
+		a.tv_usec -= 1000000;
+	}
+	return a;
+}
+
+struct timeval ast_tvsub(struct timeval a, struct timeval b)
+{
+	a.tv_sec -= b.tv_sec;
+	a.tv_usec -= b.tv_usec;
+	if (a.tv_usec < 0) {
+		a.tv_sec--;
+		a.tv_usec += 1000000;
+	}
+	return a;
+}
+
+static int bench_cb(const void *data)
+{
+	return 0;
+}
+
+static double elapsed_ns(clock_t start, int ops)
+{
+	return (clock() - start) * 1e9 / CLOCKS_PER_SEC / ops;
+}
+
+static void bench(int pending, int steps)
+{
+	struct sched_context *con;
+	int *ids, i, x;
+	double churn, when, runq;
+	volatile long sink = 0;
+	clock_t start;
+
+	if (!(con = sched_context_create()) || !(ids = calloc(pending, sizeof(*ids)))) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	srandom(pending);
+	for (i = 0; i < pending; i++)
+		ids[i] = ast_sched_add(con, 1000 + random() % 60000, bench_cb, NULL);
+
+	start = clock();
+	for (i = 0; i < steps; i++) {
+		x = random() % pending;
+		ast_sched_del(con, ids[x]);
+		ids[x] = ast_sched_add(con, 1000 + random() % 60000, bench_cb, NULL);
+	}
+	churn = elapsed_ns(start, steps);
+
+	start = clock();
+	for (i = 0; i < steps; i++)
+		sink += ast_sched_when(con, ids[random() % pending]);
+	when = elapsed_ns(start, steps);
+
+	for (i = 0; i < pending; i++)
+		ast_sched_del(con, ids[i]);
+	for (i = 0; i < pending; i++)
+		ast_sched_add(con, 0, bench_cb, NULL);
+	start = clock();
+	x = ast_sched_runq(con);
+	runq = elapsed_ns(start, x ? x : 1);
+
+	printf("%8d %12.0f %12.0f %12.0f\n", pending, churn, when, runq);
+	fflush(stdout);
+	free(ids);
+	sched_context_destroy(con);
+}
+
+int main(int argc, char *argv[])
+{
+	static const int sizes[] = { 100, 1000, 10000 };
+	int steps = 100000, i;
+
+	if (argc > 1)
+		steps = atoi(argv[1]);
+	for (i = 2; i < argc; i++) {
+		if (atoi(argv[i]) < 1)
+			break;
+	}
+	if (steps < 1 || i < argc) {
+		fprintf(stderr, "usage: schedbench [steps [pending ...]]\n");
+		return 1;
+	}
+	printf("%8s %12s %12s %12s\n", "pending", "del+add ns", "when ns", "runq ns");
+	if (argc > 2) {
+		for (i = 2; i < argc; i++)
+			bench(atoi(argv[i]), steps);
+	} else {
+		for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+			bench(sizes[i], steps);
+	}
+	return 0;
+}